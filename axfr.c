@@ -63,6 +63,13 @@ query_axfr(struct nsd *nsd, struct query *query)
 			RCODE_SET(query->packet, RCODE_NOTAUTH);
 			return QUERY_PROCESSED;
 		}
+		if(query->axfr_zone->is_cold) {
+			/* lazy-zones, the zone is not read yet */
+			query_lazy_zone_load(nsd, query->axfr_zone);
+			RCODE_SET(query->packet, RCODE_SERVFAIL);
+			query->axfr_zone = NULL;
+			return QUERY_PROCESSED;
+		}
 		ZTATUP(nsd, query->axfr_zone, raxfr);
 
 		query->axfr_current_domain = qdomain;
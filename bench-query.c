@@ -0,0 +1,69 @@
+/*
+ * bench-query.c -- the text query lines of the benchmark tools, made into
+ * query packets.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <string.h>
+#include <strings.h>
+
+#include "bench-query.h"
+#include "buffer.h"
+#include "dname.h"
+#include "dns.h"
+#include "packet.h"
+
+int
+bench_query_from_line(char* line, uint16_t id, uint16_t edns_size,
+	uint8_t* buf, size_t* len)
+{
+	char* tok[4];
+	int n = 0, withdo = 0, dlen;
+	uint16_t t, c = CLASS_IN;
+	uint8_t dname[MAXDOMAINLEN+1];
+	buffer_type b;
+	char* s = strtok(line, " \t\r\n");
+	while(s && n < 4) {
+		tok[n++] = s;
+		s = strtok(NULL, " \t\r\n");
+	}
+	if(n > 1 && strcasecmp(tok[n-1], "DO") == 0) {
+		withdo = 1;
+		n--;
+	}
+	if(n < 2 || n > 3)
+		return 0;
+	if((dlen=dname_parse_wire(dname, tok[0])) == 0)
+		return 0;
+	if(n == 3 && !(c = rrclass_from_string(tok[1])))
+		return 0;
+	if(!(t = rrtype_from_string(tok[n-1])))
+		return 0;
+
+	buffer_create_from(&b, buf, UDP_MAX_MESSAGE_LEN);
+	buffer_clear(&b);
+	memset(buf, 0, QHEADERSZ);
+	ID_SET(&b, id);
+	QDCOUNT_SET(&b, 1);
+	buffer_skip(&b, QHEADERSZ);
+	buffer_write(&b, dname, dlen);
+	buffer_write_u16(&b, t);
+	buffer_write_u16(&b, c);
+	if(withdo || edns_size) {
+		ARCOUNT_SET(&b, 1);
+		buffer_write_u8(&b, 0);
+		buffer_write_u16(&b, TYPE_OPT);
+		buffer_write_u16(&b, edns_size?edns_size:4096);
+		buffer_write_u8(&b, 0); /* rcode */
+		buffer_write_u8(&b, 0); /* version */
+		buffer_write_u16(&b, withdo?0x8000:0); /* DO flag */
+		buffer_write_u16(&b, 0);
+	}
+	*len = buffer_position(&b);
+	return 1;
+}
@@ -0,0 +1,24 @@
+/*
+ * bench-query.h -- the text query lines of the benchmark tools, made into
+ * query packets.  For nsd-bench and the loadgen load generator, it is not
+ * linked into nsd.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef BENCH_QUERY_H
+#define BENCH_QUERY_H
+
+/*
+ * Parse a text line with qname [class] type [DO] into a query packet, in
+ * buf of UDP_MAX_MESSAGE_LEN, with the query ID.  With edns_size the query
+ * has an OPT record with that size, without it only for DO, size 4096.
+ * The line is modified.  Returns 0 on a parse error.
+ */
+int bench_query_from_line(char* line, uint16_t id, uint16_t edns_size,
+	uint8_t* buf, size_t* len);
+
+#endif /* BENCH_QUERY_H */
@@ -20,6 +20,7 @@
 #include "dname.h"
 #include "tsig.h"
 #include "rrl.h"
+#include "dns.h"
 #include "configyyrename.h"
 
 int yylex(void);
@@ -76,6 +77,14 @@ static int parse_range(const char *str, long long *low, long long *high);
 %token VAR_ZONESDIR
 %token VAR_ZONELISTFILE
 %token VAR_DATABASE
+%token VAR_DATABASE_READ_THREADS
+%token VAR_DATABASE_HUGE_PAGES
+%token VAR_DATABASE_PREFAULT
+%token VAR_DATABASE_NUMA_REPLICAS
+%token VAR_DATABASE_COW_AUDIT
+%token VAR_LAZY_ZONES
+%token VAR_LAZY_ZONES_MEMORY
+%token VAR_LAZY_ZONES_COLD_DROP
 %token VAR_LOGFILE
 %token VAR_LOG_ONLY_SYSLOG
 %token VAR_PIDFILE
@@ -97,6 +106,12 @@ static int parse_range(const char *str, long long *low, long long *high);
 %token VAR_IPV6_EDNS_SIZE
 %token VAR_STATISTICS
 %token VAR_XFRD_RELOAD_TIMEOUT
+%token VAR_XFRD_RELOAD_MAX_STALENESS
+%token VAR_XFRD_UDP_WINDOW
+%token VAR_XFRD_UDP_MASTER_RATE
+%token VAR_XFRD_NOTIFY_WINDOW
+%token VAR_XFRD_NOTIFY_RATE
+%token VAR_XFRD_TCP_IDLE_TIMEOUT
 %token VAR_LOG_TIME_ASCII
 %token VAR_ROUND_ROBIN
 %token VAR_MINIMAL_RESPONSES
@@ -129,6 +144,13 @@ static int parse_range(const char *str, long long *low, long long *high);
 %token VAR_DNSTAP_VERSION
 %token VAR_DNSTAP_LOG_AUTH_QUERY_MESSAGES
 %token VAR_DNSTAP_LOG_AUTH_RESPONSE_MESSAGES
+%token VAR_DNSTAP_SAMPLE_RATE
+%token VAR_DNSTAP_FILTER_ZONE
+%token VAR_DNSTAP_FILTER_QTYPE
+%token VAR_DNSTAP_FILTER_RCODE
+%token VAR_DNSTAP_FILTER_TRANSPORT
+%token VAR_DNSTAP_FILTER_RRL
+%token VAR_DNSTAP_FILTER_TC
 
 /* remote-control */
 %token VAR_REMOTE_CONTROL
@@ -258,6 +280,37 @@ server_option:
         cfg_parser->opt->zonefiles_write = ZONEFILES_WRITE_INTERVAL;
       }
     }
+  | VAR_DATABASE_READ_THREADS number
+    {
+      if ($2 > 0) {
+        cfg_parser->opt->database_read_threads = (int)$2;
+      } else {
+        yyerror("expected a number greater than zero");
+      }
+    }
+  | VAR_DATABASE_HUGE_PAGES STRING
+    {
+      int b;
+      if(strcmp($2, "hugetlbfs") == 0) {
+        cfg_parser->opt->database_huge_pages = 2;
+      } else if(parse_boolean($2, &b)) {
+        cfg_parser->opt->database_huge_pages = b;
+      } else {
+        yyerror("expected yes, no or hugetlbfs");
+      }
+    }
+  | VAR_DATABASE_PREFAULT boolean
+    { cfg_parser->opt->database_prefault = $2; }
+  | VAR_DATABASE_NUMA_REPLICAS boolean
+    { cfg_parser->opt->database_numa_replicas = $2; }
+  | VAR_DATABASE_COW_AUDIT boolean
+    { cfg_parser->opt->database_cow_audit = $2; }
+  | VAR_LAZY_ZONES boolean
+    { cfg_parser->opt->lazy_zones = $2; }
+  | VAR_LAZY_ZONES_MEMORY number
+    { cfg_parser->opt->lazy_zones_memory = (int)$2; }
+  | VAR_LAZY_ZONES_COLD_DROP boolean
+    { cfg_parser->opt->lazy_zones_cold_drop = $2; }
   | VAR_IDENTITY STRING
     { cfg_parser->opt->identity = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_VERSION STRING
@@ -347,6 +400,30 @@ server_option:
     { cfg_parser->opt->xfrdir = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_XFRD_RELOAD_TIMEOUT number
     { cfg_parser->opt->xfrd_reload_timeout = (int)$2; }
+  | VAR_XFRD_RELOAD_MAX_STALENESS number
+    { cfg_parser->opt->xfrd_reload_max_staleness = (int)$2; }
+  | VAR_XFRD_UDP_WINDOW number
+    {
+      if ($2 > 0) {
+        cfg_parser->opt->xfrd_udp_window = (int)$2;
+      } else {
+        yyerror("expected a number greater than zero");
+      }
+    }
+  | VAR_XFRD_UDP_MASTER_RATE number
+    { cfg_parser->opt->xfrd_udp_master_rate = (int)$2; }
+  | VAR_XFRD_NOTIFY_WINDOW number
+    {
+      if ($2 > 0) {
+        cfg_parser->opt->xfrd_notify_window = (int)$2;
+      } else {
+        yyerror("expected a number greater than zero");
+      }
+    }
+  | VAR_XFRD_NOTIFY_RATE number
+    { cfg_parser->opt->xfrd_notify_rate = (int)$2; }
+  | VAR_XFRD_TCP_IDLE_TIMEOUT number
+    { cfg_parser->opt->xfrd_tcp_idle_timeout = (int)$2; }
   | VAR_VERBOSITY number
     { cfg_parser->opt->verbosity = (int)$2; }
   | VAR_RRL_SIZE number
@@ -575,6 +652,54 @@ dnstap_option:
     { cfg_parser->opt->dnstap_log_auth_query_messages = $2; }
   | VAR_DNSTAP_LOG_AUTH_RESPONSE_MESSAGES boolean
     { cfg_parser->opt->dnstap_log_auth_response_messages = $2; }
+  | VAR_DNSTAP_SAMPLE_RATE number
+    { cfg_parser->opt->dnstap_sample_rate = (int)$2; }
+  | VAR_DNSTAP_FILTER_ZONE STRING
+    {
+      struct dnstap_zone_option *z, **p = &cfg_parser->opt->dnstap_filter_zones;
+      z = region_alloc_zero(cfg_parser->opt->region, sizeof(*z));
+      z->name = region_strdup(cfg_parser->opt->region, $2);
+      while(*p)
+        p = &(*p)->next;
+      *p = z;
+    }
+  | VAR_DNSTAP_FILTER_QTYPE STRING
+    {
+      uint16_t t = rrtype_from_string($2);
+      if(t == 0) {
+        yyerror("expected a qtype, such as A or ANY");
+      } else {
+        if(!cfg_parser->opt->dnstap_filter_qtypes)
+          cfg_parser->opt->dnstap_filter_qtypes = region_alloc_zero(
+            cfg_parser->opt->region, 65536/8);
+        cfg_parser->opt->dnstap_filter_qtypes[t/8] |= (1<<(t&7));
+      }
+    }
+  | VAR_DNSTAP_FILTER_RCODE STRING
+    {
+      int r = rcode_from_string($2);
+      if(r == -1) {
+        yyerror("expected an rcode, such as NXDOMAIN or SERVFAIL");
+      } else {
+        cfg_parser->opt->dnstap_filter_rcodes |= (1<<r);
+      }
+    }
+  | VAR_DNSTAP_FILTER_TRANSPORT STRING
+    {
+      if(strcmp($2, "udp") == 0) {
+        cfg_parser->opt->dnstap_filter_transport = 1;
+      } else if(strcmp($2, "tcp") == 0) {
+        cfg_parser->opt->dnstap_filter_transport = 2;
+      } else if(strcmp($2, "all") == 0) {
+        cfg_parser->opt->dnstap_filter_transport = 0;
+      } else {
+        yyerror("expected udp, tcp or all");
+      }
+    }
+  | VAR_DNSTAP_FILTER_RRL boolean
+    { cfg_parser->opt->dnstap_filter_rrl = $2; }
+  | VAR_DNSTAP_FILTER_TC boolean
+    { cfg_parser->opt->dnstap_filter_tc = $2; }
   ;
 
 remote_control:
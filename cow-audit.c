@@ -0,0 +1,254 @@
+/*
+ * cow-audit.c -- write protect the zone data in the server processes, to
+ * find the writes that make private copies of its pages.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+#include "cow-audit.h"
+#include "nsd.h"
+#include "namedb.h"
+#include "util.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SIGACTION) && defined(SA_SIGINFO)
+#define COW_AUDIT 1
+#endif
+#if defined(HAVE_EXECINFO_H) && defined(HAVE_BACKTRACE)
+#define COW_AUDIT_BACKTRACE 1
+#endif
+
+#ifdef COW_AUDIT
+/* a range of write protected zone data, size 0 if no longer protected */
+struct cow_range {
+	char* start;
+	size_t size;
+};
+
+static struct cow_range* cow_ranges = NULL;
+static size_t cow_range_count = 0;
+static size_t cow_range_max = 0;
+static size_t cow_page = 0;
+/* the pages that were written to */
+static volatile size_t cow_pages = 0;
+/* the code addresses of the writes, and the pages written per address */
+static void* cow_sites[COW_AUDIT_SITES];
+static size_t cow_site_pages[COW_AUDIT_SITES];
+static volatile size_t cow_site_count = 0;
+/* the SIGSEGV action for other faults */
+static struct sigaction cow_old_action;
+
+static void
+cow_audit_add_range(void* start, size_t size, void* ATTR_UNUSED(arg))
+{
+	if(cow_range_count == cow_range_max) {
+		cow_range_max = (cow_range_max?cow_range_max*2:64);
+		cow_ranges = (struct cow_range*)xrealloc(cow_ranges,
+			cow_range_max*sizeof(struct cow_range));
+	}
+	cow_ranges[cow_range_count].start = (char*)start;
+	cow_ranges[cow_range_count].size = size;
+	cow_range_count++;
+}
+
+/* count the pages written at the code address */
+static void
+cow_audit_site(void* site, size_t pages)
+{
+	size_t i;
+	for(i=0; i<cow_site_count; i++) {
+		if(cow_sites[i] == site) {
+			cow_site_pages[i] += pages;
+			return;
+		}
+	}
+	if(cow_site_count < COW_AUDIT_SITES) {
+		cow_sites[cow_site_count] = site;
+		cow_site_pages[cow_site_count] = pages;
+		cow_site_count++;
+	}
+}
+
+static void
+cow_audit_handler(int ATTR_UNUSED(sig), siginfo_t* info,
+	void* ATTR_UNUSED(context))
+{
+	char* addr = (char*)info->si_addr;
+	struct cow_range* r = NULL;
+	size_t i, pages = 1;
+	void* site = NULL;
+#ifdef COW_AUDIT_BACKTRACE
+	void* trace[COW_AUDIT_TRACE];
+	int n;
+#endif
+	for(i=0; i<cow_range_count; i++) {
+		if(addr >= cow_ranges[i].start &&
+			addr < cow_ranges[i].start + cow_ranges[i].size) {
+			r = &cow_ranges[i];
+			break;
+		}
+	}
+	if(!r || info->si_code != SEGV_ACCERR) {
+		/* not a write to the zone data, the fault happens again
+		 * when this returns, with the action from before */
+		(void)sigaction(SIGSEGV, &cow_old_action, NULL);
+		return;
+	}
+	if(mprotect(addr - ((uintptr_t)addr % cow_page), cow_page,
+		PROT_READ | PROT_WRITE) == -1) {
+		/* hugetlbfs pages cannot be split, the arena is writable */
+		if(mprotect(r->start, r->size, PROT_READ | PROT_WRITE) == -1) {
+			(void)sigaction(SIGSEGV, &cow_old_action, NULL);
+			return;
+		}
+		pages = r->size / cow_page;
+		r->size = 0;
+	}
+	cow_pages += pages;
+#ifdef COW_AUDIT_BACKTRACE
+	/* the frames are this handler, the signal frame, and then the
+	 * code that wrote to the page */
+	n = backtrace(trace, COW_AUDIT_TRACE);
+	if(n > 2)
+		site = trace[2];
+#ifndef NDEBUG
+	if(n > 2) {
+		static const char msg[] = "database-cow-audit: write to the "
+			"zone data\n";
+		if(write(STDERR_FILENO, msg, sizeof(msg)-1) != -1)
+			backtrace_symbols_fd(trace+2, n-2, STDERR_FILENO);
+	}
+#endif /* NDEBUG */
+#endif /* COW_AUDIT_BACKTRACE */
+	cow_audit_site(site, pages);
+}
+#endif /* COW_AUDIT */
+
+void
+cow_audit_start(struct nsd* nsd)
+{
+#ifdef COW_AUDIT
+	struct sigaction action;
+	size_t i, protect = 0;
+#ifdef USE_COMPACT_DOMAINS
+	size_t domains, domain_mem, temp;
+#endif
+	cow_page = getpagesize();
+	region_walk_arenas(nsd->db->region, cow_audit_add_range, NULL);
+#ifdef USE_COMPACT_DOMAINS
+	/* the queries write to the temporary domains, they are on pages
+	 * of their own at the start */
+	domain_arena_stats(&domains, &domain_mem);
+	temp = domain_arena_temp_size();
+	if(domain_arena_base && domain_mem > temp)
+		cow_audit_add_range(domain_arena_base + temp,
+			domain_mem - temp, NULL);
+#endif
+	if(cow_range_count == 0) {
+		log_msg(LOG_ERR, "database-cow-audit: the zone data is not in "
+			"arenas, it is not protected");
+		return;
+	}
+#ifdef COW_AUDIT_BACKTRACE
+	{
+		/* load the unwinder now, and not in the signal handler */
+		void* trace[1];
+		(void)backtrace(trace, 1);
+	}
+#endif
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = cow_audit_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	if(sigaction(SIGSEGV, &action, &cow_old_action) == -1) {
+		log_msg(LOG_ERR, "database-cow-audit: sigaction failed: %s",
+			strerror(errno));
+		cow_range_count = 0;
+		return;
+	}
+	for(i=0; i<cow_range_count; i++) {
+		if(mprotect(cow_ranges[i].start, cow_ranges[i].size,
+			PROT_READ) == -1) {
+			log_msg(LOG_ERR, "database-cow-audit: mprotect failed: "
+				"%s", strerror(errno));
+			cow_ranges[i].size = 0;
+		}
+		protect += cow_ranges[i].size;
+	}
+	VERBOSITY(2, (LOG_INFO, "server %d write protected %u bytes of "
+		"zone data", nsd->this_child?nsd->this_child->child_num+1:0,
+		(unsigned)protect));
+#else
+	(void)nsd;
+	log_msg(LOG_ERR, "database-cow-audit: not supported on this system");
+#endif /* COW_AUDIT */
+}
+
+uint64_t
+cow_audit_bytes(void)
+{
+#ifdef COW_AUDIT
+	return (uint64_t)cow_pages * cow_page;
+#else
+	return 0;
+#endif
+}
+
+void
+cow_audit_stop(struct nsd* nsd)
+{
+#ifdef COW_AUDIT
+	int num = nsd->this_child?nsd->this_child->child_num+1:0;
+	char** names = NULL;
+	size_t i;
+	if(cow_range_count == 0)
+		return;
+	for(i=0; i<cow_range_count; i++) {
+		if(cow_ranges[i].size)
+			(void)mprotect(cow_ranges[i].start, cow_ranges[i].size,
+				PROT_READ | PROT_WRITE);
+	}
+	(void)sigaction(SIGSEGV, &cow_old_action, NULL);
+	cow_range_count = 0;
+	if(cow_pages == 0) {
+		VERBOSITY(2, (LOG_INFO, "database-cow-audit: server %d did "
+			"not write to the zone data", num));
+		return;
+	}
+	log_msg(LOG_INFO, "database-cow-audit: server %d wrote to %u pages "
+		"of the zone data, %u bytes", num, (unsigned)cow_pages,
+		(unsigned)cow_audit_bytes());
+#ifdef COW_AUDIT_BACKTRACE
+	names = backtrace_symbols(cow_sites, (int)cow_site_count);
+#endif
+	for(i=0; i<cow_site_count; i++) {
+		if(names)
+			log_msg(LOG_INFO, "database-cow-audit: server %d: %u "
+				"pages written at %s", num,
+				(unsigned)cow_site_pages[i], names[i]);
+		else	log_msg(LOG_INFO, "database-cow-audit: server %d: %u "
+				"pages written at %p", num,
+				(unsigned)cow_site_pages[i], cow_sites[i]);
+	}
+	free(names);
+#else
+	(void)nsd;
+#endif /* COW_AUDIT */
+}
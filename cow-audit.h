@@ -0,0 +1,38 @@
+/*
+ * cow-audit.h -- write protect the zone data in the server processes, to
+ * find the writes that make private copies of its pages.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef COW_AUDIT_H
+#define COW_AUDIT_H
+
+struct nsd;
+
+/* number of code addresses of writes that are counted */
+#define COW_AUDIT_SITES 64
+/* frames in the backtrace of a write */
+#define COW_AUDIT_TRACE 16
+
+/*
+ * The server processes share the pages of the zone data with the parent
+ * until they write to them, then the page is copied for the process.  In
+ * a server process, write protect the arenas of the zone data, and of the
+ * domain arena without the temporary domains.  A write is caught with
+ * SIGSEGV, the page is made writable and counted, with the code address
+ * of the write.  Call after the fork, before the server is started.
+ */
+void cow_audit_start(struct nsd* nsd);
+
+/* bytes of the zone data that this process wrote to */
+uint64_t cow_audit_bytes(void);
+
+/* log the code addresses of the writes, and make the zone data writable,
+ * for the shutdown of the server process */
+void cow_audit_stop(struct nsd* nsd);
+
+#endif /* COW_AUDIT_H */
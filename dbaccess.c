@@ -17,6 +17,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "dns.h"
 #include "namedb.h"
@@ -45,6 +51,10 @@ namedb_close(struct namedb* db)
 			db->udb = NULL;
 		}
 		zonec_desetup_parser();
+#ifdef HAVE_MMAP
+		if(db->lazy_used)
+			(void)munmap(db->lazy_used, LAZY_ZONE_IDS);
+#endif
 		region_destroy(db->region);
 	}
 }
@@ -102,21 +112,29 @@ apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
 	}
 }
 
-/** read rr */
+/*
+ * The zones are read from the nsd.db with plain pointers into the mmap,
+ * and not with udb_ptr, that are linked into the udb for relocation on
+ * every assignment.  The udb is not changed while the zone is read, so
+ * the mmap stays in place.
+ */
+#define UDB_READ(udb, rptr) UDB_REL((udb)->base, (rptr).data)
+
+/** read rr, domain names in the rdata are inserted in owners, if any */
 static void
-read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
+read_rr(region_type* region, domain_table_type* owners, rr_type* rr,
+	struct rr_d* urr, domain_type* domain)
 {
 	buffer_type buffer;
 	ssize_t c;
-	assert(udb_ptr_get_type(urr) == udb_chunk_type_rr);
-	rr->owner = domain;
-	rr->type = RR(urr)->type;
-	rr->klass = RR(urr)->klass;
-	rr->ttl = RR(urr)->ttl;
-
-	buffer_create_from(&buffer, RR(urr)->wire, RR(urr)->len);
-	c = rdata_wireformat_to_rdata_atoms(db->region, db->domains,
-		rr->type, RR(urr)->len, &buffer, &rr->rdatas);
+	rr_set_owner(rr, domain);
+	rr->type = urr->type;
+	rr->klass = urr->klass;
+	rr->ttl = urr->ttl;
+
+	buffer_create_from(&buffer, urr->wire, urr->len);
+	c = rdata_wireformat_to_rdata_atoms(region, owners,
+		rr->type, urr->len, &buffer, &rr->rdatas);
 	if(c == -1) {
 		/* safe on error */
 		rr->rdata_count = 0;
@@ -128,30 +146,27 @@ read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
 
 /** calculate rr count */
 static uint16_t
-calculate_rr_count(udb_base* udb, udb_ptr* rrset)
+calculate_rr_count(udb_base* udb, struct rrset_d* rrset)
 {
-	udb_ptr rr;
+	udb_void rr = rrset->rrs.data;
 	uint16_t num = 0;
-	udb_ptr_new(&rr, udb, &RRSET(rrset)->rrs);
-	while(rr.data) {
+	while(rr) {
 		num++;
-		udb_ptr_set_rptr(&rr, udb, &RR(&rr)->next);
+		rr = ((struct rr_d*)UDB_REL(udb->base, rr))->next.data;
 	}
-	udb_ptr_unlink(&rr, udb);
 	return num;
 }
 
 /** read rrset */
 static void
 read_rrset(udb_base* udb, namedb_type* db, zone_type* zone,
-	domain_type* domain, udb_ptr* urrset)
+	domain_type* domain, struct rrset_d* urrset)
 {
 	rrset_type* rrset;
-	udb_ptr urr;
+	struct rr_d* urr;
 	unsigned i;
-	assert(udb_ptr_get_type(urrset) == udb_chunk_type_rrset);
 	/* if no RRs, do not create anything (robust) */
-	if(RRSET(urrset)->rrs.data == 0)
+	if(urrset->rrs.data == 0)
 		return;
 	rrset = (rrset_type *) region_alloc(db->region, sizeof(rrset_type));
 	rrset->zone = zone;
@@ -159,12 +174,11 @@ read_rrset(udb_base* udb, namedb_type* db, zone_type* zone,
 	rrset->rrs = (rr_type *) region_alloc_array(
 		db->region, rrset->rr_count, sizeof(rr_type));
 	/* add the RRs */
-	udb_ptr_new(&urr, udb, &RRSET(urrset)->rrs);
+	urr = (struct rr_d*)UDB_READ(udb, urrset->rrs);
 	for(i=0; i<rrset->rr_count; i++) {
-		read_rr(db, &rrset->rrs[i], &urr, domain);
-		udb_ptr_set_rptr(&urr, udb, &RR(&urr)->next);
+		read_rr(db->region, db->domains, &rrset->rrs[i], urr, domain);
+		urr = (struct rr_d*)UDB_READ(udb, urr->next);
 	}
-	udb_ptr_unlink(&urr, udb);
 	domain_add_rrset(domain, rrset);
 	if(domain == zone->apex)
 		apex_rrset_checks(db, rrset, domain);
@@ -176,7 +190,7 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 {
 	const dname_type* dname;
 	domain_type* domain;
-	udb_ptr urrset;
+	udb_void urrset;
 
 	dname = dname_make(dname_region, d->name, 0);
 	if(!dname) return;
@@ -184,11 +198,12 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 	assert(domain); /* domain_table_insert should always return non-NULL */
 
 	/* add rrsets */
-	udb_ptr_init(&urrset, udb);
-	udb_ptr_set_rptr(&urrset, udb, &d->rrsets);
-	while(urrset.data) {
-		read_rrset(udb, db, zone, domain, &urrset);
-		udb_ptr_set_rptr(&urrset, udb, &RRSET(&urrset)->next);
+	urrset = d->rrsets.data;
+	while(urrset) {
+		struct rrset_d* rs = (struct rrset_d*)UDB_REL(udb->base,
+			urrset);
+		read_rrset(udb, db, zone, domain, rs);
+		urrset = rs->next.data;
 
 		if(++udb_rrsets % ZONEC_PCT_COUNT == 0 && time(NULL) > udb_time + ZONEC_PCT_TIME) {
 			udb_time = time(NULL);
@@ -198,7 +213,6 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 		}
 	}
 	region_free_all(dname_region);
-	udb_ptr_unlink(&urrset, udb);
 }
 
 /** recurse read radix from disk. This radix tree is by domain name, so max of
@@ -276,15 +290,59 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	zone->zonestatid = 0;
 	zone->is_secure = 0;
 	zone->is_changed = 0;
+	zone->dnstap_filter = 0;
 	zone->is_ok = 1;
+	zone->is_cold = 0;
+	zone->lazy_id = 0;
+	zone->lazy_mem = 0;
+	zone->lazy_prev = NULL;
+	zone->lazy_next = NULL;
+	/* without the nsd.db, a transferred zone is only in memory */
+	if(db->lazy_used && db->lazy_ids+1 < LAZY_ZONE_IDS &&
+		(db->udb || !zone_is_slave(zo)))
+		zone->lazy_id = ++db->lazy_ids;
 	return zone;
 }
 
+/** take a zone out of the list of read lazy zones */
+static void
+lazy_zone_unlink(namedb_type* db, zone_type* zone)
+{
+	if(zone->lazy_prev)
+		zone->lazy_prev->lazy_next = zone->lazy_next;
+	else if(db->lazy_first == zone)
+		db->lazy_first = zone->lazy_next;
+	else	return; /* not in the list */
+	if(zone->lazy_next)
+		zone->lazy_next->lazy_prev = zone->lazy_prev;
+	else	db->lazy_last = zone->lazy_prev;
+	zone->lazy_prev = NULL;
+	zone->lazy_next = NULL;
+	db->lazy_mem -= zone->lazy_mem;
+	zone->lazy_mem = 0;
+}
+
+/** put a zone at the front of the list of read lazy zones */
+static void
+lazy_zone_link_first(namedb_type* db, zone_type* zone)
+{
+	zone->lazy_prev = NULL;
+	zone->lazy_next = db->lazy_first;
+	if(db->lazy_first)
+		db->lazy_first->lazy_prev = zone;
+	else	db->lazy_last = zone;
+	db->lazy_first = zone;
+	db->lazy_mem += zone->lazy_mem;
+}
+
 void
 namedb_zone_delete(namedb_type* db, zone_type* zone)
 {
 	/* RRs and UDB and NSEC3 and so on must be already deleted */
 	radix_delete(db->zonetree, zone->node);
+	lazy_zone_unlink(db, zone);
+	if(zone->lazy_id)
+		db->lazy_used[zone->lazy_id] = 0;
 
 	/* see if apex can be deleted */
 	if(zone->apex) {
@@ -319,6 +377,25 @@ namedb_zone_delete(namedb_type* db, zone_type* zone)
 }
 
 #ifdef HAVE_MMAP
+/** read the SOA and NS of a zone from the nsd.db, for a cold zone */
+static void
+read_zone_apex(udb_base* udb, namedb_type* db, udb_ptr* z, zone_type* zone)
+{
+	const dname_type* dname = domain_dname(zone->apex);
+	udb_ptr d, rrset;
+	if(!udb_domain_find(udb, z, dname_name(dname), dname->name_size, &d))
+		return;
+	if(udb_rrset_find(udb, &d, TYPE_SOA, &rrset)) {
+		read_rrset(udb, db, zone, zone->apex, RRSET(&rrset));
+		udb_ptr_unlink(&rrset, udb);
+	}
+	if(udb_rrset_find(udb, &d, TYPE_NS, &rrset)) {
+		read_rrset(udb, db, zone, zone->apex, RRSET(&rrset));
+		udb_ptr_unlink(&rrset, udb);
+	}
+	udb_ptr_unlink(&d, udb);
+}
+
 /** read a zone */
 static void
 read_zone(udb_base* udb, namedb_type* db, struct nsd_options* opt,
@@ -342,14 +419,393 @@ read_zone(udb_base* udb, namedb_type* db, struct nsd_options* opt,
 	udb_rrset_count = ZONE(z)->rrset_count;
 	zone = namedb_zone_create(db, dname, zo);
 	region_free_all(dname_region);
-	read_zone_data(udb, db, dname_region, z, zone);
 	zone->is_changed = (ZONE(z)->is_changed != 0);
+	if(zone->lazy_id) {
+		/* lazy-zones, the rest is read when the zone is used */
+		read_zone_apex(udb, db, z, zone);
+		zone->is_cold = 1;
+		return;
+	}
+	read_zone_data(udb, db, dname_region, z, zone);
 #ifdef NSEC3
 	prehash_zone_complete(db, zone);
 #endif
 }
 #endif /* HAVE_MMAP */
 
+#if defined(HAVE_MMAP) && defined(HAVE_PTHREAD)
+/*
+ * With database-read-threads, the zones are decoded from the nsd.db by
+ * a number of threads, each zone into a region of its own.  The domain
+ * names are not looked up in the domain table by the threads, that is
+ * done when the main thread merges the decoded zone into the namedb.
+ * The zones are merged in the order of the nsd.db, so the domains are
+ * numbered as when the zones are read one after the other.
+ */
+
+/** a decoded domain, with its rrsets, their rrs have no owner yet and the
+ * domain name atoms of the rdata point to a dname_type */
+struct decoded_domain {
+	struct decoded_domain* next;
+	const dname_type* dname;
+	rrset_type* rrsets;
+};
+
+/** a zone to decode */
+struct decoded_zone {
+	/* the zone_d in the udb */
+	udb_void udbzone;
+	struct zone_options* zo;
+	/* the decoded zone, in its own region, NULL before decode */
+	region_type* region;
+	const dname_type* apex;
+	struct decoded_domain* first, *last;
+	size_t rrset_count;
+	uint64_t decode_usec;
+	int done;
+};
+
+/** the threads that decode zones */
+struct read_threads {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	udb_base* udb;
+	struct decoded_zone* zones;
+	size_t num;
+	/* the next zone to decode */
+	size_t next;
+	/* the number of zones that are merged */
+	size_t merged;
+	/* the threads do not decode zones further than this ahead of the
+	 * merge, that bounds the memory for decoded zones */
+	size_t window;
+	int stop;
+};
+
+/** decode an rrset of a domain */
+static void
+decode_rrset(udb_base* udb, struct decoded_zone* dz, struct decoded_domain* dd,
+	rrset_type** last, struct rrset_d* urrset)
+{
+	rrset_type* rrset;
+	struct rr_d* urr;
+	unsigned i;
+	if(urrset->rrs.data == 0)
+		return;
+	rrset = (rrset_type *) region_alloc(dz->region, sizeof(rrset_type));
+	rrset->next = NULL;
+	rrset->zone = NULL;
+	rrset->rr_count = calculate_rr_count(udb, urrset);
+	rrset->rrs = (rr_type *) region_alloc_array(
+		dz->region, rrset->rr_count, sizeof(rr_type));
+	urr = (struct rr_d*)UDB_READ(udb, urrset->rrs);
+	for(i=0; i<rrset->rr_count; i++) {
+		read_rr(dz->region, NULL, &rrset->rrs[i], urr, NULL);
+		urr = (struct rr_d*)UDB_READ(udb, urr->next);
+	}
+	/* keep the nsd.db order, that domain_add_rrset is called in */
+	if(*last)
+		(*last)->next = rrset;
+	else	dd->rrsets = rrset;
+	*last = rrset;
+	dz->rrset_count++;
+}
+
+/** decode a domain */
+static void
+decode_node_elem(udb_base* udb, struct decoded_zone* dz, struct domain_d* d)
+{
+	struct decoded_domain* dd;
+	rrset_type* last = NULL;
+	udb_void urrset;
+	const dname_type* dname = dname_make(dz->region, d->name, 0);
+	if(!dname) return;
+	dd = (struct decoded_domain*)region_alloc(dz->region, sizeof(*dd));
+	dd->next = NULL;
+	dd->dname = dname;
+	dd->rrsets = NULL;
+	if(dz->last)
+		dz->last->next = dd;
+	else	dz->first = dd;
+	dz->last = dd;
+
+	urrset = d->rrsets.data;
+	while(urrset) {
+		struct rrset_d* rs = (struct rrset_d*)UDB_REL(udb->base,
+			urrset);
+		decode_rrset(udb, dz, dd, &last, rs);
+		urrset = rs->next.data;
+	}
+}
+
+/** decode the domains of the radix tree, in the order of read_zone_recurse */
+static void
+decode_zone_recurse(udb_base* udb, struct decoded_zone* dz,
+	struct udb_radnode_d* node)
+{
+	if(node->elem.data)
+		decode_node_elem(udb, dz, (struct domain_d*)
+			((char*)udb->base + node->elem.data));
+	if(node->lookup.data) {
+		uint16_t i;
+		struct udb_radarray_d* a = (struct udb_radarray_d*)
+			((char*)udb->base + node->lookup.data);
+		for(i=0; i<a->len; i++) {
+			if(a->array[i].node.data) {
+				decode_zone_recurse(udb, dz,
+					(struct udb_radnode_d*)((char*)udb->base +
+						a->array[i].node.data));
+			}
+		}
+	}
+}
+
+/** decode a zone, this does not access the namedb */
+static void
+decode_zone(udb_base* udb, struct decoded_zone* dz)
+{
+	struct zone_d* z = (struct zone_d*)UDB_REL(udb->base, dz->udbzone);
+	struct udb_radtree_d* dtree;
+	struct timespec start, end;
+	get_time_monotonic(&start);
+	dz->region = region_create(xalloc, free);
+	dz->apex = dname_make(dz->region, z->name, 0);
+	dtree = (struct udb_radtree_d*)UDB_READ(udb, z->domains);
+	if(dtree->root.data)
+		decode_zone_recurse(udb, dz, (struct udb_radnode_d*)
+			((char*)udb->base + dtree->root.data));
+	get_time_monotonic(&end);
+	dz->decode_usec = timespec_elapsed_usec(&start, &end);
+}
+
+/** thread that decodes zones, until all are decoded or it is stopped */
+static void*
+decode_thread(void* arg)
+{
+	struct read_threads* rt = (struct read_threads*)arg;
+	pthread_mutex_lock(&rt->lock);
+	while(!rt->stop && rt->next < rt->num) {
+		struct decoded_zone* dz;
+		if(rt->next >= rt->merged + rt->window) {
+			pthread_cond_wait(&rt->cond, &rt->lock);
+			continue;
+		}
+		dz = &rt->zones[rt->next++];
+		pthread_mutex_unlock(&rt->lock);
+		decode_zone(rt->udb, dz);
+		pthread_mutex_lock(&rt->lock);
+		dz->done = 1;
+		pthread_cond_broadcast(&rt->cond);
+	}
+	pthread_mutex_unlock(&rt->lock);
+	return NULL;
+}
+
+/** copy a decoded rrset into the namedb */
+static rrset_type*
+merge_rrset(namedb_type* db, zone_type* zone, domain_type* domain,
+	rrset_type* drrset)
+{
+	rrset_type* rrset;
+	unsigned i, j;
+	rrset = (rrset_type *) region_alloc(db->region, sizeof(rrset_type));
+	rrset->zone = zone;
+	rrset->rr_count = drrset->rr_count;
+	rrset->rrs = (rr_type *) region_alloc_array(
+		db->region, rrset->rr_count, sizeof(rr_type));
+	for(i=0; i<rrset->rr_count; i++) {
+		rr_type* drr = &drrset->rrs[i];
+		rr_type* rr = &rrset->rrs[i];
+		rr_set_owner(rr, domain);
+		rr->type = drr->type;
+		rr->klass = drr->klass;
+		rr->ttl = drr->ttl;
+		rr->rdata_count = drr->rdata_count;
+		if(drr->rdatas == NULL) {
+			rr->rdatas = NULL;
+			continue;
+		}
+		rr->rdatas = (rdata_atom_type *) region_alloc_array(
+			db->region, rr->rdata_count, sizeof(rdata_atom_type));
+		for(j=0; j<rr->rdata_count; j++) {
+			if(rdata_atom_is_domain(rr->type, j)) {
+				rr->rdatas[j].domain = domain_table_insert(
+					db->domains, (const dname_type*)
+					drr->rdatas[j].data);
+				rr->rdatas[j].domain->usage ++;
+			} else if(rdata_atom_is_inline(drr->rdatas[j])) {
+				rr->rdatas[j] = drr->rdatas[j];
+			} else {
+				rr->rdatas[j].data = (uint16_t*)
+					region_alloc_init(db->region,
+					drr->rdatas[j].data, sizeof(uint16_t)
+					+ rdata_atom_size(drr->rdatas[j]));
+			}
+		}
+	}
+	return rrset;
+}
+
+/** merge a decoded zone into the namedb */
+static void
+merge_zone(udb_base* udb, namedb_type* db, struct decoded_zone* dz)
+{
+	struct decoded_domain* dd;
+	rrset_type* drrset;
+	zone_type* zone;
+	struct timespec start, end;
+	if(!dz->apex) return;
+	get_time_monotonic(&start);
+	udb_rrsets = 0;
+	udb_rrset_count = ((struct zone_d*)UDB_REL(udb->base,
+		dz->udbzone))->rrset_count;
+	zone = namedb_zone_create(db, dz->apex, dz->zo);
+	for(dd = dz->first; dd; dd = dd->next) {
+		domain_type* domain = domain_table_insert(db->domains,
+			dd->dname);
+		for(drrset = dd->rrsets; drrset; drrset = drrset->next) {
+			rrset_type* rrset = merge_rrset(db, zone, domain,
+				drrset);
+			domain_add_rrset(domain, rrset);
+			if(domain == zone->apex)
+				apex_rrset_checks(db, rrset, domain);
+
+			if(++udb_rrsets % ZONEC_PCT_COUNT == 0 && time(NULL) > udb_time + ZONEC_PCT_TIME) {
+				udb_time = time(NULL);
+				VERBOSITY(1, (LOG_INFO, "read %s %d %%",
+					dz->zo->name,
+					(int)(udb_rrsets*((unsigned long)100)/udb_rrset_count)));
+			}
+		}
+	}
+	zone->is_changed = (((struct zone_d*)UDB_REL(udb->base,
+		dz->udbzone))->is_changed != 0);
+#ifdef NSEC3
+	prehash_zone_complete(db, zone);
+#endif
+	get_time_monotonic(&end);
+	VERBOSITY(2, (LOG_INFO, "zone %s read, %u rrsets, decoded in %llu "
+		"usec, merged in %llu usec", dz->zo->name,
+		(unsigned)dz->rrset_count, (unsigned long long)dz->decode_usec,
+		(unsigned long long)timespec_elapsed_usec(&start, &end)));
+}
+
+/** read zones from nsd.db, decoded with threads */
+static void
+read_zones_threaded(udb_base* udb, namedb_type* db, struct nsd_options* opt,
+	region_type* dname_region)
+{
+	struct read_threads rt;
+	pthread_t* threads;
+	int i, num_threads = 0;
+	size_t z;
+	udb_ptr ztree, n;
+
+	/* remove the zones that are deleted from the options first, the
+	 * udb is not changed after that, so the threads can read it */
+	memset(&rt, 0, sizeof(rt));
+	udb_ptr_new(&ztree, udb, udb_base_get_userdata(udb));
+	udb_radix_first(udb, &ztree, &n);
+	while(n.data) {
+		udb_ptr zp;
+		const dname_type* dname;
+		udb_ptr_new(&zp, udb, &RADNODE(&n)->elem);
+		udb_radix_next(udb, &n); /* store in case n is deleted */
+		dname = dname_make(dname_region, ZONE(&zp)->name, 0);
+		if(dname && !zone_options_find(opt, dname)) {
+			VERBOSITY(2, (LOG_WARNING, "zone %s is deleted",
+				dname_to_string(dname, NULL)));
+			udb_zone_delete(udb, &zp);
+		} else if(dname) {
+			rt.num++;
+		}
+		udb_ptr_unlink(&zp, udb);
+		region_free_all(dname_region);
+	}
+	rt.zones = (struct decoded_zone*)xalloc_array_zero(
+		rt.num?rt.num:1, sizeof(struct decoded_zone));
+	z = 0;
+	udb_radix_first(udb, &ztree, &n);
+	while(n.data && z < rt.num) {
+		struct zone_d* zd = (struct zone_d*)UDB_READ(udb,
+			RADNODE(&n)->elem);
+		const dname_type* dname = dname_make(dname_region, zd->name, 0);
+		if(dname) {
+			rt.zones[z].udbzone = RADNODE(&n)->elem.data;
+			rt.zones[z].zo = zone_options_find(opt, dname);
+			z++;
+		}
+		region_free_all(dname_region);
+		udb_radix_next(udb, &n);
+	}
+	udb_ptr_unlink(&ztree, udb);
+	udb_ptr_unlink(&n, udb);
+	rt.num = z;
+
+	rt.udb = udb;
+	rt.window = (size_t)opt->database_read_threads * 2;
+	udb_time = time(NULL);
+	pthread_mutex_init(&rt.lock, NULL);
+	pthread_cond_init(&rt.cond, NULL);
+	threads = (pthread_t*)xalloc_array_zero(opt->database_read_threads,
+		sizeof(pthread_t));
+	for(i=0; i<opt->database_read_threads && (size_t)i<rt.num; i++) {
+		int r;
+		if((r=pthread_create(&threads[num_threads], NULL,
+			decode_thread, &rt)) != 0) {
+			log_msg(LOG_ERR, "cannot create thread to read "
+				"nsd.db: %s", strerror(r));
+			break;
+		}
+		num_threads++;
+	}
+	VERBOSITY(2, (LOG_INFO, "read %u zones with %d threads",
+		(unsigned)rt.num, num_threads));
+
+	for(z=0; z<rt.num; z++) {
+		struct decoded_zone* dz = &rt.zones[z];
+		pthread_mutex_lock(&rt.lock);
+		if(rt.next == z) {
+			/* not picked up by a thread yet, decode it here */
+			rt.next++;
+			pthread_mutex_unlock(&rt.lock);
+			decode_zone(udb, dz);
+			pthread_mutex_lock(&rt.lock);
+			dz->done = 1;
+		}
+		while(!dz->done)
+			pthread_cond_wait(&rt.cond, &rt.lock);
+		pthread_mutex_unlock(&rt.lock);
+
+		merge_zone(udb, db, dz);
+		region_destroy(dz->region);
+		dz->region = NULL;
+
+		pthread_mutex_lock(&rt.lock);
+		rt.merged = z+1;
+		if(nsd.signal_hint_shutdown)
+			rt.stop = 1;
+		pthread_cond_broadcast(&rt.cond);
+		pthread_mutex_unlock(&rt.lock);
+		if(rt.stop) break;
+	}
+	pthread_mutex_lock(&rt.lock);
+	rt.stop = 1;
+	pthread_cond_broadcast(&rt.cond);
+	pthread_mutex_unlock(&rt.lock);
+	for(i=0; i<num_threads; i++)
+		pthread_join(threads[i], NULL);
+	/* zones decoded but not merged, after a shutdown */
+	for(z=0; z<rt.num; z++)
+		if(rt.zones[z].region)
+			region_destroy(rt.zones[z].region);
+	pthread_cond_destroy(&rt.cond);
+	pthread_mutex_destroy(&rt.lock);
+	free(threads);
+	free(rt.zones);
+}
+#endif /* HAVE_MMAP && HAVE_PTHREAD */
+
 #ifdef HAVE_MMAP
 /** read zones from nsd.db */
 static void
@@ -357,6 +813,13 @@ read_zones(udb_base* udb, namedb_type* db, struct nsd_options* opt,
 	region_type* dname_region)
 {
 	udb_ptr ztree, n, z;
+#ifdef HAVE_PTHREAD
+	/* with lazy-zones only the apex is read, no threads needed */
+	if(opt->database_read_threads > 1 && !db->lazy_used) {
+		read_zones_threaded(udb, db, opt, dname_region);
+		return;
+	}
+#endif
 	udb_ptr_init(&z, udb);
 	udb_ptr_new(&ztree, udb, udb_base_get_userdata(udb));
 	udb_radix_first(udb,&ztree,&n);
@@ -386,8 +849,10 @@ try_read_udb(namedb_type* db, int fd, const char* filename,
 	 * read from the database.
 	 */
 	region_type* dname_region;
+	struct timespec start, end;
 
 	assert(fd != -1);
+	get_time_monotonic(&start);
 	if(!(db->udb=udb_base_create_fd(filename, fd, &namedb_walkfunc,
 		NULL))) {
 		/* fd is closed by failed udb create call */
@@ -403,12 +868,19 @@ try_read_udb(namedb_type* db, int fd, const char* filename,
 		db->udb = NULL;
 		return 0;
 	}
+#ifdef HAVE_MADVISE
+	/* the whole file is read, let the pages be read ahead */
+	(void)madvise(db->udb->base, db->udb->base_size, MADV_WILLNEED);
+#endif
 	/* read if it can be opened */
 	dname_region = region_create(xalloc, free);
 	/* this operation does not fail, we end up with
 	 * something, even if that is an empty namedb */
 	read_zones(db->udb, db, opt, dname_region);
 	region_destroy(dname_region);
+	get_time_monotonic(&end);
+	VERBOSITY(1, (LOG_INFO, "read %s in %llu msec", filename,
+		(unsigned long long)timespec_elapsed_usec(&start, &end)/1000));
 	return 1;
 }
 #endif /* HAVE_MMAP */
@@ -423,21 +895,76 @@ namedb_open (const char* filename, struct nsd_options* opt)
 	 * freed in namedb_close.
 	 */
 	region_type* db_region;
-	int fd;
+	int fd, slab = 0, slab_flags = 0;
 
+#ifdef USE_SLAB_ALLOC
+	/* the slabs give the memory of deleted RRs back to the OS */
+	slab = 1;
+#endif
+	/* huge pages and prefault need the arenas of the slabs */
+	if(opt && opt->database_huge_pages == 2)
+		slab_flags |= REGION_SLAB_HUGETLB;
+	else if(opt && opt->database_huge_pages)
+		slab_flags |= REGION_SLAB_HUGE;
+	if(opt && opt->database_prefault)
+		slab_flags |= REGION_SLAB_PREFAULT;
+	/* the NUMA replicas are copies of the arenas */
+	if(opt && opt->database_numa_replicas)
+		slab = 1;
+	/* the audit write protects the arenas */
+	if(opt && opt->database_cow_audit)
+		slab = 1;
+	/* lazy-zones counts the memory of a zone in the slabs, and the
+	 * slabs give it back when the zone is put away */
+	if(opt && opt->lazy_zones)
+		slab = 1;
+	if(slab || slab_flags) {
+		db_region = region_create_slab(xalloc, free,
+			DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE,
+			slab_flags);
+	} else {
 #ifdef USE_MMAP_ALLOC
-	db_region = region_create_custom(mmap_alloc, mmap_free, MMAP_ALLOC_CHUNK_SIZE,
-		MMAP_ALLOC_LARGE_OBJECT_SIZE, MMAP_ALLOC_INITIAL_CLEANUP_SIZE, 1);
+		db_region = region_create_custom(mmap_alloc, mmap_free,
+			MMAP_ALLOC_CHUNK_SIZE, MMAP_ALLOC_LARGE_OBJECT_SIZE,
+			MMAP_ALLOC_INITIAL_CLEANUP_SIZE, 1);
 #else /* !USE_MMAP_ALLOC */
-	db_region = region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
-		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+		db_region = region_create_custom(xalloc, free,
+			DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+			DEFAULT_INITIAL_CLEANUP_SIZE, 1);
 #endif /* !USE_MMAP_ALLOC */
+	}
 	db = (namedb_type *) region_alloc(db_region, sizeof(struct namedb));
 	db->region = db_region;
 	db->domains = domain_table_create(db->region);
 	db->zonetree = radix_tree_create(db->region);
 	db->diff_skip = 0;
 	db->diff_pos = 0;
+	db->lazy_used = NULL;
+	db->lazy_ids = 0;
+	db->lazy_gen = 0;
+	db->lazy_first = NULL;
+	db->lazy_last = NULL;
+	db->lazy_mem = 0;
+#ifdef HAVE_MMAP
+	if(opt && opt->lazy_zones) {
+		/* shared with the server processes, that are forked later */
+		db->lazy_used = (uint8_t*)mmap(NULL, LAZY_ZONE_IDS,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON
+#ifdef MAP_NORESERVE
+			| MAP_NORESERVE
+#endif
+			, -1, 0);
+		if(db->lazy_used == MAP_FAILED) {
+			log_msg(LOG_ERR, "lazy-zones: mmap failed: %s, the "
+				"zones are read at the start", strerror(errno));
+			db->lazy_used = NULL;
+		}
+	}
+#else
+	if(opt && opt->lazy_zones)
+		log_msg(LOG_ERR, "lazy-zones: no mmap(), the zones are read "
+			"at the start");
+#endif /* HAVE_MMAP */
 	zonec_setup_parser(db);
 
 	if (gettimeofday(&(db->diff_timestamp), NULL) != 0) {
@@ -656,6 +1183,10 @@ void namedb_check_zonefile(struct nsd* nsd, udb_base* taskudb,
 	if(!zone) {
 		zone = namedb_zone_create(nsd->db, dname, zopt);
 	}
+	if(zone->is_cold) {
+		namedb_zone_warm(nsd, zone, taskudb, last_task);
+		return;
+	}
 	namedb_read_zonefile(nsd, zone, taskudb, last_task);
 }
 
@@ -663,9 +1194,176 @@ void namedb_check_zonefiles(struct nsd* nsd, struct nsd_options* opt,
 	udb_base* taskudb, udb_ptr* last_task)
 {
 	struct zone_options* zo;
+	zone_type* zone;
 	/* check all zones in opt, create if not exist in main db */
 	RBTREE_FOR(zo, struct zone_options*, opt->zone_options) {
+		if(nsd->db->lazy_used) {
+			/* lazy-zones, the cold zones are checked when they
+			 * are read, new zones start cold */
+			zone = namedb_find_zone(nsd->db,
+				(const dname_type*)zo->node.key);
+			if(!zone) {
+				zone = namedb_zone_create(nsd->db,
+					(const dname_type*)zo->node.key, zo);
+				if(zone->lazy_id)
+					zone->is_cold = 1;
+			}
+			if(zone->is_cold)
+				continue;
+		}
 		namedb_check_zonefile(nsd, taskudb, last_task, zo);
 		if(nsd->signal_hint_shutdown) break;
 	}
 }
+
+/** the bytes of zone data, for the memory of the lazy zones */
+static size_t
+lazy_zones_db_mem(namedb_type* db)
+{
+	size_t mapped, used, released;
+	region_get_slab_stats(db->region, &mapped, &used, &released);
+#ifdef USE_COMPACT_DOMAINS
+	{
+		size_t count, mem;
+		domain_arena_stats(&count, &mem);
+		used += count*sizeof(domain_type);
+	}
+#endif
+	return used;
+}
+
+void
+namedb_zone_warm(struct nsd* nsd, zone_type* zone, udb_base* taskudb,
+	udb_ptr* last_task)
+{
+	namedb_type* db = nsd->db;
+	size_t before, after;
+	int read_file = 1;
+	if(!zone->is_cold)
+		return;
+	before = lazy_zones_db_mem(db);
+#ifdef NSEC3
+	nsec3_clear_precompile(db, zone);
+	zone->nsec3_param = NULL;
+#endif
+	delete_zone_rrs(db, zone);
+	zone->is_cold = 0;
+#ifdef HAVE_MMAP
+	if(db->udb) {
+		region_type* dname_region;
+		udb_ptr z;
+		if(udb_zone_search(db->udb, &z, dname_name(domain_dname(
+			zone->apex)), domain_dname(zone->apex)->name_size)) {
+			dname_region = region_create(xalloc, free);
+			udb_rrsets = 0;
+			udb_rrset_count = ZONE(&z)->rrset_count;
+			udb_time = time(NULL);
+			read_zone_data(db->udb, db, dname_region, &z, zone);
+			region_destroy(dname_region);
+			udb_ptr_unlink(&z, db->udb);
+#ifdef NSEC3
+			prehash_zone_complete(db, zone);
+#endif
+			/* the zonefile is checked as it is for the other
+			 * zones at the start */
+			read_file = nsd->options->zonefiles_check;
+		}
+	}
+#endif /* HAVE_MMAP */
+	if(read_file)
+		namedb_read_zonefile(nsd, zone, taskudb, last_task);
+	after = lazy_zones_db_mem(db);
+	zone->lazy_mem = (uint32_t)(after > before ? after - before : 0);
+	lazy_zone_link_first(db, zone);
+	if(zone->lazy_id)
+		db->lazy_used[zone->lazy_id] = LAZY_ZONE_USED;
+	VERBOSITY(2, (LOG_INFO, "lazy-zones: zone %s is read, %u bytes",
+		zone->opts->name, (unsigned)zone->lazy_mem));
+}
+
+/** put a read lazy zone away, only its SOA and NS stay in memory */
+static void
+namedb_zone_cool(namedb_type* db, zone_type* zone)
+{
+	lazy_zone_unlink(db, zone);
+#ifdef NSEC3
+	nsec3_clear_precompile(db, zone);
+	zone->nsec3_param = NULL;
+#endif
+	delete_zone_rrs(db, zone);
+#ifdef HAVE_MMAP
+	if(db->udb) {
+		udb_ptr z;
+		if(udb_zone_search(db->udb, &z, dname_name(domain_dname(
+			zone->apex)), domain_dname(zone->apex)->name_size)) {
+			read_zone_apex(db->udb, db, &z, zone);
+			udb_ptr_unlink(&z, db->udb);
+		}
+	}
+#endif /* HAVE_MMAP */
+	if(!db->udb) {
+		/* the zonefile is read again when the zone is used */
+		if(zone->filename)
+			region_recycle(db->region, zone->filename,
+				strlen(zone->filename)+1);
+		zone->filename = NULL;
+		zone->mtime.tv_sec = 0;
+		zone->mtime.tv_nsec = 0;
+	}
+	zone->is_cold = 1;
+	db->lazy_used[zone->lazy_id] = 0;
+	VERBOSITY(2, (LOG_INFO, "lazy-zones: zone %s is put away",
+		zone->opts->name));
+}
+
+void
+namedb_lazy_zones_update(struct nsd* nsd, struct nsd_options* opt)
+{
+	namedb_type* db = nsd->db;
+	zone_type* zone, *next, *recent = NULL;
+	uint64_t max;
+	if(!db->lazy_used)
+		return;
+	/* the marks of the cold zones are for the servers of this reload.
+	 * When the gen wraps around, the marks of the previous round are
+	 * cleared, a zone asked for LAZY_ZONE_GENS reloads ago would
+	 * otherwise look asked for by the new servers, and not be read */
+	db->lazy_gen++;
+	if(db->lazy_gen % LAZY_ZONE_GENS == 0) {
+		uint32_t id;
+		for(id = 1; id <= db->lazy_ids; id++)
+			if(db->lazy_used[id] != LAZY_ZONE_USED)
+				db->lazy_used[id] = 0;
+	}
+	/* the zones used since the previous reload go to the front.  A
+	 * read zone can have the mark of a server from before it was read,
+	 * that asked for it, that is a use too */
+	for(zone = db->lazy_first; zone; zone = next) {
+		next = zone->lazy_next;
+		if(db->lazy_used[zone->lazy_id] == 0)
+			continue;
+		db->lazy_used[zone->lazy_id] = 0;
+		if(!recent)
+			recent = zone;
+		if(zone != db->lazy_first) {
+			uint32_t mem = zone->lazy_mem;
+			lazy_zone_unlink(db, zone);
+			zone->lazy_mem = mem;
+			lazy_zone_link_first(db, zone);
+		}
+	}
+	if(opt->lazy_zones_memory <= 0)
+		return;
+	/* put away the least recently used zones, not the ones that are
+	 * used since the previous reload, they are from the front up to
+	 * recent */
+	max = (uint64_t)opt->lazy_zones_memory * 1024 * 1024;
+	zone = db->lazy_last;
+	while(zone && db->lazy_mem > max && zone != recent) {
+		next = zone->lazy_prev;
+		/* without the nsd.db, changes from transfers are kept */
+		if(db->udb || !zone->is_changed)
+			namedb_zone_cool(db, zone);
+		zone = next;
+	}
+}
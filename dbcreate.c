@@ -73,8 +73,8 @@ udb_del_rr(udb_base* udb, udb_ptr* z, rr_type* rr)
 	uint8_t rdata[MAX_RDLENGTH];
 	size_t rdatalen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
 	assert(udb);
-	udb_zone_del_rr(udb, z, dname_name(domain_dname(rr->owner)),
-		domain_dname(rr->owner)->name_size, rr->type, rr->klass,
+	udb_zone_del_rr(udb, z, dname_name(domain_dname(rr_owner(rr))),
+		domain_dname(rr_owner(rr))->name_size, rr->type, rr->klass,
 		rdata, rdatalen);
 }
 
@@ -92,8 +92,8 @@ udb_write_rr(udb_base* udb, udb_ptr* z, rr_type* rr)
 			sizeof(rdata)-rdatalen);
 	}
 	assert(udb);
-	return udb_zone_add_rr(udb, z, dname_name(domain_dname(rr->owner)),
-		domain_dname(rr->owner)->name_size, rr->type, rr->klass,
+	return udb_zone_add_rr(udb, z, dname_name(domain_dname(rr_owner(rr))),
+		domain_dname(rr_owner(rr))->name_size, rr->type, rr->klass,
 		rr->ttl, rdata, rdatalen);
 }
 
@@ -339,6 +339,9 @@ namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt)
 	zone = namedb_find_zone(nsd->db, (const dname_type*)zopt->node.key);
 	if(!zone || !zone->apex || !zone->soa_rrset)
 		return;
+	/* lazy-zones, a cold zone only has its SOA and NS in memory */
+	if(zone->is_cold)
+		return;
 	/* write if file does not exist, or if changed */
 	/* so, determine filename, create directory components, check exist*/
 	zfile = config_make_zonefile(zopt, nsd);
@@ -208,7 +208,8 @@ add_rdata_to_recyclebin(namedb_type* db, rr_type* rr)
 	size_t i;
 	for(i=0; i<rr->rdata_count; i++)
 	{
-		if(!rdata_atom_is_domain(rr->type, i))
+		if(!rdata_atom_is_domain(rr->type, i) &&
+			!rdata_atom_is_inline(rr->rdatas[i]))
 			region_recycle(db->region, rr->rdatas[i].data,
 				rdata_atom_size(rr->rdatas[i])
 				+ sizeof(uint16_t));
@@ -252,10 +253,10 @@ rrset_zero_nonexist_check(domain_type* domain, domain_type* ce)
 					return p;
 				p->is_existing = 0;
 				/* fixup wildcard child of parent */
-				if(p->parent &&
-					p->parent->wildcard_child_closest_match == p)
-					p->parent->wildcard_child_closest_match = domain_previous_existing_child(p);
-				p = p->parent;
+				if(domain_parent(p) &&
+					domain_wildcard_match(domain_parent(p)) == p)
+					domain_set_wildcard_match(domain_parent(p), domain_previous_existing_child(p));
+				p = domain_parent(p);
 			}
 		}
 	}
@@ -372,14 +373,14 @@ debug_find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 		if (rrset->rrs[i].type != type) {
 			log_msg(LOG_WARNING, "diff: RR <%s, %s> does not match "
 				"RR num %d type %s",
-				dname_to_string(domain_dname(rrset->rrs[i].owner),0),
+				dname_to_string(domain_dname(rr_owner(&rrset->rrs[i])),0),
 				rrtype_to_string(type),	i,
 				rrtype_to_string(rrset->rrs[i].type));
 		}
 		if (rrset->rrs[i].klass != klass) {
 			log_msg(LOG_WARNING, "diff: RR <%s, %s> class %d "
 				"does not match RR num %d class %d",
-				dname_to_string(domain_dname(rrset->rrs[i].owner),0),
+				dname_to_string(domain_dname(rr_owner(&rrset->rrs[i])),0),
 				rrtype_to_string(type),
 				klass, i,
 				rrset->rrs[i].klass);
@@ -387,7 +388,7 @@ debug_find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 		if (rrset->rrs[i].rdata_count != rdata_num) {
 			log_msg(LOG_WARNING, "diff: RR <%s, %s> rdlen %u "
 				"does not match RR num %d rdlen %d",
-				dname_to_string(domain_dname(rrset->rrs[i].owner),0),
+				dname_to_string(domain_dname(rr_owner(&rrset->rrs[i])),0),
 				rrtype_to_string(type),
 				(unsigned) rdata_num, i,
 				(unsigned) rrset->rrs[i].rdata_count);
@@ -396,7 +397,7 @@ debug_find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 			&rd, &reason)) {
 			log_msg(LOG_WARNING, "diff: RR <%s, %s> rdata element "
 				"%d differs from RR num %d rdata (%s)",
-				dname_to_string(domain_dname(rrset->rrs[i].owner),0),
+				dname_to_string(domain_dname(rr_owner(&rrset->rrs[i])),0),
 				rrtype_to_string(type),
 				rd, i, reason);
 		}
@@ -437,22 +438,22 @@ nsec3_delete_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 	if(!zone->nsec3_param)
 		return;
 	/* see if the domain was an NSEC3-domain in the chain, but no longer */
-	if(rr->type == TYPE_NSEC3 && rr->owner->nsec3 &&
-		rr->owner->nsec3->nsec3_node.key &&
+	if(rr->type == TYPE_NSEC3 && rr_owner(rr)->nsec3 &&
+		rr_owner(rr)->nsec3->nsec3_node.key &&
 		nsec3_rr_uses_params(rr, zone) &&
-		nsec3_in_chain_count(rr->owner, zone) <= 1) {
-		domain_type* prev = nsec3_chain_find_prev(zone, rr->owner);
+		nsec3_in_chain_count(rr_owner(rr), zone) <= 1) {
+		domain_type* prev = nsec3_chain_find_prev(zone, rr_owner(rr));
 		/* remove from prehash because no longer an NSEC3 domain */
-		if(domain_is_prehash(db->domains, rr->owner))
-			prehash_del(db->domains, rr->owner);
+		if(domain_is_prehash(db->domains, rr_owner(rr)))
+			prehash_del(db->domains, rr_owner(rr));
 		/* fixup the last in the zone */
-		if(rr->owner == zone->nsec3_last)
+		if(rr_owner(rr) == zone->nsec3_last)
 			zone->nsec3_last = prev;
 		/* unlink from the nsec3tree */
 		zone_del_domain_in_hash_tree(zone->nsec3tree,
-			&rr->owner->nsec3->nsec3_node);
+			&rr_owner(rr)->nsec3->nsec3_node);
 		/* add previous NSEC3 to the prehash list */
-		if(prev && prev != rr->owner)
+		if(prev && prev != rr_owner(rr))
 			prehash_add(db->domains, prev);
 		else	nsec3_clear_precompile(db, zone);
 		/* this domain becomes ordinary data domain: done later */
@@ -494,7 +495,7 @@ nsec3_rrsets_changed_remove_prehash(domain_type* domain, zone_type* zone)
 	if(domain != zone->apex && domain->nsec3 &&
 		domain->nsec3->ds_parent_hash &&
 		domain->nsec3->ds_parent_hash->node.key &&
-		(!domain->parent || nsec3_domain_part_of_zone(domain->parent, zone)) &&
+		(!domain_parent(domain) || nsec3_domain_part_of_zone(domain_parent(domain), zone)) &&
 		!nsec3_condition_dshash(domain, zone)) {
 		/* remove precompile */
 		domain->nsec3->nsec3_ds_parent_cover = NULL;
@@ -557,15 +558,15 @@ nsec3_add_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 	/* the RR has been added in full, also to UDB (and thus NSEC3PARAM 
 	 * in the udb has been adjusted) */
 	if(zone->nsec3_param && rr->type == TYPE_NSEC3 &&
-		(!rr->owner->nsec3 || !rr->owner->nsec3->nsec3_node.key)
+		(!rr_owner(rr)->nsec3 || !rr_owner(rr)->nsec3->nsec3_node.key)
 		&& nsec3_rr_uses_params(rr, zone)) {
 		/* added NSEC3 into the chain */
-		nsec3_precompile_nsec3rr(db, rr->owner, zone);
+		nsec3_precompile_nsec3rr(db, rr_owner(rr), zone);
 		/* the domain has become an NSEC3-domain, if it was precompiled
 		 * previously, remove that, neatly done in routine above */
-		nsec3_rrsets_changed_remove_prehash(rr->owner, zone);
+		nsec3_rrsets_changed_remove_prehash(rr_owner(rr), zone);
 		/* set this NSEC3 to prehash */
-		prehash_add(db->domains, rr->owner);
+		prehash_add(db->domains, rr_owner(rr));
 	} else if(!zone->nsec3_param && rr->type == TYPE_NSEC3PARAM) {
 		/* see if this means NSEC3 chain can be used */
 		nsec3_find_zone_param(db, zone, udbz, NULL, 0);
@@ -818,7 +819,7 @@ add_RR(namedb_type* db, const dname_type* dname,
 	region_recycle(db->region, rrs_old, sizeof(rr_type) * rrset->rr_count);
 	rrset->rr_count ++;
 
-	rrset->rrs[rrset->rr_count - 1].owner = domain;
+	rr_set_owner(&rrset->rrs[rrset->rr_count - 1], domain);
 	rrset->rrs[rrset->rr_count - 1].rdatas = rdatas;
 	rrset->rrs[rrset->rr_count - 1].ttl = ttl;
 	rrset->rrs[rrset->rr_count - 1].type = type;
@@ -850,13 +851,13 @@ add_RR(namedb_type* db, const dname_type* dname,
 	}
 #ifdef NSEC3
 	if(rrset_added) {
-		domain_type* p = domain->parent;
+		domain_type* p = domain_parent(domain);
 		nsec3_add_rrset_trigger(db, domain, zone, type);
 		/* go up and process (possibly created) empty nonterminals, 
 		 * until we hit the apex or root */
 		while(p && p->rrsets == NULL && !p->is_apex) {
 			nsec3_rrsets_changed_add_prehash(db, p, zone);
-			p = p->parent;
+			p = domain_parent(p);
 		}
 	}
 	nsec3_add_rr_trigger(db, &rrset->rrs[rrset->rr_count - 1], zone, udbz);
@@ -1792,6 +1793,21 @@ void task_new_zonestat_inc(udb_base* udb, udb_ptr* last, unsigned sz)
 	udb_ptr_unlink(&e, udb);
 }
 
+void task_new_reload_info(udb_base* udb, udb_ptr* last,
+	struct reload_info* info)
+{
+	udb_ptr e;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task reload_info"));
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d) +
+		sizeof(*info), NULL)) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add r_i");
+		return;
+	}
+	TASKLIST(&e)->task_type = task_reload_info;
+	memmove(TASKLIST(&e)->zname, info, sizeof(*info));
+	udb_ptr_unlink(&e, udb);
+}
+
 int
 task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* dname,
 	uint32_t old_serial, uint32_t new_serial, uint64_t filenumber)
@@ -1898,6 +1914,11 @@ task_process_add_zone(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
 	z->zonestatid = (unsigned)task->yesno;
 	/* if zone is empty, attempt to read the zonefile from disk (if any) */
 	if(!z->soa_rrset && z->opts->pattern->zonefile) {
+		/* lazy-zones, it is read when it is used */
+		if(z->lazy_id) {
+			z->is_cold = 1;
+			return;
+		}
 		namedb_read_zonefile(nsd, z, udb, last_task);
 	}
 }
@@ -2020,6 +2041,9 @@ task_process_apply_xfr(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 		xfrd_unlink_xfrfile(nsd, TASKLIST(task)->yesno);
 		return;
 	}
+	/* lazy-zones, an IXFR applies to the contents of the zone */
+	if(zone->is_cold)
+		namedb_zone_warm(nsd, zone, udb, last_task);
 	/* apply the XFR */
 	/* oldserial, newserial, yesno is filenumber */
 	df = xfrd_open_xfrfile(nsd, TASKLIST(task)->yesno, "r");
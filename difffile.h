@@ -88,7 +88,9 @@ struct task_list_d {
 		/** options change */
 		task_opt_change,
 		/** zonestat increment */
-		task_zonestat_inc
+		task_zonestat_inc,
+		/** reload phase timings, result for xfrd */
+		task_reload_info
 	} task_type;
 	uint32_t size; /* size of this struct */
 
@@ -101,6 +103,15 @@ struct task_list_d {
 	struct dname zname[0];
 };
 #define TASKLIST(ptr) ((struct task_list_d*)UDB_PTR(ptr))
+
+/* reload_info task data, after the task_list_d */
+struct reload_info {
+	/* number of tasks processed, and of those zone transfers */
+	uint64_t tasks, xfrs;
+	/* usec to process the tasks, to compact and sync the database, to
+	 * start the new children and to wait for the old main to quit */
+	uint64_t process_usec, sync_usec, children_usec, quit_usec;
+};
 /** create udb for tasks */
 struct udb_base* task_file_create(const char* file);
 void task_remap(udb_base* udb);
@@ -126,6 +137,8 @@ void task_new_add_pattern(udb_base* udb, udb_ptr* last,
 void task_new_del_pattern(udb_base* udb, udb_ptr* last, const char* name);
 void task_new_opt_change(udb_base* udb, udb_ptr* last, struct nsd_options* opt);
 void task_new_zonestat_inc(udb_base* udb, udb_ptr* last, unsigned sz);
+void task_new_reload_info(udb_base* udb, udb_ptr* last,
+	struct reload_info* info);
 int task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* zone,
 	uint32_t old_serial, uint32_t new_serial, uint64_t filenumber);
 void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
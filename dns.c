@@ -33,6 +33,22 @@ static lookup_table_type dns_rrclasses[] = {
 	{ 0, NULL }
 };
 
+/* The RCODE names, from RFC 1035 and RFC 2136.  */
+static lookup_table_type dns_rcodes[] = {
+	{ RCODE_OK, "NOERROR" },
+	{ RCODE_FORMAT, "FORMERR" },
+	{ RCODE_SERVFAIL, "SERVFAIL" },
+	{ RCODE_NXDOMAIN, "NXDOMAIN" },
+	{ RCODE_IMPL, "NOTIMP" },
+	{ RCODE_REFUSE, "REFUSED" },
+	{ RCODE_YXDOMAIN, "YXDOMAIN" },
+	{ RCODE_YXRRSET, "YXRRSET" },
+	{ RCODE_NXRRSET, "NXRRSET" },
+	{ RCODE_NOTAUTH, "NOTAUTH" },
+	{ RCODE_NOTZONE, "NOTZONE" },
+	{ 0, NULL }
+};
+
 static rrtype_descriptor_type rrtype_descriptors[(RRTYPE_DESCRIPTORS_LENGTH+1)] = {
 	/* 0 */
 	{ 0, NULL, T_UTYPE, 1, 1, { RDATA_WF_BINARY }, { RDATA_ZF_UNKNOWN } },
@@ -936,6 +952,41 @@ rrclass_to_string(uint16_t rrclass)
 	return buf;
 }
 
+const char *
+rcode_to_string(uint8_t rcode)
+{
+	static char buf[20];
+	lookup_table_type *entry = lookup_by_id(dns_rcodes, rcode);
+	if (entry) {
+		assert(strlen(entry->name) < sizeof(buf));
+		strlcpy(buf, entry->name, sizeof(buf));
+	} else {
+		snprintf(buf, sizeof(buf), "RCODE%d", (int) rcode);
+	}
+	return buf;
+}
+
+int
+rcode_from_string(const char *name)
+{
+	char *end;
+	long rcode;
+	lookup_table_type *entry;
+
+	entry = lookup_by_name(dns_rcodes, name);
+	if (entry) {
+		return entry->id;
+	}
+
+	if (strncasecmp(name, "RCODE", 5) != 0 ||
+		!isdigit((unsigned char)name[5]))
+		return -1;
+	rcode = strtol(name + 5, &end, 10);
+	if (*end != '\0' || rcode < 0 || rcode > 15)
+		return -1;
+	return (int) rcode;
+}
+
 uint16_t
 rrclass_from_string(const char *name)
 {
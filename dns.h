@@ -282,6 +282,13 @@ uint16_t rrtype_from_string(const char *name);
 const char *rrclass_to_string(uint16_t rrclass);
 uint16_t rrclass_from_string(const char *name);
 
+/*
+ * The header RCODE by name, NOERROR, SERVFAIL, .. or RCODEnn.
+ * Return -1 if no rcode matches.
+ */
+const char *rcode_to_string(uint8_t rcode);
+int rcode_from_string(const char *name);
+
 #ifdef __cplusplus
 inline rr_section_type
 operator++(rr_section_type &lhs)
@@ -32,46 +32,148 @@
 #include "buffer.h"
 #include "namedb.h"
 #include "options.h"
+#include "query.h"
+#include "dname.h"
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+#endif /* HAVE_MMAP */
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+/* the length value of a message that skips to the start of the ring */
+#define DT_RING_PAD 0xffffffff
+/* round the message length up to the alignment in the ring */
+#define DT_RING_ALIGN(x) (((x)+7)&~((uint32_t)7))
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define dt_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define dt_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define dt_exchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define dt_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define dt_load_acquire(p) dt_sync_load(p)
+#define dt_store_release(p, v) do { __sync_synchronize(); \
+		*(volatile uint32_t*)(p) = (v); } while(0)
+#define dt_exchange(p, v) __sync_lock_test_and_set((p), (v))
+#define dt_fence() __sync_synchronize()
+static uint32_t dt_sync_load(uint32_t* p)
+{
+	uint32_t v = *(volatile uint32_t*)p;
+	__sync_synchronize();
+	return v;
+}
+#endif /* HAVE_ATOMIC_BUILTINS */
+
+/* the ring of this worker, that it claimed when it started, or NULL */
+static struct dt_collector_ring* dt_ring = NULL;
+/* in the worker, the queries since the last sampled query */
+static int dt_sample_count = 0;
+/* in the worker, if the current query passed the filter so far, and the
+ * copy of the query that waits for the response filter */
+static int dt_query_logged = 0;
+static int dt_query_kept = 0;
+static struct buffer dt_query_copy;
+static uint8_t dt_query_data[MAX_PACKET_SIZE];
+
+/* create the lock file of the rings, it is unlinked, the workers have
+ * it open from the fork */
+static int
+dt_lock_file_create(struct nsd* nsd)
+{
+	char buf[1024];
+	int fd;
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("nsd-dnstap-rings", MFD_CLOEXEC);
+	if(fd != -1)
+		return fd;
+#endif
+	snprintf(buf, sizeof(buf), "%snsd-dnstap.XXXXXX",
+		nsd->options->xfrdir);
+	fd = mkstemp(buf);
+	if(fd == -1) {
+		error("dnstap_collector: cannot create %s: %s", buf,
+			strerror(errno));
+	}
+	unlink(buf);
+	return fd;
+}
 
 struct dt_collector* dt_collector_create(struct nsd* nsd)
 {
-	int i, sv[2];
+	int sv[2];
+	struct dnstap_zone_option* z;
 	struct dt_collector* dt_col = (struct dt_collector*)xalloc_zero(
 		sizeof(*dt_col));
 	dt_col->count = nsd->child_count;
 	dt_col->dt_env = NULL;
-	dt_col->region = region_create(xalloc, free);
-	dt_col->send_buffer = buffer_create(dt_col->region,
-		/* msglen + is_response + addrlen + is_tcp + packetlen + packet + zonelen + zone + spare + addr */
-		4+1+4+1+4+TCP_MAX_MESSAGE_LEN+4+MAXHOSTNAMELEN + 32 +
-#ifdef INET6
-		sizeof(struct sockaddr_storage)
+
+	/* the zones of the filter, as domain names */
+	for(z = nsd->options->dnstap_filter_zones; z; z = z->next)
+		dt_col->num_filter_zones++;
+	if(dt_col->num_filter_zones > 0) {
+		int i = 0;
+		dt_col->filter_zones = (const struct dname**)region_alloc_array(
+			nsd->options->region, dt_col->num_filter_zones,
+			sizeof(*dt_col->filter_zones));
+		for(z = nsd->options->dnstap_filter_zones; z; z = z->next) {
+			dt_col->filter_zones[i] = dname_parse(
+				nsd->options->region, z->name);
+			if(!dt_col->filter_zones[i])
+				error("dnstap-filter-zone: cannot parse %s",
+					z->name);
+			i++;
+		}
+	}
+#ifndef RATELIMIT
+	if(nsd->options->dnstap_filter_rrl)
+		log_msg(LOG_WARNING, "dnstap-filter-rrl: yes but nsd is built "
+			"without ratelimit, no queries are logged");
+#endif
+	dt_col->filter_response = (dt_col->num_filter_zones > 0 ||
+		nsd->options->dnstap_filter_qtypes ||
+		nsd->options->dnstap_filter_rcodes ||
+		nsd->options->dnstap_filter_rrl ||
+		nsd->options->dnstap_filter_tc);
+
+	/* the ring buffers, in shared memory for the worker processes,
+	 * the pages are zero and only used pages are touched */
+	dt_col->ring_count = 2*dt_col->count;
+#ifdef HAVE_MMAP
+	dt_col->rings = (struct dt_collector_ring*)mmap(NULL,
+		sizeof(struct dt_collector_ring)*dt_col->ring_count,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(dt_col->rings == MAP_FAILED) {
+		error("dnstap_collector: cannot mmap ring buffers: %s",
+			strerror(errno));
+	}
 #else
-		sizeof(struct sockaddr_in)
+	error("dnstap_collector: needs mmap for the ring buffers");
 #endif
-		);
-
-	/* open pipes in struct nsd */
-	nsd->dt_collector_fd_send = (int*)xalloc_array_zero(dt_col->count,
-		sizeof(int));
-	nsd->dt_collector_fd_recv = (int*)xalloc_array_zero(dt_col->count,
-		sizeof(int));
-	for(i=0; i<dt_col->count; i++) {
-		int fd[2];
-		fd[0] = -1;
-		fd[1] = -1;
-		if(pipe(fd) < 0) {
-			error("dnstap_collector: cannot create pipe: %s",
-				strerror(errno));
-		}
-		if(fcntl(fd[0], F_SETFL, O_NONBLOCK) == -1) {
-			log_msg(LOG_ERR, "fcntl failed: %s", strerror(errno));
-		}
-		if(fcntl(fd[1], F_SETFL, O_NONBLOCK) == -1) {
-			log_msg(LOG_ERR, "fcntl failed: %s", strerror(errno));
-		}
-		nsd->dt_collector_fd_recv[i] = fd[0];
-		nsd->dt_collector_fd_send[i] = fd[1];
+	dt_col->lock_fd = dt_lock_file_create(nsd);
+
+	/* the wakeup fd for the collector */
+#ifdef HAVE_SYS_EVENTFD_H
+	dt_col->wake_fd[0] = eventfd(0, 0);
+	if(dt_col->wake_fd[0] == -1) {
+		error("dnstap_collector: cannot create eventfd: %s",
+			strerror(errno));
+	}
+	dt_col->wake_fd[1] = dt_col->wake_fd[0];
+#else
+	if(pipe(dt_col->wake_fd) < 0) {
+		error("dnstap_collector: cannot create pipe: %s",
+			strerror(errno));
+	}
+	if(fcntl(dt_col->wake_fd[1], F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "fcntl failed: %s", strerror(errno));
+	}
+#endif /* HAVE_SYS_EVENTFD_H */
+	if(fcntl(dt_col->wake_fd[0], F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "fcntl failed: %s", strerror(errno));
 	}
 
 	/* open socketpair */
@@ -91,20 +193,25 @@ struct dt_collector* dt_collector_create(struct nsd* nsd)
 	return dt_col;
 }
 
-void dt_collector_destroy(struct dt_collector* dt_col, struct nsd* nsd)
+void dt_collector_destroy(struct dt_collector* dt_col,
+	struct nsd* ATTR_UNUSED(nsd))
 {
 	if(!dt_col) return;
-	free(nsd->dt_collector_fd_recv);
-	nsd->dt_collector_fd_recv = NULL;
-	free(nsd->dt_collector_fd_send);
-	nsd->dt_collector_fd_send = NULL;
-	region_destroy(dt_col->region);
+#ifdef HAVE_MMAP
+	if(dt_col->rings)
+		munmap(dt_col->rings,
+			sizeof(struct dt_collector_ring)*dt_col->ring_count);
+#endif
+	/* closes the locks of this process on the rings */
+	if(dt_col->lock_fd != -1)
+		close(dt_col->lock_fd);
+	dt_ring = NULL;
 	free(dt_col);
 }
 
-void dt_collector_close(struct dt_collector* dt_col, struct nsd* nsd)
+void dt_collector_close(struct dt_collector* dt_col,
+	struct nsd* ATTR_UNUSED(nsd))
 {
-	int i;
 	if(!dt_col) return;
 	if(dt_col->cmd_socket_dt != -1) {
 		close(dt_col->cmd_socket_dt);
@@ -114,16 +221,66 @@ void dt_collector_close(struct dt_collector* dt_col, struct nsd* nsd)
 		close(dt_col->cmd_socket_nsd);
 		dt_col->cmd_socket_nsd = -1;
 	}
-	for(i=0; i<dt_col->count; i++) {
-		if(nsd->dt_collector_fd_recv[i] != -1) {
-			close(nsd->dt_collector_fd_recv[i]);
-			nsd->dt_collector_fd_recv[i] = -1;
-		}
-		if(nsd->dt_collector_fd_send[i] != -1) {
-			close(nsd->dt_collector_fd_send[i]);
-			nsd->dt_collector_fd_send[i] = -1;
-		}
+	if(dt_col->wake_fd[0] != -1) {
+		close(dt_col->wake_fd[0]);
+		if(dt_col->wake_fd[1] != dt_col->wake_fd[0])
+			close(dt_col->wake_fd[1]);
+		dt_col->wake_fd[0] = -1;
+		dt_col->wake_fd[1] = -1;
+	}
+}
+
+void dt_collector_get_stats(struct dt_collector* dt_col, uint64_t* queued,
+	uint64_t* dropped)
+{
+	int i;
+	*queued = 0;
+	*dropped = 0;
+	for(i=0; i<dt_col->ring_count; i++) {
+		*queued += dt_col->rings[i].queued;
+		*dropped += dt_col->rings[i].dropped;
 	}
+	*queued -= dt_col->queued_clear;
+	*dropped -= dt_col->dropped_clear;
+}
+
+void dt_collector_get_filter_stats(struct dt_collector* dt_col,
+	uint64_t* filter)
+{
+	int i, f;
+	for(f=0; f<DT_FILTER_NUM; f++) {
+		filter[f] = 0;
+		for(i=0; i<dt_col->ring_count; i++)
+			filter[f] += dt_col->rings[i].filter[f];
+		filter[f] -= dt_col->filter_clear[f];
+	}
+}
+
+int dt_collector_filter_used(struct dt_collector* dt_col,
+	struct nsd_options* opt, int f)
+{
+	switch(f) {
+	case DT_FILTER_SAMPLE: return (opt->dnstap_sample_rate > 1);
+	case DT_FILTER_TRANSPORT: return (opt->dnstap_filter_transport != 0);
+	case DT_FILTER_ZONE: return (dt_col->num_filter_zones > 0);
+	case DT_FILTER_QTYPE: return (opt->dnstap_filter_qtypes != NULL);
+	case DT_FILTER_RCODE: return (opt->dnstap_filter_rcodes != 0);
+	case DT_FILTER_RRL: return opt->dnstap_filter_rrl;
+	case DT_FILTER_TC: return opt->dnstap_filter_tc;
+	}
+	return 0;
+}
+
+void dt_collector_clear_stats(struct dt_collector* dt_col)
+{
+	uint64_t queued, dropped, filter[DT_FILTER_NUM];
+	int f;
+	dt_collector_get_stats(dt_col, &queued, &dropped);
+	dt_col->queued_clear += queued;
+	dt_col->dropped_clear += dropped;
+	dt_collector_get_filter_stats(dt_col, filter);
+	for(f=0; f<DT_FILTER_NUM; f++)
+		dt_col->filter_clear[f] += filter[f];
 }
 
 /* handle command from nsd to dt collector.
@@ -137,53 +294,6 @@ dt_handle_cmd_from_nsd(int ATTR_UNUSED(fd), short event, void* arg)
 	}
 }
 
-/* read data from fd into buffer, true when message is complete */
-static int read_into_buffer(int fd, struct buffer* buf)
-{
-	size_t msglen;
-	ssize_t r;
-	if(buffer_position(buf) < 4) {
-		/* read the length of the message */
-		r = read(fd, buffer_current(buf), 4 - buffer_position(buf));
-		if(r == -1) {
-			if(errno == EAGAIN || errno == EINTR) {
-				/* continue to read later */
-				return 0;
-			}
-			log_msg(LOG_ERR, "dnstap collector: read failed: %s",
-				strerror(errno));
-			return 0;
-		}
-		buffer_skip(buf, r);
-		if(buffer_position(buf) < 4)
-			return 0; /* continue to read more msglen later */
-	}
-
-	/* msglen complete */
-	msglen = buffer_read_u32_at(buf, 0);
-	/* assert we have enough space, if we don't and we wanted to continue,
-	 * we would have to skip the message somehow, but that should never
-	 * happen because send_buffer and receive_buffer have the same size */
-	assert(buffer_capacity(buf) >= msglen + 4);
-	r = read(fd, buffer_current(buf), msglen - (buffer_position(buf) - 4));
-	if(r == -1) {
-		if(errno == EAGAIN || errno == EINTR) {
-			/* continue to read later */
-			return 0;
-		}
-		log_msg(LOG_ERR, "dnstap collector: read failed: %s",
-			strerror(errno));
-		return 0;
-	}
-	buffer_skip(buf, r);
-	if(buffer_position(buf) < 4 + msglen)
-		return 0; /* read more msg later */
-
-	/* msg complete */
-	buffer_flip(buf);
-	return 1;
-}
-
 /* submit the content of the buffer received to dnstap */
 static void
 dt_submit_content(struct dt_env* dt_env, struct buffer* buf)
@@ -235,29 +345,81 @@ dt_submit_content(struct dt_env* dt_env, struct buffer* buf)
 	}
 }
 
-/* handle input from worker for dnstap */
-void
-dt_handle_input(int fd, short event, void* arg)
+/* read the messages in the ring and submit them to dnstap */
+static void
+dt_ring_drain(struct dt_collector* dt_col, struct dt_collector_ring* ring)
 {
-	struct dt_collector_input* dt_input = (struct dt_collector_input*)arg;
-	if((event&EV_READ) != 0) {
-		/* read */
-		if(!read_into_buffer(fd, dt_input->buffer))
-			return;
-
-		/* once data is complete, write it to dnstap */
+	uint32_t tail = ring->tail;
+	uint32_t head = dt_load_acquire(&ring->head);
+	struct buffer buf;
+	while(tail != head) {
+		uint32_t off = tail & (DT_COLLECTOR_RING_SIZE-1);
+		uint32_t len = read_uint32(ring->data+off);
+		if(len == DT_RING_PAD) {
+			/* skip to the start of the ring */
+			tail += DT_COLLECTOR_RING_SIZE - off;
+			continue;
+		}
+		if(len > DT_COLLECTOR_RING_SIZE - off - 4) {
+			log_msg(LOG_ERR, "dnstap collector: bad message "
+				"length in ring, skipped");
+			tail = head;
+			break;
+		}
 		VERBOSITY(4, (LOG_INFO, "dnstap collector: received msg len %d",
-			(int)buffer_remaining(dt_input->buffer)));
-		if(dt_input->dt_collector->dt_env) {
-			dt_submit_content(dt_input->dt_collector->dt_env,
-				dt_input->buffer);
+			(int)len));
+		if(dt_col->dt_env) {
+			buffer_create_from(&buf, ring->data+off, 4+len);
+			dt_submit_content(dt_col->dt_env, &buf);
 		}
-		
-		/* clear buffer for next message */
-		buffer_clear(dt_input->buffer);
+		tail += DT_RING_ALIGN(4+len);
+		/* the space is free for the worker */
+		dt_store_release(&ring->tail, tail);
+	}
+	dt_store_release(&ring->tail, tail);
+}
+
+/* read all the rings, and wait for the wakeup when they are empty */
+static void
+dt_collector_drain(struct dt_collector* dt_col)
+{
+	int i, more = 0;
+	struct timeval tv;
+	for(i=0; i<dt_col->ring_count; i++)
+		dt_ring_drain(dt_col, &dt_col->rings[i]);
+	/* tell the workers to wake us up, and look again for messages
+	 * that were written before they saw that */
+	for(i=0; i<dt_col->ring_count; i++)
+		dt_store_release(&dt_col->rings[i].sleeping, 1);
+	dt_fence();
+	for(i=0; i<dt_col->ring_count; i++) {
+		if(dt_load_acquire(&dt_col->rings[i].head) !=
+			dt_col->rings[i].tail)
+			more = 1;
+	}
+	if(more) {
+		/* continue after the other events */
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		if(event_add(dt_col->drain_event, &tv) != 0)
+			log_msg(LOG_ERR, "dnstap collector: event_add failed");
 	}
 }
 
+/* handle wakeup from the workers for dnstap */
+void
+dt_handle_wakeup(int fd, short event, void* arg)
+{
+	struct dt_collector* dt_col = (struct dt_collector*)arg;
+	if((event&EV_READ) != 0) {
+		/* reset the eventfd counter, or empty the pipe */
+		uint64_t cnt;
+		while(read(fd, &cnt, sizeof(cnt)) > 0)
+			;
+	}
+	dt_collector_drain(dt_col);
+}
+
 /* init dnstap */
 static void dt_init_dnstap(struct dt_collector* dt_col, struct nsd* nsd)
 {
@@ -284,30 +446,24 @@ static void dt_init_dnstap(struct dt_collector* dt_col, struct nsd* nsd)
 /* cleanup dt collector process for exit */
 static void dt_collector_cleanup(struct dt_collector* dt_col, struct nsd* nsd)
 {
-	int i;
 	dt_delete(dt_col->dt_env);
 	event_del(dt_col->cmd_event);
-	for(i=0; i<dt_col->count; i++) {
-		event_del(dt_col->inputs[i].event);
-	}
+	event_del(dt_col->wake_event);
+	event_del(dt_col->drain_event);
 	dt_collector_close(dt_col, nsd);
 	event_base_free(dt_col->event_base);
 #ifdef MEMCLEAN
 	free(dt_col->cmd_event);
-	if(dt_col->inputs) {
-		for(i=0; i<dt_col->count; i++) {
-			free(dt_col->inputs[i].event);
-		}
-		free(dt_col->inputs);
-	}
+	free(dt_col->wake_event);
+	free(dt_col->drain_event);
 	dt_collector_destroy(dt_col, nsd);
 #endif
 }
 
 /* attach events to the event base to listen to the workers and cmd channel */
-static void dt_attach_events(struct dt_collector* dt_col, struct nsd* nsd)
+static void dt_attach_events(struct dt_collector* dt_col,
+	struct nsd* ATTR_UNUSED(nsd))
 {
-	int i;
 	/* create event base */
 	dt_col->event_base = nsd_child_event_base();
 	if(!dt_col->event_base) {
@@ -324,34 +480,21 @@ static void dt_attach_events(struct dt_collector* dt_col, struct nsd* nsd)
 	if(event_add(dt_col->cmd_event, NULL) != 0)
 		log_msg(LOG_ERR, "dnstap collector: event_add failed");
 	
-	/* add worker input handlers */
-	dt_col->inputs = xalloc_array_zero(dt_col->count,
-		sizeof(*dt_col->inputs));
-	for(i=0; i<dt_col->count; i++) {
-		dt_col->inputs[i].dt_collector = dt_col;
-		dt_col->inputs[i].event = (struct event*)xalloc_zero(
-			sizeof(struct event));
-		event_set(dt_col->inputs[i].event,
-			nsd->dt_collector_fd_recv[i], EV_PERSIST|EV_READ,
-			dt_handle_input, &dt_col->inputs[i]);
-		if(event_base_set(dt_col->event_base,
-			dt_col->inputs[i].event) != 0)
-			log_msg(LOG_ERR, "dnstap collector: event_base_set failed");
-		if(event_add(dt_col->inputs[i].event, NULL) != 0)
-			log_msg(LOG_ERR, "dnstap collector: event_add failed");
-		
-		dt_col->inputs[i].buffer = buffer_create(dt_col->region,
-			/* msglen + is_response + addrlen + is_tcp + packetlen + packet + zonelen + zone + spare + addr */
-			4+1+4+1+4+TCP_MAX_MESSAGE_LEN+4+MAXHOSTNAMELEN + 32 +
-#ifdef INET6
-			sizeof(struct sockaddr_storage)
-#else
-			sizeof(struct sockaddr_in)
-#endif
-		);
-		assert(buffer_capacity(dt_col->inputs[i].buffer) ==
-			buffer_capacity(dt_col->send_buffer));
-	}
+	/* add the worker wakeup handler, and the timer to continue */
+	dt_col->wake_event = (struct event*)xalloc_zero(
+		sizeof(*dt_col->wake_event));
+	event_set(dt_col->wake_event, dt_col->wake_fd[0],
+		EV_PERSIST|EV_READ, dt_handle_wakeup, dt_col);
+	if(event_base_set(dt_col->event_base, dt_col->wake_event) != 0)
+		log_msg(LOG_ERR, "dnstap collector: event_base_set failed");
+	if(event_add(dt_col->wake_event, NULL) != 0)
+		log_msg(LOG_ERR, "dnstap collector: event_add failed");
+	dt_col->drain_event = (struct event*)xalloc_zero(
+		sizeof(*dt_col->drain_event));
+	event_set(dt_col->drain_event, -1, EV_TIMEOUT, dt_handle_wakeup,
+		dt_col);
+	if(event_base_set(dt_col->event_base, dt_col->drain_event) != 0)
+		log_msg(LOG_ERR, "dnstap collector: event_base_set failed");
 }
 
 /* the dnstap collector process main routine */
@@ -361,6 +504,8 @@ static void dt_collector_run(struct dt_collector* dt_col, struct nsd* nsd)
 	VERBOSITY(1, (LOG_INFO, "dnstap collector started"));
 	dt_init_dnstap(dt_col, nsd);
 	dt_attach_events(dt_col, nsd);
+	/* messages from before the start */
+	dt_collector_drain(dt_col);
 
 	/* run */
 	if(event_base_loop(dt_col->event_base, 0) == -1) {
@@ -435,82 +580,240 @@ prep_send_data(struct buffer* buf, uint8_t is_response,
 	return 1;
 }
 
-/* attempt to write buffer to socket, if it blocks do not write it. */
-static void attempt_to_write(int s, uint8_t* data, size_t len)
-{
-	size_t total = 0;
-	ssize_t r;
-	while(total < len) {
-		r = write(s, data+total, len-total);
-		if(r == -1) {
-			if(errno == EAGAIN && total == 0) {
-				/* on first write part, check if pipe is full,
-				 * if the nonblocking fd blocks, then drop
-				 * the message */
-				return;
-			}
-			if(errno != EAGAIN && errno != EINTR) {
-				/* some sort of error, print it and drop it */
-				log_msg(LOG_ERR,
-					"dnstap collector: write failed: %s",
-					strerror(errno));
-				return;
-			}
-			/* continue and write this again */
-			/* for EINTR, we have to do this,
-			 * for EAGAIN, if the first part succeeded, we have
-			 * to continue to write the remainder of the message,
-			 * because otherwise partial messages confuse the
-			 * receiver. */
-			continue;
-		}
-		total += r;
-	}
-}
-
-void dt_collector_submit_auth_query(struct nsd* nsd,
+/* submit a message to the ring of this worker, without blocking */
+static void
+dt_ring_submit(struct nsd* nsd, uint8_t is_response,
 #ifdef INET6
 	struct sockaddr_storage* addr,
 #else
 	struct sockaddr_in* addr,
 #endif
-	socklen_t addrlen, int is_tcp, struct buffer* packet)
+	socklen_t addrlen, int is_tcp, struct buffer* packet,
+	struct zone* zone)
 {
-	if(!nsd->dt_collector) return;
-	if(!nsd->options->dnstap_log_auth_query_messages) return;
-	VERBOSITY(4, (LOG_INFO, "dnstap submit auth query"));
+	struct dt_collector* dt_col = nsd->dt_collector;
+	struct dt_collector_ring* ring = dt_ring;
+	uint32_t head, tail, off, len, need, avail;
+	struct buffer buf;
+
+	if(!ring)
+		return;
+
+	/* msglen + is_response + addrlen + is_tcp + packetlen + packet +
+	 * zonelen + zone */
+	len = 4+1+4+addrlen+1+4+buffer_remaining(packet)+4;
+	if(zone && zone->apex && domain_dname(zone->apex))
+		len += domain_dname(zone->apex)->name_size;
+	need = DT_RING_ALIGN(len);
+	head = ring->head;
+	tail = dt_load_acquire(&ring->tail);
+	off = head & (DT_COLLECTOR_RING_SIZE-1);
+	avail = DT_COLLECTOR_RING_SIZE - (head - tail);
+	if(need > DT_COLLECTOR_RING_SIZE - off) {
+		/* does not fit at the end, continue at the start */
+		if(DT_COLLECTOR_RING_SIZE - off + need > avail)
+			goto drop;
+		write_uint32(ring->data+off, DT_RING_PAD);
+		head += DT_COLLECTOR_RING_SIZE - off;
+		off = 0;
+	} else if(need > avail) {
+		goto drop;
+	}
 
-	/* marshal data into send buffer */
-	if(!prep_send_data(nsd->dt_collector->send_buffer, 0, addr, addrlen,
-		is_tcp, packet, NULL))
-		return; /* probably did not fit in buffer */
+	/* marshal data into the ring */
+	buffer_create_from(&buf, ring->data+off, len);
+	if(!prep_send_data(&buf, is_response, addr, addrlen, is_tcp, packet,
+		zone))
+		goto drop;
+	dt_store_release(&ring->head, head+need);
+	ring->queued++;
+
+	/* wake up the collector, if it waits */
+	dt_fence();
+	if(dt_load_acquire(&ring->sleeping) &&
+		dt_exchange(&ring->sleeping, 0)) {
+		uint64_t one = 1;
+		if(write(dt_col->wake_fd[1], &one, sizeof(one)) == -1 &&
+			errno != EAGAIN && errno != EINTR)
+			log_msg(LOG_ERR, "dnstap collector: wakeup failed: %s",
+				strerror(errno));
+	}
+	return;
+drop:
+	ring->dropped++;
+}
 
-	/* attempt to send data; do not block */
-	attempt_to_write(nsd->dt_collector_fd_send[nsd->this_child->child_num],
-		buffer_begin(nsd->dt_collector->send_buffer),
-		buffer_remaining(nsd->dt_collector->send_buffer));
+/* lock the ring for this process, without waiting, returns false if
+ * another process has it */
+static int
+dt_ring_lock(struct dt_collector* dt_col, int r)
+{
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (off_t)r;
+	fl.l_len = 1;
+	if(fcntl(dt_col->lock_fd, F_SETLK, &fl) == -1) {
+		if(errno != EACCES && errno != EAGAIN)
+			log_msg(LOG_ERR, "dnstap: cannot lock ring: %s",
+				strerror(errno));
+		return 0;
+	}
+	return 1;
 }
 
-void dt_collector_submit_auth_response(struct nsd* nsd,
-#ifdef INET6
-	struct sockaddr_storage* addr,
+struct dt_collector_ring*
+dt_collector_ring_claim(struct dt_collector* dt_col, int child_num)
+{
+	int r;
+	if(dt_ring_lock(dt_col, child_num))
+		return &dt_col->rings[child_num];
+	if(dt_ring_lock(dt_col, child_num+dt_col->count))
+		return &dt_col->rings[child_num+dt_col->count];
+	/* more than two workers with this child number, after reloads in
+	 * quick succession, take a ring that is free */
+	for(r=0; r<dt_col->ring_count; r++) {
+		if(dt_ring_lock(dt_col, r))
+			return &dt_col->rings[r];
+	}
+	return NULL;
+}
+
+void dt_collector_worker_start(struct nsd* nsd)
+{
+	if(!nsd->dt_collector) return;
+	dt_ring = dt_collector_ring_claim(nsd->dt_collector,
+		nsd->this_child->child_num);
+	if(!dt_ring)
+		log_msg(LOG_WARNING, "dnstap: no free ring for server %d, "
+			"its queries are not logged",
+			nsd->this_child->child_num);
+}
+
+void dt_collector_mark_zones(struct dt_collector* dt_col, struct namedb* db)
+{
+	struct zone* zone;
+	int i;
+	if(!dt_col) return;
+	for(i=0; i<dt_col->num_filter_zones; i++) {
+		zone = namedb_find_zone(db, dt_col->filter_zones[i]);
+		if(zone)
+			zone->dnstap_filter = 1;
+	}
+}
+
+/* see if the processed query and response pass the filter stages for
+ * the zone, qtype, rcode, rate limit and truncation */
+static int
+dt_filter_response(struct nsd* nsd, struct query* q, int discarded)
+{
+	struct dt_collector* dt_col = nsd->dt_collector;
+	struct dt_collector_ring* ring = dt_ring;
+	struct nsd_options* opt = nsd->options;
+
+	if(dt_col->num_filter_zones > 0) {
+		if(!q->zone || !q->zone->dnstap_filter)
+			return 0;
+		ring->filter[DT_FILTER_ZONE]++;
+	}
+	if(opt->dnstap_filter_qtypes) {
+		if(q->qtype == 0 || !(opt->dnstap_filter_qtypes[q->qtype/8] &
+			(1<<(q->qtype&7))))
+			return 0;
+		ring->filter[DT_FILTER_QTYPE]++;
+	}
+	if(opt->dnstap_filter_rcodes) {
+		if(discarded || !(opt->dnstap_filter_rcodes &
+			(1<<RCODE(q->packet))))
+			return 0;
+		ring->filter[DT_FILTER_RCODE]++;
+	}
+	if(opt->dnstap_filter_rrl) {
+#ifdef RATELIMIT
+		if(!q->rrl_limited)
+			return 0;
+		ring->filter[DT_FILTER_RRL]++;
 #else
-	struct sockaddr_in* addr,
+		return 0;
 #endif
-	socklen_t addrlen, int is_tcp, struct buffer* packet,
-	struct zone* zone)
+	}
+	if(opt->dnstap_filter_tc) {
+		if(discarded || !TC(q->packet))
+			return 0;
+		ring->filter[DT_FILTER_TC]++;
+	}
+	return 1;
+}
+
+void dt_collector_submit_auth_query(struct nsd* nsd, struct query* q)
 {
-	if(!nsd->dt_collector) return;
+	struct dt_collector* dt_col = nsd->dt_collector;
+	struct nsd_options* opt;
+	if(!dt_col) return;
+	opt = nsd->options;
+	dt_query_logged = 0;
+	dt_query_kept = 0;
+	if(!opt->dnstap_log_auth_query_messages &&
+		!opt->dnstap_log_auth_response_messages)
+		return;
+	if(!dt_ring)
+		return;
+
+	/* the filter stages that are known before processing */
+	if(opt->dnstap_sample_rate > 1) {
+		if(++dt_sample_count < opt->dnstap_sample_rate)
+			return;
+		dt_sample_count = 0;
+		dt_ring->filter[DT_FILTER_SAMPLE]++;
+	}
+	if(opt->dnstap_filter_transport) {
+		if(opt->dnstap_filter_transport != (q->tcp?2:1))
+			return;
+		dt_ring->filter[DT_FILTER_TRANSPORT]++;
+	}
+	dt_query_logged = 1;
+	if(!opt->dnstap_log_auth_query_messages)
+		return;
+	if(dt_col->filter_response) {
+		/* keep the query until the response is known */
+		buffer_create_from(&dt_query_copy, dt_query_data,
+			sizeof(dt_query_data));
+		if(buffer_remaining(q->packet) > sizeof(dt_query_data))
+			return;
+		buffer_write(&dt_query_copy, buffer_begin(q->packet),
+			buffer_remaining(q->packet));
+		buffer_flip(&dt_query_copy);
+		dt_query_kept = 1;
+		return;
+	}
+	VERBOSITY(4, (LOG_INFO, "dnstap submit auth query"));
+
+	dt_ring_submit(nsd, 0, &q->addr, q->addrlen, q->tcp, q->packet, NULL);
+}
+
+void dt_collector_submit_auth_response(struct nsd* nsd, struct query* q,
+	int discarded)
+{
+	struct dt_collector* dt_col = nsd->dt_collector;
+	if(!dt_col || !dt_query_logged) return;
+	dt_query_logged = 0;
+	if(dt_col->filter_response) {
+		if(!dt_filter_response(nsd, q, discarded)) {
+			dt_query_kept = 0;
+			return;
+		}
+		if(dt_query_kept) {
+			VERBOSITY(4, (LOG_INFO, "dnstap submit auth query"));
+			dt_ring_submit(nsd, 0, &q->addr, q->addrlen, q->tcp,
+				&dt_query_copy, NULL);
+			dt_query_kept = 0;
+		}
+	}
+	if(discarded) return;
 	if(!nsd->options->dnstap_log_auth_response_messages) return;
 	VERBOSITY(4, (LOG_INFO, "dnstap submit auth response"));
 
-	/* marshal data into send buffer */
-	if(!prep_send_data(nsd->dt_collector->send_buffer, 1, addr, addrlen,
-		is_tcp, packet, zone))
-		return; /* probably did not fit in buffer */
-
-	/* attempt to send data; do not block */
-	attempt_to_write(nsd->dt_collector_fd_send[nsd->this_child->child_num],
-		buffer_begin(nsd->dt_collector->send_buffer),
-		buffer_remaining(nsd->dt_collector->send_buffer));
+	dt_ring_submit(nsd, 1, &q->addr, q->addrlen, q->tcp, q->packet,
+		q->zone);
 }
@@ -13,10 +13,52 @@ struct dt_env;
 struct nsd;
 struct event_base;
 struct event;
-struct dt_collector_input;
 struct zone;
 struct buffer;
-struct region;
+struct query;
+struct nsd_options;
+struct dname;
+struct namedb;
+
+/* size of the ring buffer per worker, a power of two */
+#define DT_COLLECTOR_RING_SIZE (4*1024*1024)
+/* cache line size, the worker and collector parts of a ring are apart */
+#define DT_COLLECTOR_LINE 64
+
+/* the stages of the dnstap filter in the worker, the number of query and
+ * response exchanges that pass a stage is counted */
+#define DT_FILTER_SAMPLE 0
+#define DT_FILTER_TRANSPORT 1
+#define DT_FILTER_ZONE 2
+#define DT_FILTER_QTYPE 3
+#define DT_FILTER_RCODE 4
+#define DT_FILTER_RRL 5
+#define DT_FILTER_TC 6
+#define DT_FILTER_NUM 7
+
+/* ring buffer in shared memory that a worker writes the messages for
+ * dnstap to, and the collector reads them from.  Single producer, single
+ * consumer.  Messages are the length (u32) and the content, aligned to 8,
+ * with a length of DT_RING_PAD to skip to the start of the ring.  The
+ * worker that writes to the ring holds the lock of the ring in the lock
+ * file, from its start until it exits. */
+struct dt_collector_ring {
+	/* written by the worker: position after the last message */
+	uint32_t head;
+	/* number of messages queued, and dropped because the ring is full */
+	uint64_t queued;
+	uint64_t dropped;
+	/* number of exchanges that passed the filter stages */
+	uint64_t filter[DT_FILTER_NUM];
+	uint8_t pad_worker[DT_COLLECTOR_LINE];
+	/* written by the collector: position of the next message to read */
+	uint32_t tail;
+	/* set when the collector waits for the wakeup fd */
+	uint32_t sleeping;
+	uint8_t pad_collector[DT_COLLECTOR_LINE];
+	/* the messages */
+	uint8_t data[DT_COLLECTOR_RING_SIZE];
+};
 
 /* information for the dnstap collector process. It collects information
  * for dnstap from the worker processes.  And writes them to the dnstap
@@ -37,22 +79,31 @@ struct dt_collector {
 	struct event_base* event_base;
 	/* in the collector process, the cmd handle event */
 	struct event* cmd_event;
-	/* in the collector process, array size count of input per worker */
-	struct dt_collector_input* inputs;
-	/* region for buffers */
-	struct region* region;
-	/* buffer for sending data to the collector */
-	struct buffer* send_buffer;
-};
-
-/* information per worker to get input from that worker. */
-struct dt_collector_input {
-	/* the collector this is part of (for use in callbacks) */
-	struct dt_collector* dt_collector;
-	/* the event to listen to the datagrams to process for that worker*/
-	struct event* event;
-	/* buffer to store the datagrams while they are read in */
-	struct buffer* buffer;
+	/* ring buffers in shared memory, array size ring_count, two per
+	 * worker, so that after a reload the new worker has a ring while the
+	 * previous worker still serves tcp on its ring */
+	struct dt_collector_ring* rings;
+	int ring_count;
+	/* the file with a lock per ring, a worker claims a ring with a
+	 * fcntl lock on the byte at the ring number, and the lock is
+	 * released when the worker exits */
+	int lock_fd;
+	/* fd that wakes up the collector, an eventfd, or a pipe where
+	 * the workers write to wake_fd[1] and the collector reads wake_fd[0] */
+	int wake_fd[2];
+	/* in the collector process, the event for the wakeup fd, and the
+	 * timer to continue reading when the rings are not empty */
+	struct event* wake_event;
+	struct event* drain_event;
+	/* the queued and dropped numbers at the last clear of statistics */
+	uint64_t queued_clear, dropped_clear;
+	uint64_t filter_clear[DT_FILTER_NUM];
+	/* the zones of the zone filter, or NULL for all zones */
+	const struct dname** filter_zones;
+	int num_filter_zones;
+	/* if the query is checked against the filter after the response,
+	 * for the zone, qtype, rcode, rrl and tc filters */
+	int filter_response;
 };
 
 /* create dt_collector process structure and dt_env */
@@ -64,29 +115,51 @@ void dt_collector_close(struct dt_collector* dt_col, struct nsd* nsd);
 /* start the collector process */
 void dt_collector_start(struct dt_collector* dt_col, struct nsd* nsd);
 
-/* submit auth query from worker.  It attempts to send it to the collector,
- * if the nonblocking fails, then it silently skips it.  So it does not block
- * on the log.
+/* get the number of messages queued in the rings by the workers, and
+ * dropped because a ring was full, since the last clear */
+void dt_collector_get_stats(struct dt_collector* dt_col, uint64_t* queued,
+	uint64_t* dropped);
+/* get the number of exchanges that passed the filter stages, since the
+ * last clear, array of DT_FILTER_NUM */
+void dt_collector_get_filter_stats(struct dt_collector* dt_col,
+	uint64_t* filter);
+/* see if the filter stage is configured */
+int dt_collector_filter_used(struct dt_collector* dt_col,
+	struct nsd_options* opt, int f);
+/* clear the statistics */
+void dt_collector_clear_stats(struct dt_collector* dt_col);
+
+/* mark the zones that are selected by the dnstap zone filter.  Called
+ * before the servers are forked, so that the workers do not write to the
+ * zone data that is shared with the other processes */
+void dt_collector_mark_zones(struct dt_collector* dt_col, struct namedb* db);
+
+/* the worker claims a ring for its messages.  Called when the worker
+ * starts, after the fork, a previous worker with the same child number
+ * that still serves tcp after a reload keeps its own ring */
+void dt_collector_worker_start(struct nsd* nsd);
+
+/* claim a free ring for this process, the ring of the child number, the
+ * other ring of the child number, or else any free ring.  Returns NULL if
+ * all the rings are in use.  The ring is the process's until it exits. */
+struct dt_collector_ring* dt_collector_ring_claim(struct dt_collector* dt_col,
+	int child_num);
+
+/* submit auth query from worker, before it is processed.  The sample rate
+ * and transport filter are applied.  If the other filters are used, the
+ * query is kept until the response is submitted.  It copies it into the
+ * ring buffer of the worker, if the ring is full, it is dropped and
+ * counted.  So it does not block on the log.
  */
-void dt_collector_submit_auth_query(struct nsd* nsd,
-#ifdef INET6
-	struct sockaddr_storage* addr,
-#else
-	struct sockaddr_in* addr,
-#endif
-	socklen_t addrlen, int is_tcp, struct buffer* packet);
+void dt_collector_submit_auth_query(struct nsd* nsd, struct query* q);
 
-/* submit auth response from worker.  It attempts to send it to the collector,
- * if the nonblocking fails, then it silently skips it.  So it does not block
+/* submit auth response from worker, after the query is processed.  With
+ * discarded the query was dropped and there is no response, but the kept
+ * query may be logged.  It copies it into the ring buffer of the worker,
+ * if the ring is full, it is dropped and counted.  So it does not block
  * on the log.
  */
-void dt_collector_submit_auth_response(struct nsd* nsd,
-#ifdef INET6
-	struct sockaddr_storage* addr,
-#else
-	struct sockaddr_in* addr,
-#endif
-	socklen_t addrlen, int is_tcp, struct buffer* packet,
-	struct zone* zone);
+void dt_collector_submit_auth_response(struct nsd* nsd, struct query* q,
+	int discarded);
 
 #endif /* DNSTAP_COLLECTOR_H */
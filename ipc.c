@@ -21,6 +21,7 @@
 #include "xfrd-notify.h"
 #include "difffile.h"
 #include "rrl.h"
+#include "cow-audit.h"
 
 /* attempt to send NSD_STATS command to child fd */
 static void send_stat_to_child(struct main_ipc_handler_data* data, int fd);
@@ -38,6 +39,7 @@ ipc_child_quit(struct nsd* nsd)
 	/* call shutdown and quit routines */
 	nsd->mode = NSD_QUIT;
 	service_remaining_tcp(nsd);
+	cow_audit_stop(nsd);
 #ifdef	BIND8_STATS
 	bind8_stats(nsd);
 #endif /* BIND8_STATS */
@@ -102,6 +104,7 @@ child_handle_parent_command(int fd, short event, void* arg)
 		if(!write_socket(fd, &mode, sizeof(mode))) {
 			log_msg(LOG_ERR, "cannot write quitwst to parent");
 		}
+		data->nsd->st.db_cow = cow_audit_bytes();
 		if(!write_socket(fd, &data->nsd->st, sizeof(data->nsd->st))) {
 			log_msg(LOG_ERR, "cannot write stats to parent");
 		}
@@ -284,9 +287,20 @@ stats_add(struct nsdst* total, struct nsdst* s)
 	total->ednserr += s->ednserr;
 	total->raxfr += s->raxfr;
 	total->nona += s->nona;
+	total->db_cow += s->db_cow;
+	for(i=0; i<sizeof(total->latency)/sizeof(stc_type); i++)
+		(&total->latency[0][0][0][0])[i] +=
+			(&s->latency[0][0][0][0])[i];
 
 	total->db_disk = s->db_disk;
 	total->db_mem = s->db_mem;
+	total->db_free = s->db_free;
+	memcpy(total->db_free_chunks, s->db_free_chunks,
+		sizeof(total->db_free_chunks));
+	total->db_slab = s->db_slab;
+	total->db_slab_used = s->db_slab_used;
+	total->db_slab_released = s->db_slab_released;
+	memcpy(total->db_numa, s->db_numa, sizeof(total->db_numa));
 }
 
 /** subtract stats from total */
@@ -317,6 +331,91 @@ stats_subtract(struct nsdst* total, struct nsdst* s)
 	total->ednserr -= s->ednserr;
 	total->raxfr -= s->raxfr;
 	total->nona -= s->nona;
+	total->db_cow -= s->db_cow;
+	for(i=0; i<sizeof(total->latency)/sizeof(stc_type); i++)
+		(&total->latency[0][0][0][0])[i] -=
+			(&s->latency[0][0][0][0])[i];
+}
+
+/** add compact zone stats to total */
+void
+zonestat_add(struct nsdst* total, struct nsdzst* z)
+{
+	static const int qtypes[ZST_QTYPES] = {TYPE_A, TYPE_NS, TYPE_SOA,
+		TYPE_MX, TYPE_TXT, TYPE_AAAA};
+	static const int rcodes[ZST_RCODES] = {RCODE_OK, RCODE_SERVFAIL,
+		RCODE_NXDOMAIN, RCODE_REFUSE};
+	unsigned i;
+	for(i=0; i<ZST_QTYPES; i++)
+		total->qtype[qtypes[i]] += z->qtype[i];
+	for(i=0; i<ZST_RCODES; i++)
+		total->rcode[rcodes[i]] += z->rcode[i];
+	total->qclass[CLASS_IN] += z->qclass_in;
+	total->opcode[OPCODE_QUERY] += z->opcode_query;
+	for(i=0; i<ZST_OVERFLOW; i++) {
+		unsigned idx = ZST_KEY_INDEX(z->key[i]);
+		switch(ZST_KEY_KIND(z->key[i])) {
+		case ZST_QTYPE:
+			if(idx <= LASTELEM(total->qtype))
+				total->qtype[idx] += z->count[i];
+			break;
+		case ZST_QCLASS:
+			if(idx <= LASTELEM(total->qclass))
+				total->qclass[idx] += z->count[i];
+			break;
+		case ZST_OPCODE:
+			if(idx <= LASTELEM(total->opcode))
+				total->opcode[idx] += z->count[i];
+			break;
+		case ZST_RCODE:
+			if(idx <= LASTELEM(total->rcode))
+				total->rcode[idx] += z->count[i];
+			break;
+		default:
+			break;
+		}
+	}
+	total->qudp += z->qudp;
+	total->qudp6 += z->qudp6;
+	total->ctcp += z->ctcp;
+	total->ctcp6 += z->ctcp6;
+	total->ctls += z->ctls;
+	total->ctls6 += z->ctls6;
+	total->dropped += z->dropped;
+	total->truncated += z->truncated;
+	total->edns += z->edns;
+	total->ednserr += z->ednserr;
+	total->raxfr += z->raxfr;
+	total->nona += z->nona;
+}
+
+/** subtract compact zone stats from total, slot by slot, the slots of
+ * both have the same key, or no key in s */
+void
+zonestat_subtract(struct nsdzst* total, struct nsdzst* s)
+{
+	unsigned i;
+	for(i=0; i<ZST_QTYPES; i++)
+		total->qtype[i] -= s->qtype[i];
+	for(i=0; i<ZST_RCODES; i++)
+		total->rcode[i] -= s->rcode[i];
+	total->qclass_in -= s->qclass_in;
+	total->opcode_query -= s->opcode_query;
+	total->qudp -= s->qudp;
+	total->qudp6 -= s->qudp6;
+	total->ctcp -= s->ctcp;
+	total->ctcp6 -= s->ctcp6;
+	total->ctls -= s->ctls;
+	total->ctls6 -= s->ctls6;
+	total->dropped -= s->dropped;
+	total->truncated -= s->truncated;
+	total->edns -= s->edns;
+	total->ednserr -= s->ednserr;
+	total->raxfr -= s->raxfr;
+	total->nona -= s->nona;
+	total->overflowed -= s->overflowed;
+	for(i=0; i<ZST_OVERFLOW; i++)
+		total->count[i] -= s->count[i];
 }
 
 #define FINAL_STATS_TIMEOUT 10 /* seconds */
@@ -589,6 +688,7 @@ xfrd_send_reload_req(xfrd_state_type* xfrd)
 	assert(udb_base_get_userdata(xfrd->nsd->task[xfrd->nsd->mytask])->data == 0);
 
 	xfrd_prepare_zones_for_reload();
+	xfrd_reload_sent();
 	xfrd->reload_cmd_last_sent = xfrd_time();
 	xfrd->need_to_send_reload = 0;
 	xfrd->can_send_reload = 0;
@@ -765,6 +865,7 @@ xfrd_handle_ipc_read(struct event* handler, xfrd_state_type* xfrd)
 			sizeof(pid_t), -1) != sizeof(pid_t)) {
 			log_msg(LOG_ERR, "xfrd cannot get reload_pid");
 		}
+		xfrd_reload_done();
 		/* read the not-mytask for the results and soainfo */
 		xfrd_process_task_result(xfrd,
 			xfrd->nsd->task[1-xfrd->nsd->mytask]);
@@ -17,6 +17,7 @@ struct nsd_child;
 struct xfrd_tcp;
 struct xfrd_state;
 struct nsdst;
+struct nsdzst;
 struct event;
 
 /*
@@ -91,6 +92,10 @@ void parent_check_all_children_exited(struct nsd* nsd);
 void stats_add(struct nsdst* total, struct nsdst* s);
 /** subtract stats from total */
 void stats_subtract(struct nsdst* total, struct nsdst* s);
+/** add compact zone stats to total */
+void zonestat_add(struct nsdst* total, struct nsdzst* z);
+/** subtract compact zone stats from total, slot by slot */
+void zonestat_subtract(struct nsdzst* total, struct nsdzst* s);
 
 /** set event to listen to given mode, no timeout, must be added already */
 void ipc_xfrd_set_listening(struct xfrd_state* xfrd, short mode);
@@ -0,0 +1,58 @@
+/*
+ * latency.c -- log-linear latency histograms.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+
+#include "latency.h"
+
+int
+latency_bucket(uint64_t v, int sub_bits, int buckets)
+{
+	int e = sub_bits, b;
+	if(v < ((uint64_t)1<<sub_bits))
+		return (int)v;
+	/* find the highest bit that is set */
+	while((v >> (e+1)) != 0)
+		e++;
+	b = (e-sub_bits+1)*(1<<sub_bits) +
+		(int)((v >> (e-sub_bits)) & ((1<<sub_bits)-1));
+	if(b >= buckets)
+		return buckets-1;
+	return b;
+}
+
+uint64_t
+latency_bucket_start(int b, int sub_bits)
+{
+	int e;
+	if(b < (1<<sub_bits))
+		return (uint64_t)b;
+	e = b/(1<<sub_bits) - 1 + sub_bits;
+	return ((uint64_t)((1<<sub_bits) + b%(1<<sub_bits))) << (e-sub_bits);
+}
+
+uint64_t
+latency_bucket_end(int b, int sub_bits)
+{
+	return latency_bucket_start(b+1, sub_bits);
+}
+
+uint64_t
+latency_percentile(const uint64_t* hist, int buckets, int sub_bits,
+	uint64_t num, double frac)
+{
+	uint64_t want = (uint64_t)(frac * (double)num), sum = 0;
+	int i;
+	for(i=0; i<buckets; i++) {
+		sum += hist[i];
+		if(sum > want)
+			return latency_bucket_end(i, sub_bits);
+	}
+	return latency_bucket_end(buckets-1, sub_bits);
+}
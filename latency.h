@@ -0,0 +1,33 @@
+/*
+ * latency.h -- log-linear latency histograms.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*
+ * The histograms are log-linear: the values below 1<<sub_bits have a
+ * bucket each, after that every power of two is split into 1<<sub_bits
+ * buckets.  The last of the buckets also counts the larger values.
+ */
+
+/* the bucket of the value, in a histogram with the number of buckets */
+int latency_bucket(uint64_t v, int sub_bits, int buckets);
+
+/* the lowest value in the bucket */
+uint64_t latency_bucket_start(int b, int sub_bits);
+
+/* the upper end of the bucket, the start of the next bucket */
+uint64_t latency_bucket_end(int b, int sub_bits);
+
+/* the percentile, frac is a fraction of 1, of the num values in the
+ * histogram, the upper end of the bucket it is in */
+uint64_t latency_percentile(const uint64_t* hist, int buckets, int sub_bits,
+	uint64_t num, double frac);
+
+#endif /* LATENCY_H */
@@ -37,7 +37,7 @@
 /**
  * \file
  * fake libevent implementation. Less broad in functionality, and only
- * supports select(2).
+ * supports epoll(7) and select(2).
  */
 
 #include "config.h"
@@ -56,8 +56,13 @@
 #endif
 
 #include <signal.h>
+#include <unistd.h>
 #include "mini_event.h"
 #include "util.h"
+#include "region-allocator.h"
+#ifdef MINI_EVENT_EPOLL
+#include <sys/epoll.h>
+#endif
 
 /** compare events in tree, based on timevalue, ptr for uniqueness */
 int
@@ -80,6 +85,105 @@ mini_ev_cmp(const void* a, const void* b)
 	return 0;
 }
 
+/** move the timeout in the heap up to its place */
+static void
+heap_up(struct event_base* base, int i)
+{
+	struct event* ev = base->times[i];
+	while(i > 0) {
+		int parent = (i-1)/2;
+		if(mini_ev_cmp(base->times[parent], ev) <= 0)
+			break;
+		base->times[i] = base->times[parent];
+		base->times[i]->heap_idx = i;
+		i = parent;
+	}
+	base->times[i] = ev;
+	ev->heap_idx = i;
+}
+
+/** move the timeout in the heap down to its place */
+static void
+heap_down(struct event_base* base, int i)
+{
+	struct event* ev = base->times[i];
+	for(;;) {
+		int child = 2*i+1;
+		if(child >= base->numtimes)
+			break;
+		if(child+1 < base->numtimes && mini_ev_cmp(
+			base->times[child+1], base->times[child]) < 0)
+			child++;
+		if(mini_ev_cmp(ev, base->times[child]) <= 0)
+			break;
+		base->times[i] = base->times[child];
+		base->times[i]->heap_idx = i;
+		i = child;
+	}
+	base->times[i] = ev;
+	ev->heap_idx = i;
+}
+
+/** insert the timeout in the heap */
+static int
+heap_insert(struct event_base* base, struct event* ev)
+{
+	if(base->numtimes == base->captimes) {
+		int cap = base->captimes?base->captimes*2:64;
+		struct event** t = (struct event**)realloc(base->times,
+			sizeof(struct event*)*(size_t)cap);
+		if(!t)
+			return -1;
+		base->times = t;
+		base->captimes = cap;
+	}
+	base->times[base->numtimes] = ev;
+	heap_up(base, base->numtimes++);
+	return 0;
+}
+
+/** remove the timeout from the heap, if it is in it */
+static void
+heap_remove(struct event_base* base, struct event* ev)
+{
+	int i = ev->heap_idx;
+	if(i < 0 || i >= base->numtimes || base->times[i] != ev)
+		return;
+	ev->heap_idx = -1;
+	if(i == --base->numtimes)
+		return;
+	base->times[i] = base->times[base->numtimes];
+	base->times[i]->heap_idx = i;
+	heap_up(base, i);
+	heap_down(base, base->times[i]->heap_idx);
+}
+
+/** make room in the fds array for the fd */
+static int
+grow_fds(struct event_base* base, int fd)
+{
+#ifdef MINI_EVENT_EPOLL
+	int cap = base->capfd;
+	struct event** fds;
+	while(cap <= fd)
+		cap *= 2;
+	fds = (struct event**)realloc(base->fds, sizeof(struct event*)*
+		(size_t)cap);
+	if(!fds)
+		return -1;
+	memset(fds+base->capfd, 0, sizeof(struct event*)*
+		(size_t)(cap-base->capfd));
+	base->fds = fds;
+	base->capfd = cap;
+	return 0;
+#else
+	/* select is limited to the fd_set size */
+	(void)base;
+	(void)fd;
+	return -1;
+#endif
+}
+
 /** set time */
 static int
 settime(struct event_base* base)
@@ -102,6 +206,9 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 	if(!base)
 		return NULL;
 	memset(base, 0, sizeof(*base));
+#ifdef MINI_EVENT_EPOLL
+	base->epfd = -1;
+#endif
 	base->region = region_create(xalloc, free);
 	if(!base->region) {
 		free(base);
@@ -113,13 +220,20 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		event_base_free(base);
 		return NULL;
 	}
-	base->times = rbtree_create(base->region, mini_ev_cmp);
-	if(!base->times) {
+	base->capfd = MAX_FDS;
+#ifdef MINI_EVENT_EPOLL
+	base->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(base->epfd == -1) {
 		event_base_free(base);
 		return NULL;
 	}
-	base->capfd = MAX_FDS;
-#ifdef FD_SETSIZE
+	base->ready = (struct epoll_event*)calloc(MAX_EPOLL_EVENTS,
+		sizeof(struct epoll_event));
+	if(!base->ready) {
+		event_base_free(base);
+		return NULL;
+	}
+#elif defined(FD_SETSIZE)
 	if((int)FD_SETSIZE < base->capfd)
 		base->capfd = (int)FD_SETSIZE;
 #endif
@@ -134,7 +248,7 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		event_base_free(base);
 		return NULL;
 	}
-#ifndef S_SPLINT_S
+#if !defined(S_SPLINT_S) && !defined(MINI_EVENT_EPOLL)
 	FD_ZERO(&base->reads);
 	FD_ZERO(&base->writes);
 #endif
@@ -148,11 +262,15 @@ event_get_version(void)
 	return "mini-event-"PACKAGE_VERSION;
 }
 
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *
 event_get_method(void)
 {
+#ifdef MINI_EVENT_EPOLL
+	return "epoll";
+#else
 	return "select";
+#endif
 }
 
 /** call timeouts handlers, and return how long to wait for next one or -1 */
@@ -162,12 +280,15 @@ handle_timeouts(struct event_base* base, struct timeval* now,
 {
 	struct event* p;
 	int tofired = 0;
+	/* the timeouts that are added by the callbacks are for the next
+	 * round, also if they time out right away */
+	int todo = base->numtimes;
 #ifndef S_SPLINT_S
 	wait->tv_sec = (time_t)-1;
 #endif
 
-	while((rbnode_type*)(p = (struct event*)rbtree_first(base->times))
-		!=RBTREE_NULL) {
+	while(base->numtimes > 0) {
+		p = base->times[0];
 #ifndef S_SPLINT_S
 		if(p->ev_timeout.tv_sec > now->tv_sec ||
 			(p->ev_timeout.tv_sec==now->tv_sec && 
@@ -185,15 +306,68 @@ handle_timeouts(struct event_base* base, struct timeval* now,
 			return tofired;
 		}
 #endif
+		if(todo-- == 0) {
+			/* handle the rest after a look at the fds */
+			wait->tv_sec = 0;
+			wait->tv_usec = 0;
+			return tofired;
+		}
 		/* event times out, remove it */
 		tofired = 1;
-		(void)rbtree_delete(base->times, p);
+		heap_remove(base, p);
 		p->ev_flags &= ~EV_TIMEOUT;
 		(*p->ev_callback)(p->ev_fd, EV_TIMEOUT, p->ev_arg);
 	}
 	return tofired;
 }
 
+#ifdef MINI_EVENT_EPOLL
+/** call epoll_wait and callbacks for that */
+static int
+handle_select(struct event_base* base, struct timeval* wait)
+{
+	int ret, i, ms = -1;
+
+#ifndef S_SPLINT_S
+	if(wait->tv_sec != (time_t)-1) {
+		/* round up, so that the timeout has passed after the wait */
+		ms = (int)wait->tv_sec*1000 + (int)(wait->tv_usec+999)/1000;
+	}
+#endif
+	if((ret = epoll_wait(base->epfd, base->ready, MAX_EPOLL_EVENTS,
+		ms)) == -1) {
+		ret = errno;
+		if(settime(base) < 0)
+			return -1;
+		errno = ret;
+		if(ret == EAGAIN || ret == EINTR)
+			return 0;
+		return -1;
+	}
+	if(settime(base) < 0)
+		return -1;
+
+	for(i=0; i<ret; i++) {
+		int fd = base->ready[i].data.fd;
+		uint32_t e = base->ready[i].events;
+		short bits = 0;
+		struct event* ev;
+		/* the event can be deleted by an earlier callback */
+		if(fd < 0 || fd >= base->capfd || !(ev = base->fds[fd]))
+			continue;
+		if((e&(EPOLLIN|EPOLLHUP|EPOLLERR)))
+			bits |= EV_READ;
+		if((e&(EPOLLOUT|EPOLLHUP|EPOLLERR)))
+			bits |= EV_WRITE;
+		bits &= ev->ev_flags;
+		if(bits) {
+			(*ev->ev_callback)(ev->ev_fd, bits, ev->ev_arg);
+		}
+	}
+	return 0;
+}
+#else
+
 /** call select and callbacks for that */
 static int
 handle_select(struct event_base* base, struct timeval* wait)
@@ -244,6 +418,7 @@ handle_select(struct event_base* base, struct timeval* wait)
 	}
 	return 0;
 }
+#endif /* MINI_EVENT_EPOLL */
 
 /** run select once */
 int
@@ -304,7 +479,12 @@ event_base_free(struct event_base* base)
 {
 	if(!base)
 		return;
-	/* base->times is allocated in region and is freed with the region */
+#ifdef MINI_EVENT_EPOLL
+	if(base->epfd != -1)
+		close(base->epfd);
+	free(base->ready);
+#endif
+	free(base->times);
 	if(base->fds)
 		free(base->fds);
 	if(base->signals)
@@ -318,7 +498,7 @@ void
 event_set(struct event* ev, int fd, short bits, 
 	void (*cb)(int, short, void *), void* arg)
 {
-	ev->node.key = ev;
+	ev->heap_idx = -1;
 	ev->ev_fd = fd;
 	ev->ev_flags = bits;
 	ev->ev_callback = cb;
@@ -341,9 +521,31 @@ event_add(struct event* ev, struct timeval* tv)
 {
 	if(ev->added)
 		event_del(ev);
-	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		(ev->ev_flags&(EV_READ|EV_WRITE)) &&
+		grow_fds(ev->ev_base, ev->ev_fd) == -1)
 		return -1;
 	if( (ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+#ifdef MINI_EVENT_EPOLL
+		struct epoll_event e;
+		memset(&e, 0, sizeof(e));
+		e.data.fd = ev->ev_fd;
+		if(ev->ev_flags&EV_READ)
+			e.events |= EPOLLIN;
+		if(ev->ev_flags&EV_WRITE)
+			e.events |= EPOLLOUT;
+		if(ev->ev_flags&EV_ET)
+			e.events |= EPOLLET;
+		if(epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_ADD, ev->ev_fd, &e)
+			== -1) {
+			/* still registered, for a closed fd that is still
+			 * open in a child process, or an earlier event */
+			if(errno != EEXIST || epoll_ctl(ev->ev_base->epfd,
+				EPOLL_CTL_MOD, ev->ev_fd, &e) == -1)
+				return -1;
+		}
+		ev->ev_base->fds[ev->ev_fd] = ev;
+#else
 		ev->ev_base->fds[ev->ev_fd] = ev;
 		if(ev->ev_flags&EV_READ) {
 			FD_SET(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
@@ -353,6 +555,7 @@ event_add(struct event* ev, struct timeval* tv)
 		}
 		FD_SET(FD_SET_T ev->ev_fd, &ev->ev_base->content);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
+#endif /* MINI_EVENT_EPOLL */
 		if(ev->ev_fd > ev->ev_base->maxfd)
 			ev->ev_base->maxfd = ev->ev_fd;
 	}
@@ -366,7 +569,8 @@ event_add(struct event* ev, struct timeval* tv)
 			ev->ev_timeout.tv_sec++;
 		}
 #endif
-		(void)rbtree_insert(ev->ev_base->times, &ev->node);
+		if(heap_insert(ev->ev_base, ev) == -1)
+			return -1;
 	}
 	ev->added = 1;
 	return 0;
@@ -376,16 +580,27 @@ event_add(struct event* ev, struct timeval* tv)
 int
 event_del(struct event* ev)
 {
-	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		(ev->ev_flags&(EV_READ|EV_WRITE)))
 		return -1;
 	if((ev->ev_flags&EV_TIMEOUT))
-		(void)rbtree_delete(ev->ev_base->times, &ev->node);
+		heap_remove(ev->ev_base, ev);
 	if((ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+#ifdef MINI_EVENT_EPOLL
+		if(ev->ev_base->fds[ev->ev_fd] == ev) {
+			ev->ev_base->fds[ev->ev_fd] = NULL;
+			/* fails if the fd is already closed, then it is
+			 * removed from the epoll set */
+			(void)epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_DEL,
+				ev->ev_fd, NULL);
+		}
+#else
 		ev->ev_base->fds[ev->ev_fd] = NULL;
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->writes);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->content);
+#endif /* MINI_EVENT_EPOLL */
 	}
 	ev->added = 0;
 	return 0;
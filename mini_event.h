@@ -36,17 +36,19 @@
 /**
  * \file
  * This file implements part of the event(3) libevent api.
- * The back end is only select. Max number of fds is limited.
+ * The back end is epoll, if available, or else select.  With select the
+ * max number of fds is limited.
  * Max number of signals is limited, one handler per signal only.
  * And one handler per fd.
  *
- * Although limited to select() and a max (1024) open fds, it
- * is efficient:
+ * With select() and a max (1024) open fds, it is efficient:
  * o dispatch call caches fd_sets to use. 
  * o handler calling takes time ~ to the number of fds.
- * o timeouts are stored in a redblack tree, sorted, so take log(n).
- * Timeouts are only accurate to the second (no subsecond accuracy).
- * To avoid cpu hogging, fractional timeouts are rounded up to a whole second.
+ * With epoll, handler calling takes time ~ to the number of ready fds,
+ * and the fds array grows with the highest fd.  EV_ET makes the event
+ * edge triggered.
+ * o timeouts are stored in a binary heap, sorted, so take log(n), and the
+ *   first timeout is found in constant time.
  */
 
 #ifndef MINI_EVENT_H
@@ -55,6 +57,11 @@ struct region;
 
 #if defined(USE_MINI_EVENT) && !defined(USE_WINSOCK)
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define MINI_EVENT_EPOLL 1
+struct epoll_event;
+#endif
+
 #ifdef	HAVE_SYS_SELECT_H
 /* for fd_set on OpenBSD */
 #include <sys/select.h>
@@ -74,26 +81,37 @@ struct region;
 #define EV_SIGNAL	0x08
 /** event must persist */
 #define EV_PERSIST	0x10
+/** event is edge triggered, only with epoll */
+#define EV_ET		0x20
 
-/* needs our redblack tree */
-#include "rbtree.h"
-
-/** max number of file descriptors to support */
+/** max number of file descriptors to support, with select, and the
+ * initial size of the fds array with epoll */
 #define MAX_FDS 1024
 /** max number of signals to support */
 #define MAX_SIG 32
+/** max number of ready fds returned by one epoll_wait */
+#define MAX_EPOLL_EVENTS 256
 
 /** event base */
 struct event_base
 {
-	/** sorted by timeout (absolute), ptr */
-	rbtree_type* times;
+	/** heap sorted by timeout (absolute), ptr */
+	struct event** times;
+	/** number of timeouts in the heap, and capacity of the array */
+	int numtimes;
+	int captimes;
 	/** array of 0 - maxfd of ptr to event for it */
 	struct event** fds;
 	/** max fd in use */
 	int maxfd;
 	/** capacity - size of the fds array */
 	int capfd;
+#ifdef MINI_EVENT_EPOLL
+	/** the epoll fd */
+	int epfd;
+	/** the ready events returned by epoll_wait */
+	struct epoll_event* ready;
+#else
 	/* fdset for read write, for fds ready, and added */
 	fd_set 
 		/** fds for reading */
@@ -104,6 +122,7 @@ struct event_base
 		ready, 
 		/** ready plus newly added events. */
 		content;
+#endif /* MINI_EVENT_EPOLL */
 	/** array of 0 - maxsig of ptr to event for it */
 	struct event** signals;
 	/** if we need to exit */
@@ -120,8 +139,8 @@ struct event_base
  * Event structure. Has some of the event elements.
  */
 struct event {
-	/** node in timeout rbtree */
-	rbnode_type node;
+	/** index in the timeout heap, -1 if not in the heap */
+	int heap_idx;
 	/** is event already added */
 	int added;
 
@@ -145,7 +164,7 @@ struct event {
 void *event_init(time_t* time_secs, struct timeval* time_tv);
 /** get version */
 const char *event_get_version(void);
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *event_get_method(void);
 /** run select in a loop */
 int event_base_dispatch(struct event_base *);
@@ -10,15 +10,161 @@
 #include "config.h"
 
 #include <sys/types.h>
+#ifdef USE_COMPACT_DOMAINS
+#include <sys/mman.h>
+#endif
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "namedb.h"
 #include "nsec3.h"
+#include "util.h"
+
+#ifdef USE_COMPACT_DOMAINS
+#include "nsd.h"
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define	MAP_ANONYMOUS	MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+/* max number of domains in the arena, that much memory is reserved */
+#define DOMAIN_ARENA_MAX ((size_t)1<<28)
+/* the arena is made accessible in steps of this many bytes */
+#define DOMAIN_ARENA_STEP (4*1024*1024)
+
+char* domain_arena_base = NULL;
+/* bytes reserved, and bytes accessible */
+static size_t domain_arena_reserved = 0;
+static size_t domain_arena_size = 0;
+/* the first slot that has not been used, and domains in use */
+static size_t domain_arena_top = 0;
+static size_t domain_arena_count = 0;
+/* slots of deleted domains, linked by numlist_next */
+static domain_ref_type domain_arena_freelist = 0;
+/* bytes at the start with the temporary domains */
+static size_t domain_arena_temp_bytes = 0;
+
+static void
+domain_arena_grow(void)
+{
+	if(domain_arena_size + DOMAIN_ARENA_STEP > domain_arena_reserved) {
+		log_msg(LOG_ERR, "domain arena full, with %u domains",
+			(unsigned)domain_arena_count);
+		exit(1);
+	}
+	if(mprotect(domain_arena_base + domain_arena_size, DOMAIN_ARENA_STEP,
+		PROT_READ | PROT_WRITE) == -1) {
+		log_msg(LOG_ERR, "domain arena mprotect failed: %s",
+			strerror(errno));
+		exit(1);
+	}
+	domain_arena_size += DOMAIN_ARENA_STEP;
+}
+
+static void
+domain_arena_init(void)
+{
+	size_t max = DOMAIN_ARENA_MAX * sizeof(domain_type);
+	void* p;
+	/* reserve the address space, it takes no memory until it is made
+	 * accessible.  Less if the system does not allow that much. */
+	while((p = mmap(NULL, max, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS |
+		MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+		if(max <= 16*DOMAIN_ARENA_STEP) {
+			log_msg(LOG_ERR, "could not reserve domain arena: %s",
+				strerror(errno));
+			exit(1);
+		}
+		max /= 2;
+	}
+	domain_arena_base = (char*)p;
+	domain_arena_reserved = max - max%DOMAIN_ARENA_STEP;
+	/* slot 0 is NULL, then the temporary domains.  The queries of a
+	 * server write to them, they are on pages of their own, so that
+	 * the pages with the domains of the zones stay shared with the
+	 * other processes */
+	domain_arena_temp_bytes = (1 + EXTRA_DOMAIN_NUMBERS) *
+		sizeof(domain_type);
+	domain_arena_temp_bytes += getpagesize() - 1;
+	domain_arena_temp_bytes -= domain_arena_temp_bytes % getpagesize();
+	domain_arena_top = (domain_arena_temp_bytes + sizeof(domain_type) - 1)
+		/ sizeof(domain_type);
+	while(domain_arena_top*sizeof(domain_type) > domain_arena_size)
+		domain_arena_grow();
+}
+
+domain_type*
+domain_arena_alloc(void)
+{
+	domain_type* domain;
+	if(!domain_arena_base)
+		domain_arena_init();
+	if(domain_arena_freelist) {
+		domain = domain_from_ref(domain_arena_freelist);
+		domain_arena_freelist = domain->numlist_next;
+	} else {
+		while((domain_arena_top+1)*sizeof(domain_type) >
+			domain_arena_size)
+			domain_arena_grow();
+		domain = domain_from_ref((domain_ref_type)domain_arena_top++);
+	}
+	domain_arena_count++;
+	return domain;
+}
+
+void
+domain_arena_free(domain_type* domain)
+{
+	domain->numlist_next = domain_arena_freelist;
+	domain_arena_freelist = domain_to_ref(domain);
+	domain_arena_count--;
+}
+
+domain_type*
+domain_arena_temp(size_t i)
+{
+	assert(i < EXTRA_DOMAIN_NUMBERS);
+	if(!domain_arena_base)
+		domain_arena_init();
+	return domain_from_ref((domain_ref_type)(1 + i));
+}
+
+void
+domain_arena_stats(size_t* count, size_t* mem)
+{
+	*count = domain_arena_count;
+	*mem = domain_arena_size;
+}
+
+size_t
+domain_arena_temp_size(void)
+{
+	return domain_arena_temp_bytes;
+}
+
+/* put the domains of the table back in the arena, when its region
+ * is freed */
+static void
+domain_table_arena_cleanup(void* arg)
+{
+	domain_table_type* table = (domain_table_type*)arg;
+	domain_type* domain = table->numlist_last, *prev;
+	while(domain) {
+		prev = domain_numlist_prev(domain);
+		domain_arena_free(domain);
+		domain = prev;
+	}
+	table->numlist_last = NULL;
+}
+#endif /* USE_COMPACT_DOMAINS */
 
 static domain_type *
 allocate_domain_info(domain_table_type* table,
@@ -31,8 +177,12 @@ allocate_domain_info(domain_table_type* table,
 	assert(dname);
 	assert(parent);
 
+#ifdef USE_COMPACT_DOMAINS
+	result = domain_arena_alloc();
+#else
 	result = (domain_type *) region_alloc(table->region,
 					      sizeof(domain_type));
+#endif
 #ifdef USE_RADIX_TREE
 	result->dname 
 #else
@@ -40,8 +190,8 @@ allocate_domain_info(domain_table_type* table,
 #endif
 		= dname_partial_copy(
 		table->region, dname, domain_dname(parent)->label_count + 1);
-	result->parent = parent;
-	result->wildcard_child_closest_match = result;
+	domain_set_parent(result, parent);
+	domain_set_wildcard_match(result, result);
 	result->rrsets = NULL;
 	result->usage = 0;
 #ifdef NSEC3
@@ -52,9 +202,9 @@ allocate_domain_info(domain_table_type* table,
 	assert(table->numlist_last); /* it exists because root exists */
 	/* push this domain at the end of the numlist */
 	result->number = table->numlist_last->number+1;
-	result->numlist_next = NULL;
-	result->numlist_prev = table->numlist_last;
-	table->numlist_last->numlist_next = result;
+	domain_set_numlist_next(result, NULL);
+	domain_set_numlist_prev(result, table->numlist_last);
+	domain_set_numlist_next(table->numlist_last, result);
 	table->numlist_last = result;
 
 	return result;
@@ -94,30 +244,32 @@ numlist_make_last(domain_table_type* table, domain_type* domain)
 	domain->number = last->number;
 	last->number = sw;
 	/* swap list position with the last element */
-	assert(domain->numlist_next);
-	assert(last->numlist_prev);
-	if(domain->numlist_next != last) {
+	assert(domain_numlist_next(domain));
+	assert(domain_numlist_prev(last));
+	if(domain_numlist_next(domain) != last) {
 		/* case 1: there are nodes between domain .. last */
-		domain_type* span_start = domain->numlist_next;
-		domain_type* span_end = last->numlist_prev;
+		domain_type* span_start = domain_numlist_next(domain);
+		domain_type* span_end = domain_numlist_prev(last);
 		/* these assignments walk the new list from start to end */
-		if(domain->numlist_prev)
-			domain->numlist_prev->numlist_next = last;
-		last->numlist_prev = domain->numlist_prev;
-		last->numlist_next = span_start;
-		span_start->numlist_prev = last;
-		span_end->numlist_next = domain;
-		domain->numlist_prev = span_end;
-		domain->numlist_next = NULL;
+		if(domain_numlist_prev(domain))
+			domain_set_numlist_next(domain_numlist_prev(domain),
+				last);
+		domain_set_numlist_prev(last, domain_numlist_prev(domain));
+		domain_set_numlist_next(last, span_start);
+		domain_set_numlist_prev(span_start, last);
+		domain_set_numlist_next(span_end, domain);
+		domain_set_numlist_prev(domain, span_end);
+		domain_set_numlist_next(domain, NULL);
 	} else {
 		/* case 2: domain and last are neighbors */
 		/* these assignments walk the new list from start to end */
-		if(domain->numlist_prev)
-			domain->numlist_prev->numlist_next = last;
-		last->numlist_prev = domain->numlist_prev;
-		last->numlist_next = domain;
-		domain->numlist_prev = last;
-		domain->numlist_next = NULL;
+		if(domain_numlist_prev(domain))
+			domain_set_numlist_next(domain_numlist_prev(domain),
+				last);
+		domain_set_numlist_prev(last, domain_numlist_prev(domain));
+		domain_set_numlist_next(last, domain);
+		domain_set_numlist_prev(domain, last);
+		domain_set_numlist_next(domain, NULL);
 	}
 	table->numlist_last = domain;
 }
@@ -127,9 +279,9 @@ static domain_type*
 numlist_pop_last(domain_table_type* table)
 {
 	domain_type* d = table->numlist_last;
-	table->numlist_last = table->numlist_last->numlist_prev;
+	table->numlist_last = domain_numlist_prev(table->numlist_last);
 	if(table->numlist_last)
-		table->numlist_last->numlist_next = NULL;
+		domain_set_numlist_next(table->numlist_last, NULL);
 	return d;
 }
 
@@ -215,7 +367,7 @@ prehash_del(domain_table_type* table, domain_type* domain)
 static void
 do_deldomain(namedb_type* db, domain_type* domain)
 {
-	assert(domain && domain->parent); /* exists and not root */
+	assert(domain && domain_parent(domain)); /* exists and not root */
 	/* first adjust the number list so that domain is the last one */
 	numlist_make_last(db->domains, domain);
 	/* pop off the domain from the number list */
@@ -260,9 +412,9 @@ do_deldomain(namedb_type* db, domain_type* domain)
 	/* see if this domain is someones wildcard-child-closest-match,
 	 * which can only be the parent, and then it should use the
 	 * one-smaller than this domain as closest-match. */
-	if(domain->parent->wildcard_child_closest_match == domain)
-		domain->parent->wildcard_child_closest_match =
-			domain_previous_existing_child(domain);
+	if(domain_wildcard_match(domain_parent(domain)) == domain)
+		domain_set_wildcard_match(domain_parent(domain),
+			domain_previous_existing_child(domain));
 
 	/* actual removal */
 #ifdef USE_RADIX_TREE
@@ -272,7 +424,11 @@ do_deldomain(namedb_type* db, domain_type* domain)
 #endif
 	region_recycle(db->domains->region, domain_dname(domain),
 		dname_total_size(domain_dname(domain)));
+#ifdef USE_COMPACT_DOMAINS
+	domain_arena_free(domain);
+#else
 	region_recycle(db->domains->region, domain, sizeof(domain_type));
+#endif
 }
 
 void
@@ -281,7 +437,7 @@ domain_table_deldomain(namedb_type* db, domain_type* domain)
 	domain_type* parent;
 
 	while(domain_can_be_deleted(domain)) {
-		parent = domain->parent;
+		parent = domain_parent(domain);
 		/* delete it */
 		do_deldomain(db, domain);
 		/* test parent */
@@ -320,22 +476,26 @@ domain_table_create(region_type* region)
 
 	origin = dname_make(region, (uint8_t *) "", 0);
 
+#ifdef USE_COMPACT_DOMAINS
+	root = domain_arena_alloc();
+#else
 	root = (domain_type *) region_alloc(region, sizeof(domain_type));
+#endif
 #ifdef USE_RADIX_TREE
 	root->dname
 #else
 	root->node.key
 #endif
 		= origin;
-	root->parent = NULL;
-	root->wildcard_child_closest_match = root;
+	domain_set_parent(root, NULL);
+	domain_set_wildcard_match(root, root);
 	root->rrsets = NULL;
 	root->number = 1; /* 0 is used for after header */
 	root->usage = 1; /* do not delete root, ever */
 	root->is_existing = 0;
 	root->is_apex = 0;
-	root->numlist_prev = NULL;
-	root->numlist_next = NULL;
+	domain_set_numlist_prev(root, NULL);
+	domain_set_numlist_next(root, NULL);
 #ifdef NSEC3
 	root->nsec3 = NULL;
 #endif
@@ -358,6 +518,9 @@ domain_table_create(region_type* region)
 #ifdef NSEC3
 	result->prehash_list = NULL;
 #endif
+#ifdef USE_COMPACT_DOMAINS
+	region_add_cleanup(region, domain_table_arena_cleanup, result);
+#endif
 
 	return result;
 }
@@ -393,7 +556,7 @@ domain_table_search(domain_table_type *table,
 			dname);
 		assert(label_match_count < dname->label_count);
 		while (label_match_count < domain_dname(*closest_encloser)->label_count) {
-			(*closest_encloser) = (*closest_encloser)->parent;
+			(*closest_encloser) = domain_parent(*closest_encloser);
 			assert(*closest_encloser);
 		}
 	}
@@ -458,10 +621,10 @@ domain_table_insert(domain_table_type* table,
 			if (label_compare(dname_name(domain_dname(result)),
 					  (const uint8_t *) "\001*") <= 0
 			    && dname_compare(domain_dname(result),
-					     domain_dname(closest_encloser->wildcard_child_closest_match)) > 0)
+					     domain_dname(domain_wildcard_match(closest_encloser))) > 0)
 			{
-				closest_encloser->wildcard_child_closest_match
-					= result;
+				domain_set_wildcard_match(closest_encloser,
+					result);
 			}
 			closest_encloser = result;
 		} while (domain_dname(closest_encloser)->label_count < dname->label_count);
@@ -472,7 +635,7 @@ domain_table_insert(domain_table_type* table,
 
 domain_type *domain_previous_existing_child(domain_type* domain)
 {
-	domain_type* parent = domain->parent;
+	domain_type* parent = domain_parent(domain);
 	domain = domain_previous(domain);
 	while(domain && !domain->is_existing) {
 		if(domain == parent) /* do not walk back above parent */
@@ -501,14 +664,14 @@ domain_add_rrset(domain_type* domain, rrset_type* rrset)
 		domain->is_existing = 1;
 		/* does this name in existance update the parent's
 		 * wildcard closest match? */
-		if(domain->parent
+		if(domain_parent(domain)
 		   && label_compare(dname_name(domain_dname(domain)),
 			(const uint8_t *) "\001*") <= 0
 		   && dname_compare(domain_dname(domain),
-		   	domain_dname(domain->parent->wildcard_child_closest_match)) > 0) {
-			domain->parent->wildcard_child_closest_match = domain;
+		   	domain_dname(domain_wildcard_match(domain_parent(domain)))) > 0) {
+			domain_set_wildcard_match(domain_parent(domain), domain);
 		}
-		domain = domain->parent;
+		domain = domain_parent(domain);
 	}
 }
 
@@ -554,7 +717,7 @@ domain_find_zone(namedb_type* db, domain_type* domain)
 			}
 			return namedb_find_zone(db, domain_dname(domain));
 		}
-		domain = domain->parent;
+		domain = domain_parent(domain);
 	}
 	return NULL;
 }
@@ -573,8 +736,8 @@ domain_find_parent_zone(namedb_type* db, zone_type* zone)
 	}
 	/* the NS record in the parent zone above this zone is not present,
 	 * workaround to find that parent zone anyway */
-	if(zone->apex->parent)
-		return domain_find_zone(db, zone->apex->parent);
+	if(domain_parent(zone->apex))
+		return domain_find_zone(db, domain_parent(zone->apex));
 	return NULL;
 }
 
@@ -585,7 +748,7 @@ domain_find_ns_rrsets(domain_type* domain, zone_type* zone, rrset_type **ns)
 		*ns = domain_find_rrset(domain, zone, TYPE_NS);
 		if (*ns)
 			return domain;
-		domain = domain->parent;
+		domain = domain_parent(domain);
 	}
 
 	*ns = NULL;
@@ -595,11 +758,11 @@ domain_find_ns_rrsets(domain_type* domain, zone_type* zone, rrset_type **ns)
 domain_type *
 find_dname_above(domain_type* domain, zone_type* zone)
 {
-	domain_type* d = domain->parent;
+	domain_type* d = domain_parent(domain);
 	while(d && d != zone->apex) {
 		if(domain_find_rrset(d, zone, TYPE_DNAME))
 			return d;
-		d = d->parent;
+		d = domain_parent(d);
 	}
 	return NULL;
 }
@@ -619,9 +782,9 @@ domain_wildcard_child(domain_type* domain)
 	domain_type* wildcard_child;
 
 	assert(domain);
-	assert(domain->wildcard_child_closest_match);
+	assert(domain_wildcard_match(domain));
 
-	wildcard_child = domain->wildcard_child_closest_match;
+	wildcard_child = domain_wildcard_match(domain);
 	if (wildcard_child != domain
 	    && label_is_wildcard(dname_name(domain_dname(wildcard_child))))
 	{
@@ -645,7 +808,18 @@ rr_rrsig_type_covered(rr_type* rr)
 	assert(rr->rdata_count > 0);
 	assert(rdata_atom_size(rr->rdatas[0]) == sizeof(uint16_t));
 
-	return ntohs(* (uint16_t *) rdata_atom_data(rr->rdatas[0]));
+	return read_uint16(rdata_atom_data(rr->rdatas[0]));
+}
+
+int
+rdata_atom_set_inline(rdata_atom_type* atom, const void* data, size_t size)
+{
+	if(size > RDATA_INLINE_MAX)
+		return 0;
+	memset(atom, 0, sizeof(*atom));
+	atom->small.tag = (uint8_t)((size << 1) | 1);
+	memcpy(atom->small.bytes, data, size);
+	return 1;
 }
 
 zone_type *
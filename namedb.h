@@ -34,6 +34,14 @@ typedef struct domain domain_type;
 typedef struct zone zone_type;
 typedef struct namedb namedb_type;
 
+#ifdef USE_COMPACT_DOMAINS
+/* a link to a domain, the index of the domain in the domain arena.
+ * 0 is NULL, the links are read and set with the accessors below. */
+typedef uint32_t domain_ref_type;
+#else
+typedef domain_type* domain_ref_type;
+#endif
+
 struct domain_table
 {
 	region_type* region;
@@ -100,14 +108,14 @@ struct domain
 #else
 	rbnode_type     node;
 #endif
-	domain_type* parent;
-	domain_type* wildcard_child_closest_match;
+	domain_ref_type parent;
+	domain_ref_type wildcard_child_closest_match;
 	rrset_type* rrsets;
 #ifdef NSEC3
 	struct nsec3_domain_data* nsec3;
 #endif
 	/* double-linked list sorted by domain.number */
-	domain_type* numlist_prev, *numlist_next;
+	domain_ref_type numlist_prev, numlist_next;
 	uint32_t     number; /* Unique domain name number.  */
 	uint32_t     usage; /* number of ptrs to this from RRs(in rdata) and
 			     from zone-apex pointers, also the root has one
@@ -144,11 +152,19 @@ struct zone
 	unsigned     is_secure : 1; /* zone uses DNSSEC */
 	unsigned     is_ok : 1; /* zone has not expired. */
 	unsigned     is_changed : 1; /* zone was changed by AXFR */
+	unsigned     dnstap_filter : 1; /* selected by the dnstap zone
+		filter, set before the servers are forked */
+	unsigned     is_cold : 1; /* lazy-zones, only the SOA and NS are
+		read, the zone is read when it is used */
+	uint32_t     lazy_id; /* index in db->lazy_used, 0 if not lazy */
+	uint32_t     lazy_mem; /* bytes of the zone, when read by lazy-zones */
+	/* list of the zones read by lazy-zones, most recently used first */
+	zone_type*   lazy_prev, *lazy_next;
 } ATTR_PACKED;
 
 /* a RR in DNS */
 struct rr {
-	domain_type*     owner;
+	domain_ref_type  owner;
 	rdata_atom_type* rdatas;
 	uint32_t         ttl;
 	uint16_t         type;
@@ -168,6 +184,9 @@ struct rrset
 	uint16_t    rr_count;
 } ATTR_PACKED;
 
+/* the largest rdata that is stored inline in the atom */
+#define RDATA_INLINE_MAX (sizeof(uint16_t*)-1)
+
 /*
  * The field used is based on the wireformat the atom is stored in.
  * The allowed wireformats are defined by the rdata_wireformat_type
@@ -180,8 +199,91 @@ union rdata_atom
 
 	/* Default. */
 	uint16_t*    data;
+
+	/* Rdata of up to RDATA_INLINE_MAX bytes, like an A record or a
+	 * preference, is stored in the atom.  The tag overlaps the low
+	 * byte of the data pointer, it has bit 0 set, that is never set
+	 * in a pointer to uint16_t, and the length in the other bits. */
+	struct {
+#ifdef WORDS_BIGENDIAN
+		uint8_t bytes[RDATA_INLINE_MAX];
+		uint8_t tag;
+#else
+		uint8_t tag;
+		uint8_t bytes[RDATA_INLINE_MAX];
+#endif
+	} small;
 };
 
+#ifdef USE_COMPACT_DOMAINS
+/*
+ * The domains are in one arena, a reserved range of memory.  The links
+ * are indexes in the arena, the pointer is the base plus the index times
+ * the size of a domain.  The arena is per process.  The first slots are
+ * for the temporary domains of queries, they are set up by the query.
+ */
+extern char* domain_arena_base;
+/* get a new domain in the arena, not initialised */
+domain_type* domain_arena_alloc(void);
+/* put the domain back in the arena */
+void domain_arena_free(domain_type* domain);
+/* get the temporary domain with number i, < EXTRA_DOMAIN_NUMBERS */
+domain_type* domain_arena_temp(size_t i);
+/* number of domains in the arena, and the bytes of memory for them */
+void domain_arena_stats(size_t* count, size_t* mem);
+/* bytes at the start of the arena, on pages of their own, with the
+ * temporary domains */
+size_t domain_arena_temp_size(void);
+
+static inline domain_type*
+domain_from_ref(domain_ref_type ref)
+{
+	return ref == 0 ? NULL :
+		(domain_type*)(domain_arena_base + (size_t)ref*sizeof(domain_type));
+}
+
+static inline domain_ref_type
+domain_to_ref(domain_type* domain)
+{
+	return domain == NULL ? 0 : (domain_ref_type)(((char*)domain -
+		domain_arena_base) / sizeof(domain_type));
+}
+
+/* the wildcard match link to the domain itself, for the temporary
+ * domains of wildcard answers that are not in the arena */
+#define DOMAIN_REF_SELF 0xffffffff
+
+static inline domain_type*
+domain_wildcard_match(domain_type* domain)
+{
+	return domain->wildcard_child_closest_match == DOMAIN_REF_SELF ?
+		domain : domain_from_ref(domain->wildcard_child_closest_match);
+}
+
+static inline void
+domain_set_wildcard_match(domain_type* domain, domain_type* match)
+{
+	domain->wildcard_child_closest_match = (match == domain ?
+		DOMAIN_REF_SELF : domain_to_ref(match));
+}
+#else
+#define domain_from_ref(ref) (ref)
+#define domain_to_ref(domain) (domain)
+#define domain_wildcard_match(d) ((d)->wildcard_child_closest_match)
+#define domain_set_wildcard_match(d, w) \
+	((d)->wildcard_child_closest_match = (w))
+#endif /* USE_COMPACT_DOMAINS */
+
+/* the links between domains, and from a RR to its owner */
+#define domain_parent(d) domain_from_ref((d)->parent)
+#define domain_set_parent(d, p) ((d)->parent = domain_to_ref(p))
+#define domain_numlist_prev(d) domain_from_ref((d)->numlist_prev)
+#define domain_set_numlist_prev(d, p) ((d)->numlist_prev = domain_to_ref(p))
+#define domain_numlist_next(d) domain_from_ref((d)->numlist_next)
+#define domain_set_numlist_next(d, n) ((d)->numlist_next = domain_to_ref(n))
+#define rr_owner(rr) domain_from_ref((rr)->owner)
+#define rr_set_owner(rr, d) ((rr)->owner = domain_to_ref(d))
+
 /*
  * Create a new domain_table containing only the root domain.
  */
@@ -329,8 +431,34 @@ struct namedb
 	/* if diff_skip=1, diff_pos contains the nsd.diff place to continue */
 	uint8_t		  diff_skip;
 	off_t		  diff_pos;
+	/* lazy-zones, a byte per lazy_id, shared with the server
+	 * processes, they mark the zones that are used.  NULL if not lazy */
+	uint8_t*	  lazy_used;
+	uint32_t	  lazy_ids;
+	/* the reload number, for the marks of the cold zones */
+	uint32_t	  lazy_gen;
+	/* the zones that are read, and their bytes */
+	zone_type*	  lazy_first, *lazy_last;
+	uint64_t	  lazy_mem;
 };
 
+/* the number of lazy zones, the lazy_used map is reserved, not allocated */
+#define LAZY_ZONE_IDS (1<<24)
+/* lazy_used, a read zone was queried since the reload */
+#define LAZY_ZONE_USED 1
+/* lazy_used, a cold zone is asked to be read, by the servers of reload gen.
+ * The gen wraps around in LAZY_ZONE_GENS, then the marks are cleared */
+#define LAZY_ZONE_GENS 250
+#define LAZY_ZONE_ASKED(gen) ((uint8_t)(2+(gen)%LAZY_ZONE_GENS))
+
+/* mark a zone read by lazy-zones as used, it is kept in memory */
+static inline void
+lazy_zone_touch(namedb_type* db, zone_type* zone)
+{
+	if(zone->lazy_id && db->lazy_used[zone->lazy_id] != LAZY_ZONE_USED)
+		db->lazy_used[zone->lazy_id] = LAZY_ZONE_USED;
+}
+
 static inline int rdata_atom_is_domain(uint16_t type, size_t index);
 static inline int rdata_atom_is_literal_domain(uint16_t type, size_t index);
 
@@ -340,18 +468,37 @@ rdata_atom_domain(rdata_atom_type atom)
 	return atom.domain;
 }
 
+static inline int
+rdata_atom_is_inline(rdata_atom_type atom)
+{
+	return (atom.small.tag & 1);
+}
+
 static inline uint16_t
 rdata_atom_size(rdata_atom_type atom)
 {
+	if(rdata_atom_is_inline(atom))
+		return atom.small.tag >> 1;
 	return *atom.data;
 }
 
 static inline uint8_t *
-rdata_atom_data(rdata_atom_type atom)
+rdata_atom_data_ptr(const rdata_atom_type* atom)
 {
-	return (uint8_t *) (atom.data + 1);
+	if(rdata_atom_is_inline(*atom))
+		return (uint8_t *) atom->small.bytes;
+	return (uint8_t *) (atom->data + 1);
 }
 
+/* the data can be inside the atom, so this takes the atom itself, an
+ * lvalue, and not a copy */
+#define rdata_atom_data(atom) rdata_atom_data_ptr(&(atom))
+
+/* store the rdata inline in the atom, returns false if it is larger
+ * than RDATA_INLINE_MAX */
+int rdata_atom_set_inline(rdata_atom_type* atom, const void* data,
+	size_t size);
+
 
 /* Find the zone for the specified dname in DB. */
 zone_type *namedb_find_zone(namedb_type *db, const dname_type *dname);
@@ -392,6 +539,12 @@ void apex_rrset_checks(struct namedb* db, rrset_type* rrset,
 zone_type* namedb_zone_create(namedb_type* db, const dname_type* dname,
         struct zone_options* zopt);
 void namedb_zone_delete(namedb_type* db, zone_type* zone);
+/** read a cold zone of lazy-zones, from the nsd.db or the zonefile */
+void namedb_zone_warm(struct nsd* nsd, zone_type* zone,
+	struct udb_base* taskudb, struct udb_ptr* last_task);
+/** after the tasks of a reload, put the least recently used zones of
+ * lazy-zones away, if they take more than lazy-zones-memory */
+void namedb_lazy_zones_update(struct nsd* nsd, struct nsd_options* opt);
 void namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt);
 void namedb_write_zonefiles(struct nsd* nsd, struct nsd_options* options);
 int create_dirs(const char* path);
@@ -0,0 +1,646 @@
+/*
+ * nsd-bench.c -- replay a query corpus through query processing.
+ *
+ * Copyright (c) 2021, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "nsd.h"
+#include "tsig.h"
+#include "options.h"
+#include "namedb.h"
+#include "query.h"
+#include "packet.h"
+#include "dname.h"
+#include "util.h"
+#include "latency.h"
+#include "bench-query.h"
+
+struct nsd nsd;
+
+/* answer types in the breakdown */
+#define BENCH_ANSWER 0
+#define BENCH_REFERRAL 1
+#define BENCH_NODATA 2
+#define BENCH_NXDOMAIN 3
+#define BENCH_OTHER 4
+#define BENCH_DROPPED 5
+#define BENCH_TYPES 6
+static const char* bench_type_str[BENCH_TYPES] = {"answer", "referral",
+	"nodata", "nxdomain", "other", "dropped"};
+
+/* log-linear histogram of nanoseconds per query, 8 buckets per power of
+ * two, that is 12% precision on the percentiles */
+#define BENCH_SUB_BITS 3
+#define BENCH_BUCKETS 256
+
+/* a query from the corpus */
+struct bench_query {
+	/* query packet in wire format */
+	uint8_t* data;
+	size_t len;
+	/* source address of the query */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+};
+
+/* the list of queries to replay */
+struct bench_corpus {
+	struct bench_query* list;
+	size_t num, capacity;
+	/* number of packets in the input that were skipped */
+	size_t skipped;
+};
+
+/* the results of one benchmark process, passed to the parent over a pipe */
+struct bench_result {
+	/* number of queries processed */
+	uint64_t num;
+	/* time spent, in nanoseconds */
+	uint64_t elapsed;
+	/* number of answers per answer type */
+	uint64_t types[BENCH_TYPES];
+	/* number of truncated answers */
+	uint64_t truncated;
+	/* number of objects and bytes allocated in the query region */
+	uint64_t allocs, alloc_bytes;
+	/* growth of the database region (temporary domains and such) */
+	uint64_t db_growth;
+	/* nanoseconds per query */
+	uint64_t hist[BENCH_BUCKETS];
+};
+
+/*
+ * Print the help text.
+ *
+ */
+static void
+usage (void)
+{
+	fprintf(stderr, "Usage: nsd-bench [-c configfile] [-p procs] "
+		"[-r rounds] [-b bufsize] corpus\n");
+	fprintf(stderr, "Replays the queries in the corpus file through the "
+		"query processing of\nNSD, with the zones from the config "
+		"loaded, and reports the speed.\nThe zones are read from the "
+		"zonefiles, nsd.db is not used.\n");
+	fprintf(stderr, "The corpus is a pcap file, or a text file with on "
+		"every line:\n\tqname [class] type [DO]\n");
+	fprintf(stderr, "A relative corpus path is relative to the zonesdir "
+		"of the config.\n");
+	fprintf(stderr, "-c file	config file, default %s\n", CONFIGFILE);
+	fprintf(stderr, "-p procs	number of processes to run, default 1\n");
+	fprintf(stderr, "-r rounds	number of times to replay the corpus, "
+		"default 1\n");
+	fprintf(stderr, "-b bufsize	answer buffer size, default 512 "
+		"(65535 for TCP)\n");
+	fprintf(stderr, "Version %s. Report bugs to <%s>.\n",
+		PACKAGE_VERSION, PACKAGE_BUGREPORT);
+}
+
+/* add a query packet to the corpus */
+static void
+corpus_add(struct bench_corpus* c, uint8_t* data, size_t len,
+	struct sockaddr_storage* addr, socklen_t addrlen)
+{
+	struct bench_query* e;
+	if(len < QHEADERSZ || len > UDP_MAX_MESSAGE_LEN) {
+		c->skipped++;
+		return;
+	}
+	if(c->num == c->capacity) {
+		c->capacity = (c->capacity == 0)?1024:c->capacity*2;
+		c->list = xrealloc(c->list, c->capacity*sizeof(*c->list));
+	}
+	e = &c->list[c->num++];
+	e->data = xalloc(len);
+	memcpy(e->data, data, len);
+	e->len = len;
+	memcpy(&e->addr, addr, addrlen);
+	e->addrlen = addrlen;
+}
+
+/* the address for queries from the text corpus */
+static socklen_t
+loopback_addr(struct sockaddr_storage* addr)
+{
+	struct sockaddr_in* sa = (struct sockaddr_in*)addr;
+	memset(addr, 0, sizeof(*addr));
+	sa->sin_family = AF_INET;
+	sa->sin_addr.s_addr = htonl(0x7f000001);
+	sa->sin_port = htons(53);
+	return (socklen_t)sizeof(*sa);
+}
+
+/* read the text format corpus */
+static void
+read_text_corpus(FILE* in, const char* fname, struct bench_corpus* c)
+{
+	char line[1024];
+	uint8_t buf[UDP_MAX_MESSAGE_LEN];
+	size_t len;
+	int lineno = 0;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = loopback_addr(&addr);
+	while(fgets(line, sizeof(line), in)) {
+		char* p = line;
+		lineno++;
+		while(*p == ' ' || *p == '\t')
+			p++;
+		if(*p == 0 || *p == '\n' || *p == '\r' || *p == '#' ||
+			*p == ';')
+			continue;
+		if(!bench_query_from_line(p, (uint16_t)lineno, 0, buf, &len)) {
+			fprintf(stderr, "%s:%d: cannot parse query, skipped\n",
+				fname, lineno);
+			c->skipped++;
+			continue;
+		}
+		corpus_add(c, buf, len, &addr, addrlen);
+	}
+}
+
+/* pcap file format constants */
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_LINK_NULL 0
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_LINK_RAW 101
+#define PCAP_LINK_LINUX_SLL 113
+
+static uint32_t
+pcap_u32(uint8_t* p, int swap)
+{
+	if(swap)
+		return ((uint32_t)p[3]<<24) | ((uint32_t)p[2]<<16) |
+			((uint32_t)p[1]<<8) | (uint32_t)p[0];
+	return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) |
+		((uint32_t)p[2]<<8) | (uint32_t)p[3];
+}
+
+/* take the DNS query out of a UDP/IP packet and add it to the corpus */
+static void
+pcap_packet(struct bench_corpus* c, uint8_t* p, size_t len, int ethertype)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	size_t iplen;
+	memset(&addr, 0, sizeof(addr));
+	if(ethertype == 0 && len > 0)
+		ethertype = ((p[0]>>4) == 6)?0x86dd:0x0800;
+	if(ethertype == 0x0800) {
+		struct sockaddr_in* sa = (struct sockaddr_in*)&addr;
+		if(len < 20 || (p[0]>>4) != 4 || p[9] != IPPROTO_UDP ||
+			(p[6]&0x3f) != 0 || p[7] != 0) {
+			/* not UDP or a fragment */
+			c->skipped++;
+			return;
+		}
+		iplen = (p[0]&0x0f)*4;
+		sa->sin_family = AF_INET;
+		memcpy(&sa->sin_addr, p+12, 4);
+		addrlen = (socklen_t)sizeof(*sa);
+#ifdef INET6
+	} else if(ethertype == 0x86dd) {
+		struct sockaddr_in6* sa = (struct sockaddr_in6*)&addr;
+		if(len < 40 || (p[0]>>4) != 6 || p[6] != IPPROTO_UDP) {
+			c->skipped++;
+			return;
+		}
+		iplen = 40;
+		sa->sin6_family = AF_INET6;
+		memcpy(&sa->sin6_addr, p+8, 16);
+		addrlen = (socklen_t)sizeof(*sa);
+#endif
+	} else {
+		c->skipped++;
+		return;
+	}
+	if(len < iplen + 8 + QHEADERSZ) {
+		c->skipped++;
+		return;
+	}
+	((struct sockaddr_in*)&addr)->sin_port = htons((p[iplen]<<8) |
+		p[iplen+1]);
+	p += iplen + 8;
+	len -= iplen + 8;
+	/* only queries, not the answers in the capture */
+	if((p[2]&0x80)) {
+		c->skipped++;
+		return;
+	}
+	corpus_add(c, p, len, &addr, addrlen);
+}
+
+/* read the pcap format corpus, the magic number has been read */
+static void
+read_pcap_corpus(FILE* in, const char* fname, uint8_t* magic,
+	struct bench_corpus* c)
+{
+	uint8_t hdr[24], rec[16];
+	static uint8_t pkt[65536];
+	uint32_t linktype, caplen;
+	int swap = 0;
+	memcpy(hdr, magic, 4);
+	if(fread(hdr+4, 1, sizeof(hdr)-4, in) != sizeof(hdr)-4)
+		error("%s: short pcap header", fname);
+	if(pcap_u32(hdr, 1) == PCAP_MAGIC || pcap_u32(hdr, 1) ==
+		PCAP_MAGIC_NSEC)
+		swap = 1;
+	linktype = pcap_u32(hdr+20, swap);
+	while(fread(rec, 1, sizeof(rec), in) == sizeof(rec)) {
+		uint8_t* p = pkt;
+		int ethertype = 0;
+		caplen = pcap_u32(rec+8, swap);
+		if(caplen > sizeof(pkt))
+			error("%s: packet too large in pcap", fname);
+		if(fread(pkt, 1, caplen, in) != caplen)
+			break;
+		switch(linktype) {
+		case PCAP_LINK_NULL:
+			if(caplen < 4) { c->skipped++; continue; }
+			p += 4; caplen -= 4;
+			break;
+		case PCAP_LINK_ETHERNET:
+			if(caplen < 14) { c->skipped++; continue; }
+			ethertype = (p[12]<<8) | p[13];
+			p += 14; caplen -= 14;
+			if(ethertype == 0x8100 && caplen >= 4) {
+				/* VLAN tag */
+				ethertype = (p[2]<<8) | p[3];
+				p += 4; caplen -= 4;
+			}
+			break;
+		case PCAP_LINK_LINUX_SLL:
+			if(caplen < 16) { c->skipped++; continue; }
+			ethertype = (p[14]<<8) | p[15];
+			p += 16; caplen -= 16;
+			break;
+		case PCAP_LINK_RAW:
+			break;
+		default:
+			error("%s: unsupported pcap link type %u", fname,
+				(unsigned)linktype);
+		}
+		pcap_packet(c, p, caplen, ethertype);
+	}
+}
+
+/* read the corpus, pcap or text */
+static void
+read_corpus(const char* fname, struct bench_corpus* c)
+{
+	uint8_t magic[4];
+	FILE* in = fopen(fname, "r");
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	if(fread(magic, 1, 4, in) == 4 && (pcap_u32(magic, 0) == PCAP_MAGIC ||
+		pcap_u32(magic, 1) == PCAP_MAGIC ||
+		pcap_u32(magic, 0) == PCAP_MAGIC_NSEC ||
+		pcap_u32(magic, 1) == PCAP_MAGIC_NSEC)) {
+		read_pcap_corpus(in, fname, magic, c);
+	} else {
+		rewind(in);
+		read_text_corpus(in, fname, c);
+	}
+	fclose(in);
+}
+
+static uint64_t
+timespec_ns(struct timespec* t)
+{
+	return ((uint64_t)t->tv_sec)*1000000000 + (uint64_t)t->tv_nsec;
+}
+
+/* classify the answer in the packet */
+static int
+bench_type(buffer_type* packet)
+{
+	if(RCODE(packet) == RCODE_NXDOMAIN)
+		return BENCH_NXDOMAIN;
+	if(RCODE(packet) != RCODE_OK)
+		return BENCH_OTHER;
+	if(ANCOUNT(packet) != 0)
+		return BENCH_ANSWER;
+	if(AA(packet))
+		return BENCH_NODATA;
+	if(NSCOUNT(packet) != 0)
+		return BENCH_REFERRAL;
+	return BENCH_OTHER;
+}
+
+/* replay the corpus a number of rounds, like handle_udp does it */
+static void
+bench_run(struct nsd* nsd, struct bench_corpus* c, int rounds, int bufsize,
+	struct bench_result* res)
+{
+	static domain_type* compressed_dnames[MAXRRSPP];
+	region_type* region = region_create(xalloc, free);
+	size_t needed = domain_table_count(nsd->db->domains) + 1 +
+		EXTRA_DOMAIN_NUMBERS;
+	uint16_t* compressed_dname_offsets = xalloc_array_zero(needed,
+		sizeof(uint16_t));
+	query_type* q;
+	struct timespec start, end, t0, t1;
+	size_t dbmem = region_get_mem(nsd->db->region);
+	size_t i;
+	int r;
+
+	compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
+	q = query_create(region, compressed_dname_offsets,
+		domain_table_count(nsd->db->domains) + 1, compressed_dnames);
+	memset(res, 0, sizeof(*res));
+	get_time_monotonic(&start);
+	for(r=0; r<rounds; r++) {
+		for(i=0; i<c->num; i++) {
+			struct bench_query* e = &c->list[i];
+			get_time_monotonic(&t0);
+			query_reset(q, bufsize, bufsize > UDP_MAX_MESSAGE_LEN);
+			memcpy(&q->addr, &e->addr, e->addrlen);
+			q->addrlen = e->addrlen;
+			buffer_write(q->packet, e->data, e->len);
+			buffer_flip(q->packet);
+			if(query_process(q, nsd) != QUERY_DISCARDED) {
+				query_add_optional(q, nsd);
+				buffer_flip(q->packet);
+				get_time_monotonic(&t1);
+				res->types[bench_type(q->packet)]++;
+				if(TC(q->packet))
+					res->truncated++;
+			} else {
+				get_time_monotonic(&t1);
+				res->types[BENCH_DROPPED]++;
+			}
+			res->hist[latency_bucket(timespec_ns(&t1) -
+				timespec_ns(&t0), BENCH_SUB_BITS,
+				BENCH_BUCKETS)]++;
+			res->allocs += region_get_alloc_count(q->region);
+			res->alloc_bytes += region_get_mem(q->region);
+			res->num++;
+		}
+	}
+	get_time_monotonic(&end);
+	res->elapsed = timespec_ns(&end) - timespec_ns(&start);
+	res->db_growth = region_get_mem(nsd->db->region) - dbmem;
+	region_destroy(region);
+	free(compressed_dname_offsets);
+}
+
+/* add the results of a process to the total */
+static void
+bench_add(struct bench_result* total, struct bench_result* r)
+{
+	int i;
+	total->num += r->num;
+	if(r->elapsed > total->elapsed)
+		total->elapsed = r->elapsed;
+	for(i=0; i<BENCH_TYPES; i++)
+		total->types[i] += r->types[i];
+	total->truncated += r->truncated;
+	total->allocs += r->allocs;
+	total->alloc_bytes += r->alloc_bytes;
+	total->db_growth += r->db_growth;
+	for(i=0; i<BENCH_BUCKETS; i++)
+		total->hist[i] += r->hist[i];
+}
+
+/* percentile from the histogram, fraction of 1 */
+static uint64_t
+bench_percentile(struct bench_result* r, double frac)
+{
+	return latency_percentile(r->hist, BENCH_BUCKETS, BENCH_SUB_BITS,
+		r->num, frac);
+}
+
+static void
+bench_print(struct bench_result* total, double qps_sum, int procs)
+{
+	int i;
+	if(total->num == 0) {
+		printf("no queries processed\n");
+		return;
+	}
+	printf("queries: %llu in %d process%s\n",
+		(unsigned long long)total->num, procs, (procs==1?"":"es"));
+	printf("qps: %.0f\n", qps_sum);
+	printf("qps.per_process: %.0f\n", qps_sum/procs);
+	printf("ns_per_query.avg: %llu\n", (unsigned long long)
+		(total->elapsed * procs / total->num));
+	printf("ns_per_query.p50: %llu\n",
+		(unsigned long long)bench_percentile(total, 0.50));
+	printf("ns_per_query.p90: %llu\n",
+		(unsigned long long)bench_percentile(total, 0.90));
+	printf("ns_per_query.p99: %llu\n",
+		(unsigned long long)bench_percentile(total, 0.99));
+	printf("ns_per_query.p999: %llu\n",
+		(unsigned long long)bench_percentile(total, 0.999));
+	printf("ns_per_query.max: %llu\n",
+		(unsigned long long)bench_percentile(total, 1.0));
+	printf("allocs_per_query: %.2f\n", (double)total->allocs /
+		(double)total->num);
+	printf("alloc_bytes_per_query: %.1f\n", (double)total->alloc_bytes /
+		(double)total->num);
+	printf("db_region_growth: %llu\n",
+		(unsigned long long)total->db_growth);
+	for(i=0; i<BENCH_TYPES; i++)
+		printf("type.%s: %llu\n", bench_type_str[i],
+			(unsigned long long)total->types[i]);
+	printf("truncated: %llu\n", (unsigned long long)total->truncated);
+}
+
+/* run the benchmark in procs processes and print the result */
+static void
+bench(struct nsd* nsd, struct bench_corpus* c, int procs, int rounds,
+	int bufsize)
+{
+	struct bench_result total, r;
+	double qps_sum = 0;
+	int* fds = xalloc_array_zero(procs, sizeof(int));
+	pid_t* pids = xalloc_array_zero(procs, sizeof(pid_t));
+	int i;
+
+	memset(&total, 0, sizeof(total));
+	if(procs == 1) {
+		bench_run(nsd, c, rounds, bufsize, &r);
+		bench_add(&total, &r);
+		if(r.elapsed != 0)
+			qps_sum = (double)r.num*1e9/(double)r.elapsed;
+	} else {
+		/* fork like the server children, they share the database
+		 * pages that were loaded before the fork */
+		for(i=0; i<procs; i++) {
+			int sv[2];
+			if(pipe(sv) == -1)
+				error("pipe: %s", strerror(errno));
+			pids[i] = fork();
+			if(pids[i] == -1)
+				error("fork: %s", strerror(errno));
+			if(pids[i] == 0) {
+				close(sv[0]);
+				bench_run(nsd, c, rounds, bufsize, &r);
+				if(!write_socket(sv[1], &r, sizeof(r)))
+					exit(1);
+				close(sv[1]);
+				exit(0);
+			}
+			close(sv[1]);
+			fds[i] = sv[0];
+		}
+		for(i=0; i<procs; i++) {
+			size_t got = 0;
+			while(got < sizeof(r)) {
+				ssize_t ret = read(fds[i], ((uint8_t*)&r)+got,
+					sizeof(r)-got);
+				if(ret == -1 && errno == EINTR)
+					continue;
+				if(ret <= 0)
+					error("process %d failed", i);
+				got += (size_t)ret;
+			}
+			close(fds[i]);
+			(void)waitpid(pids[i], NULL, 0);
+			bench_add(&total, &r);
+			if(r.elapsed != 0)
+				qps_sum += (double)r.num*1e9/(double)r.elapsed;
+		}
+	}
+	bench_print(&total, qps_sum, procs);
+	free(fds);
+	free(pids);
+}
+
+/* dummy functions to link */
+int writepid(struct nsd * ATTR_UNUSED(nsd))
+{
+	        return 0;
+}
+void unlinkpid(const char * ATTR_UNUSED(file))
+{
+}
+void bind8_stats(struct nsd * ATTR_UNUSED(nsd))
+{
+}
+
+void sig_handler(int ATTR_UNUSED(sig))
+{
+}
+
+extern char *optarg;
+extern int optind;
+
+int
+main(int argc, char *argv[])
+{
+	/* Scratch variables... */
+	int c, procs = 1, rounds = 1, bufsize = 512;
+	const char *configfile = CONFIGFILE;
+	struct bench_corpus corpus;
+	region_type* region;
+	memset(&nsd, 0, sizeof(nsd));
+	memset(&corpus, 0, sizeof(corpus));
+
+	log_init("nsd-bench");
+
+	/* Parse the command line... */
+	while ((c = getopt(argc, argv, "b:c:hp:r:"
+		)) != -1) {
+		switch (c) {
+		case 'b':
+			bufsize = atoi(optarg);
+			break;
+		case 'c':
+			configfile = optarg;
+			break;
+		case 'p':
+			procs = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		case '?':
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	/* Commandline parse error */
+	if (argc != 1 || procs < 1 || rounds < 1 || bufsize < 512 ||
+		bufsize > TCP_MAX_MESSAGE_LEN) {
+		usage();
+		exit(1);
+	}
+
+	/* Read options */
+	region = region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	nsd.region = region;
+	nsd.options = nsd_options_create(region);
+	tsig_init(nsd.options->region);
+	if(!parse_options_file(nsd.options, configfile, NULL, NULL)) {
+		error("could not read config: %s\n", configfile);
+	}
+	if(!parse_zone_list_file(nsd.options)) {
+		error("could not read zonelist file %s\n",
+			nsd.options->zonelistfile);
+	}
+	/* the paths after this are relative to the zonesdir, as in nsd */
+	if(nsd.options->zonesdir && nsd.options->zonesdir[0]) {
+		if(chdir(nsd.options->zonesdir)) {
+			error("cannot chdir to '%s': %s",
+				nsd.options->zonesdir, strerror(errno));
+		}
+	}
+	if (verbosity == 0)
+		verbosity = nsd.options->verbosity;
+	nsd.identity = nsd.options->identity?nsd.options->identity:IDENTITY;
+	nsd.version = nsd.options->version?nsd.options->version:VERSION;
+	nsd.ipv4_edns_size = nsd.options->ipv4_edns_size;
+	nsd.ipv6_edns_size = nsd.options->ipv6_edns_size;
+	edns_init_data(&nsd.edns_ipv4, nsd.options->ipv4_edns_size);
+#if defined(INET6)
+	edns_init_data(&nsd.edns_ipv6, nsd.options->ipv6_edns_size);
+#endif
+
+	/* read the corpus, relative to the zonesdir like the zonefiles */
+	read_corpus(argv[0], &corpus);
+	printf("corpus: %lu queries, %lu skipped\n",
+		(unsigned long)corpus.num, (unsigned long)corpus.skipped);
+	if(corpus.num == 0)
+		error("no queries in %s", argv[0]);
+
+	/* read the zones from the zonefiles, into memory only, like with
+	 * database: "", so that the nsd.db of the server is not changed */
+	nsd.options->database = "";
+	nsd.db = namedb_open(nsd.options->database, nsd.options);
+	if(!nsd.db)
+		error("cannot create the zone database: %s", strerror(errno));
+	namedb_check_zonefiles(&nsd, nsd.options, NULL, NULL);
+	printf("zones: %lu, domains: %lu, db_mem: %lu\n",
+		(unsigned long)nsd.db->zonetree->count,
+		(unsigned long)domain_table_count(nsd.db->domains),
+		(unsigned long)region_get_mem(nsd.db->region));
+
+	bench(&nsd, &corpus, procs, rounds, bufsize);
+
+	exit(0);
+}
@@ -17,6 +17,7 @@
 #include "util.h"
 #include "dname.h"
 #include "rrl.h"
+#include "dns.h"
 
 extern char *optarg;
 extern int optind;
@@ -377,6 +378,17 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_BIN(confine_to_zone, o);
 		SERV_GET_BIN(refuse_any, o);
 		SERV_GET_BIN(tcp_reject_overflow, o);
+		if(strcasecmp(o, "database_huge_pages") == 0) {
+			printf("%s\n", opt->database_huge_pages == 2 ?
+				"hugetlbfs" : (opt->database_huge_pages ?
+				"yes" : "no"));
+			return;
+		}
+		SERV_GET_BIN(database_prefault, o);
+		SERV_GET_BIN(database_numa_replicas, o);
+		SERV_GET_BIN(database_cow_audit, o);
+		SERV_GET_BIN(lazy_zones, o);
+		SERV_GET_BIN(lazy_zones_cold_drop, o);
 		SERV_GET_BIN(log_only_syslog, o);
 		/* str */
 		SERV_GET_PATH(final, database, o);
@@ -407,6 +419,14 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_INT(ipv6_edns_size, o);
 		SERV_GET_INT(statistics, o);
 		SERV_GET_INT(xfrd_reload_timeout, o);
+		SERV_GET_INT(database_read_threads, o);
+		SERV_GET_INT(lazy_zones_memory, o);
+		SERV_GET_INT(xfrd_reload_max_staleness, o);
+		SERV_GET_INT(xfrd_udp_window, o);
+		SERV_GET_INT(xfrd_udp_master_rate, o);
+		SERV_GET_INT(xfrd_notify_window, o);
+		SERV_GET_INT(xfrd_notify_rate, o);
+		SERV_GET_INT(xfrd_tcp_idle_timeout, o);
 		SERV_GET_INT(verbosity, o);
 		SERV_GET_INT(send_buffer_size, o);
 		SERV_GET_INT(receive_buffer_size, o);
@@ -427,6 +447,10 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_STR(dnstap_version, o);
 		SERV_GET_BIN(dnstap_log_auth_query_messages, o);
 		SERV_GET_BIN(dnstap_log_auth_response_messages, o);
+		SERV_GET_INT(dnstap_sample_rate, o);
+		SERV_GET_INT(dnstap_filter_transport, o);
+		SERV_GET_BIN(dnstap_filter_rrl, o);
+		SERV_GET_BIN(dnstap_filter_tc, o);
 #endif
 		SERV_GET_INT(zonefiles_write, o);
 		/* remote control */
@@ -501,6 +525,10 @@ config_test_print_server(nsd_options_type* opt)
 	key_options_type* key;
 	zone_options_type* zone;
 	pattern_options_type* pat;
+#ifdef USE_DNSTAP
+	struct dnstap_zone_option* dz;
+	int i;
+#endif
 
 	printf("# Config settings.\n");
 	printf("server:\n");
@@ -518,6 +546,20 @@ config_test_print_server(nsd_options_type* opt)
 	printf("\ttcp-reject-overflow: %s\n",
 		opt->tcp_reject_overflow ? "yes" : "no");
 	print_string_var("database:", opt->database);
+	printf("\tdatabase-read-threads: %d\n", opt->database_read_threads);
+	printf("\tdatabase-huge-pages: %s\n",
+		opt->database_huge_pages == 2 ? "hugetlbfs" :
+		(opt->database_huge_pages ? "yes" : "no"));
+	printf("\tdatabase-prefault: %s\n",
+		opt->database_prefault ? "yes" : "no");
+	printf("\tdatabase-numa-replicas: %s\n",
+		opt->database_numa_replicas ? "yes" : "no");
+	printf("\tdatabase-cow-audit: %s\n",
+		opt->database_cow_audit ? "yes" : "no");
+	printf("\tlazy-zones: %s\n", opt->lazy_zones ? "yes" : "no");
+	printf("\tlazy-zones-memory: %d\n", opt->lazy_zones_memory);
+	printf("\tlazy-zones-cold-drop: %s\n",
+		opt->lazy_zones_cold_drop ? "yes" : "no");
 	print_string_var("identity:", opt->identity);
 	print_string_var("version:", opt->version);
 	print_string_var("nsid:", opt->nsid);
@@ -561,6 +603,13 @@ config_test_print_server(nsd_options_type* opt)
 	print_string_var("zonelistfile:", opt->zonelistfile);
 	print_string_var("xfrdir:", opt->xfrdir);
 	printf("\txfrd-reload-timeout: %d\n", opt->xfrd_reload_timeout);
+	printf("\txfrd-reload-max-staleness: %d\n",
+		opt->xfrd_reload_max_staleness);
+	printf("\txfrd-udp-window: %d\n", opt->xfrd_udp_window);
+	printf("\txfrd-udp-master-rate: %d\n", opt->xfrd_udp_master_rate);
+	printf("\txfrd-notify-window: %d\n", opt->xfrd_notify_window);
+	printf("\txfrd-notify-rate: %d\n", opt->xfrd_notify_rate);
+	printf("\txfrd-tcp-idle-timeout: %d\n", opt->xfrd_tcp_idle_timeout);
 	printf("\tlog-time-ascii: %s\n", opt->log_time_ascii?"yes":"no");
 	printf("\tround-robin: %s\n", opt->round_robin?"yes":"no");
 	printf("\tminimal-responses: %s\n", opt->minimal_responses?"yes":"no");
@@ -614,6 +663,25 @@ config_test_print_server(nsd_options_type* opt)
 	print_string_var("dnstap-version:", opt->dnstap_version);
 	printf("\tdnstap-log-auth-query-messages: %s\n", opt->dnstap_log_auth_query_messages?"yes":"no");
 	printf("\tdnstap-log-auth-response-messages: %s\n", opt->dnstap_log_auth_response_messages?"yes":"no");
+	printf("\tdnstap-sample-rate: %d\n", opt->dnstap_sample_rate);
+	for(dz = opt->dnstap_filter_zones; dz; dz = dz->next)
+		print_string_var("dnstap-filter-zone:", dz->name);
+	if(opt->dnstap_filter_qtypes) {
+		for(i = 0; i < 65536; i++) {
+			if(opt->dnstap_filter_qtypes[i/8] & (1<<(i&7)))
+				printf("\tdnstap-filter-qtype: %s\n",
+					rrtype_to_string(i));
+		}
+	}
+	for(i = 0; i < 16; i++) {
+		if(opt->dnstap_filter_rcodes & (1<<i))
+			printf("\tdnstap-filter-rcode: %s\n", rcode_to_string(i));
+	}
+	printf("\tdnstap-filter-transport: %s\n",
+		opt->dnstap_filter_transport==1?"udp":
+		(opt->dnstap_filter_transport==2?"tcp":"all"));
+	printf("\tdnstap-filter-rrl: %s\n", opt->dnstap_filter_rrl?"yes":"no");
+	printf("\tdnstap-filter-tc: %s\n", opt->dnstap_filter_tc?"yes":"no");
 #endif
 
 	printf("\nremote-control:\n");
@@ -702,6 +770,26 @@ additional_checks(nsd_options_type* opt, const char* filename)
 		errors ++;
 	}
 #endif
+#ifdef USE_DNSTAP
+	{
+		struct dnstap_zone_option* dz;
+		for(dz = opt->dnstap_filter_zones; dz; dz = dz->next) {
+			if(!dname_parse(opt->region, dz->name)) {
+				fprintf(stderr, "%s: cannot parse dnstap-filter-zone %s.\n",
+					filename, dz->name);
+				errors ++;
+			}
+		}
+	}
+#ifndef RATELIMIT
+	if(opt->dnstap_filter_rrl)
+	{
+		fprintf(stderr, "%s: 'dnstap-filter-rrl: yes' but ratelimit feature not enabled.\n",
+			filename);
+		errors ++;
+	}
+#endif
+#endif /* USE_DNSTAP */
 	if (opt->identity && strlen(opt->identity) > UCHAR_MAX) {
                 fprintf(stderr, "%s: server identity too long (%u characters)\n",
                       filename, (unsigned) strlen(opt->identity));
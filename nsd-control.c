@@ -104,6 +104,7 @@ usage()
 	printf("  force_transfer [<zone>]	update slave zones with AXFR, no serial check\n");
 	printf("  zonestatus [<zone>]		print state, serial, activity\n");
 	printf("  serverpid			get pid of server process\n");
+	printf("  export_xfrd_state		print the zone transfer state as text\n");
 	printf("  verbosity <number>		change logging detail\n");
 	printf("  print_tsig [<key_name>]	print tsig with <name> the secret and algo\n");
 	printf("  update_tsig <name> <secret>	change existing tsig with <name> to a new <secret>\n");
@@ -52,6 +52,12 @@ struct zone_mem {
 
 	/* count of number of domains */
 	size_t domaincount;
+	/* count of number of RRs */
+	size_t rrcount;
+#ifdef USE_COMPACT_DOMAINS
+	/* the domains, in the domain arena */
+	size_t domain_arena;
+#endif
 };
 
 /* total memory structure */
@@ -67,6 +73,12 @@ struct tot_mem {
 
 	/* count of number of domains */
 	size_t domaincount;
+	/* count of number of RRs */
+	size_t rrcount;
+#ifdef USE_COMPACT_DOMAINS
+	/* the domains, in the domain arena */
+	size_t domain_arena;
+#endif
 
 	/* options data */
 	size_t opt_data;
@@ -88,6 +100,8 @@ struct tot_mem {
 static void
 account_zone(struct namedb* db, struct zone_mem* zmem)
 {
+	domain_type* d;
+	rrset_type* rrset;
 	zmem->data = region_get_mem(db->region);
 	zmem->data_unused = region_get_mem_unused(db->region);
 	if(db->udb) {
@@ -96,6 +110,24 @@ account_zone(struct namedb* db, struct zone_mem* zmem)
 			db->udb->alloc->disk->stat_data);
 	}
 	zmem->domaincount = domain_table_count(db->domains);
+	zmem->rrcount = 0;
+	for(d = db->domains->root; d; d = domain_next(d)) {
+		for(rrset = d->rrsets; rrset; rrset = rrset->next)
+			zmem->rrcount += rrset->rr_count;
+	}
+#ifdef USE_COMPACT_DOMAINS
+	zmem->domain_arena = zmem->domaincount * sizeof(domain_type);
+#endif
+}
+
+/* bytes of the domain and RR links that are 32-bit with compact domains,
+ * the parent, wildcard match and number list links and the RR owner */
+static size_t
+compact_links_saving(size_t domaincount, size_t rrcount)
+{
+	if(sizeof(void*) <= sizeof(uint32_t))
+		return 0;
+	return (domaincount*4 + rrcount) * (sizeof(void*) - sizeof(uint32_t));
 }
 
 static void
@@ -121,6 +153,14 @@ print_zone_mem(struct zone_mem* z)
 	pretty_mem(z->data_unused, "zone unused space (due to alignment)");
 	pretty_mem(z->udb_data, "data in nsd.db");
 	pretty_mem(z->udb_overhead, "overhead in nsd.db");
+#ifdef USE_COMPACT_DOMAINS
+	pretty_mem(z->domain_arena, "domains (in the domain arena)");
+	pretty_mem(compact_links_saving(z->domaincount, z->rrcount),
+		"saved by 32-bit domain links");
+#else
+	pretty_mem(compact_links_saving(z->domaincount, z->rrcount),
+		"to save with --enable-compact-domains");
+#endif
 }
 
 static void
@@ -140,6 +180,9 @@ account_total(struct nsd_options* opt, struct tot_mem* t)
 
 	t->ram = t->data + t->data_unused + t->opt_data + t->opt_unused +
 		t->compresstable;
+#ifdef USE_COMPACT_DOMAINS
+	t->ram += t->domain_arena;
+#endif
 #ifdef RATELIMIT
 	t->ram += t->rrl;
 #endif
@@ -152,6 +195,9 @@ print_tot_mem(struct tot_mem* t)
 	printf("\ntotal\n");
 	pretty_mem(t->data, "data");
 	pretty_mem(t->data_unused, "unused space (due to alignment)");
+#ifdef USE_COMPACT_DOMAINS
+	pretty_mem(t->domain_arena, "domains (in the domain arena)");
+#endif
 	pretty_mem(t->opt_data, "options");
 	pretty_mem(t->opt_unused, "options unused space (due to alignment)");
 	pretty_mem(t->compresstable, "name table (depends on servercount)");
@@ -160,6 +206,13 @@ print_tot_mem(struct tot_mem* t)
 #endif
 	pretty_mem(t->udb_data, "data in nsd.db");
 	pretty_mem(t->udb_overhead, "overhead in nsd.db");
+#ifdef USE_COMPACT_DOMAINS
+	pretty_mem(compact_links_saving(t->domaincount, t->rrcount),
+		"saved by 32-bit domain links");
+#else
+	pretty_mem(compact_links_saving(t->domaincount, t->rrcount),
+		"to save with --enable-compact-domains");
+#endif
 	printf("\nsummary\n");
 
 	pretty_mem(t->ram, "ram usage (excl space for buffers)");
@@ -174,6 +227,10 @@ add_mem(struct tot_mem* t, struct zone_mem* z)
 	t->udb_data += z->udb_data;
 	t->udb_overhead += z->udb_overhead;
 	t->domaincount += z->domaincount;
+	t->rrcount += z->rrcount;
+#ifdef USE_COMPACT_DOMAINS
+	t->domain_arena += z->domain_arena;
+#endif
 }
 
 static void
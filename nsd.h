@@ -97,6 +97,34 @@ typedef	unsigned long stc_type;
 				nsd->st.stc[LASTELEM(nsd->st.stc)]++ */
 
 #define	STATUP2(nsd, stc, i) nsd->st.stc[(i) <= (LASTELEM(nsd->st.stc) - 1) ? i : LASTELEM(nsd->st.stc)]++
+
+/* number of chunk sizes in the free lists of nsd.db, from 32 bytes
+ * (2**UDB_ALLOC_CHUNK_MINEXP) to 1 Mb (2**UDB_ALLOC_CHUNKS_MAX) */
+#define DB_FREE_SIZES 16
+/* number of NUMA nodes in the statistics of the zone data replicas */
+#define DB_NUMA_NODES 8
+
+/*
+ * Latency histograms of the service time of queries, from the receive of
+ * the query to the submission of the answer to the kernel.  The buckets
+ * are log-linear in microseconds: buckets 0-3 are 0-3 usec, after that
+ * every power of two is split into 1<<LAT_SUB_BITS sub-buckets.  The last
+ * bucket also counts everything that is larger (about 100 msec and up).
+ */
+#define LAT_SUB_BITS 2
+#define LAT_BUCKETS 64
+/* transport of the query */
+#define LAT_UDP 0
+#define LAT_TCP 1
+#define LAT_TLS 2
+#define LAT_TRANSPORTS 3
+/* type of answer */
+#define LAT_ANSWER 0
+#define LAT_REFERRAL 1
+#define LAT_NODATA 2
+#define LAT_NXDOMAIN 3
+#define LAT_OTHER 4
+#define LAT_ANSWER_TYPES 5
 #else	/* BIND8_STATS */
 
 #define	STATUP(nsd, stc) /* Nothing */
@@ -104,6 +132,101 @@ typedef	unsigned long stc_type;
 
 #endif /* BIND8_STATS */
 
+#ifdef BIND8_STATS
+/*
+ * Compact statistics for one zonestat id.  The per zone arrays have an
+ * entry per zonestat, and there can be very many of them, so a full
+ * struct nsdst is too large.  The common counters are inline, the rare
+ * qtypes, qclasses, opcodes and rcodes are counted in a couple of overflow
+ * slots, and when the slots are all in use in the overflowed counter.
+ * The key of a slot is the kind and the index, 0 for an unused slot.
+ * The key of a slot does not change once set, for the lifetime of the
+ * array, so xfrd can subtract earlier printed values slot by slot.
+ */
+#define ZST_QTYPES 6 /* A, NS, SOA, MX, TXT, AAAA */
+#define ZST_RCODES 4 /* NOERROR, SERVFAIL, NXDOMAIN, REFUSED */
+#define ZST_OVERFLOW 4
+#define ZST_QTYPE 1
+#define ZST_QCLASS 2
+#define ZST_OPCODE 3
+#define ZST_RCODE 4
+#define ZST_KEY(kind, i) ((uint16_t)(((kind)<<9) | (i)))
+#define ZST_KEY_KIND(key) ((key)>>9)
+#define ZST_KEY_INDEX(key) ((key)&0x1ff)
+struct nsdzst {
+	stc_type qtype[ZST_QTYPES];
+	stc_type qclass_in, opcode_query;
+	stc_type rcode[ZST_RCODES];
+	stc_type qudp, qudp6, ctcp, ctcp6, ctls, ctls6;
+	stc_type dropped, truncated, edns, ednserr, raxfr, nona;
+	/* the rare counters that did not fit in the overflow slots */
+	stc_type overflowed;
+	uint16_t key[ZST_OVERFLOW];
+	stc_type count[ZST_OVERFLOW];
+};
+
+/* count a rare counter in the overflow slots.  The children share the
+ * array, an unused slot is claimed with a compare and swap, so that the
+ * key of a slot is set once, also when two children claim it at the same
+ * time.  The increments are not locked, like for the other counters. */
+static inline void
+zonestat_inc_overflow(struct nsdzst* z, uint16_t key)
+{
+	int i;
+	for(i=0; i<ZST_OVERFLOW; i++) {
+		if(z->key[i] == 0)
+			(void)__sync_bool_compare_and_swap(&z->key[i], 0, key);
+		if(z->key[i] == key) {
+			z->count[i]++;
+			return;
+		}
+	}
+	z->overflowed++;
+}
+
+static inline void
+zonestat_inc_qtype(struct nsdzst* z, int i)
+{
+	switch(i) {
+	case TYPE_A: z->qtype[0]++; break;
+	case TYPE_NS: z->qtype[1]++; break;
+	case TYPE_SOA: z->qtype[2]++; break;
+	case TYPE_MX: z->qtype[3]++; break;
+	case TYPE_TXT: z->qtype[4]++; break;
+	case TYPE_AAAA: z->qtype[5]++; break;
+	default: zonestat_inc_overflow(z, ZST_KEY(ZST_QTYPE, i<=255?i:256));
+	}
+}
+
+static inline void
+zonestat_inc_qclass(struct nsdzst* z, int i)
+{
+	if(i == CLASS_IN)
+		z->qclass_in++;
+	else	zonestat_inc_overflow(z, ZST_KEY(ZST_QCLASS, i<=2?i:3));
+}
+
+static inline void
+zonestat_inc_opcode(struct nsdzst* z, int i)
+{
+	if(i == OPCODE_QUERY)
+		z->opcode_query++;
+	else	zonestat_inc_overflow(z, ZST_KEY(ZST_OPCODE, i<=4?i:5));
+}
+
+static inline void
+zonestat_inc_rcode(struct nsdzst* z, int i)
+{
+	switch(i) {
+	case RCODE_OK: z->rcode[0]++; break;
+	case RCODE_SERVFAIL: z->rcode[1]++; break;
+	case RCODE_NXDOMAIN: z->rcode[2]++; break;
+	case RCODE_REFUSE: z->rcode[3]++; break;
+	default: zonestat_inc_overflow(z, ZST_KEY(ZST_RCODE, i<=15?i:16));
+	}
+}
+#endif /* BIND8_STATS */
+
 #ifdef USE_ZONE_STATS
 /* increment zone statistic, checks if zone-nonNULL and zone array bounds */
 #define ZTATUP(nsd, zone, stc) ( \
@@ -112,8 +235,8 @@ typedef	unsigned long stc_type;
 		: 0)
 #define	ZTATUP2(nsd, zone, stc, i) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		(nsd->zonestatnow[zone->zonestatid].stc[(i) <= (LASTELEM(nsd->zonestatnow[zone->zonestatid].stc) - 1) ? i : LASTELEM(nsd->zonestatnow[zone->zonestatid].stc)]++ ) \
-		: 0)
+		zonestat_inc_##stc(&nsd->zonestatnow[zone->zonestatid], (i)) \
+		: (void)0)
 #else /* USE_ZONE_STATS */
 #define	ZTATUP(nsd, zone, stc) /* Nothing */
 #define	ZTATUP2(nsd, zone, stc, i) /* Nothing */
@@ -207,6 +330,8 @@ struct	nsd
 	volatile sig_atomic_t quit_sync_done;
 	unsigned		server_kind;
 	struct namedb	*db;
+	/* copies of the zone data per NUMA node, or NULL */
+	struct numa_replicas* numa;
 	int				debug;
 
 	size_t            child_count;
@@ -287,10 +412,26 @@ struct	nsd
 		stc_type dropped, truncated, wrongzone, txerr, rxerr;
 		stc_type edns, ednserr, raxfr, nona;
 		uint64_t db_disk, db_mem;
+		/* bytes free in nsd.db, and the number of free chunks
+		 * per size, for the fragmentation of the file */
+		uint64_t db_free, db_free_chunks[DB_FREE_SIZES];
+		/* bytes in the slabs of the zone data, in use by objects,
+		 * and of empty slabs given back to the OS */
+		uint64_t db_slab, db_slab_used, db_slab_released;
+		/* bytes of the zone data replica per NUMA node */
+		uint64_t db_numa[DB_NUMA_NODES];
+		/* bytes of the zone data the servers wrote to, with
+		 * database-cow-audit */
+		uint64_t db_cow;
+		/* latency histograms, per transport, answer type, and
+		 * without and with the DO bit.  They are not counted per
+		 * zone, and are kept last, the zone stats print clears the
+		 * counters before them */
+		stc_type latency[LAT_TRANSPORTS][LAT_ANSWER_TYPES][2][LAT_BUCKETS];
 	} st;
 	/* per zone stats, each an array per zone-stat-idx, stats per zone is
 	 * add of [0][zoneidx] and [1][zoneidx]. */
-	struct nsdst* zonestat[2];
+	struct nsdzst* zonestat[2];
 	/* fd for zonestat mapping (otherwise mmaps cannot be shared between
 	 * processes and resized) */
 	int zonestatfd[2];
@@ -299,14 +440,12 @@ struct	nsd
 	/* size of the mmapped zone stat array (number of array entries) */
 	size_t zonestatsize[2], zonestatdesired, zonestatsizenow;
 	/* current zonestat array to use */
-	struct nsdst* zonestatnow;
+	struct nsdzst* zonestatnow;
 #endif /* BIND8_STATS */
 #ifdef USE_DNSTAP
-	/* the dnstap collector process info */
+	/* the dnstap collector process info, with the ring buffers from
+	 * the server processes.  Kept open for (re-)forks. */
 	struct dt_collector* dt_collector;
-	/* the pipes from server processes to the dt_collector,
-	 * arrays of size child_count.  Kept open for (re-)forks. */
-	int *dt_collector_fd_send, *dt_collector_fd_recv;
 #endif /* USE_DNSTAP */
 	/* ratelimit for errors, time value */
 	time_t err_limit_time;
@@ -473,7 +473,7 @@ nsec3_domain_part_of_zone(domain_type* d, zone_type* z)
 	while(d) {
 		if(d->is_apex)
 			return (z->apex == d); /* zonecut, if right zone*/
-		d = d->parent;
+		d = domain_parent(d);
 	}
 	return 0;
 }
@@ -493,7 +493,7 @@ nsec3_condition_dshash(domain_type* d, zone_type* z)
 	return d->is_existing && !domain_has_only_NSEC3(d, z) &&
 		(domain_find_rrset(d, z, TYPE_DS) ||
 		domain_find_rrset(d, z, TYPE_NS)) && d != z->apex
-		&& nsec3_domain_part_of_zone(d->parent, z);
+		&& nsec3_domain_part_of_zone(domain_parent(d), z);
 }
 
 zone_type*
@@ -515,7 +515,7 @@ nsec3_tree_zone(namedb_type* db, domain_type* d)
 					return rrset->zone;
 			return namedb_find_zone(db, domain_dname(d));
 		}
-		d = d->parent;
+		d = domain_parent(d);
 	}
 	return NULL;
 }
@@ -525,7 +525,7 @@ nsec3_tree_dszone(namedb_type* db, domain_type* d)
 {
 	/* the DStree does not contain nodes with d==z->apex */
 	if(d->is_apex)
-		d = d->parent;
+		d = domain_parent(d);
 	return nsec3_tree_zone(db, d);
 }
 
@@ -1029,13 +1029,13 @@ nsec3_add_ds_proof(struct query *query, struct answer *answer,
 			domain->nsec3->nsec3_cover);
 	} else {
 		/* prove closest provable encloser */
-		domain_type* par = domain->parent;
+		domain_type* par = domain_parent(domain);
 		domain_type* prev_par = 0;
 
 		while(par && (!par->nsec3 || !par->nsec3->nsec3_is_exact))
 		{
 			prev_par = par;
-			par = par->parent;
+			par = domain_parent(par);
 		}
 		assert(par); /* parent zone apex must be provable, thus this ends */
 		if(!par->nsec3) return;
@@ -1078,28 +1078,28 @@ nsec3_answer_nodata(struct query* query, struct answer* answer,
 		/* query->zone must be the parent zone */
 		nsec3_add_ds_proof(query, answer, original, 0);
 		/* if the DS is from a wildcard match */
-		if (original==original->wildcard_child_closest_match
+		if (original==domain_wildcard_match(original)
 			&& label_is_wildcard(dname_name(domain_dname(original)))) {
 			/* denial for wildcard is already there */
 			/* add parent proof to have a closest encloser proof for wildcard parent */
 			/* in other words: nsec3 matching closest encloser */
-			if(original->parent && original->parent->nsec3 &&
-				original->parent->nsec3->nsec3_is_exact)
+			if(domain_parent(original) && domain_parent(original)->nsec3 &&
+				domain_parent(original)->nsec3->nsec3_is_exact)
 				nsec3_add_rrset(query, answer, AUTHORITY_SECTION,
-					original->parent->nsec3->nsec3_cover);
+					domain_parent(original)->nsec3->nsec3_cover);
 		}
 	}
 	/* the nodata is result from a wildcard match */
-	else if (original==original->wildcard_child_closest_match
+	else if (original==domain_wildcard_match(original)
 		&& label_is_wildcard(dname_name(domain_dname(original)))) {
 		/* denial for wildcard is already there */
 
 		/* add parent proof to have a closest encloser proof for wildcard parent */
 		/* in other words: nsec3 matching closest encloser */
-		if(original->parent && original->parent->nsec3 &&
-			original->parent->nsec3->nsec3_is_exact)
+		if(domain_parent(original) && domain_parent(original)->nsec3 &&
+			domain_parent(original)->nsec3->nsec3_is_exact)
 			nsec3_add_rrset(query, answer, AUTHORITY_SECTION,
-				original->parent->nsec3->nsec3_cover);
+				domain_parent(original)->nsec3->nsec3_cover);
 		/* proof for wildcard itself */
 		/* in other words: nsec3 matching source of synthesis */
 		if(original->nsec3)
@@ -1110,15 +1110,15 @@ nsec3_answer_nodata(struct query* query, struct answer* answer,
 		if(original->nsec3) {
 			if(!original->nsec3->nsec3_is_exact) {
 				/* go up to an existing parent */
-				while(original->parent && original->parent->nsec3 && !original->parent->nsec3->nsec3_is_exact)
-					original = original->parent;
+				while(domain_parent(original) && domain_parent(original)->nsec3 && !domain_parent(original)->nsec3->nsec3_is_exact)
+					original = domain_parent(original);
 			}
 			nsec3_add_rrset(query, answer, AUTHORITY_SECTION,
 				original->nsec3->nsec3_cover);
 			if(!original->nsec3->nsec3_is_exact) {
-				if(original->parent && original->parent->nsec3 && original->parent->nsec3->nsec3_is_exact)
+				if(domain_parent(original) && domain_parent(original)->nsec3 && domain_parent(original)->nsec3->nsec3_is_exact)
 				    nsec3_add_rrset(query, answer, AUTHORITY_SECTION,
-					original->parent->nsec3->nsec3_cover);
+					domain_parent(original)->nsec3->nsec3_cover);
 
 			}
 		}
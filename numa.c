@@ -0,0 +1,471 @@
+/*
+ * numa.c -- copies of the zone data on every NUMA node, for the server
+ * processes on that node.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "numa.h"
+#include "nsd.h"
+#include "namedb.h"
+#include "options.h"
+#include "util.h"
+
+#if defined(HAVE_CPUSET_T) && defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+#define NUMA_REPLICAS 1
+#endif
+
+const char* numa_sysfs_dir = NUMA_SYSFS_DIR;
+
+#ifdef NUMA_REPLICAS
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+/* nodes in the mask for mbind */
+#define NUMA_MASK_NODES 1024
+/* the ranges on these boundaries can be in hugetlbfs pages */
+#define NUMA_HUGE_PAGE (2*1024*1024)
+/* the setting of transparent huge pages for shared memory */
+#define NUMA_THP_SHMEM "/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+
+/* read the list in the sysfs file, like 0-3,8-11, into an array */
+static int
+numa_read_list(const char* file, int** list, size_t* num)
+{
+	char buf[4096], *p, *e;
+	size_t max = 0;
+	long a, b;
+	FILE* in = fopen(file, "r");
+	*list = NULL;
+	*num = 0;
+	if(!in)
+		return 0;
+	if(!fgets(buf, sizeof(buf), in)) {
+		fclose(in);
+		return 0;
+	}
+	fclose(in);
+	p = buf;
+	while(*p && *p != '\n') {
+		a = strtol(p, &e, 10);
+		if(e == p || a < 0)
+			break;
+		b = a;
+		p = e;
+		if(*p == '-') {
+			b = strtol(p+1, &e, 10);
+			if(e == p+1 || b < a)
+				break;
+			p = e;
+		}
+		for(; a <= b; a++) {
+			if(*num == max) {
+				max = (max?max*2:16);
+				*list = (int*)xrealloc(*list, max*sizeof(int));
+			}
+			(*list)[(*num)++] = (int)a;
+		}
+		if(*p == ',')
+			p++;
+	}
+	return 1;
+}
+
+/* read the nodes that have cpus */
+static int
+numa_read_nodes(struct numa_replicas* numa)
+{
+	char file[256];
+	int* ids;
+	size_t num, i;
+	snprintf(file, sizeof(file), "%s/online", numa_sysfs_dir);
+	if(!numa_read_list(file, &ids, &num)) {
+		log_msg(LOG_ERR, "database-numa-replicas: cannot read %s: %s",
+			file, strerror(errno));
+		return 0;
+	}
+	numa->nodes = (struct numa_node*)xalloc_array_zero(num?num:1,
+		sizeof(struct numa_node));
+	for(i=0; i<num; i++) {
+		struct numa_node* n = &numa->nodes[numa->node_count];
+		snprintf(file, sizeof(file), "%s/node%d/cpulist",
+			numa_sysfs_dir, ids[i]);
+		if(!numa_read_list(file, &n->cpus, &n->cpu_count) ||
+			n->cpu_count == 0) {
+			/* a node with memory and no cpus */
+			free(n->cpus);
+			n->cpus = NULL;
+			continue;
+		}
+		n->node = ids[i];
+		n->fd = -1;
+		n->fd_small = -1;
+		numa->node_count++;
+	}
+	free(ids);
+	return 1;
+}
+
+/* add the arena to the ranges to copy */
+static void
+numa_add_range(void* start, size_t size, void* arg)
+{
+	struct numa_replicas* numa = (struct numa_replicas*)arg;
+	struct numa_range* r;
+	if(numa->range_count == numa->range_max) {
+		numa->range_max = (numa->range_max?numa->range_max*2:64);
+		numa->ranges = (struct numa_range*)xrealloc(numa->ranges,
+			numa->range_max*sizeof(struct numa_range));
+	}
+	r = &numa->ranges[numa->range_count++];
+	r->start = (char*)start;
+	r->size = size;
+	/* a hugetlbfs mapping starts and ends on a huge page */
+	r->small = ((uintptr_t)start % NUMA_HUGE_PAGE) != 0 ||
+		size % NUMA_HUGE_PAGE != 0;
+	if(r->small) {
+		r->offset = numa->small_size;
+		numa->small_size += size;
+	} else {
+		r->offset = numa->size;
+		numa->size += size;
+	}
+}
+
+/* log if the transparent huge pages are off for the memfds */
+static void
+numa_check_thp_shmem(void)
+{
+	char buf[256], *p, *e;
+	FILE* in = fopen(NUMA_THP_SHMEM, "r");
+	if(!in)
+		return;
+	if(!fgets(buf, sizeof(buf), in)) {
+		fclose(in);
+		return;
+	}
+	fclose(in);
+	/* the setting in use is in brackets, like always [never] */
+	if(!(p = strchr(buf, '[')) || !(e = strchr(p, ']')))
+		return;
+	*e = 0;
+	if(strcmp(p+1, "never") == 0 || strcmp(p+1, "deny") == 0)
+		log_msg(LOG_WARNING, "database-numa-replicas: the copies of the "
+			"zone data are not in huge pages, because %s is %s, "
+			"set it to advise", NUMA_THP_SHMEM, p+1);
+}
+
+/* set the affinity of this process to the cpus */
+static void
+numa_set_cpus(int* cpus, size_t num)
+{
+	cpuset_t* set = cpuset_create();
+	size_t i;
+	for(i=0; i<num; i++)
+		cpuset_set((cpuid_t)cpus[i], set);
+	if(set_cpu_affinity(set) != 0)
+		log_msg(LOG_ERR, "database-numa-replicas: cannot set cpu "
+			"affinity: %s", strerror(errno));
+	cpuset_destroy(set);
+}
+
+/* bind the memory to the node, the pages are allocated on it */
+static void
+numa_bind(void* p, size_t size, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask[NUMA_MASK_NODES/(sizeof(unsigned long)*8)];
+	if(node >= NUMA_MASK_NODES)
+		return;
+	memset(mask, 0, sizeof(mask));
+	mask[node/(sizeof(unsigned long)*8)] =
+		1UL << (node%(sizeof(unsigned long)*8));
+	if(syscall(SYS_mbind, p, size, MPOL_BIND, mask,
+		(unsigned long)NUMA_MASK_NODES+1, 0) != 0) {
+		/* the copy is made on the cpus of the node, so the pages
+		 * are local for the first touch policy */
+		VERBOSITY(2, (LOG_INFO, "database-numa-replicas: mbind "
+			"failed: %s", strerror(errno)));
+	}
+#else
+	(void)p; (void)size; (void)node;
+#endif
+}
+
+/* create a memfd of size bytes and map it, with hugetlbfs pages if
+ * hugetlb.  The hugetlbfs pages are reserved by the mmap, if there are
+ * too few that fails, and it is not logged. */
+static char*
+numa_memfd_map(int* fd, size_t size, int hugetlb)
+{
+	char* p;
+	*fd = memfd_create("nsd-numa-replica", MFD_CLOEXEC
+#ifdef MFD_HUGETLB
+		| (hugetlb?MFD_HUGETLB:0)
+#endif
+		);
+	if(*fd == -1) {
+		if(!hugetlb)
+			log_msg(LOG_ERR, "database-numa-replicas: memfd_create "
+				"failed: %s", strerror(errno));
+		return NULL;
+	}
+	if(ftruncate(*fd, (off_t)size) == -1) {
+		if(!hugetlb)
+			log_msg(LOG_ERR, "database-numa-replicas: ftruncate "
+				"failed: %s", strerror(errno));
+		close(*fd);
+		*fd = -1;
+		return NULL;
+	}
+	p = (char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, *fd, 0);
+	if(p == MAP_FAILED) {
+		if(!hugetlb)
+			log_msg(LOG_ERR, "database-numa-replicas: mmap failed: "
+				"%s", strerror(errno));
+		close(*fd);
+		*fd = -1;
+		return NULL;
+	}
+	return p;
+}
+
+/* copy the ranges to new memfds for the node */
+static int
+numa_node_fill(struct numa_replicas* numa, struct numa_node* n)
+{
+	char* p = NULL, *s = NULL;
+	size_t i;
+#ifdef MFD_HUGETLB
+	if(numa->huge == 2) {
+		if((p = numa_memfd_map(&n->fd, numa->size, 1)) != NULL)
+			n->hugetlb = 1;
+		else	log_msg(LOG_INFO, "database-numa-replicas: no "
+				"hugetlbfs pages for the copy on node %d, using "
+				"transparent huge pages", n->node);
+	}
+#endif
+	if(!p && !(p = numa_memfd_map(&n->fd, numa->size, 0)))
+		return 0;
+	if(numa->small_size && !(s = numa_memfd_map(&n->fd_small,
+		numa->small_size, 0))) {
+		(void)munmap(p, numa->size);
+		return 0;
+	}
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+	if(numa->huge && !n->hugetlb)
+		(void)madvise(p, numa->size, MADV_HUGEPAGE);
+#endif
+	numa_bind(p, numa->size, n->node);
+	if(s)
+		numa_bind(s, numa->small_size, n->node);
+	numa_set_cpus(n->cpus, n->cpu_count);
+	for(i=0; i<numa->range_count; i++)
+		memcpy((numa->ranges[i].small?s:p) + numa->ranges[i].offset,
+			numa->ranges[i].start, numa->ranges[i].size);
+	if(munmap(p, numa->size) == -1 ||
+		(s && munmap(s, numa->small_size) == -1))
+		log_msg(LOG_ERR, "database-numa-replicas: munmap failed: %s",
+			strerror(errno));
+	return 1;
+}
+
+/* the NUMA node of the cpu that this process runs on, or -1 */
+static int
+numa_current_node(void)
+{
+#ifdef SYS_getcpu
+	unsigned cpu = 0, node = 0;
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return (int)node;
+#endif
+	return -1;
+}
+#endif /* NUMA_REPLICAS */
+
+struct numa_replicas*
+numa_replicas_create(struct nsd* nsd)
+{
+#ifdef NUMA_REPLICAS
+	struct numa_replicas* numa = (struct numa_replicas*)xalloc_zero(
+		sizeof(*numa));
+	size_t i;
+	cpuset_t* saved;
+#ifdef USE_COMPACT_DOMAINS
+	size_t domains, domain_mem;
+#endif
+	numa->huge = nsd->options->database_huge_pages;
+	if(!numa_read_nodes(numa)) {
+		numa_replicas_delete(numa);
+		return NULL;
+	}
+	if(numa->node_count < 2) {
+		VERBOSITY(1, (LOG_INFO, "database-numa-replicas: one NUMA "
+			"node, the zone data is not copied"));
+		numa_replicas_delete(numa);
+		return NULL;
+	}
+	region_walk_arenas(nsd->db->region, numa_add_range, numa);
+#ifdef USE_COMPACT_DOMAINS
+	domain_arena_stats(&domains, &domain_mem);
+	if(domain_arena_base && domain_mem)
+		numa_add_range(domain_arena_base, domain_mem, numa);
+#endif
+	if(numa->size == 0) {
+		log_msg(LOG_ERR, "database-numa-replicas: the zone data is "
+			"not in arenas, it is not copied");
+		numa_replicas_delete(numa);
+		return NULL;
+	}
+	if(numa->huge == 1)
+		numa_check_thp_shmem();
+
+	/* the copies are made on the cpus of their node, after that this
+	 * process runs on the cpus it had before */
+	saved = cpuset_create();
+	if(get_cpu_affinity(saved) != 0)
+		log_msg(LOG_ERR, "database-numa-replicas: cannot get cpu "
+			"affinity: %s", strerror(errno));
+	for(i=0; i<numa->node_count; i++) {
+		if(!numa_node_fill(numa, &numa->nodes[i]))
+			break;
+	}
+	if(set_cpu_affinity(nsd->use_cpu_affinity?nsd->cpuset:saved) != 0)
+		log_msg(LOG_ERR, "database-numa-replicas: cannot set cpu "
+			"affinity: %s", strerror(errno));
+	cpuset_destroy(saved);
+	if(i < numa->node_count) {
+		numa_replicas_delete(numa);
+		return NULL;
+	}
+	VERBOSITY(1, (LOG_INFO, "database-numa-replicas: copied %u bytes of "
+		"zone data to %u NUMA nodes", (unsigned)(numa->size +
+		numa->small_size), (unsigned)numa->node_count));
+	return numa;
+#else
+	(void)nsd;
+	log_msg(LOG_ERR, "database-numa-replicas: not supported on this "
+		"system");
+	return NULL;
+#endif /* NUMA_REPLICAS */
+}
+
+void
+numa_replicas_delete(struct numa_replicas* numa)
+{
+	size_t i;
+	if(!numa)
+		return;
+	for(i=0; i<numa->node_count; i++) {
+		if(numa->nodes[i].fd != -1)
+			close(numa->nodes[i].fd);
+		if(numa->nodes[i].fd_small != -1)
+			close(numa->nodes[i].fd_small);
+		free(numa->nodes[i].cpus);
+	}
+	free(numa->nodes);
+	free(numa->ranges);
+	free(numa);
+}
+
+void
+numa_replicas_map(struct nsd* nsd)
+{
+#ifdef NUMA_REPLICAS
+	struct numa_replicas* numa = nsd->numa;
+	struct numa_node* n = NULL;
+	size_t i, j, c, best = 0;
+	int node;
+	if(nsd->use_cpu_affinity && nsd->this_child->cpuset) {
+		/* the node with the most cpus of this server */
+		for(i=0; i<numa->node_count; i++) {
+			c = 0;
+			for(j=0; j<numa->nodes[i].cpu_count; j++)
+				if(cpuset_isset((cpuid_t)numa->nodes[i].cpus[j],
+					nsd->this_child->cpuset))
+					c++;
+			if(c > best) {
+				best = c;
+				n = &numa->nodes[i];
+			}
+		}
+	} else {
+		/* the node this server runs on now, the scheduler mostly
+		 * keeps it there */
+		node = numa_current_node();
+		for(i=0; i<numa->node_count; i++)
+			if(numa->nodes[i].node == node)
+				n = &numa->nodes[i];
+		if(!n)
+			n = &numa->nodes[nsd->this_child->child_num %
+				numa->node_count];
+	}
+	if(n) {
+		for(i=0; i<numa->range_count; i++) {
+			struct numa_range* r = &numa->ranges[i];
+			/* the hugetlbfs pages are not reserved for every
+			 * server, a page that is written to is copied from
+			 * the pool, like for the arenas of the zone data */
+			if(mmap(r->start, r->size, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_FIXED|(!r->small && n->hugetlb?
+				MAP_NORESERVE:0), r->small?n->fd_small:n->fd,
+				(off_t)r->offset) == MAP_FAILED) {
+				log_msg(LOG_ERR, "database-numa-replicas: "
+					"mmap of node %d failed: %s", n->node,
+					strerror(errno));
+				exit(1);
+			}
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+			if(numa->huge && (r->small || !n->hugetlb))
+				(void)madvise(r->start, r->size,
+					MADV_HUGEPAGE);
+#endif
+		}
+		VERBOSITY(2, (LOG_INFO, "server %d uses the zone data on "
+			"NUMA node %d", nsd->this_child->child_num + 1,
+			n->node));
+	}
+	/* the mappings keep the replica, the server needs no descriptors */
+	for(i=0; i<numa->node_count; i++) {
+		if(numa->nodes[i].fd != -1)
+			close(numa->nodes[i].fd);
+		if(numa->nodes[i].fd_small != -1)
+			close(numa->nodes[i].fd_small);
+		numa->nodes[i].fd = -1;
+		numa->nodes[i].fd_small = -1;
+	}
+#else
+	(void)nsd;
+#endif /* NUMA_REPLICAS */
+}
+
+void
+numa_replicas_stats(struct numa_replicas* numa, uint64_t* bytes, size_t num)
+{
+	size_t i;
+	memset(bytes, 0, num*sizeof(uint64_t));
+	if(!numa)
+		return;
+	for(i=0; i<numa->node_count; i++) {
+		if(numa->nodes[i].node >= 0 && (size_t)numa->nodes[i].node < num)
+			bytes[numa->nodes[i].node] = numa->size +
+				numa->small_size;
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * numa.h -- copies of the zone data on every NUMA node, for the server
+ * processes on that node.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+struct nsd;
+
+/* the NUMA nodes are listed in sysfs */
+#ifndef NUMA_SYSFS_DIR
+#define NUMA_SYSFS_DIR "/sys/devices/system/node"
+#endif
+/* the directory that is read, NUMA_SYSFS_DIR, the tests change it */
+extern const char* numa_sysfs_dir;
+
+/*
+ * A replica is a memfd with a copy of the arenas of the zone data region,
+ * and of the domain arena.  The server processes map it over the arenas,
+ * at the same addresses, so the pointers in the zone data stay valid.
+ * It is mapped private, a page that is written to is copied for the
+ * process.  The arenas are in a memfd with hugetlbfs pages if the zone
+ * data uses them, the ranges that are not on huge page boundaries are in
+ * a second memfd with small pages.
+ */
+struct numa_node {
+	/* the node number in sysfs */
+	int node;
+	/* the cpus of the node */
+	int* cpus;
+	size_t cpu_count;
+	/* memfd with the copy of the arenas, -1 if none */
+	int fd;
+	/* if fd has hugetlbfs pages */
+	int hugetlb;
+	/* memfd with the copy of the other ranges, -1 if none */
+	int fd_small;
+};
+
+/* a range of zone data memory that is copied to the replicas */
+struct numa_range {
+	char* start;
+	size_t size;
+	/* offset in the replica */
+	size_t offset;
+	/* if in the memfd with small pages */
+	int small;
+};
+
+struct numa_replicas {
+	/* the nodes with cpus */
+	struct numa_node* nodes;
+	size_t node_count;
+	/* the ranges in the replicas */
+	struct numa_range* ranges;
+	size_t range_count;
+	size_t range_max;
+	/* bytes in a replica, in the memfd of the arenas and in the one
+	 * with small pages */
+	size_t size;
+	size_t small_size;
+	/* database-huge-pages, 1 transparent huge pages, 2 hugetlbfs */
+	int huge;
+};
+
+/*
+ * Copy the zone data of nsd->db to memory on every NUMA node.  The zone
+ * data must be in the slab region, the copies are of its arenas.
+ * Returns NULL if the system has one node, or if the copies cannot be
+ * made, that is logged.  Call before the server processes are forked.
+ */
+struct numa_replicas* numa_replicas_create(struct nsd* nsd);
+
+/* close the replicas and free the structure, the mappings of server
+ * processes stay valid */
+void numa_replicas_delete(struct numa_replicas* numa);
+
+/*
+ * In a server process, pick the NUMA node and map its replica over the
+ * zone data.  The node is the one with the most cpus of the
+ * server-N-cpu-affinity, or without cpu affinity, the node that the
+ * process runs on.  The process is not pinned to the node.
+ */
+void numa_replicas_map(struct nsd* nsd);
+
+/* bytes of zone data per NUMA node number, for the nodes below num */
+void numa_replicas_stats(struct numa_replicas* numa, uint64_t* bytes,
+	size_t num);
+
+#endif /* NUMA_H */
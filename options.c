@@ -63,6 +63,14 @@ nsd_options_create(region_type* region)
 	opt->do_ip4 = 1;
 	opt->do_ip6 = 1;
 	opt->database = DBFILE;
+	opt->database_read_threads = 1;
+	opt->database_huge_pages = 0;
+	opt->database_prefault = 0;
+	opt->database_numa_replicas = 0;
+	opt->database_cow_audit = 0;
+	opt->lazy_zones = 0;
+	opt->lazy_zones_memory = 0;
+	opt->lazy_zones_cold_drop = 0;
 	opt->identity = 0;
 	opt->version = 0;
 	opt->nsid = 0;
@@ -117,12 +125,25 @@ nsd_options_create(region_type* region)
 	opt->dnstap_version = NULL;
 	opt->dnstap_log_auth_query_messages = 0;
 	opt->dnstap_log_auth_response_messages = 0;
+	opt->dnstap_sample_rate = 0;
+	opt->dnstap_filter_zones = NULL;
+	opt->dnstap_filter_qtypes = NULL;
+	opt->dnstap_filter_rcodes = 0;
+	opt->dnstap_filter_transport = 0;
+	opt->dnstap_filter_rrl = 0;
+	opt->dnstap_filter_tc = 0;
 #endif
 	opt->zonefiles_check = 1;
 	if(opt->database == NULL || opt->database[0] == 0)
 		opt->zonefiles_write = ZONEFILES_WRITE_INTERVAL;
 	else	opt->zonefiles_write = 0;
 	opt->xfrd_reload_timeout = 1;
+	opt->xfrd_reload_max_staleness = 30;
+	opt->xfrd_udp_window = 128;
+	opt->xfrd_udp_master_rate = 0;
+	opt->xfrd_notify_window = 1024;
+	opt->xfrd_notify_rate = 0;
+	opt->xfrd_tcp_idle_timeout = 10;
 	opt->tls_service_key = NULL;
 	opt->tls_service_ocsp = NULL;
 	opt->tls_service_pem = NULL;
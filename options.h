@@ -74,6 +74,24 @@ struct nsd_options {
 	int do_ip4;
 	int do_ip6;
 	const char* database;
+	/* number of threads that decode the zones when nsd.db is read */
+	int database_read_threads;
+	/* back the zone data in memory with huge pages, 1 transparent
+	 * huge pages, 2 hugetlbfs pages */
+	int database_huge_pages;
+	/* fault in the memory for the zone data when it is allocated */
+	int database_prefault;
+	/* copy the zone data to every NUMA node for the server children */
+	int database_numa_replicas;
+	/* write protect the zone data in the server children, and count
+	 * the pages they write to */
+	int database_cow_audit;
+	/* read the zones when they are first used */
+	int lazy_zones;
+	/* megabytes for the zones read by lazy-zones, 0 is no limit */
+	int lazy_zones_memory;
+	/* drop the queries for zones that are not read yet, no SERVFAIL */
+	int lazy_zones_cold_drop;
 	const char* identity;
 	const char* version;
 	const char* logfile;
@@ -101,6 +119,19 @@ struct nsd_options {
 	const char* zonelistfile;
 	const char* nsid;
 	int xfrd_reload_timeout;
+	/* max seconds that the reload wait period grows to, when reloads
+	 * take long */
+	int xfrd_reload_max_staleness;
+	/* max outstanding udp queries of xfrd */
+	int xfrd_udp_window;
+	/* max udp queries per second per master, 0 is no limit */
+	int xfrd_udp_master_rate;
+	/* max zones that send NOTIFY at the same time */
+	int xfrd_notify_window;
+	/* max NOTIFY per second per secondary, 0 is no limit */
+	int xfrd_notify_rate;
+	/* seconds an idle xfrd tcp connection to a master stays open */
+	int xfrd_tcp_idle_timeout;
 	int zonefiles_check;
 	int zonefiles_write;
 	int log_time_ascii;
@@ -162,10 +193,32 @@ struct nsd_options {
 	int dnstap_log_auth_query_messages;
 	/** true to log dnstap AUTH_RESPONSE message events */
 	int dnstap_log_auth_response_messages;
+	/** log 1 in this number of queries, 0 or 1 logs all */
+	int dnstap_sample_rate;
+	/** only log queries for these zones, NULL for all zones */
+	struct dnstap_zone_option* dnstap_filter_zones;
+	/** bitmap of the qtypes to log, NULL for all qtypes */
+	uint8_t* dnstap_filter_qtypes;
+	/** bitmap of the rcodes to log, 0 for all rcodes */
+	uint16_t dnstap_filter_rcodes;
+	/** only log udp (1) or tcp (2), 0 for both */
+	int dnstap_filter_transport;
+	/** only log queries that were rate limited */
+	int dnstap_filter_rrl;
+	/** only log truncated responses */
+	int dnstap_filter_tc;
 
 	region_type* region;
 };
 
+/*
+ * Zone name for the dnstap zone filter.
+ */
+struct dnstap_zone_option {
+	struct dnstap_zone_option* next;
+	char* name;
+};
+
 struct range_option {
 	struct range_option* next;
 	int first;
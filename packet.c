@@ -21,7 +21,7 @@ int minimal_responses = 0;
 static void
 encode_dname(query_type *q, domain_type *domain)
 {
-	while (domain->parent && query_get_dname_offset(q, domain) == 0) {
+	while (domain_parent(domain) && query_get_dname_offset(q, domain) == 0) {
 		query_put_dname_offset(q, domain, buffer_position(q->packet));
 		DEBUG(DEBUG_NAME_COMPRESSION, 2,
 		      (LOG_INFO, "dname: %s, number: %lu, offset: %u\n",
@@ -30,9 +30,9 @@ encode_dname(query_type *q, domain_type *domain)
 		       query_get_dname_offset(q, domain)));
 		buffer_write(q->packet, dname_name(domain_dname(domain)),
 			     label_length(dname_name(domain_dname(domain))) + 1U);
-		domain = domain->parent;
+		domain = domain_parent(domain);
 	}
-	if (domain->parent) {
+	if (domain_parent(domain)) {
 		DEBUG(DEBUG_NAME_COMPRESSION, 2,
 		      (LOG_INFO, "dname: %s, number: %lu, pointer: %u\n",
 		       domain_to_string(domain),
@@ -274,7 +274,7 @@ packet_read_rr(region_type *region, domain_table_type *owners,
 		return NULL;
 	}
 
-	result->owner = domain_table_insert(owners, owner);
+	rr_set_owner(result, domain_table_insert(owners, owner));
 	result->type = buffer_read_u16(packet);
 	result->klass = buffer_read_u16(packet);
 
@@ -110,7 +110,7 @@ query_clear_compression_tables(struct query *q)
 void
 query_add_compression_domain(struct query *q, domain_type *domain, uint16_t offset)
 {
-	while (domain->parent) {
+	while (domain_parent(domain)) {
 		DEBUG(DEBUG_NAME_COMPRESSION, 2,
 		      (LOG_INFO, "query dname: %s, number: %lu, offset: %u\n",
 		       domain_to_string(domain),
@@ -118,7 +118,7 @@ query_add_compression_domain(struct query *q, domain_type *domain, uint16_t offs
 		       offset));
 		query_put_dname_offset(q, domain, offset);
 		offset += label_length(dname_name(domain_dname(domain))) + 1;
-		domain = domain->parent;
+		domain = domain_parent(domain);
 	}
 }
 
@@ -247,6 +247,7 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 
 #ifdef RATELIMIT
 	q->wildcard_domain = NULL;
+	q->rrl_limited = 0;
 #endif
 }
 
@@ -254,6 +255,18 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 static domain_type*
 query_get_tempdomain(struct query *q)
 {
+#ifdef USE_COMPACT_DOMAINS
+	/* in the domain arena, so the links to them are indexes */
+	domain_type* d;
+	if(q->number_temporary_domains >= EXTRA_DOMAIN_NUMBERS)
+		return 0;
+	q->number_temporary_domains ++;
+	d = domain_arena_temp(q->number_temporary_domains-1);
+	memset(d, 0, sizeof(domain_type));
+	d->number = q->compressed_dname_offsets_size +
+		q->number_temporary_domains - 1;
+	return d;
+#else
 	static domain_type d[EXTRA_DOMAIN_NUMBERS];
 	if(q->number_temporary_domains >= EXTRA_DOMAIN_NUMBERS)
 		return 0;
@@ -262,6 +275,7 @@ query_get_tempdomain(struct query *q)
 	d[q->number_temporary_domains-1].number = q->compressed_dname_offsets_size +
 		q->number_temporary_domains - 1;
 	return &d[q->number_temporary_domains-1];
+#endif /* USE_COMPACT_DOMAINS */
 }
 
 static void
@@ -405,6 +419,44 @@ process_tsig(struct query* q)
 	return NSD_RC_OK;
 }
 
+/*
+ * Ask xfrd to read a cold zone of lazy-zones, it is read by the next reload.
+ * The servers ask once per reload, the mark is in the shared lazy_used.
+ */
+void
+query_lazy_zone_load(struct nsd* nsd, zone_type* zone)
+{
+	sig_atomic_t mode = NSD_PASS_TO_XFRD;
+	const dname_type* apex = domain_dname(zone->apex);
+	uint8_t pkt[QHEADERSZ + MAXDOMAINLEN + 4];
+	uint16_t sz, t;
+	uint32_t acl = htonl((uint32_t)-1);
+	int s;
+	if(!zone->lazy_id || !nsd->this_child ||
+		nsd->db->lazy_used[zone->lazy_id] ==
+		LAZY_ZONE_ASKED(nsd->db->lazy_gen))
+		return;
+	nsd->db->lazy_used[zone->lazy_id] = LAZY_ZONE_ASKED(nsd->db->lazy_gen);
+	/* a SOA query for the apex, xfrd reads the zone name from it */
+	memset(pkt, 0, QHEADERSZ);
+	pkt[5] = 1; /* QDCOUNT */
+	memmove(pkt+QHEADERSZ, dname_name(apex), apex->name_size);
+	t = htons(TYPE_SOA);
+	memmove(pkt+QHEADERSZ+apex->name_size, &t, sizeof(t));
+	t = htons(CLASS_IN);
+	memmove(pkt+QHEADERSZ+apex->name_size+2, &t, sizeof(t));
+	sz = htons(QHEADERSZ + apex->name_size + 4);
+	s = nsd->this_child->parent_fd;
+	if(!write_socket(s, &mode, sizeof(mode)) ||
+		!write_socket(s, &sz, sizeof(sz)) ||
+		!write_socket(s, pkt, QHEADERSZ + apex->name_size + 4) ||
+		!write_socket(s, &acl, sizeof(acl)) ||
+		!write_socket(s, &acl, sizeof(acl))) {
+		log_msg(LOG_ERR, "error in IPC lazy zone server2main, %s",
+			strerror(errno));
+	}
+}
+
 /*
  * Check notify acl and forward to xfrd (or return an error).
  */
@@ -590,7 +642,7 @@ find_covering_nsec(domain_type *closest_match,
 #else
 	while (closest_match->node.parent == NULL)
 #endif
-		closest_match = closest_match->parent;
+		closest_match = domain_parent(closest_match);
 	while (closest_match) {
 		*nsec_rrset = domain_find_rrset(closest_match, zone, TYPE_NSEC);
 		if (*nsec_rrset) {
@@ -659,7 +711,7 @@ add_additional_rrsets(struct query *query, answer_type *answer,
 		 * based on a wildcard domain.
 		 */
 		while (!match->is_existing) {
-			match = match->parent;
+			match = domain_parent(match);
 		}
 		if (additional != match && domain_wildcard_child(match)) {
 			domain_type *wildcard_child = domain_wildcard_child(match);
@@ -673,8 +725,8 @@ add_additional_rrsets(struct query *query, answer_type *answer,
 			temp->node.parent = NULL;
 #endif
 			temp->number = additional->number;
-			temp->parent = match;
-			temp->wildcard_child_closest_match = temp;
+			domain_set_parent(temp, match);
+			domain_set_wildcard_match(temp, temp);
 			temp->rrsets = wildcard_child->rrsets;
 			temp->is_existing = wildcard_child->is_existing;
 			additional = temp;
@@ -785,7 +837,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 		if(answer->section[j] == ANSWER_SECTION &&
 			answer->rrsets[j]->rr_count == 1 &&
 			answer->rrsets[j]->rrs[0].type == TYPE_CNAME &&
-			dname_compare(domain_dname(answer->rrsets[j]->rrs[0].owner), from_name) == 0 &&
+			dname_compare(domain_dname(rr_owner(&answer->rrsets[j]->rrs[0])), from_name) == 0 &&
 			answer->rrsets[j]->rrs[0].rdata_count == 1 &&
 			dname_compare(domain_dname(answer->rrsets[j]->rrs[0].rdatas->domain), to_name) == 0) {
 			DEBUG(DEBUG_QUERY,2, (LOG_INFO, "loop for synthesized CNAME rrset for query %s", dname_to_string(q->qname, NULL)));
@@ -800,7 +852,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 		if(!newdom)
 			return 0;
 		newdom->is_existing = 1;
-		newdom->parent = lastparent;
+		domain_set_parent(newdom, lastparent);
 #ifdef USE_RADIX_TREE
 		newdom->dname
 #else
@@ -827,7 +879,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 		if(!newdom)
 			return 0;
 		newdom->is_existing = 0;
-		newdom->parent = lastparent;
+		domain_set_parent(newdom, lastparent);
 #ifdef USE_RADIX_TREE
 		newdom->dname
 #else
@@ -849,7 +901,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 	rrset->rr_count = 1;
 	rrset->rrs = (rr_type*) region_alloc(q->region, sizeof(rr_type));
 	memset(rrset->rrs, 0, sizeof(rr_type));
-	rrset->rrs->owner = cname_domain;
+	rr_set_owner(rrset->rrs, cname_domain);
 	rrset->rrs->ttl = ttl;
 	rrset->rrs->type = TYPE_CNAME;
 	rrset->rrs->klass = CLASS_IN;
@@ -1097,8 +1149,8 @@ answer_authoritative(struct nsd   *nsd,
 #ifdef NSEC3
 	if(exact && domain_has_only_NSEC3(closest_match, q->zone)) {
 		exact = 0; /* pretend it does not exist */
-		if(closest_encloser->parent)
-			closest_encloser = closest_encloser->parent;
+		if(domain_parent(closest_encloser))
+			closest_encloser = domain_parent(closest_encloser);
 	}
 #endif /* NSEC3 */
 	if((dname_ce = find_dname_above(closest_encloser, q->zone)) != NULL) {
@@ -1177,8 +1229,8 @@ answer_authoritative(struct nsd   *nsd,
 		memcpy(&match->node, &wildcard_child->node, sizeof(rbnode_type));
 		match->node.parent = NULL;
 #endif
-		match->parent = closest_encloser;
-		match->wildcard_child_closest_match = match;
+		domain_set_parent(match, closest_encloser);
+		domain_set_wildcard_match(match, match);
 		match->number = domain_number;
 		match->rrsets = wildcard_child->rrsets;
 		match->is_existing = wildcard_child->is_existing;
@@ -1239,8 +1291,8 @@ answer_authoritative(struct nsd   *nsd,
 			 * proving there is no wildcard.
 			 */
 			if(closest_encloser && (nsec_domain =
-				find_covering_nsec(closest_encloser->
-					wildcard_child_closest_match, q->zone,
+				find_covering_nsec(domain_wildcard_match(
+					closest_encloser), q->zone,
 					&nsec_rrset)) != NULL) {
 				add_rrset(q, answer, AUTHORITY_SECTION, nsec_domain, nsec_rrset);
 			}
@@ -1276,6 +1328,15 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 		return;
 	}
 	assert(closest_encloser); /* otherwise, no q->zone would be found */
+	if(q->zone->is_cold) {
+		/* lazy-zones, the zone is not read yet */
+		query_lazy_zone_load(nsd, q->zone);
+		if(q->cname_count == 0)
+			RCODE_SET(q->packet, RCODE_SERVFAIL);
+		return;
+	}
+	if(nsd->db->lazy_used)
+		lazy_zone_touch(nsd->db, q->zone);
 	if(!q->zone->apex || !q->zone->soa_rrset) {
 		/* zone is configured but not loaded */
 		if(q->cname_count == 0)
@@ -1298,7 +1359,7 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 	if (closest_encloser && !closest_encloser->is_existing) {
 		exact = 0;
 		while (closest_encloser != NULL && !closest_encloser->is_existing)
-			closest_encloser = closest_encloser->parent;
+			closest_encloser = domain_parent(closest_encloser);
 	}
 
 	/*
@@ -1314,6 +1375,14 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 		zone_type *zone = domain_find_parent_zone(nsd->db, q->zone);
 		if (zone) {
 			q->zone = zone;
+			if(q->zone->is_cold) {
+				query_lazy_zone_load(nsd, q->zone);
+				if(q->cname_count == 0)
+					RCODE_SET(q->packet, RCODE_SERVFAIL);
+				return;
+			}
+			if(nsd->db->lazy_used)
+				lazy_zone_touch(nsd->db, q->zone);
 			if(!q->zone->apex || !q->zone->soa_rrset) {
 				/* zone is configured but not loaded */
 				if(q->cname_count == 0)
@@ -1604,6 +1673,12 @@ query_process(query_type *q, nsd_type *nsd)
 
 	answer_query(nsd, q);
 
+	/* lazy-zones, drop the UDP query for a zone that is not read yet,
+	 * the client retries, and it is answered when the zone is read */
+	if(RCODE(q->packet) == RCODE_SERVFAIL && q->zone && q->zone->is_cold &&
+		nsd->options->lazy_zones_cold_drop && !q->tcp)
+		return QUERY_DISCARDED;
+
 	return QUERY_PROCESSED;
 }
 
@@ -120,6 +120,8 @@ struct query {
 #ifdef RATELIMIT
 	/* if we encountered a wildcard, its domain */
 	domain_type *wildcard_domain;
+	/* if the response was rate limited, and slipped or dropped */
+	int rrl_limited;
 #endif
 };
 
@@ -186,6 +188,11 @@ void query_reset(query_type *query, size_t maxlen, int is_tcp);
  */
 query_state_type query_process(query_type *q, nsd_type *nsd);
 
+/*
+ * Ask xfrd to read a cold zone of lazy-zones, once per reload.
+ */
+void query_lazy_zone_load(struct nsd* nsd, struct zone* zone);
+
 /*
  * Prepare the query structure for writing the response. The packet
  * data up-to the current packet limit is preserved. This usually
@@ -817,12 +817,21 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 				region_destroy(temp_region);
 				return -1;
 			}
-			if(is_wirestore) {
+			if(is_wirestore && rdata_atom_set_inline(
+				&temp_rdatas[i], dname_name(dname),
+				dname->name_size)) {
+				/* stored in the atom */
+			} else if(is_wirestore) {
 				temp_rdatas[i].data = (uint16_t *) region_alloc(
                                 	region, sizeof(uint16_t) + ((size_t)dname->name_size));
 				temp_rdatas[i].data[0] = dname->name_size;
 				memcpy(temp_rdatas[i].data+1, dname_name(dname),
 					dname->name_size);
+			} else if(!owners) {
+				/* no table to insert into, keep the name */
+				temp_rdatas[i].data = (uint16_t *)
+					region_alloc_init(region, dname,
+					dname_total_size(dname));
 			} else {
 				temp_rdatas[i].domain
 					= domain_table_insert(owners, dname);
@@ -842,10 +851,17 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 				break;
 			}
 
-			temp_rdatas[i].data = (uint16_t *) region_alloc(
-				region, sizeof(uint16_t) + length);
-			temp_rdatas[i].data[0] = length;
-			buffer_read(packet, temp_rdatas[i].data + 1, length);
+			if(length <= RDATA_INLINE_MAX) {
+				rdata_atom_set_inline(&temp_rdatas[i],
+					buffer_current(packet), length);
+				buffer_skip(packet, length);
+			} else {
+				temp_rdatas[i].data = (uint16_t *) region_alloc(
+					region, sizeof(uint16_t) + length);
+				temp_rdatas[i].data[0] = length;
+				buffer_read(packet, temp_rdatas[i].data + 1,
+					length);
+			}
 		}
 	}
 
@@ -27,7 +27,9 @@ int rdata_atom_to_string(buffer_type *output, rdata_zoneformat_type type,
  * Split the wireformat RDATA into an array of rdata atoms. Domain
  * names are inserted into the OWNERS table. The number of rdata atoms
  * is returned and the array itself is allocated in REGION and stored
- * in RDATAS.
+ * in RDATAS.  If OWNERS is NULL, the domain names are allocated in
+ * REGION and the data of the atom points to the dname_type, so that it
+ * can be inserted in a domain table later.
  *
  * Returns -1 on failure.
  */
@@ -10,13 +10,26 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "region-allocator.h"
 #include "util.h"
 
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define	MAP_ANONYMOUS	MAP_ANON
+#endif
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+/* small objects can be put in slabs, see region_create_slab */
+#define REGION_SLAB 1
+#endif
+
 /** This value is enough so that x*y does not overflow if both < than this */
 #define REGION_NO_OVERFLOW ((size_t)1 << (sizeof(size_t) * 4))
 
@@ -52,6 +65,49 @@ struct large_elem {
 	struct large_elem* prev;
 };
 
+/* size of a slab, and its alignment, so the slab of an object is found
+ * from its address */
+#define REGION_SLAB_SIZE	(64*1024)
+/* the objects start after the slab header */
+#define REGION_SLAB_HEADER	64
+#define REGION_SLAB_START(s)	((char*)(s) + REGION_SLAB_HEADER)
+#define REGION_SLAB_END(s)	((char*)(s) + REGION_SLAB_SIZE)
+#define REGION_SLAB_OF(p)	((struct region_slab*)((uintptr_t)(p) & \
+				~(uintptr_t)(REGION_SLAB_SIZE-1)))
+/* max number of size classes */
+#define REGION_SLAB_CLASSES	32
+/* the slabs are carved from arenas, aligned to their size, so that an
+ * arena can be a huge page */
+#define REGION_ARENA_SIZE	(2*1024*1024)
+
+/* a slab with the objects of one size class, or an empty slab */
+struct region_slab {
+	/* in the list of slabs of the class with free objects, or in the
+	 * list of empty slabs */
+	struct region_slab* next;
+	struct region_slab* prev;
+	/* the size class, NULL if empty */
+	struct region_slab_class* cls;
+	/* recycled objects in the slab */
+	struct recycle_elem* free;
+	/* start of the part of the slab that is not carved into objects */
+	char* carve;
+	/* number of objects in use */
+	size_t used;
+	/* if the pages of the empty slab are given back to the OS */
+	int released;
+};
+
+struct region_slab_class {
+	/* size of the objects */
+	size_t size;
+	/* slabs that have free objects */
+	struct region_slab* avail;
+	/* number of slabs and objects in use of this class */
+	size_t slabs;
+	size_t used;
+};
+
 struct region
 {
 	size_t        total_allocated;
@@ -82,6 +138,26 @@ struct region
 	struct recycle_elem** recycle_bin;
 	/* amount of memory in recycle storage */
 	size_t		recycle_size;
+
+	/* if not NULL the small objects are in slabs, by size class.
+	 * slab_index[i] is the class for objects of size i. */
+	struct region_slab_class* slab_class;
+	uint8_t*	slab_index;
+	size_t		slab_class_num;
+	/* empty slabs, kept to be used for any class */
+	struct region_slab* slab_empty;
+	/* number of slabs, of empty slabs, and of empty slabs with
+	 * the pages given back */
+	size_t		slab_count;
+	size_t		slab_empty_count;
+	size_t		slab_released;
+	/* the page size, for the part of a slab that can be given back */
+	size_t		slab_page;
+	/* REGION_SLAB_HUGE, REGION_SLAB_HUGETLB and REGION_SLAB_PREFAULT */
+	int		slab_flags;
+	/* the part of the current arena that has no slabs yet */
+	char*		arena_next;
+	char*		arena_end;
 };
 
 
@@ -101,6 +177,17 @@ alloc_region_base(void *(*allocator)(size_t size),
 	result->recycle_bin = NULL;
 	result->recycle_size = 0;
 	result->large_list = NULL;
+	result->slab_class = NULL;
+	result->slab_index = NULL;
+	result->slab_class_num = 0;
+	result->slab_empty = NULL;
+	result->slab_count = 0;
+	result->slab_empty_count = 0;
+	result->slab_released = 0;
+	result->slab_page = 0;
+	result->slab_flags = 0;
+	result->arena_next = NULL;
+	result->arena_end = NULL;
 
 	result->allocated = 0;
 	result->data = NULL;
@@ -180,6 +267,73 @@ region_type *region_create_custom(void *(*allocator)(size_t),
 	return result;
 }
 
+region_type *
+region_create_slab(void *(*allocator)(size_t),
+		   void (*deallocator)(void *),
+		   size_t large_object_size,
+		   size_t initial_cleanup_size,
+		   int flags)
+{
+#ifdef REGION_SLAB
+	region_type* result;
+	size_t i, sz, p;
+	if(large_object_size > REGION_SLAB_SIZE/8)
+		large_object_size = REGION_SLAB_SIZE/8;
+	result = alloc_region_base(allocator, deallocator,
+		initial_cleanup_size);
+	if(!result)
+		return NULL;
+	result->chunk_size = 0;
+	result->large_object_size = large_object_size;
+	result->slab_class = allocator(sizeof(struct region_slab_class)
+		* REGION_SLAB_CLASSES);
+	result->slab_index = allocator(large_object_size);
+	if(!result->slab_class || !result->slab_index) {
+		region_destroy(result);
+		return NULL;
+	}
+	/* size classes are powers of two, and halfway between them,
+	 * 8 16 24 32 48 64 96 .., up to the large object size */
+	sz = REGION_ALIGN_UP(sizeof(struct recycle_elem), ALIGNMENT);
+	p = sz;
+	i = 0;
+	while(i < REGION_SLAB_CLASSES) {
+		result->slab_class[result->slab_class_num++].size = sz;
+		if(sz >= large_object_size)
+			break;
+		if(sz == p && p >= 16 && p/2 >= ALIGNMENT)
+			sz = p + p/2;
+		else	sz = (p *= 2);
+		i++;
+	}
+	assert(result->slab_class[result->slab_class_num-1].size
+		>= large_object_size);
+	for(i=0, p=0; i<large_object_size; i++) {
+		while(result->slab_class[p].size < i)
+			p++;
+		result->slab_index[i] = (uint8_t)p;
+	}
+	for(i=0; i<result->slab_class_num; i++) {
+		result->slab_class[i].avail = NULL;
+		result->slab_class[i].slabs = 0;
+		result->slab_class[i].used = 0;
+	}
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	result->slab_page = (size_t)sysconf(_SC_PAGESIZE);
+#else
+	result->slab_page = 4096;
+#endif
+	result->slab_flags = flags;
+	return result;
+#else
+	(void)flags;
+	/* no slabs without mmap, use a recycle bin */
+	return region_create_custom(allocator, deallocator,
+		large_object_size*8, large_object_size, initial_cleanup_size,
+		1);
+#endif /* REGION_SLAB */
+}
+
 
 void
 region_destroy(region_type *region)
@@ -195,6 +349,10 @@ region_destroy(region_type *region)
 	deallocator(region->initial_data);
 	if(region->recycle_bin)
 		deallocator(region->recycle_bin);
+	if(region->slab_class)
+		deallocator(region->slab_class);
+	if(region->slab_index)
+		deallocator(region->slab_index);
 	if(region->large_list) {
 		struct large_elem* p = region->large_list, *np;
 		while(p) {
@@ -248,6 +406,229 @@ region_remove_cleanup(region_type *region, void (*action)(void *), void *data)
 	}
 }
 
+#ifdef REGION_SLAB
+static void
+region_arena_unmap(void* arena)
+{
+	if(munmap(arena, REGION_ARENA_SIZE) == -1)
+		log_msg(LOG_ERR, "munmap failed: %s", strerror(errno));
+}
+
+/* map a new arena, aligned to its size */
+static char*
+region_arena_map(region_type* region)
+{
+	char* p, *a;
+#ifdef MAP_HUGETLB
+	/* hugetlbfs pages, if the system has them available */
+	if((region->slab_flags & REGION_SLAB_HUGETLB)) {
+		p = mmap(NULL, REGION_ARENA_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+#ifdef MAP_HUGE_2MB
+			| MAP_HUGE_2MB
+#endif
+#ifdef MAP_POPULATE
+			| ((region->slab_flags & REGION_SLAB_PREFAULT)?
+			MAP_POPULATE:0)
+#endif
+			, -1, 0);
+		if(p != MAP_FAILED && ((uintptr_t)p & (REGION_ARENA_SIZE-1))
+			== 0)
+			return p;
+		if(p != MAP_FAILED)
+			(void)munmap(p, REGION_ARENA_SIZE);
+		/* use transparent huge pages from now on */
+		log_msg(LOG_INFO, "no hugetlbfs pages for the zone data, "
+			"using transparent huge pages");
+		region->slab_flags &= ~REGION_SLAB_HUGETLB;
+		region->slab_flags |= REGION_SLAB_HUGE;
+	}
+#endif
+	p = mmap(NULL, 2*REGION_ARENA_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
+		exit(1);
+	}
+	a = (char*)(((uintptr_t)p + REGION_ARENA_SIZE - 1) &
+		~(uintptr_t)(REGION_ARENA_SIZE-1));
+	if(a > p)
+		(void)munmap(p, a - p);
+	if(a + REGION_ARENA_SIZE < p + 2*REGION_ARENA_SIZE)
+		(void)munmap(a + REGION_ARENA_SIZE,
+			(p + 2*REGION_ARENA_SIZE) - (a + REGION_ARENA_SIZE));
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+	if((region->slab_flags & (REGION_SLAB_HUGE|REGION_SLAB_HUGETLB)))
+		(void)madvise(a, REGION_ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+	if((region->slab_flags & REGION_SLAB_PREFAULT)) {
+		/* write to the pages, so they are faulted in now */
+		char* q;
+#if defined(HAVE_MADVISE) && defined(MADV_POPULATE_WRITE)
+		if(madvise(a, REGION_ARENA_SIZE, MADV_POPULATE_WRITE) != 0)
+#endif
+		for(q = a; q < a + REGION_ARENA_SIZE; q += region->slab_page)
+			*(volatile char*)q = 0;
+	}
+	return a;
+}
+
+/* get a new slab from the current arena, or a new arena */
+static struct region_slab*
+region_slab_map(region_type* region)
+{
+	struct region_slab* s;
+	if(region->arena_next == region->arena_end) {
+		char* a = region_arena_map(region);
+		if(!region_add_cleanup(region, region_arena_unmap, a)) {
+			region_arena_unmap(a);
+			return NULL;
+		}
+		region->arena_next = a;
+		region->arena_end = a + REGION_ARENA_SIZE;
+	}
+	s = (struct region_slab*)region->arena_next;
+	region->arena_next += REGION_SLAB_SIZE;
+	return s;
+}
+
+static void
+region_slab_link(struct region_slab** list, struct region_slab* s)
+{
+	s->prev = NULL;
+	s->next = *list;
+	if(*list)
+		(*list)->prev = s;
+	*list = s;
+}
+
+static void
+region_slab_unlink(struct region_slab** list, struct region_slab* s)
+{
+	if(s->prev)
+		s->prev->next = s->next;
+	else	*list = s->next;
+	if(s->next)
+		s->next->prev = s->prev;
+}
+
+/* true if the slab has no room for another object */
+static int
+region_slab_full(struct region_slab* s)
+{
+	return !s->free && s->carve + s->cls->size > REGION_SLAB_END(s);
+}
+
+/* get a slab for the class, an empty one or a new one */
+static struct region_slab*
+region_slab_get(region_type* region, struct region_slab_class* c)
+{
+	struct region_slab* s = region->slab_empty;
+	if(s) {
+		region_slab_unlink(&region->slab_empty, s);
+		region->slab_empty_count--;
+		if(s->released) {
+			s->released = 0;
+			region->slab_released--;
+		}
+	} else {
+		s = region_slab_map(region);
+		if(!s)
+			return NULL;
+		s->released = 0;
+		region->slab_count++;
+	}
+	s->cls = c;
+	s->free = NULL;
+	s->carve = REGION_SLAB_START(s);
+	s->used = 0;
+	c->slabs++;
+	region_slab_link(&c->avail, s);
+	return s;
+}
+
+/* put the slab, that has no objects in use, on the empty list, and give
+ * its pages back to the OS. They read as zeroes when used again. */
+static void
+region_slab_release(region_type* region, struct region_slab* s)
+{
+	struct region_slab_class* c = s->cls;
+	region_slab_unlink(&c->avail, s);
+	c->slabs--;
+	region->recycle_size -= s->carve - REGION_SLAB_START(s);
+	s->cls = NULL;
+	s->free = NULL;
+	s->carve = REGION_SLAB_START(s);
+#if defined(HAVE_MADVISE) && defined(MADV_DONTNEED)
+	/* the first page, with the header, is kept.  Huge pages are kept,
+	 * and prefaulted pages too. */
+	if(region->slab_page < REGION_SLAB_SIZE && !(region->slab_flags &
+		(REGION_SLAB_HUGE|REGION_SLAB_HUGETLB|REGION_SLAB_PREFAULT)) &&
+		madvise((char*)s + region->slab_page,
+		REGION_SLAB_SIZE - region->slab_page, MADV_DONTNEED) == 0) {
+		s->released = 1;
+		region->slab_released++;
+	}
+#endif
+	region_slab_link(&region->slab_empty, s);
+	region->slab_empty_count++;
+}
+
+static void *
+region_slab_alloc(region_type *region, size_t size, size_t aligned_size)
+{
+	struct region_slab_class* c =
+		&region->slab_class[region->slab_index[aligned_size]];
+	struct region_slab* s = c->avail;
+	void* result;
+
+	if(!s && !(s = region_slab_get(region, c)))
+		return NULL;
+	if(s->free) {
+		result = s->free;
+		s->free = s->free->next;
+		region->recycle_size -= c->size;
+	} else {
+		result = s->carve;
+		s->carve += c->size;
+	}
+	s->used++;
+	if(region_slab_full(s))
+		region_slab_unlink(&c->avail, s);
+	c->used++;
+
+	region->total_allocated += c->size;
+	region->unused_space += c->size - size;
+	++region->small_objects;
+	return result;
+}
+
+static void
+region_slab_recycle(region_type *region, void *block, size_t size)
+{
+	struct region_slab* s = REGION_SLAB_OF(block);
+	struct region_slab_class* c = s->cls;
+	struct recycle_elem* elem = (struct recycle_elem*)block;
+
+	assert(c && s->used > 0);
+	if(region_slab_full(s))
+		region_slab_link(&c->avail, s);
+	elem->next = s->free;
+	s->free = elem;
+	s->used--;
+	c->used--;
+	region->recycle_size += c->size;
+	region->total_allocated -= c->size;
+	region->unused_space -= c->size - size;
+	--region->small_objects;
+
+	/* the last slab with room of the class is kept, so that
+	 * an alloc and recycle in turn does not map and release it */
+	if(s->used == 0 && !(c->avail == s && s->next == NULL))
+		region_slab_release(region, s);
+}
+#endif /* REGION_SLAB */
+
 void *
 region_alloc(region_type *region, size_t size)
 {
@@ -275,6 +656,11 @@ region_alloc(region_type *region, size_t size)
 		return (char *)result + sizeof(struct large_elem);
 	}
 
+#ifdef REGION_SLAB
+	if (region->slab_class)
+		return region_slab_alloc(region, size, aligned_size);
+#endif
+
 	if (region->recycle_bin && region->recycle_bin[aligned_size]) {
 		result = (void*)region->recycle_bin[aligned_size];
 		region->recycle_bin[aligned_size] = region->recycle_bin[aligned_size]->next;
@@ -399,6 +785,22 @@ region_free_all(region_type *region)
 		region->recycle_size = 0;
 	}
 
+	if(region->slab_class) {
+		/* the arenas are unmapped by the cleanups */
+		for(i=0; i<region->slab_class_num; i++) {
+			region->slab_class[i].avail = NULL;
+			region->slab_class[i].slabs = 0;
+			region->slab_class[i].used = 0;
+		}
+		region->slab_empty = NULL;
+		region->arena_next = NULL;
+		region->arena_end = NULL;
+		region->slab_count = 0;
+		region->slab_empty_count = 0;
+		region->slab_released = 0;
+		region->recycle_size = 0;
+	}
+
 	if(region->large_list) {
 		struct large_elem* p = region->large_list, *np;
 		void (*deallocator)(void *) = region->deallocator;
@@ -433,7 +835,7 @@ region_recycle(region_type *region, void *block, size_t size)
 {
 	size_t aligned_size;
 
-	if(!block || !region->recycle_bin)
+	if(!block || (!region->recycle_bin && !region->slab_class))
 		return;
 
 	if (size == 0) {
@@ -441,6 +843,12 @@ region_recycle(region_type *region, void *block, size_t size)
 	}
 	aligned_size = REGION_ALIGN_UP(size, ALIGNMENT);
 
+#ifdef REGION_SLAB
+	if(region->slab_class && aligned_size < region->large_object_size) {
+		region_slab_recycle(region, block, size);
+		return;
+	}
+#endif
 	if(aligned_size < region->large_object_size) {
 		struct recycle_elem* elem = (struct recycle_elem*)block;
 		/* we rely on the fact that ALIGNMENT is void* so the next will fit */
@@ -505,6 +913,19 @@ region_dump_stats(region_type *region, FILE *out)
 				fprintf(out, " %lu", (unsigned long)count);
 		}
 	}
+	if(region->slab_class) {
+		/* objects in use and slabs per size class */
+		size_t i;
+		fprintf(out, ", %lu slabs (%lu empty, %lu released)",
+			(unsigned long)region->slab_count,
+			(unsigned long)region->slab_empty_count,
+			(unsigned long)region->slab_released);
+		for(i=0; i<region->slab_class_num; i++)
+			fprintf(out, " %lu:%lu/%lu",
+				(unsigned long)region->slab_class[i].size,
+				(unsigned long)region->slab_class[i].used,
+				(unsigned long)region->slab_class[i].slabs);
+	}
 }
 
 size_t region_get_recycle_size(region_type* region)
@@ -522,6 +943,43 @@ size_t region_get_mem_unused(region_type* region)
 	return region->unused_space;
 }
 
+size_t region_get_alloc_count(region_type* region)
+{
+	return region->small_objects + region->large_objects;
+}
+
+void region_get_slab_stats(region_type* region, size_t* mapped,
+	size_t* used, size_t* released)
+{
+	size_t i;
+	*mapped = 0;
+	*used = 0;
+	*released = 0;
+	if(!region->slab_class)
+		return;
+	*mapped = region->slab_count * REGION_SLAB_SIZE;
+	for(i=0; i<region->slab_class_num; i++)
+		*used += region->slab_class[i].used *
+			region->slab_class[i].size;
+	*released = region->slab_released *
+		(REGION_SLAB_SIZE - region->slab_page);
+}
+
+void region_walk_arenas(region_type* region,
+	void (*func)(void* arena, size_t size, void* arg), void* arg)
+{
+#ifdef REGION_SLAB
+	size_t i;
+	for(i=0; i<region->cleanup_count; i++) {
+		if(region->cleanups[i].action == region_arena_unmap)
+			(*func)(region->cleanups[i].data, REGION_ARENA_SIZE,
+				arg);
+	}
+#else
+	(void)region; (void)func; (void)arg;
+#endif /* REGION_SLAB */
+}
+
 /* debug routine */
 void
 region_log_stats(region_type *region)
@@ -559,5 +1017,24 @@ region_log_stats(region_type *region)
 			}
 		}
 	}
+	if(region->slab_class) {
+		size_t i;
+		snprintf(str, strl, ", %lu slabs (%lu empty, %lu released)",
+			(unsigned long)region->slab_count,
+			(unsigned long)region->slab_empty_count,
+			(unsigned long)region->slab_released);
+		len = strlen(str);
+		str+=len;
+		strl-=len;
+		for(i=0; i<region->slab_class_num; i++) {
+			snprintf(str, strl, " %lu:%lu/%lu",
+				(unsigned long)region->slab_class[i].size,
+				(unsigned long)region->slab_class[i].used,
+				(unsigned long)region->slab_class[i].slabs);
+			len = strlen(str);
+			str+=len;
+			strl-=len;
+		}
+	}
 	log_msg(LOG_INFO, "memory: %s", buf);
 }
@@ -58,6 +58,30 @@ region_type *region_create_custom(void *(*allocator)(size_t),
 				  size_t initial_cleanup_size,
 				  int recycle);
 
+/*
+ * Create a new region that keeps the small objects in slabs of 64k, one
+ * size class per slab.  The size classes are powers of two, and halfway
+ * between.  A recycled object goes back to its slab, and when a slab is
+ * empty its pages are given back to the OS with madvise.  For long lived
+ * regions with lots of recycle, like the zone data.  Without mmap it is
+ * a region with a recycle bin.
+ * The slabs are carved from arenas of 2Mb.  With REGION_SLAB_HUGE in the
+ * flags, the arenas are marked for transparent huge pages.  With
+ * REGION_SLAB_HUGETLB they are hugetlbfs pages, if the system has them,
+ * and otherwise transparent huge pages.  The hugetlbfs pages are private,
+ * after a fork the copy on write of such a page takes a page from the
+ * pool, and if the pool is empty the process gets SIGBUS.  With
+ * REGION_SLAB_PREFAULT the arenas are faulted in when they are mapped.
+ * With any of the flags the pages of empty slabs are not given back.
+ */
+region_type *region_create_slab(void *(*allocator)(size_t),
+				void (*deallocator)(void *),
+				size_t large_object_size,
+				size_t initial_cleanup_size,
+				int flags);
+#define REGION_SLAB_HUGE	1
+#define REGION_SLAB_PREFAULT	2
+#define REGION_SLAB_HUGETLB	4
 
 /*
  * Destroy REGION.  All memory associated with REGION is freed as if
@@ -146,6 +170,16 @@ size_t region_get_recycle_size(region_type* region);
 size_t region_get_mem(region_type* region);
 /* get size of region memory unused */
 size_t region_get_mem_unused(region_type* region);
+/* get number of objects allocated in the region (since free_all) */
+size_t region_get_alloc_count(region_type* region);
+/* get the bytes in slabs, the bytes of objects in use in slabs, and the
+ * bytes of empty slabs given back to the OS.  Zero without slabs. */
+void region_get_slab_stats(region_type* region, size_t* mapped,
+	size_t* used, size_t* released);
+/* call func for every arena of slabs in the region, with its start and
+ * size in bytes.  The arenas are mapped memory, aligned to their size. */
+void region_walk_arenas(region_type* region,
+	void (*func)(void* arena, size_t size, void* arg), void* arg);
 
 /* Debug print REGION statistics to LOG. */
 void region_log_stats(region_type *region);
@@ -55,6 +55,7 @@
 #include <openssl/rand.h>
 #endif
 #include <ctype.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <assert.h>
 #include <fcntl.h>
@@ -74,10 +75,16 @@
 #include "xfrd.h"
 #include "xfrd-notify.h"
 #include "xfrd-tcp.h"
+#include "xfrd-disk.h"
+#include "xfrd-udp.h"
 #include "nsd.h"
 #include "options.h"
 #include "difffile.h"
 #include "ipc.h"
+#include "latency.h"
+#ifdef USE_DNSTAP
+#include "dnstap/dnstap_collector.h"
+#endif
 
 #ifdef HAVE_SYS_TYPES_H
 #  include <sys/types.h>
@@ -966,7 +973,7 @@ force_transfer_zone(xfrd_zone_type* zone)
 	/* if in TCP transaction, stop it immediately. */
 	if(zone->tcp_conn != -1)
 		xfrd_tcp_release(xfrd->tcp_set, zone);
-	else if(zone->zone_handler.ev_fd != -1)
+	else if(zone->udp_query)
 		xfrd_udp_release(zone);
 	/* pretend we not longer have it and force any
 	 * zone to be downloaded (even same serial, w AXFR) */
@@ -1032,7 +1039,7 @@ print_zonestatus(RES* ssl, xfrd_state_type* xfrd, struct zone_options* zo)
 		if(nz->is_waiting) {
 			if(!ssl_printf(ssl, "	notify: \"waiting-for-fd\"\n"))
 				return 0;
-		} else if(nz->notify_send_enable || nz->notify_send6_enable) {
+		} else if(nz->notify_send_enable) {
 			int i;
 			if(!ssl_printf(ssl, "	notify: \"send"))
 				return 0;
@@ -1066,9 +1073,9 @@ print_zonestatus(RES* ssl, xfrd_state_type* xfrd, struct zone_options* zo)
 		if(!print_soa_status(ssl, "notified-serial", &xz->soa_notified,
 			xz->soa_notified_acquired))
 			return 0;
-	} else if(xz->event_added) {
+	} else if(xz->timer_set) {
 		if(!ssl_printf(ssl, "\twait: \"%lu sec between attempts\"\n",
-			(unsigned long)xz->timeout.tv_sec))
+			(unsigned long)xz->timeout))
 			return 0;
 	}
 
@@ -1076,7 +1083,7 @@ print_zonestatus(RES* ssl, xfrd_state_type* xfrd, struct zone_options* zo)
 	if(xz->udp_waiting) {
 		if(!ssl_printf(ssl, "	transfer: \"waiting-for-UDP-fd\"\n"))
 			return 0;
-	} else if(xz->zone_handler.ev_fd != -1 && xz->tcp_conn == -1) {
+	} else if(xz->udp_query && xz->tcp_conn == -1) {
 		if(!ssl_printf(ssl, "	transfer: \"sent UDP to %s\"\n",
 			xz->master->ip_address_spec))
 			return 0;
@@ -1665,7 +1672,7 @@ repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt)
 			if(xz->tcp_conn != -1) {
 				xfrd_tcp_release(xfrd->tcp_set, xz);
 				xfrd_set_refresh_now(xz);
-			} else if(xz->zone_handler.ev_fd != -1) {
+			} else if(xz->udp_query) {
 				xfrd_udp_release(xz);
 				xfrd_set_refresh_now(xz);
 			}
@@ -1907,6 +1914,25 @@ do_serverpid(RES* ssl, xfrd_state_type* xfrd)
 	(void)ssl_printf(ssl, "%u\n", (unsigned)xfrd->reload_pid);
 }
 
+/** print the text of export_xfrd_state over the ssl connection */
+static int
+print_xfrd_state_text(void* arg, buffer_type* buf)
+{
+	/* terminate the text, buffer_printf left room for it */
+	buffer_write_u8(buf, 0);
+	return ssl_print_text((RES*)arg, (char*)buffer_begin(buf));
+}
+
+/** do the export_xfrd_state command: print the state in the text format */
+static void
+do_export_xfrd_state(RES* ssl, xfrd_state_type* xfrd)
+{
+	region_type* region = region_create(xalloc, free);
+	buffer_type* buf = buffer_create(region, 4096);
+	(void)xfrd_print_state_text(xfrd, buf, print_xfrd_state_text, ssl);
+	region_destroy(region);
+}
+
 /** do the print_tsig command: printout tsig info */
 static void
 do_print_tsig(RES* ssl, xfrd_state_type* xfrd, char* arg)
@@ -2210,6 +2236,8 @@ execute_cmd(struct daemon_remote* rc, RES* ssl, char* cmd, struct rc_state* rs)
 		do_repattern(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "serverpid", 9)) {
 		do_serverpid(ssl, rc->xfrd);
+	} else if(cmdcmp(p, "export_xfrd_state", 17)) {
+		do_export_xfrd_state(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "print_tsig", 10)) {
 		do_print_tsig(ssl, rc->xfrd, skipwhite(p+10));
 	} else if(cmdcmp(p, "update_tsig", 11)) {
@@ -2514,14 +2542,40 @@ print_stat_block(RES* ssl, char* n, char* d, struct nsdst* st)
 		return;
 }
 
+/* print the latency histograms, empty buckets are not printed */
+static void
+print_latency(RES* ssl, struct nsdst* st)
+{
+	const char* tpstr[] = {"udp", "tcp", "tls"};
+	const char* anstr[] = {"answer", "referral", "nodata", "nxdomain",
+		"other"};
+	int t, a, d, b;
+	for(t=0; t<LAT_TRANSPORTS; t++) {
+	    for(a=0; a<LAT_ANSWER_TYPES; a++) {
+		for(d=0; d<2; d++) {
+		    for(b=0; b<LAT_BUCKETS; b++) {
+			if(inhibit_zero && st->latency[t][a][d][b] == 0)
+				continue;
+			if(!ssl_printf(ssl, "latency.%s.%s.%s.usec.%lu=%lu\n",
+				tpstr[t], anstr[a], (d?"do":"nodo"),
+				(unsigned long)latency_bucket_start(b,
+				LAT_SUB_BITS),
+				(unsigned long)st->latency[t][a][d][b]))
+				return;
+		    }
+		}
+	    }
+	}
+}
+
 #ifdef USE_ZONE_STATS
 static void
 resize_zonestat(xfrd_state_type* xfrd, size_t num)
 {
-	struct nsdst** a = xalloc_array_zero(num, sizeof(struct nsdst*));
+	struct nsdzst** a = xalloc_array_zero(num, sizeof(struct nsdzst*));
 	if(xfrd->zonestat_clear_num != 0)
 		memcpy(a, xfrd->zonestat_clear, xfrd->zonestat_clear_num
-			* sizeof(struct nsdst*));
+			* sizeof(struct nsdzst*));
 	free(xfrd->zonestat_clear);
 	xfrd->zonestat_clear = a;
 	xfrd->zonestat_clear_num = num;
@@ -2531,7 +2585,12 @@ static void
 zonestat_print(RES* ssl, xfrd_state_type* xfrd, int clear)
 {
 	struct zonestatname* n;
-	struct nsdst stat0, stat1;
+	struct nsdst stat0;
+	struct nsdzst z[2], d[2];
+	stc_type overflowed;
+	/* the latency histograms are not counted per zone, they stay zero,
+	 * and per zone only the counters before them are cleared */
+	memset(&stat0, 0, sizeof(stat0));
 	RBTREE_FOR(n, struct zonestatname*, xfrd->nsd->options->zonestatnames){
 		char* name = (char*)n->node.key;
 		if(n->id >= xfrd->zonestat_safe)
@@ -2543,16 +2602,22 @@ zonestat_print(RES* ssl, xfrd_state_type* xfrd, int clear)
 		 * the newly forked processes get the other block to use,
 		 * these blocks are mmapped and are currently in use to
 		 * add statistics to */
-		memcpy(&stat0, &xfrd->nsd->zonestat[0][n->id], sizeof(stat0));
-		memcpy(&stat1, &xfrd->nsd->zonestat[1][n->id], sizeof(stat1));
-		stats_add(&stat0, &stat1);
-		
-		/* save a copy of current (cumulative) stats in stat1 */
-		memcpy(&stat1, &stat0, sizeof(stat1));
-		/* subtract last total of stats that was 'cleared' */
+		memcpy(&z[0], &xfrd->nsd->zonestat[0][n->id], sizeof(z[0]));
+		memcpy(&z[1], &xfrd->nsd->zonestat[1][n->id], sizeof(z[1]));
+		memcpy(d, z, sizeof(d));
+
+		/* subtract last total of stats that was 'cleared', the
+		 * overflow slots of the blocks keep their key, so the
+		 * stored copies of the blocks subtract slot by slot */
 		if(n->id < xfrd->zonestat_clear_num &&
-			xfrd->zonestat_clear[n->id])
-			stats_subtract(&stat0, xfrd->zonestat_clear[n->id]);
+			xfrd->zonestat_clear[n->id]) {
+			zonestat_subtract(&d[0], &xfrd->zonestat_clear[n->id][0]);
+			zonestat_subtract(&d[1], &xfrd->zonestat_clear[n->id][1]);
+		}
+		memset(&stat0, 0, offsetof(struct nsdst, latency));
+		zonestat_add(&stat0, &d[0]);
+		zonestat_add(&stat0, &d[1]);
+		overflowed = d[0].overflowed + d[1].overflowed;
 		if(clear) {
 			/* extend storage array if needed */
 			if(n->id >= xfrd->zonestat_clear_num) {
@@ -2562,11 +2627,10 @@ zonestat_print(RES* ssl, xfrd_state_type* xfrd, int clear)
 					resize_zonestat(xfrd, n->id+1);
 			}
 			if(!xfrd->zonestat_clear[n->id])
-				xfrd->zonestat_clear[n->id] = xalloc(
-					sizeof(struct nsdst));
+				xfrd->zonestat_clear[n->id] = xalloc_array_zero(2,
+					sizeof(struct nsdzst));
 			/* store last total of stats */
-			memcpy(xfrd->zonestat_clear[n->id], &stat1,
-				sizeof(struct nsdst));
+			memcpy(xfrd->zonestat_clear[n->id], z, sizeof(z));
 		}
 
 		/* stat0 contains the details that we want to print */
@@ -2575,10 +2639,68 @@ zonestat_print(RES* ssl, xfrd_state_type* xfrd, int clear)
 				stat0.ctcp6 + stat0.ctls + stat0.ctls6)))
 			return;
 		print_stat_block(ssl, name, ".", &stat0);
+		if(overflowed != 0 && !ssl_printf(ssl, "%s%snum.overflowed="
+			"%lu\n", name, ".", (unsigned long)overflowed))
+			return;
 	}
 }
 #endif /* USE_ZONE_STATS */
 
+/** print the reload pipeline statistics */
+static int
+print_reload_stats(RES* ssl, xfrd_state_type* xfrd)
+{
+	uint64_t age = 0;
+	if(xfrd->reload_pending) {
+		struct timespec now;
+		get_time_monotonic(&now);
+		age = timespec_elapsed_usec(&xfrd->reload_pending_since, &now);
+	}
+	if(!ssl_printf(ssl, "reload.queue=%lu\n",
+		(unsigned long)xfrd->reload_pending))
+		return 0;
+	if(!print_longnum(ssl, "reload.queue.age.usec=", age))
+		return 0;
+	if(!ssl_printf(ssl, "reload.running=%lu\n",
+		(unsigned long)xfrd->reload_running))
+		return 0;
+	if(!ssl_printf(ssl, "reload.wait=%lu\n",
+		(unsigned long)xfrd->reload_wait))
+		return 0;
+	if(!print_longnum(ssl, "reload.num=", xfrd->reload_num))
+		return 0;
+	if(!print_longnum(ssl, "reload.updates=", xfrd->reload_updates))
+		return 0;
+	if(!print_longnum(ssl, "reload.time.avg.usec=", xfrd->reload_time_avg))
+		return 0;
+	if(!print_longnum(ssl, "reload.time.last.usec=",
+		xfrd->reload_time_last))
+		return 0;
+	if(!print_longnum(ssl, "reload.staleness.last.usec=",
+		xfrd->reload_staleness_last))
+		return 0;
+	if(!print_longnum(ssl, "reload.staleness.max.usec=",
+		xfrd->reload_staleness_max))
+		return 0;
+	if(!print_longnum(ssl, "reload.last.tasks=", xfrd->reload_last_tasks))
+		return 0;
+	if(!print_longnum(ssl, "reload.last.xfrs=", xfrd->reload_last_xfrs))
+		return 0;
+	if(!print_longnum(ssl, "reload.last.process.usec=",
+		xfrd->reload_last_process))
+		return 0;
+	if(!print_longnum(ssl, "reload.last.sync.usec=",
+		xfrd->reload_last_sync))
+		return 0;
+	if(!print_longnum(ssl, "reload.last.children.usec=",
+		xfrd->reload_last_children))
+		return 0;
+	if(!print_longnum(ssl, "reload.last.quit.usec=",
+		xfrd->reload_last_quit))
+		return 0;
+	return 1;
+}
+
 static void
 print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear)
 {
@@ -2611,6 +2733,33 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear)
 		return;
 	if(!print_longnum(ssl, "size.db.mem=", xfrd->nsd->st.db_mem))
 		return;
+	if(!print_longnum(ssl, "size.db.free=", xfrd->nsd->st.db_free))
+		return;
+	for(i=0; i<DB_FREE_SIZES; i++) {
+		if(!ssl_printf(ssl, "size.db.free.%lu=%lu\n",
+			(unsigned long)32<<i,
+			(unsigned long)xfrd->nsd->st.db_free_chunks[i]))
+			return;
+	}
+	if(!print_longnum(ssl, "size.db.slab=", xfrd->nsd->st.db_slab))
+		return;
+	if(!print_longnum(ssl, "size.db.slab.used=",
+		xfrd->nsd->st.db_slab_used))
+		return;
+	if(!print_longnum(ssl, "size.db.slab.released=",
+		xfrd->nsd->st.db_slab_released))
+		return;
+	for(i=0; i<DB_NUMA_NODES; i++) {
+		if(xfrd->nsd->st.db_numa[i] == 0)
+			continue;
+		if(!ssl_printf(ssl, "size.db.numa.node%lu=%lu\n",
+			(unsigned long)i,
+			(unsigned long)xfrd->nsd->st.db_numa[i]))
+			return;
+	}
+	if(xfrd->nsd->options->database_cow_audit &&
+		!print_longnum(ssl, "size.db.cow=", xfrd->nsd->st.db_cow))
+		return;
 	if(!print_longnum(ssl, "size.xfrd.mem=", region_get_mem(xfrd->region)))
 		return;
 	if(!print_longnum(ssl, "size.config.disk=", 
@@ -2620,6 +2769,7 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear)
 		xfrd->nsd->options->region)))
 		return;
 	print_stat_block(ssl, "", "", &xfrd->nsd->st);
+	print_latency(ssl, &xfrd->nsd->st);
 
 	/* zone statistics */
 	if(!ssl_printf(ssl, "zone.master=%lu\n",
@@ -2627,6 +2777,80 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear)
 		return;
 	if(!ssl_printf(ssl, "zone.slave=%lu\n", (unsigned long)xfrd->zones->count))
 		return;
+
+	/* notify sending */
+	if(!ssl_printf(ssl, "notify.queue=%lu\n",
+		(unsigned long)xfrd->notify_waiting_num))
+		return;
+	if(!ssl_printf(ssl, "notify.active=%lu\n",
+		(unsigned long)xfrd->notify_udp_num))
+		return;
+	if(!ssl_printf(ssl, "notify.inflight=%lu\n",
+		(unsigned long)xfrd->udp_set->num_notify))
+		return;
+	if(!ssl_printf(ssl, "notify.sent=%lu\n",
+		(unsigned long)xfrd->notify_sent))
+		return;
+	if(!ssl_printf(ssl, "notify.acked=%lu\n",
+		(unsigned long)xfrd->notify_acked))
+		return;
+	if(!ssl_printf(ssl, "notify.failed=%lu\n",
+		(unsigned long)xfrd->notify_failed))
+		return;
+	if(!ssl_printf(ssl, "notify.latency.usec.avg=%lu\n",
+		(unsigned long)(xfrd->notify_acked?xfrd->notify_latency_sum/
+		xfrd->notify_acked:0)))
+		return;
+	if(!ssl_printf(ssl, "notify.latency.usec.max=%lu\n",
+		(unsigned long)xfrd->notify_latency_max))
+		return;
+
+	/* tcp connections to masters, and their reuse for transfers */
+	if(!ssl_printf(ssl, "xfr.tcp.open=%lu\n",
+		(unsigned long)xfrd->tcp_set->tcp_count))
+		return;
+	if(!ssl_printf(ssl, "xfr.tcp.idle=%lu\n",
+		(unsigned long)xfrd_tcp_num_idle(xfrd->tcp_set)))
+		return;
+	if(!print_longnum(ssl, "xfr.tcp.connect=", xfrd->tcp_set->num_connect))
+		return;
+	if(!print_longnum(ssl, "xfr.tcp.query=", xfrd->tcp_set->num_query))
+		return;
+	if(!print_longnum(ssl, "xfr.tcp.reuse=", xfrd->tcp_set->num_reuse))
+		return;
+
+	/* reload batching, and the phases of the last reload */
+	if(!print_reload_stats(ssl, xfrd))
+		return;
+#ifdef USE_DNSTAP
+	/* dnstap messages from the workers to the collector */
+	if(xfrd->nsd->dt_collector) {
+		static const char* filter_names[DT_FILTER_NUM] = {
+			"sample", "transport", "zone", "qtype", "rcode",
+			"rrl", "tc" };
+		uint64_t queued, dropped, filter[DT_FILTER_NUM];
+		char nm[32];
+		int f;
+		dt_collector_get_stats(xfrd->nsd->dt_collector, &queued,
+			&dropped);
+		if(!print_longnum(ssl, "dnstap.queued=", queued))
+			return;
+		if(!print_longnum(ssl, "dnstap.dropped=", dropped))
+			return;
+		/* the exchanges that passed the configured filters */
+		dt_collector_get_filter_stats(xfrd->nsd->dt_collector,
+			filter);
+		for(f=0; f<DT_FILTER_NUM; f++) {
+			if(!dt_collector_filter_used(
+				xfrd->nsd->dt_collector, xfrd->nsd->options, f))
+				continue;
+			snprintf(nm, sizeof(nm), "dnstap.filter.%s=",
+				filter_names[f]);
+			if(!print_longnum(ssl, nm, filter[f]))
+				return;
+		}
+	}
+#endif
 #ifdef USE_ZONE_STATS
 	zonestat_print(ssl, xfrd, clear); /* per-zone statistics */
 #else
@@ -2640,6 +2864,14 @@ clear_stats(xfrd_state_type* xfrd)
 	size_t i;
 	uint64_t dbd = xfrd->nsd->st.db_disk;
 	uint64_t dbm = xfrd->nsd->st.db_mem;
+	uint64_t dbf = xfrd->nsd->st.db_free;
+	uint64_t dbfc[DB_FREE_SIZES];
+	uint64_t dbs = xfrd->nsd->st.db_slab;
+	uint64_t dbsu = xfrd->nsd->st.db_slab_used;
+	uint64_t dbsr = xfrd->nsd->st.db_slab_released;
+	uint64_t dbnuma[DB_NUMA_NODES];
+	memcpy(dbfc, xfrd->nsd->st.db_free_chunks, sizeof(dbfc));
+	memcpy(dbnuma, xfrd->nsd->st.db_numa, sizeof(dbnuma));
 	for(i=0; i<xfrd->nsd->child_count; i++) {
 		xfrd->nsd->children[i].query_count = 0;
 	}
@@ -2649,6 +2881,27 @@ clear_stats(xfrd_state_type* xfrd)
 	 * that before the next stats printout */
 	xfrd->nsd->st.db_disk = dbd;
 	xfrd->nsd->st.db_mem = dbm;
+	xfrd->nsd->st.db_free = dbf;
+	memcpy(xfrd->nsd->st.db_free_chunks, dbfc, sizeof(dbfc));
+	xfrd->nsd->st.db_slab = dbs;
+	xfrd->nsd->st.db_slab_used = dbsu;
+	xfrd->nsd->st.db_slab_released = dbsr;
+	memcpy(xfrd->nsd->st.db_numa, dbnuma, sizeof(dbnuma));
+	xfrd->notify_sent = 0;
+	xfrd->notify_acked = 0;
+	xfrd->notify_failed = 0;
+	xfrd->notify_latency_sum = 0;
+	xfrd->notify_latency_max = 0;
+	xfrd->tcp_set->num_connect = 0;
+	xfrd->tcp_set->num_query = 0;
+	xfrd->tcp_set->num_reuse = 0;
+	xfrd->reload_num = 0;
+	xfrd->reload_updates = 0;
+	xfrd->reload_staleness_max = 0;
+#ifdef USE_DNSTAP
+	if(xfrd->nsd->dt_collector)
+		dt_collector_clear_stats(xfrd->nsd->dt_collector);
+#endif
 }
 
 void
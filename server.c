@@ -81,12 +81,18 @@
 #include "remote.h"
 #include "lookup3.h"
 #include "rrl.h"
+#include "numa.h"
+#include "cow-audit.h"
+#include "latency.h"
 #ifdef USE_DNSTAP
 #include "dnstap/dnstap_collector.h"
 #endif
 
 #define RELOAD_SYNC_TIMEOUT 25 /* seconds */
 
+/* number of AXFR messages that are built and written with one writev */
+#define AXFR_BATCH_MESSAGES 8
+
 #ifdef USE_TCP_FASTOPEN
   #define TCP_FASTOPEN_FILE "/proc/sys/net/ipv4/tcp_fastopen"
   #define TCP_FASTOPEN_SERVER_BIT_MASK 0x2
@@ -214,6 +220,17 @@ struct tcp_handler_data
 	 * If the connection is allowed to have further queries on it.
 	 */
 	int tcp_no_more_queries;
+#ifdef HAVE_WRITEV
+	/*
+	 * The batch of AXFR messages that is written with one writev.
+	 * The first buffer is the query packet, the others are allocated
+	 * in the region when the connection does its first AXFR.  The
+	 * bytes_transmitted count is for the whole batch, of axfr_total.
+	 */
+	buffer_type* axfr_packet[AXFR_BATCH_MESSAGES];
+	int axfr_count;
+	size_t axfr_total;
+#endif
 #ifdef HAVE_SSL
 	/*
 	 * TLS object.
@@ -446,6 +463,13 @@ restart_child_servers(struct nsd *nsd, region_type* region, netio_type* netio,
 				if (fcntl(nsd->this_child->parent_fd, F_SETFL, O_NONBLOCK) == -1) {
 					log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
 				}
+				if(nsd->numa)
+					numa_replicas_map(nsd);
+				if(nsd->options->database_cow_audit)
+					cow_audit_start(nsd);
+#ifdef USE_DNSTAP
+				dt_collector_worker_start(nsd);
+#endif
 				server_child(nsd);
 				/* NOTREACH */
 				exit(0);
@@ -485,7 +509,7 @@ server_zonestat_alloc(struct nsd* nsd)
 {
 	size_t num = (nsd->options->zonestatnames->count==0?1:
 			nsd->options->zonestatnames->count);
-	size_t sz = sizeof(struct nsdst)*num;
+	size_t sz = sizeof(struct nsdzst)*num;
 	char tmpfile[256];
 	uint8_t z = 0;
 
@@ -536,7 +560,7 @@ server_zonestat_alloc(struct nsd* nsd)
 			nsd->zonestatfname[1], strerror(errno));
 		exit(1);
 	}
-	nsd->zonestat[0] = (struct nsdst*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+	nsd->zonestat[0] = (struct nsdzst*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
 		MAP_SHARED, nsd->zonestatfd[0], 0);
 	if(nsd->zonestat[0] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
@@ -544,7 +568,7 @@ server_zonestat_alloc(struct nsd* nsd)
 		unlink(nsd->zonestatfname[1]);
 		exit(1);
 	}
-	nsd->zonestat[1] = (struct nsdst*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+	nsd->zonestat[1] = (struct nsdzst*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
 		MAP_SHARED, nsd->zonestatfd[1], 0);
 	if(nsd->zonestat[1] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
@@ -567,8 +591,8 @@ zonestat_remap(struct nsd* nsd, int idx, size_t sz)
 {
 #ifdef HAVE_MMAP
 #ifdef MREMAP_MAYMOVE
-	nsd->zonestat[idx] = (struct nsdst*)mremap(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx], sz,
+	nsd->zonestat[idx] = (struct nsdzst*)mremap(nsd->zonestat[idx],
+		sizeof(struct nsdzst)*nsd->zonestatsize[idx], sz,
 		MREMAP_MAYMOVE);
 	if(nsd->zonestat[idx] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mremap failed: %s", strerror(errno));
@@ -576,12 +600,12 @@ zonestat_remap(struct nsd* nsd, int idx, size_t sz)
 	}
 #else /* !HAVE MREMAP */
 	if(msync(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx], MS_ASYNC) != 0)
+		sizeof(struct nsdzst)*nsd->zonestatsize[idx], MS_ASYNC) != 0)
 		log_msg(LOG_ERR, "msync failed: %s", strerror(errno));
 	if(munmap(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx]) != 0)
+		sizeof(struct nsdzst)*nsd->zonestatsize[idx]) != 0)
 		log_msg(LOG_ERR, "munmap failed: %s", strerror(errno));
-	nsd->zonestat[idx] = (struct nsdst*)mmap(NULL, sz,
+	nsd->zonestat[idx] = (struct nsdzst*)mmap(NULL, sz,
 		PROT_READ|PROT_WRITE, MAP_SHARED, nsd->zonestatfd[idx], 0);
 	if(nsd->zonestat[idx] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
@@ -604,7 +628,7 @@ server_zonestat_realloc(struct nsd* nsd)
 		idx = 1;
 	if(nsd->zonestatsize[idx] == nsd->zonestatdesired)
 		return;
-	sz = sizeof(struct nsdst)*nsd->zonestatdesired;
+	sz = sizeof(struct nsdzst)*nsd->zonestatdesired;
 	if(lseek(nsd->zonestatfd[idx], (off_t)sz-1, SEEK_SET) == -1) {
 		log_msg(LOG_ERR, "lseek %s: %s", nsd->zonestatfname[idx],
 			strerror(errno));
@@ -618,8 +642,8 @@ server_zonestat_realloc(struct nsd* nsd)
 	zonestat_remap(nsd, idx, sz);
 	/* zero the newly allocated region */
 	if(nsd->zonestatdesired > nsd->zonestatsize[idx]) {
-		memset(((char*)nsd->zonestat[idx])+sizeof(struct nsdst) *
-			nsd->zonestatsize[idx], 0, sizeof(struct nsdst) *
+		memset(((char*)nsd->zonestat[idx])+sizeof(struct nsdzst) *
+			nsd->zonestatsize[idx], 0, sizeof(struct nsdzst) *
 			(nsd->zonestatdesired - nsd->zonestatsize[idx]));
 	}
 	nsd->zonestatsize[idx] = nsd->zonestatdesired;
@@ -1416,6 +1440,16 @@ server_start_children(struct nsd *nsd, region_type* region, netio_type* netio,
 		nsd->children[i].pid = 0;
 	}
 
+#ifdef USE_DNSTAP
+	dt_collector_mark_zones(nsd->dt_collector, nsd->db);
+#endif
+	/* the copies of the zone data are made again for this database,
+	 * the old ones are used by the old servers */
+	numa_replicas_delete(nsd->numa);
+	nsd->numa = NULL;
+	if(nsd->options->database_numa_replicas)
+		nsd->numa = numa_replicas_create(nsd);
+
 	return restart_child_servers(nsd, region, netio, xfrd_sock_p);
 }
 
@@ -2106,7 +2140,8 @@ block_read(struct nsd* nsd, int s, void* p, ssize_t sz, int timeout)
 }
 
 static void
-reload_process_tasks(struct nsd* nsd, udb_ptr* last_task, int cmdsocket)
+reload_process_tasks(struct nsd* nsd, udb_ptr* last_task, int cmdsocket,
+	struct reload_info* info)
 {
 	sig_atomic_t cmd = NSD_QUIT_SYNC;
 	udb_ptr t, next;
@@ -2118,6 +2153,9 @@ reload_process_tasks(struct nsd* nsd, udb_ptr* last_task, int cmdsocket)
 		/* store next in list so this one can be deleted or reused */
 		udb_ptr_set_rptr(&next, u, &TASKLIST(&t)->next);
 		udb_rptr_zero(&TASKLIST(&t)->next, u);
+		info->tasks++;
+		if(TASKLIST(&t)->task_type == task_apply_xfr)
+			info->xfrs++;
 
 		/* process task t */
 		/* append results for task t and update last_task */
@@ -2173,7 +2211,7 @@ reload_do_stats(int cmdfd, struct nsd* nsd, udb_ptr* last)
 {
 	struct nsdst s;
 	stc_type* p;
-	size_t i;
+	size_t i, slab, slab_used, slab_released;
 	if(block_read(nsd, cmdfd, &s, sizeof(s),
 		RELOAD_SYNC_TIMEOUT) != sizeof(s)) {
 		log_msg(LOG_ERR, "could not read stats from oldpar");
@@ -2181,6 +2219,20 @@ reload_do_stats(int cmdfd, struct nsd* nsd, udb_ptr* last)
 	}
 	s.db_disk = (nsd->db->udb?nsd->db->udb->base_size:0);
 	s.db_mem = region_get_mem(nsd->db->region);
+	region_get_slab_stats(nsd->db->region, &slab, &slab_used,
+		&slab_released);
+	s.db_slab = slab;
+	s.db_slab_used = slab_used;
+	s.db_slab_released = slab_released;
+	numa_replicas_stats(nsd->numa, s.db_numa, DB_NUMA_NODES);
+	if(nsd->db->udb) {
+		s.db_free = nsd->db->udb->alloc->disk->stat_free;
+		udb_alloc_free_counts(nsd->db->udb->alloc, s.db_free_chunks,
+			DB_FREE_SIZES);
+	} else {
+		s.db_free = 0;
+		memset(s.db_free_chunks, 0, sizeof(s.db_free_chunks));
+	}
 	p = (stc_type*)task_new_stat_info(nsd->task[nsd->mytask], last, &s,
 		nsd->child_count);
 	if(!p) return;
@@ -2205,6 +2257,8 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	int ret;
 	udb_ptr last_task;
 	struct sigaction old_sigchld, ign_sigchld;
+	struct reload_info info;
+	struct timespec t0, t1;
 	/* ignore SIGCHLD from the previous server_main that used this pid */
 	memset(&ign_sigchld, 0, sizeof(ign_sigchld));
 	ign_sigchld.sa_handler = SIG_IGN;
@@ -2220,12 +2274,20 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 #endif
 
 	/* see what tasks we got from xfrd */
+	memset(&info, 0, sizeof(info));
+	get_time_monotonic(&t0);
 	task_remap(nsd->task[nsd->mytask]);
 	udb_ptr_init(&last_task, nsd->task[nsd->mytask]);
 	udb_compact_inhibited(nsd->db->udb, 1);
-	reload_process_tasks(nsd, &last_task, cmdsocket);
+	reload_process_tasks(nsd, &last_task, cmdsocket, &info);
+	namedb_lazy_zones_update(nsd, nsd->options);
+	get_time_monotonic(&t1);
+	info.process_usec = timespec_elapsed_usec(&t0, &t1);
+	t0 = t1;
+	/* the compaction is not done here, that would hold up the start
+	 * of the new children, it is done in steps by server_main when
+	 * it is idle */
 	udb_compact_inhibited(nsd->db->udb, 0);
-	udb_compact(nsd->db->udb);
 
 #ifndef NDEBUG
 	if(nsd_debug_level >= 1)
@@ -2246,6 +2308,10 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	server_zonestat_switch(nsd);
 #endif
 
+	get_time_monotonic(&t1);
+	info.sync_usec = timespec_elapsed_usec(&t0, &t1);
+	t0 = t1;
+
 	/* listen for the signals of failed children again */
 	sigaction(SIGCHLD, &old_sigchld, NULL);
 	/* Start new child processes */
@@ -2254,6 +2320,9 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		send_children_quit(nsd);
 		exit(1);
 	}
+	get_time_monotonic(&t1);
+	info.children_usec = timespec_elapsed_usec(&t0, &t1);
+	t0 = t1;
 
 	/* if the parent has quit, we must quit too, poll the fd for cmds */
 	if(block_read(nsd, cmdsocket, &cmd, sizeof(cmd), 0) == sizeof(cmd)) {
@@ -2292,6 +2361,11 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		exit(1);
 	}
 	assert(ret==-1 || ret == 0 || cmd == NSD_RELOAD);
+	get_time_monotonic(&t1);
+	info.quit_usec = timespec_elapsed_usec(&t0, &t1);
+	/* the phase timings for xfrd, before the stats so that the stats
+	 * printed by xfrd include this reload */
+	task_new_reload_info(nsd->task[nsd->mytask], &last_task, &info);
 #ifdef BIND8_STATS
 	reload_do_stats(cmdsocket, nsd, &last_task);
 #endif
@@ -2464,6 +2538,10 @@ server_main(struct nsd *nsd)
 			/* timeout to collect processes. In case no sigchild happens. */
 			timeout_spec.tv_sec = 60;
 			timeout_spec.tv_nsec = 0;
+			/* compact nsd.db in steps, between the events, while
+			 * there is no reload that uses it */
+			if(reload_pid == -1 && udb_compact_pending(nsd->db->udb))
+				timeout_spec.tv_sec = 0;
 
 			/* listen on ports, timeout for collecting terminated children */
 			if(netio_dispatch(netio, &timeout_spec, 0) == -1) {
@@ -2471,6 +2549,15 @@ server_main(struct nsd *nsd)
 					log_msg(LOG_ERR, "netio_dispatch failed: %s", strerror(errno));
 				}
 			}
+			if(reload_pid == -1 && nsd->mode == NSD_RUN &&
+				udb_compact_pending(nsd->db->udb)) {
+				if(!udb_compact_step(nsd->db->udb,
+					UDB_COMPACT_STEP_SIZE))
+					log_msg(LOG_ERR, "could not compact %s",
+						nsd->dbfile);
+				if(!udb_compact_pending(nsd->db->udb))
+					udb_base_sync(nsd->db->udb, 0);
+			}
 			if(nsd->restart_children) {
 				restart_child_servers(nsd, server_region, netio,
 					&nsd->xfrd_listener->fd);
@@ -2710,9 +2797,10 @@ server_process_query_udp(struct nsd *nsd, struct query *query)
 {
 #ifdef RATELIMIT
 	if(query_process(query, nsd) != QUERY_DISCARDED) {
-		if(rrl_process_query(query))
+		if(rrl_process_query(query)) {
+			query->rrl_limited = 1;
 			return rrl_slip(query);
-		else	return QUERY_PROCESSED;
+		} else	return QUERY_PROCESSED;
 	}
 	return QUERY_DISCARDED;
 #else
@@ -2720,6 +2808,28 @@ server_process_query_udp(struct nsd *nsd, struct query *query)
 #endif
 }
 
+#ifdef BIND8_STATS
+/* account the service time of the answer in q->packet in the histograms */
+static void
+stats_latency(struct nsd* nsd, struct query* q, int transport, uint64_t usec)
+{
+	int type;
+	if(RCODE(q->packet) == RCODE_NXDOMAIN)
+		type = LAT_NXDOMAIN;
+	else if(RCODE(q->packet) != RCODE_OK)
+		type = LAT_OTHER;
+	else if(ANCOUNT(q->packet) != 0)
+		type = LAT_ANSWER;
+	else if(AA(q->packet))
+		type = LAT_NODATA;
+	else if(NSCOUNT(q->packet) != 0)
+		type = LAT_REFERRAL;
+	else	type = LAT_OTHER;
+	nsd->st.latency[transport][type][q->edns.dnssec_ok?1:0]
+		[latency_bucket(usec, LAT_SUB_BITS, LAT_BUCKETS)]++;
+}
+#endif /* BIND8_STATS */
+
 const char*
 nsd_event_vs(void)
 {
@@ -2749,7 +2859,7 @@ const char*
 nsd_event_method(void)
 {
 #ifdef USE_MINI_EVENT
-	return "select";
+	return event_get_method();
 #else
 	struct event_base* b = nsd_child_event_base();
 	const char* m = "?";
@@ -3038,6 +3148,7 @@ server_child(struct nsd *nsd)
 	}
 
 	service_remaining_tcp(nsd);
+	cow_audit_stop(nsd);
 #ifdef	BIND8_STATS
 	bind8_stats(nsd);
 #endif /* BIND8_STATS */
@@ -3250,6 +3361,10 @@ handle_udp(int fd, short event, void* arg)
 	struct udp_handler_data *data = (struct udp_handler_data *) arg;
 	int received, sent, recvcount, i;
 	struct query *q;
+#ifdef BIND8_STATS
+	struct timespec recv_time, send_time;
+	uint64_t usec;
+#endif
 
 	if (!(event & EV_READ)) {
 		return;
@@ -3266,6 +3381,10 @@ handle_udp(int fd, short event, void* arg)
 		/* Simply no data available */
 		return;
 	}
+#ifdef BIND8_STATS
+	/* one timestamp for the whole batch */
+	get_time_monotonic(&recv_time);
+#endif
 	for (i = 0; i < recvcount; i++) {
 	loopstart:
 		received = msgs[i].msg_len;
@@ -3299,8 +3418,7 @@ handle_udp(int fd, short event, void* arg)
 		buffer_skip(q->packet, received);
 		buffer_flip(q->packet);
 #ifdef USE_DNSTAP
-		dt_collector_submit_auth_query(data->nsd, &q->addr, q->addrlen,
-			q->tcp, q->packet);
+		dt_collector_submit_auth_query(data->nsd, q);
 #endif /* USE_DNSTAP */
 
 		/* Process and answer the query... */
@@ -3333,11 +3451,12 @@ handle_udp(int fd, short event, void* arg)
 			}
 #endif /* BIND8_STATS */
 #ifdef USE_DNSTAP
-			dt_collector_submit_auth_response(data->nsd,
-				&q->addr, q->addrlen, q->tcp, q->packet,
-				q->zone);
+			dt_collector_submit_auth_response(data->nsd, q, 0);
 #endif /* USE_DNSTAP */
 		} else {
+#ifdef USE_DNSTAP
+			dt_collector_submit_auth_response(data->nsd, q, 1);
+#endif /* USE_DNSTAP */
 			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 			iovecs[i].iov_len = buffer_remaining(q->packet);
 			msgs[i].msg_hdr.msg_namelen = queries[i]->addrlen;
@@ -3362,6 +3481,13 @@ handle_udp(int fd, short event, void* arg)
 		}
 	}
 
+#ifdef BIND8_STATS
+	get_time_monotonic(&send_time);
+	usec = timespec_elapsed_usec(&recv_time, &send_time);
+	for(i=0; i<recvcount; i++)
+		stats_latency(data->nsd, queries[i], LAT_UDP, usec);
+#endif /* BIND8_STATS */
+
 	/* send until all are sent */
 	i = 0;
 	while(i<recvcount) {
@@ -3486,6 +3612,9 @@ handle_tcp_reading(int fd, short event, void* arg)
 	ssize_t received;
 	struct event_base* ev_base;
 	struct timeval timeout;
+#ifdef BIND8_STATS
+	struct timespec start_time, end_time;
+#endif
 
 	if ((event & EV_TIMEOUT)) {
 		/* Connection timed out.  */
@@ -3614,6 +3743,9 @@ handle_tcp_reading(int fd, short event, void* arg)
 	}
 
 	assert(buffer_position(data->query->packet) == data->query->tcplen);
+#ifdef BIND8_STATS
+	get_time_monotonic(&start_time);
+#endif
 
 	/* Account... */
 #ifdef BIND8_STATS
@@ -3635,12 +3767,14 @@ handle_tcp_reading(int fd, short event, void* arg)
 
 	buffer_flip(data->query->packet);
 #ifdef USE_DNSTAP
-	dt_collector_submit_auth_query(data->nsd, &data->query->addr,
-		data->query->addrlen, data->query->tcp, data->query->packet);
+	dt_collector_submit_auth_query(data->nsd, data->query);
 #endif /* USE_DNSTAP */
 	data->query_state = server_process_query(data->nsd, data->query);
 	if (data->query_state == QUERY_DISCARDED) {
 		/* Drop the packet and the entire connection... */
+#ifdef USE_DNSTAP
+		dt_collector_submit_auth_response(data->nsd, data->query, 1);
+#endif /* USE_DNSTAP */
 		STATUP(data->nsd, dropped);
 		ZTATUP(data->nsd, data->query->zone, dropped);
 		cleanup_tcp_handler(data);
@@ -3674,6 +3808,9 @@ handle_tcp_reading(int fd, short event, void* arg)
 	buffer_flip(data->query->packet);
 	data->query->tcplen = buffer_remaining(data->query->packet);
 #ifdef BIND8_STATS
+	get_time_monotonic(&end_time);
+	stats_latency(data->nsd, data->query, LAT_TCP,
+		timespec_elapsed_usec(&start_time, &end_time));
 	/* Account the rcode & TC... */
 	STATUP2(data->nsd, rcode, RCODE(data->query->packet));
 	ZTATUP2(data->nsd, data->query->zone, rcode, RCODE(data->query->packet));
@@ -3683,9 +3820,7 @@ handle_tcp_reading(int fd, short event, void* arg)
 	}
 #endif /* BIND8_STATS */
 #ifdef USE_DNSTAP
-	dt_collector_submit_auth_response(data->nsd, &data->query->addr,
-		data->query->addrlen, data->query->tcp, data->query->packet,
-		data->query->zone);
+	dt_collector_submit_auth_response(data->nsd, data->query, 0);
 #endif /* USE_DNSTAP */
 	data->bytes_transmitted = 0;
 
@@ -3705,6 +3840,84 @@ handle_tcp_reading(int fd, short event, void* arg)
 	handle_tcp_writing(fd, EV_WRITE, data);
 }
 
+#ifdef HAVE_WRITEV
+/*
+ * Continue the AXFR, and build the next messages in the batch buffers,
+ * so that they are written together.  Returns the number of messages,
+ * 0 when the AXFR is done and the query state is QUERY_PROCESSED.
+ */
+static int
+tcp_axfr_batch_fill(struct tcp_handler_data* data)
+{
+	struct query *q = data->query;
+	int i;
+
+	if(!data->axfr_packet[0])
+		data->axfr_packet[0] = q->packet;
+	/* the next message continues from the header of the last one */
+	if(data->axfr_count > 1)
+		memcpy(buffer_begin(data->axfr_packet[0]), buffer_begin(
+			data->axfr_packet[data->axfr_count-1]), QHEADERSZ);
+	data->axfr_count = 0;
+	data->axfr_total = 0;
+	for(i = 0; i < AXFR_BATCH_MESSAGES; i++) {
+		if(i > 0) {
+			if(!data->axfr_packet[i])
+				data->axfr_packet[i] = buffer_create(
+					data->region, QIOBUFSZ);
+			memcpy(buffer_begin(data->axfr_packet[i]),
+				buffer_begin(q->packet), QHEADERSZ);
+			q->packet = data->axfr_packet[i];
+		}
+		buffer_clear(q->packet);
+		data->query_state = query_axfr(data->nsd, q);
+		if(data->query_state == QUERY_PROCESSED)
+			break;
+		query_add_optional(q, data->nsd);
+		buffer_flip(q->packet);
+		data->axfr_total += sizeof(q->tcplen) +
+			buffer_remaining(q->packet);
+		data->axfr_count++;
+		if(q->axfr_is_done)
+			break;
+	}
+	q->packet = data->axfr_packet[0];
+	return data->axfr_count;
+}
+
+/*
+ * Write the batch of AXFR messages, the length and the packet of each,
+ * from bytes_transmitted onwards.  Returns the result of writev.
+ */
+static ssize_t
+tcp_axfr_batch_write(struct tcp_handler_data* data, int fd)
+{
+	struct iovec iov[AXFR_BATCH_MESSAGES*2];
+	uint16_t n_tcplen[AXFR_BATCH_MESSAGES];
+	size_t skip = data->bytes_transmitted, len;
+	int i, n = 0;
+
+	for(i = 0; i < data->axfr_count; i++) {
+		len = buffer_limit(data->axfr_packet[i]);
+		n_tcplen[i] = htons(len);
+		if(skip < sizeof(n_tcplen[i])) {
+			iov[n].iov_base = (uint8_t*)&n_tcplen[i] + skip;
+			iov[n].iov_len = sizeof(n_tcplen[i]) - skip;
+			n++;
+			skip = 0;
+		} else	skip -= sizeof(n_tcplen[i]);
+		if(skip < len) {
+			iov[n].iov_base = buffer_begin(data->axfr_packet[i])
+				+ skip;
+			iov[n].iov_len = len - skip;
+			n++;
+			skip = 0;
+		} else	skip -= len;
+	}
+	return writev(fd, iov, n);
+}
+#endif /* HAVE_WRITEV */
+
 static void
 handle_tcp_writing(int fd, short event, void* arg)
 {
@@ -3722,6 +3935,33 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	assert((event & EV_WRITE));
 
+#ifdef HAVE_WRITEV
+	if (data->axfr_count > 0) {
+		/* Writing a batch of AXFR messages.  */
+		sent = tcp_axfr_batch_write(data, fd);
+		if (sent == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				return;
+			} else {
+#ifdef ECONNRESET
+				if(verbosity >= 2 || errno != ECONNRESET)
+#endif /* ECONNRESET */
+#ifdef EPIPE
+				  if(verbosity >= 2 || errno != EPIPE)
+#endif /* EPIPE 'broken pipe' */
+				    log_msg(LOG_ERR, "failed writing to tcp: %s", strerror(errno));
+				cleanup_tcp_handler(data);
+				return;
+			}
+		}
+		data->bytes_transmitted += sent;
+		if (data->bytes_transmitted < data->axfr_total) {
+			return;
+		}
+		goto axfr_continue;
+	}
+#endif /* HAVE_WRITEV */
+
 	if (data->bytes_transmitted < sizeof(q->tcplen)) {
 		/* Writing the response packet length.  */
 		uint16_t n_tcplen = htons(q->tcplen);
@@ -3813,6 +4053,11 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	if (data->query_state == QUERY_IN_AXFR) {
 		/* Continue processing AXFR and writing back results.  */
+#ifdef HAVE_WRITEV
+	axfr_continue:
+		/* Build several messages, to write them at once.  */
+		if (tcp_axfr_batch_fill(data) > 0) {
+#else
 		buffer_clear(q->packet);
 		data->query_state = query_axfr(data->nsd, q);
 		if (data->query_state != QUERY_PROCESSED) {
@@ -3821,6 +4066,7 @@ handle_tcp_writing(int fd, short event, void* arg)
 			/* Reset data. */
 			buffer_flip(q->packet);
 			q->tcplen = buffer_remaining(q->packet);
+#endif /* HAVE_WRITEV */
 			data->bytes_transmitted = 0;
 			/* Reset timeout.  */
 			timeout.tv_sec = data->tcp_timeout / 1000;
@@ -3966,6 +4212,9 @@ handle_tls_reading(int fd, short event, void* arg)
 {
 	struct tcp_handler_data *data = (struct tcp_handler_data *) arg;
 	ssize_t received;
+#ifdef BIND8_STATS
+	struct timespec start_time, end_time;
+#endif
 
 	if ((event & EV_TIMEOUT)) {
 		/* Connection timed out.  */
@@ -4094,6 +4343,9 @@ handle_tls_reading(int fd, short event, void* arg)
 	}
 
 	assert(buffer_position(data->query->packet) == data->query->tcplen);
+#ifdef BIND8_STATS
+	get_time_monotonic(&start_time);
+#endif
 
 	/* Account... */
 #ifndef INET6
@@ -4113,12 +4365,14 @@ handle_tls_reading(int fd, short event, void* arg)
 
 	buffer_flip(data->query->packet);
 #ifdef USE_DNSTAP
-	dt_collector_submit_auth_query(data->nsd, &data->query->addr,
-		data->query->addrlen, data->query->tcp, data->query->packet);
+	dt_collector_submit_auth_query(data->nsd, data->query);
 #endif /* USE_DNSTAP */
 	data->query_state = server_process_query(data->nsd, data->query);
 	if (data->query_state == QUERY_DISCARDED) {
 		/* Drop the packet and the entire connection... */
+#ifdef USE_DNSTAP
+		dt_collector_submit_auth_response(data->nsd, data->query, 1);
+#endif /* USE_DNSTAP */
 		STATUP(data->nsd, dropped);
 		ZTATUP(data->nsd, data->query->zone, dropped);
 		cleanup_tcp_handler(data);
@@ -4152,6 +4406,9 @@ handle_tls_reading(int fd, short event, void* arg)
 	buffer_flip(data->query->packet);
 	data->query->tcplen = buffer_remaining(data->query->packet);
 #ifdef BIND8_STATS
+	get_time_monotonic(&end_time);
+	stats_latency(data->nsd, data->query, LAT_TLS,
+		timespec_elapsed_usec(&start_time, &end_time));
 	/* Account the rcode & TC... */
 	STATUP2(data->nsd, rcode, RCODE(data->query->packet));
 	ZTATUP2(data->nsd, data->query->zone, rcode, RCODE(data->query->packet));
@@ -4161,9 +4418,7 @@ handle_tls_reading(int fd, short event, void* arg)
 	}
 #endif /* BIND8_STATS */
 #ifdef USE_DNSTAP
-	dt_collector_submit_auth_response(data->nsd, &data->query->addr,
-		data->query->addrlen, data->query->tcp, data->query->packet,
-		data->query->zone);
+	dt_collector_submit_auth_response(data->nsd, data->query, 0);
 #endif /* USE_DNSTAP */
 	data->bytes_transmitted = 0;
 
@@ -4437,6 +4692,11 @@ handle_tcp_accept(int fd, short event, void* arg)
 	tcp_data->query->addrlen = addrlen;
 
 	tcp_data->tcp_no_more_queries = 0;
+#ifdef HAVE_WRITEV
+	memset(tcp_data->axfr_packet, 0, sizeof(tcp_data->axfr_packet));
+	tcp_data->axfr_count = 0;
+	tcp_data->axfr_total = 0;
+#endif
 	tcp_data->tcp_timeout = data->nsd->tcp_timeout * 1000;
 	if (data->nsd->current_tcp_count > data->nsd->maximum_tcp_count/2) {
 		/* very busy, give smaller timeout */
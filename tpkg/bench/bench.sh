@@ -0,0 +1,227 @@
+#!/usr/bin/env bash
+# bench.sh -- performance regression benchmark for NSD.
+#
+# Run from the build directory with make bench, after make nsd loadgen
+# zonegen.  It generates synthetic zones, starts nsd on the loopback and
+# drives it with loadgen over UDP, TCP and TLS.  The results are written
+# as key=value lines to bench.results, so that the results for two
+# commits can be compared with
+#	bash tpkg/bench/bench.sh -c old.results new.results
+#
+# The environment variables change the run:
+#	BENCH_SIZE	names per zone, default 10000
+#	BENCH_DURATION	seconds per run, default 5
+#	BENCH_PROCS	loadgen processes, default 2
+#	BENCH_WINDOW	outstanding queries per loadgen process, default 64
+#	BENCH_SERVERS	nsd server-count, default 1
+#	BENCH_ZONES	default "flat deep wildcard nsec nsec3 tld"
+#	BENCH_TRANSPORTS default "udp tcp tls"
+#	BENCH_RESULTS	results file, default bench.results
+#	BENCH_HUGE_PAGES nsd database-huge-pages, yes, no or hugetlbfs,
+#			default no
+#	BENCH_PREFAULT	nsd database-prefault, default no
+#	BENCH_PERF	count dTLB misses with perf stat, default yes, it is
+#			skipped if perf cannot count them
+
+SRC=`dirname $0`
+. $SRC/../common.sh
+
+# compare two results files, prints the change in percent per value
+if test "$1" = "-c"; then
+	if test $# -ne 3; then
+		error "usage: bench.sh -c old.results new.results"
+	fi
+	awk -F= 'NR==FNR { if($1 !~ /^#/) old[$1]=$2; next }
+	$1 !~ /^#/ && ($1 in old) {
+		if(old[$1] != 0)
+			printf("%-40s %14s %14s %+8.1f%%\n", $1, old[$1], $2,
+				($2-old[$1])*100/old[$1]);
+		else	printf("%-40s %14s %14s\n", $1, old[$1], $2);
+	}' "$2" "$3"
+	exit 0
+fi
+
+SIZE=${BENCH_SIZE:-10000}
+DURATION=${BENCH_DURATION:-5}
+PROCS=${BENCH_PROCS:-2}
+WINDOW=${BENCH_WINDOW:-64}
+SERVERS=${BENCH_SERVERS:-1}
+ZONES=${BENCH_ZONES:-"flat deep wildcard nsec nsec3 tld"}
+TRANSPORTS=${BENCH_TRANSPORTS:-"udp tcp tls"}
+RESULTS=${BENCH_RESULTS:-bench.results}
+HUGE_PAGES=${BENCH_HUGE_PAGES:-no}
+PREFAULT=${BENCH_PREFAULT:-no}
+PERF=${BENCH_PERF:-yes}
+WORK=`pwd`/bench.work
+
+for prog in ./nsd ./loadgen ./zonegen; do
+	if test ! -x $prog; then
+		error "$prog not found, run make bench from the build directory"
+	fi
+done
+if grep "define HAVE_SSL" config.h >/dev/null 2>&1; then
+	HAVE_SSL=yes
+else
+	HAVE_SSL=no
+fi
+
+rm -rf $WORK
+mkdir $WORK || error "cannot create $WORK"
+get_random_port 2
+PORT=$RND_PORT
+TLSPORT=`expr $RND_PORT + 1`
+
+# the nsd config, with the generated zones
+cat > $WORK/nsd.conf <<EOF
+server:
+	logfile: "$WORK/nsd.log"
+	zonesdir: "$WORK"
+	zonelistfile: "$WORK/zone.list"
+	xfrdfile: "$WORK/xfrd.state"
+	xfrdir: "$WORK"
+	database: ""
+	pidfile: "$WORK/nsd.pid"
+	username: ""
+	chroot: ""
+	interface: 127.0.0.1
+	port: $PORT
+	server-count: $SERVERS
+	tcp-count: `expr $PROCS \* 2 + 10`
+	database-huge-pages: $HUGE_PAGES
+	database-prefault: $PREFAULT
+EOF
+if test "$HAVE_SSL" = yes && echo "$TRANSPORTS" | grep tls >/dev/null; then
+	if openssl req -x509 -newkey rsa:2048 -nodes -days 1 \
+		-subj "/CN=bench" -keyout $WORK/tls.key \
+		-out $WORK/tls.pem >/dev/null 2>&1; then
+		cat >> $WORK/nsd.conf <<EOF
+	tls-service-key: "$WORK/tls.key"
+	tls-service-pem: "$WORK/tls.pem"
+	tls-port: $TLSPORT
+	interface: 127.0.0.1@$TLSPORT
+EOF
+	else
+		info "cannot create a TLS certificate with openssl, no tls runs"
+		TRANSPORTS=`echo $TRANSPORTS | sed -e 's/tls//'`
+	fi
+else
+	TRANSPORTS=`echo $TRANSPORTS | sed -e 's/tls//'`
+fi
+
+BENCHZONES=""
+for z in $ZONES; do
+	if ./zonegen -n $SIZE $z $z.bench $WORK/$z.zone $WORK/$z.queries; then
+		printf "zone:\n\tname: %s.bench\n\tzonefile: %s.zone\n" \
+			$z $z >> $WORK/nsd.conf
+		BENCHZONES="$BENCHZONES $z"
+	else
+		info "zone $z is skipped"
+	fi
+done
+
+# the CPU time used by nsd and its children, in clock ticks
+CLK_TCK=`getconf CLK_TCK 2>/dev/null`
+nsd_cpu () {
+	local total=0 p t
+	if test ! -f /proc/$NSD_PID/stat -o -z "$CLK_TCK"; then
+		echo 0
+		return
+	fi
+	for p in $NSD_PID `ps -o pid= --ppid $NSD_PID 2>/dev/null`; do
+		# utime and stime, after the process name in parentheses
+		t=`sed -e 's/^.*) //' /proc/$p/stat 2>/dev/null | \
+			awk '{ print $12 + $13 }'`
+		total=`expr $total + ${t:-0}`
+	done
+	echo $total
+}
+
+# the resident memory of nsd and its children, in kb
+nsd_rss () {
+	local i=0 p
+	echo "rss.kb.main=`ps -o rss= -p $NSD_PID | tr -d ' '`"
+	for p in `ps -o pid= --ppid $NSD_PID 2>/dev/null`; do
+		echo "rss.kb.child$i=`ps -o rss= -p $p | tr -d ' '`"
+		i=`expr $i + 1`
+	done
+}
+
+# count the dTLB loads and misses of nsd and its children, from
+# perf_start until perf_stop
+if test "$PERF" = yes; then
+	if ! perf stat -x, -e dTLB-loads,dTLB-load-misses true >/dev/null 2>&1
+	then
+		info "perf stat cannot count dTLB misses, no TLB results"
+		PERF=no
+	fi
+fi
+perf_start () {
+	local pids=`echo $NSD_PID \`ps -o pid= --ppid $NSD_PID 2>/dev/null\` | \
+		tr ' ' ','`
+	perf stat -x, -e dTLB-loads,dTLB-load-misses -p $pids \
+		-o $WORK/perf.out >/dev/null 2>&1 &
+	PERF_PID=$!
+	# give perf time to attach
+	sleep 1
+}
+
+# stop perf and print the dTLB results, with $1 as the prefix
+perf_stop () {
+	kill -INT $PERF_PID 2>/dev/null
+	wait $PERF_PID 2>/dev/null
+	awk -F, -v run=$1 '$3 ~ /^dTLB-loads/ && $1 ~ /^[0-9]+$/ { l=$1 }
+	$3 ~ /^dTLB-load-misses/ && $1 ~ /^[0-9]+$/ { m=$1 }
+	END {	if(l != "") printf("%s.dtlb.loads=%s\n", run, l);
+		if(m != "") printf("%s.dtlb.misses=%s\n", run, m);
+		if(l > 0 && m != "")
+			printf("%s.dtlb.miss_pct=%.3f\n", run, m*100/l); }' \
+		$WORK/perf.out 2>/dev/null
+}
+
+./nsd -c $WORK/nsd.conf || error "could not start nsd"
+wait_nsd_up $WORK/nsd.log
+NSD_PID=`cat $WORK/nsd.pid`
+
+cat > $RESULTS <<EOF
+# nsd bench results `date`
+# `uname -srm`
+revision=`git -C $SRC rev-parse --short HEAD 2>/dev/null`
+size=$SIZE
+duration=$DURATION
+procs=$PROCS
+window=$WINDOW
+servers=$SERVERS
+huge_pages=$HUGE_PAGES
+prefault=$PREFAULT
+EOF
+nsd_rss >> $RESULTS
+
+for z in $BENCHZONES; do
+	for t in $TRANSPORTS; do
+		p=$PORT
+		test $t = tls && p=$TLSPORT
+		info "run $z $t"
+		test "$PERF" = yes && perf_start
+		cpu_before=`nsd_cpu`
+		if ! ./loadgen -p $p -t $t -n $PROCS -d $DURATION -w $WINDOW \
+			127.0.0.1 $WORK/$z.queries > $WORK/out; then
+			info "loadgen failed for $z $t"
+			test "$PERF" = yes && perf_stop $z.$t > /dev/null
+			continue
+		fi
+		cpu_after=`nsd_cpu`
+		sed -e "s/^/$z.$t./" < $WORK/out >> $RESULTS
+		test "$PERF" = yes && perf_stop $z.$t >> $RESULTS
+		received=`grep '^received=' $WORK/out | sed -e 's/^.*=//'`
+		if test "$CLK_TCK" != "" -a "${received:-0}" != 0; then
+			echo "$z.$t.cpu.usec_per_query=`echo $cpu_before \
+				$cpu_after $CLK_TCK $received | awk '{ printf \
+				"%.2f", ($2-$1)*1000000/$3/$4 }'`" >> $RESULTS
+		fi
+	done
+done
+nsd_rss | sed -e 's/^rss/after.rss/' >> $RESULTS
+
+kill_pid $NSD_PID
+cat $RESULTS
+exit 0
@@ -0,0 +1,717 @@
+/*
+ * loadgen.c -- send DNS queries to a server over UDP, TCP or TLS and
+ * measure the rate and the latency of the answers.
+ *
+ * Copyright (c) 2021, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#ifdef HAVE_SSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+#include "buffer.h"
+#include "dname.h"
+#include "dns.h"
+#include "packet.h"
+#include "util.h"
+#include "latency.h"
+#include "bench-query.h"
+
+/** transports */
+#define LG_UDP 0
+#define LG_TCP 1
+#define LG_TLS 2
+
+/* log-linear histogram of the latency in nanoseconds, 8 buckets per
+ * power of two */
+#define LG_SUB_BITS 3
+#define LG_BUCKETS 256
+
+/** how long to wait for an answer before it counts as lost, in ns */
+#define LG_TIMEOUT 1000000000ULL
+
+/** the queries to send */
+struct lg_query {
+	uint8_t* data;
+	size_t len;
+};
+
+/** the settings of the run */
+struct lg_cfg {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int transport;
+	/* number of processes */
+	int procs;
+	/* the duration in seconds */
+	int duration;
+	/* the number of outstanding queries per process */
+	int window;
+	struct lg_query* queries;
+	size_t num;
+#ifdef HAVE_SSL
+	SSL_CTX* ctx;
+#endif
+};
+
+/** the results of a process, passed to the parent over a pipe */
+struct lg_result {
+	uint64_t sent, received, lost;
+	uint64_t noerror, nxdomain, other, truncated;
+	/* the number of TCP or TLS connections made */
+	uint64_t connects;
+	/* time spent, in ns */
+	uint64_t elapsed;
+	uint64_t hist[LG_BUCKETS];
+};
+
+/** an outstanding query, indexed by query ID */
+struct lg_slot {
+	/* the time the query was sent, 0 if the slot is free */
+	uint64_t sent;
+	/* the query ID, the slot number and the generation of the slot,
+	 * so that a late answer is not taken for the next query */
+	uint16_t id;
+	/* the number of queries sent from the slot */
+	uint16_t gen;
+};
+
+/* the max window, so that a slot has at least this many IDs */
+#define LG_MAX_WINDOW (65536/16)
+
+/** print usage text */
+static void
+usage(void)
+{
+	printf("usage:	loadgen [options] server queryfile\n");
+	printf("Send the queries from the file, lines with qname [class] "
+		"type [DO],\nto the server and report qps and latency.\n");
+	printf(" -h		this help\n");
+	printf(" -p port	the server port, default 53\n");
+	printf(" -t transport	udp, tcp or tls, default udp\n");
+	printf(" -n procs	number of processes, default 1\n");
+	printf(" -d seconds	duration of the run, default 10\n");
+	printf(" -w window	outstanding queries per process, "
+		"default 64, max %d\n", LG_MAX_WINDOW);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec t;
+	get_time_monotonic(&t);
+	return ((uint64_t)t.tv_sec)*1000000000 + (uint64_t)t.tv_nsec;
+}
+
+/** read the query file */
+static void
+read_queries(const char* fname, struct lg_cfg* cfg)
+{
+	char line[1024];
+	uint8_t buf[UDP_MAX_MESSAGE_LEN];
+	size_t len, capacity = 0;
+	int lineno = 0;
+	FILE* in = fopen(fname, "r");
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	while(fgets(line, sizeof(line), in)) {
+		lineno++;
+		if(line[0] == '#' || line[0] == ';' || line[0] == '\n')
+			continue;
+		/* EDNS, so that the answers are not truncated at 512 */
+		if(!bench_query_from_line(line, 0, 1232, buf, &len)) {
+			fprintf(stderr, "%s:%d: cannot parse query, skipped\n",
+				fname, lineno);
+			continue;
+		}
+		if(cfg->num == capacity) {
+			capacity = (capacity == 0)?1024:capacity*2;
+			cfg->queries = xrealloc(cfg->queries,
+				capacity*sizeof(*cfg->queries));
+		}
+		cfg->queries[cfg->num].data = xalloc(len);
+		memcpy(cfg->queries[cfg->num].data, buf, len);
+		cfg->queries[cfg->num].len = len;
+		cfg->num++;
+	}
+	fclose(in);
+	if(cfg->num == 0)
+		error("no queries in %s", fname);
+}
+
+/** account for an answer to the outstanding query in the slot */
+static void
+lg_answer(struct lg_result* res, struct lg_slot* slots, int window,
+	uint8_t* pkt, size_t len, uint64_t now)
+{
+	uint16_t id;
+	struct lg_slot* slot;
+	if(len < QHEADERSZ)
+		return;
+	id = (uint16_t)((pkt[0]<<8) | pkt[1]);
+	slot = &slots[id % window];
+	if(slot->sent == 0 || slot->id != id)
+		return; /* late answer after the timeout */
+	res->hist[latency_bucket(now - slot->sent, LG_SUB_BITS,
+		LG_BUCKETS)]++;
+	slot->sent = 0;
+	res->received++;
+	if((pkt[3]&0xf) == RCODE_OK)
+		res->noerror++;
+	else if((pkt[3]&0xf) == RCODE_NXDOMAIN)
+		res->nxdomain++;
+	else	res->other++;
+	if((pkt[2]&0x02))
+		res->truncated++;
+}
+
+/** the next query to send from the slot, the query ID is the slot number
+ * plus window times the generation of the slot */
+static struct lg_query*
+lg_next(struct lg_cfg* cfg, size_t* pos, uint8_t* buf, struct lg_slot* slots,
+	int i)
+{
+	struct lg_query* q = &cfg->queries[*pos];
+	int gens = 65536 / cfg->window;
+	*pos = (*pos + 1) % cfg->num;
+	memcpy(buf, q->data, q->len);
+	slots[i].gen++;
+	slots[i].id = (uint16_t)(i + cfg->window*(slots[i].gen % gens));
+	buf[0] = (uint8_t)(slots[i].id>>8);
+	buf[1] = (uint8_t)(slots[i].id&0xff);
+	return q;
+}
+
+/** time out the outstanding queries that had no answer */
+static void
+lg_timeout(struct lg_result* res, struct lg_slot* slots, int window,
+	uint64_t now)
+{
+	int i;
+	for(i=0; i<window; i++) {
+		if(slots[i].sent != 0 && now - slots[i].sent > LG_TIMEOUT) {
+			slots[i].sent = 0;
+			res->lost++;
+		}
+	}
+}
+
+/** UDP load, batches of queries with sendmmsg and recvmmsg */
+static void
+run_udp(struct lg_cfg* cfg, size_t pos, struct lg_result* res,
+	uint64_t end)
+{
+	int window = cfg->window, i, n;
+	struct lg_slot* slots = xalloc_array_zero(window, sizeof(*slots));
+	uint8_t* sbuf = xalloc_array_zero(window, UDP_MAX_MESSAGE_LEN);
+	uint8_t* rbuf = xalloc_array_zero(window, UDP_MAX_MESSAGE_LEN);
+	struct iovec* siov = xalloc_array_zero(window, sizeof(*siov));
+	struct iovec* riov = xalloc_array_zero(window, sizeof(*riov));
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+	struct mmsghdr* smsg = xalloc_array_zero(window, sizeof(*smsg));
+	struct mmsghdr* rmsg = xalloc_array_zero(window, sizeof(*rmsg));
+#endif
+	int s = socket(cfg->addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if(s == -1)
+		error("socket: %s", strerror(errno));
+	if(connect(s, (struct sockaddr*)&cfg->addr, cfg->addrlen) == -1)
+		error("connect: %s", strerror(errno));
+	fcntl(s, F_SETFL, O_NONBLOCK);
+	for(i=0; i<window; i++) {
+		riov[i].iov_base = rbuf + i*UDP_MAX_MESSAGE_LEN;
+		riov[i].iov_len = UDP_MAX_MESSAGE_LEN;
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+		rmsg[i].msg_hdr.msg_iov = &riov[i];
+		rmsg[i].msg_hdr.msg_iovlen = 1;
+#endif
+	}
+
+	while(1) {
+		struct pollfd p;
+		uint64_t now = now_ns();
+		if(now >= end)
+			break;
+		lg_timeout(res, slots, window, now);
+		/* fill the free slots with new queries */
+		n = 0;
+		for(i=0; i<window; i++) {
+			struct lg_query* q;
+			if(slots[i].sent != 0)
+				continue;
+			q = lg_next(cfg, &pos, sbuf + n*UDP_MAX_MESSAGE_LEN,
+				slots, i);
+			siov[n].iov_base = sbuf + n*UDP_MAX_MESSAGE_LEN;
+			siov[n].iov_len = q->len;
+			slots[i].sent = now;
+			n++;
+		}
+		if(n > 0) {
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+			int done = 0;
+			for(i=0; i<n; i++) {
+				memset(&smsg[i], 0, sizeof(smsg[i]));
+				smsg[i].msg_hdr.msg_iov = &siov[i];
+				smsg[i].msg_hdr.msg_iovlen = 1;
+			}
+			while(done < n) {
+				int r = sendmmsg(s, smsg+done, n-done, 0);
+				if(r == -1) {
+					if(errno == EINTR)
+						continue;
+					/* skip the query that fails */
+					done++;
+					continue;
+				}
+				done += r;
+			}
+#else
+			for(i=0; i<n; i++)
+				(void)send(s, siov[i].iov_base, siov[i].iov_len,
+					0);
+#endif
+			/* the queries that could not be sent time out, and
+			 * are counted as lost */
+			res->sent += n;
+		}
+
+		p.fd = s;
+		p.events = POLLIN;
+		p.revents = 0;
+		if(poll(&p, 1, 100) <= 0)
+			continue;
+		now = now_ns();
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+		for(i=0; i<window; i++)
+			rmsg[i].msg_len = 0;
+		n = recvmmsg(s, rmsg, window, 0, NULL);
+		for(i=0; i<n; i++)
+			lg_answer(res, slots, window, riov[i].iov_base,
+				rmsg[i].msg_len, now);
+#else
+		while((n = recv(s, rbuf, UDP_MAX_MESSAGE_LEN, 0)) > 0)
+			lg_answer(res, slots, window, rbuf, (size_t)n, now);
+#endif
+	}
+	close(s);
+	free(slots);
+	free(sbuf);
+	free(rbuf);
+	free(siov);
+	free(riov);
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+	free(smsg);
+	free(rmsg);
+#endif
+}
+
+/** a TCP or TLS stream to the server */
+struct lg_stream {
+	int s;
+#ifdef HAVE_SSL
+	SSL* ssl;
+#endif
+	/* read buffer, with the data from pos to len */
+	uint8_t rbuf[65536+2];
+	size_t pos, len;
+};
+
+static void
+stream_close(struct lg_stream* st)
+{
+#ifdef HAVE_SSL
+	if(st->ssl) {
+		SSL_shutdown(st->ssl);
+		SSL_free(st->ssl);
+		st->ssl = NULL;
+	}
+#endif
+	if(st->s != -1)
+		close(st->s);
+	st->s = -1;
+}
+
+static int
+stream_open(struct lg_cfg* cfg, struct lg_stream* st)
+{
+	int on = 1;
+	struct timeval tv;
+	st->pos = st->len = 0;
+	st->s = socket(cfg->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if(st->s == -1)
+		error("socket: %s", strerror(errno));
+	if(connect(st->s, (struct sockaddr*)&cfg->addr, cfg->addrlen) == -1) {
+		log_msg(LOG_ERR, "connect: %s", strerror(errno));
+		stream_close(st);
+		return 0;
+	}
+	(void)setsockopt(st->s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	/* wake up to time out queries */
+	tv.tv_sec = 0;
+	tv.tv_usec = 100000;
+	(void)setsockopt(st->s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#ifdef HAVE_SSL
+	if(cfg->transport == LG_TLS) {
+		if(!(st->ssl = SSL_new(cfg->ctx)))
+			error("SSL_new failed");
+		SSL_set_connect_state(st->ssl);
+		if(!SSL_set_fd(st->ssl, st->s))
+			error("SSL_set_fd failed");
+		if(SSL_connect(st->ssl) != 1) {
+			log_msg(LOG_ERR, "TLS handshake failed");
+			stream_close(st);
+			return 0;
+		}
+	}
+#endif
+	return 1;
+}
+
+/** write all the data, returns 0 on failure */
+static int
+stream_write(struct lg_stream* st, uint8_t* buf, size_t len)
+{
+	while(len > 0) {
+		ssize_t r;
+#ifdef HAVE_SSL
+		if(st->ssl)
+			r = SSL_write(st->ssl, buf, (int)len);
+		else
+#endif
+			r = write(st->s, buf, len);
+		if(r <= 0) {
+			if(r == -1 && errno == EINTR)
+				continue;
+			return 0;
+		}
+		buf += r;
+		len -= (size_t)r;
+	}
+	return 1;
+}
+
+/** read more data into the buffer, -1 on failure, 0 on timeout */
+static int
+stream_fill(struct lg_stream* st)
+{
+	ssize_t r;
+	if(st->pos > 0) {
+		memmove(st->rbuf, st->rbuf+st->pos, st->len-st->pos);
+		st->len -= st->pos;
+		st->pos = 0;
+	}
+#ifdef HAVE_SSL
+	if(st->ssl) {
+		r = SSL_read(st->ssl, st->rbuf+st->len,
+			(int)(sizeof(st->rbuf)-st->len));
+		if(r <= 0) {
+			int err = SSL_get_error(st->ssl, (int)r);
+			if(err == SSL_ERROR_WANT_READ || (err ==
+				SSL_ERROR_SYSCALL && (errno == EAGAIN ||
+				errno == EINTR)))
+				return 0;
+			return -1;
+		}
+	} else
+#endif
+	{
+		r = read(st->s, st->rbuf+st->len, sizeof(st->rbuf)-st->len);
+		if(r == -1 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		if(r <= 0)
+			return -1;
+	}
+	st->len += (size_t)r;
+	return 1;
+}
+
+/** TCP and TLS load, window pipelined queries on one connection */
+static void
+run_stream(struct lg_cfg* cfg, size_t pos, struct lg_result* res,
+	uint64_t end)
+{
+	int window = cfg->window, i, n;
+	struct lg_slot* slots = xalloc_array_zero(window, sizeof(*slots));
+	uint8_t* sbuf = xalloc_array_zero(window, UDP_MAX_MESSAGE_LEN+2);
+	struct lg_stream* st = xalloc_zero(sizeof(*st));
+	st->s = -1;
+
+	while(1) {
+		uint64_t now = now_ns();
+		size_t slen = 0;
+		int r;
+		if(now >= end)
+			break;
+		if(st->s == -1) {
+			/* the outstanding queries are lost with the
+			 * connection */
+			for(i=0; i<window; i++) {
+				if(slots[i].sent != 0) {
+					slots[i].sent = 0;
+					res->lost++;
+				}
+			}
+			if(!stream_open(cfg, st)) {
+				sleep(1);
+				continue;
+			}
+			res->connects++;
+		}
+		lg_timeout(res, slots, window, now);
+		/* write the new queries in one go */
+		n = 0;
+		for(i=0; i<window; i++) {
+			struct lg_query* q;
+			if(slots[i].sent != 0)
+				continue;
+			q = lg_next(cfg, &pos, sbuf+slen+2, slots, i);
+			sbuf[slen] = (uint8_t)(q->len>>8);
+			sbuf[slen+1] = (uint8_t)(q->len&0xff);
+			slen += q->len+2;
+			slots[i].sent = now;
+			n++;
+		}
+		if(slen > 0) {
+			if(!stream_write(st, sbuf, slen)) {
+				stream_close(st);
+				continue;
+			}
+			res->sent += n;
+		}
+
+		/* read the answers that are there */
+		r = stream_fill(st);
+		if(r == -1) {
+			stream_close(st);
+			continue;
+		}
+		now = now_ns();
+		while(st->len - st->pos >= 2) {
+			size_t plen = (st->rbuf[st->pos]<<8) |
+				st->rbuf[st->pos+1];
+			if(st->len - st->pos < plen+2)
+				break;
+			lg_answer(res, slots, window, st->rbuf+st->pos+2,
+				plen, now);
+			st->pos += plen+2;
+		}
+	}
+	stream_close(st);
+	free(st);
+	free(slots);
+	free(sbuf);
+}
+
+/** run the load in one process */
+static void
+lg_run(struct lg_cfg* cfg, int id, struct lg_result* res)
+{
+	uint64_t start = now_ns(), end;
+	/* the processes start at different points in the query list */
+	size_t pos = (cfg->num / cfg->procs) * id;
+	memset(res, 0, sizeof(*res));
+	end = start + ((uint64_t)cfg->duration)*1000000000;
+	if(cfg->transport == LG_UDP)
+		run_udp(cfg, pos, res, end);
+	else	run_stream(cfg, pos, res, end);
+	res->elapsed = now_ns() - start;
+}
+
+static void
+lg_add(struct lg_result* total, struct lg_result* r)
+{
+	int i;
+	total->sent += r->sent;
+	total->received += r->received;
+	total->lost += r->lost;
+	total->noerror += r->noerror;
+	total->nxdomain += r->nxdomain;
+	total->other += r->other;
+	total->truncated += r->truncated;
+	total->connects += r->connects;
+	if(r->elapsed > total->elapsed)
+		total->elapsed = r->elapsed;
+	for(i=0; i<LG_BUCKETS; i++)
+		total->hist[i] += r->hist[i];
+}
+
+/** percentile of the latency in usec, frac is a fraction of 1 */
+static double
+lg_percentile(struct lg_result* r, double frac)
+{
+	if(r->received == 0)
+		return 0.;
+	return (double)latency_percentile(r->hist, LG_BUCKETS, LG_SUB_BITS,
+		r->received, frac)/1000.;
+}
+
+/** print the results as key=value lines */
+static void
+lg_print(struct lg_result* r)
+{
+	printf("sent=%llu\n", (unsigned long long)r->sent);
+	printf("received=%llu\n", (unsigned long long)r->received);
+	printf("lost=%llu\n", (unsigned long long)r->lost);
+	printf("qps=%.0f\n", (r->elapsed?(double)r->received*1e9/
+		(double)r->elapsed:0.));
+	printf("latency.usec.p50=%.1f\n", lg_percentile(r, 0.50));
+	printf("latency.usec.p90=%.1f\n", lg_percentile(r, 0.90));
+	printf("latency.usec.p99=%.1f\n", lg_percentile(r, 0.99));
+	printf("latency.usec.p999=%.1f\n", lg_percentile(r, 0.999));
+	printf("rcode.noerror=%llu\n", (unsigned long long)r->noerror);
+	printf("rcode.nxdomain=%llu\n", (unsigned long long)r->nxdomain);
+	printf("rcode.other=%llu\n", (unsigned long long)r->other);
+	printf("truncated=%llu\n", (unsigned long long)r->truncated);
+	printf("connects=%llu\n", (unsigned long long)r->connects);
+}
+
+/** getopt global, in case header files fail to declare it. */
+extern int optind;
+/** getopt global, in case header files fail to declare it. */
+extern char* optarg;
+
+int
+main(int argc, char* argv[])
+{
+	int c, i;
+	const char* port = "53";
+	struct lg_cfg cfg;
+	struct lg_result total, r;
+	struct addrinfo hints, *ai = NULL;
+	int* fds;
+	pid_t* pids;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.procs = 1;
+	cfg.duration = 10;
+	cfg.window = 64;
+	log_init("loadgen");
+	while((c = getopt(argc, argv, "d:hn:p:t:w:")) != -1) {
+		switch(c) {
+		case 'd':
+			cfg.duration = atoi(optarg);
+			break;
+		case 'n':
+			cfg.procs = atoi(optarg);
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 't':
+			if(strcmp(optarg, "udp") == 0)
+				cfg.transport = LG_UDP;
+			else if(strcmp(optarg, "tcp") == 0)
+				cfg.transport = LG_TCP;
+			else if(strcmp(optarg, "tls") == 0)
+				cfg.transport = LG_TLS;
+			else {
+				usage();
+				return 1;
+			}
+			break;
+		case 'w':
+			cfg.window = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if(argc != 2 || cfg.procs < 1 || cfg.duration < 1 ||
+		cfg.window < 1 || cfg.window > LG_MAX_WINDOW) {
+		usage();
+		return 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_NUMERICHOST;
+	if(getaddrinfo(argv[0], port, &hints, &ai) != 0 || !ai)
+		error("cannot parse address %s port %s", argv[0], port);
+	memcpy(&cfg.addr, ai->ai_addr, ai->ai_addrlen);
+	cfg.addrlen = (socklen_t)ai->ai_addrlen;
+	freeaddrinfo(ai);
+	read_queries(argv[1], &cfg);
+	if(cfg.transport == LG_TLS) {
+#ifdef HAVE_SSL
+#if OPENSSL_VERSION_NUMBER < 0x10100000 || !defined(HAVE_OPENSSL_INIT_SSL)
+		SSL_library_init();
+		SSL_load_error_strings();
+#else
+		OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS, NULL);
+#endif
+		/* the certificate is not checked, this measures the
+		 * server */
+		if(!(cfg.ctx = SSL_CTX_new(SSLv23_client_method())))
+			error("SSL_CTX_new failed");
+#else
+		error("tls needs SSL support, it is disabled in this build");
+#endif
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&total, 0, sizeof(total));
+	fds = xalloc_array_zero(cfg.procs, sizeof(int));
+	pids = xalloc_array_zero(cfg.procs, sizeof(pid_t));
+	for(i=0; i<cfg.procs; i++) {
+		int sv[2];
+		if(pipe(sv) == -1)
+			error("pipe: %s", strerror(errno));
+		pids[i] = fork();
+		if(pids[i] == -1)
+			error("fork: %s", strerror(errno));
+		if(pids[i] == 0) {
+			close(sv[0]);
+			lg_run(&cfg, i, &r);
+			if(!write_socket(sv[1], &r, sizeof(r)))
+				exit(1);
+			close(sv[1]);
+			exit(0);
+		}
+		close(sv[1]);
+		fds[i] = sv[0];
+	}
+	for(i=0; i<cfg.procs; i++) {
+		size_t got = 0;
+		while(got < sizeof(r)) {
+			ssize_t ret = read(fds[i], ((uint8_t*)&r)+got,
+				sizeof(r)-got);
+			if(ret == -1 && errno == EINTR)
+				continue;
+			if(ret <= 0)
+				error("process %d failed", i);
+			got += (size_t)ret;
+		}
+		close(fds[i]);
+		(void)waitpid(pids[i], NULL, 0);
+		lg_add(&total, &r);
+	}
+	lg_print(&total);
+	free(fds);
+	free(pids);
+#ifdef HAVE_SSL
+	if(cfg.ctx)
+		SSL_CTX_free(cfg.ctx);
+#endif
+	return 0;
+}
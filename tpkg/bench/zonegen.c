@@ -0,0 +1,393 @@
+/*
+ * zonegen.c -- generate synthetic zones and query lists for the benchmarks.
+ *
+ * Copyright (c) 2021, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include "dns.h"
+#include "dname.h"
+#include "util.h"
+#include "iterated_hash.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** the fake signature and key data, the server does not verify them */
+#define FAKE_KEY "AwEAAaAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+#define FAKE_SIG "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" \
+	"AAAAAAAA"
+
+/** zone origin, without trailing dot */
+static const char* origin;
+/** number of labels in the origin */
+static int origin_labels;
+
+/** print usage text */
+static void
+usage(void)
+{
+	printf("usage:	zonegen [options] kind origin zonefile queryfile\n");
+	printf("Generate a synthetic zone and a list of queries for it.\n");
+	printf("kind is flat, deep, wildcard, nsec, nsec3 or tld.\n");
+	printf(" -h		this help\n");
+	printf(" -n count	number of names in the zone, default 10000\n");
+	printf(" -q count	number of queries, default 10000\n");
+}
+
+/** deterministic random numbers, so the runs can be compared */
+static unsigned int
+rnd(unsigned int max)
+{
+	/* xorshift32 */
+	static uint32_t state = 2463534242U;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state % max);
+}
+
+/** the SOA and apex records */
+static void
+zone_header(FILE* out)
+{
+	fprintf(out, "$ORIGIN %s.\n", origin);
+	fprintf(out, "$TTL 3600\n");
+	fprintf(out, "@\tSOA\tns1 hostmaster 1 3600 900 604800 300\n");
+	fprintf(out, "@\tNS\tns1\n");
+	fprintf(out, "ns1\tA\t192.0.2.1\n");
+}
+
+/** queries for the hosts in a flat zone, qsuffix is added to the lines */
+static void
+flat_queries(FILE* qout, int count, int numq, const char* qsuffix)
+{
+	int i;
+	for(i=0; i<numq; i++) {
+		int r = (int)rnd((unsigned)count), kind = (int)rnd(10);
+		if(kind < 7)
+			fprintf(qout, "h%d.%s. A%s\n", r, origin,
+				qsuffix);
+		else if(kind == 7)
+			fprintf(qout, "h%d.%s. AAAA%s\n", r, origin,
+				qsuffix);
+		else if(kind == 8) /* nodata */
+			fprintf(qout, "h%d.%s. MX%s\n", r, origin,
+				qsuffix);
+		else	fprintf(qout, "nx%d.%s. A%s\n", r, origin,
+				qsuffix);
+	}
+}
+
+/** a flat zone, count hosts with A and AAAA */
+static void
+gen_flat(FILE* out, FILE* qout, int count, int numq)
+{
+	int i;
+	zone_header(out);
+	for(i=0; i<count; i++) {
+		fprintf(out, "h%d\tA\t10.%d.%d.%d\n", i, (i>>16)&0xff,
+			(i>>8)&0xff, i&0xff);
+		fprintf(out, "h%d\tAAAA\t2001:db8::%x\n", i, i);
+	}
+	flat_queries(qout, count, numq, "");
+}
+
+/** name of node i in the deep zone, a tree with fanout 4 */
+static void
+deep_name(char* buf, size_t len, int i)
+{
+	size_t pos;
+	pos = (size_t)snprintf(buf, len, "n%d", i);
+	while(i > 0 && pos < len) {
+		pos += (size_t)snprintf(buf+pos, len-pos, ".b%d", i%4);
+		i /= 4;
+	}
+}
+
+/** a deep zone, names are many labels down with empty nonterminals */
+static void
+gen_deep(FILE* out, FILE* qout, int count, int numq)
+{
+	char name[512], *p;
+	int i;
+	zone_header(out);
+	for(i=0; i<count; i++) {
+		deep_name(name, sizeof(name), i);
+		fprintf(out, "%s\tA\t10.%d.%d.%d\n", name, (i>>16)&0xff,
+			(i>>8)&0xff, i&0xff);
+	}
+	for(i=0; i<numq; i++) {
+		int kind = (int)rnd(10);
+		deep_name(name, sizeof(name), (int)rnd((unsigned)count));
+		if(kind < 7) {
+			fprintf(qout, "%s.%s. A\n", name, origin);
+		} else if(kind < 9) {
+			/* nxdomain below a deep name */
+			fprintf(qout, "x%u.%s.%s. A\n", rnd(1000), name,
+				origin);
+		} else {
+			/* empty nonterminal, nodata */
+			p = strchr(name, '.');
+			fprintf(qout, "%s.%s. A\n", (p?p+1:name), origin);
+		}
+	}
+}
+
+/** a zone with wildcards, and explicit names next to them */
+static void
+gen_wildcard(FILE* out, FILE* qout, int count, int numq)
+{
+	int i, nwild = (count/10 > 0)?count/10:1;
+	zone_header(out);
+	for(i=0; i<nwild; i++) {
+		fprintf(out, "*.w%d\tA\t10.%d.%d.%d\n", i, (i>>16)&0xff,
+			(i>>8)&0xff, i&0xff);
+		fprintf(out, "*.w%d\tTXT\t\"wildcard %d\"\n", i, i);
+		fprintf(out, "e.w%d\tA\t192.0.2.2\n", i);
+	}
+	for(i=0; i<numq; i++) {
+		int r = (int)rnd((unsigned)nwild), kind = (int)rnd(10);
+		if(kind < 7)
+			fprintf(qout, "q%u.w%d.%s. A\n", rnd(100000), r,
+				origin);
+		else if(kind == 7)
+			fprintf(qout, "q%u.w%d.%s. TXT\n", rnd(100000), r,
+				origin);
+		else if(kind == 8)
+			fprintf(qout, "e.w%d.%s. A\n", r, origin);
+		else	fprintf(qout, "x.q%u.w%d.%s. A\n", rnd(100000), r,
+				origin);
+	}
+}
+
+/** a delegation only zone, like a TLD */
+static void
+gen_tld(FILE* out, FILE* qout, int count, int numq)
+{
+	int i;
+	zone_header(out);
+	for(i=0; i<count; i++) {
+		fprintf(out, "d%d\tNS\tns1.d%d\n", i, i);
+		fprintf(out, "d%d\tNS\tns2.d%d\n", i, i);
+		fprintf(out, "ns1.d%d\tA\t10.%d.%d.%d\n", i, (i>>16)&0xff,
+			(i>>8)&0xff, i&0xff);
+		fprintf(out, "ns2.d%d\tAAAA\t2001:db8::%x\n", i, i);
+	}
+	for(i=0; i<numq; i++) {
+		int r = (int)rnd((unsigned)count);
+		if(rnd(10) < 9)
+			fprintf(qout, "www.d%d.%s. A\n", r, origin);
+		else	fprintf(qout, "nx%d.%s. A\n", r, origin);
+	}
+}
+
+/** an owner name in the signed zone, with its types */
+struct owner {
+	char label[64];
+	/* the hashed name for NSEC3 */
+	char hash[64];
+	const char* types;
+};
+
+/** compare labels, in canonical order for these lowercase names */
+static int
+owner_cmp_label(const void* a, const void* b)
+{
+	return strcmp(((const struct owner*)a)->label,
+		((const struct owner*)b)->label);
+}
+
+#ifdef NSEC3
+/** compare the hashed names, for the NSEC3 chain */
+static int
+owner_cmp_hash(const void* a, const void* b)
+{
+	return strcmp(((const struct owner*)a)->hash,
+		((const struct owner*)b)->hash);
+}
+#endif
+
+/** fully qualified owner name, the label is empty for the apex */
+static const char*
+owner_name(struct owner* o)
+{
+	static char buf[512];
+	if(o->label[0] == 0)
+		snprintf(buf, sizeof(buf), "%s.", origin);
+	else	snprintf(buf, sizeof(buf), "%s.%s.", o->label, origin);
+	return buf;
+}
+
+/** print a fake signature over the rrset */
+static void
+print_rrsig(FILE* out, const char* owner, const char* type, int labels)
+{
+	fprintf(out, "%s\tRRSIG\t%s 8 %d 3600 20300101000000 "
+		"20200101000000 4711 %s. %s\n", owner, type, labels, origin,
+		FAKE_SIG);
+}
+
+/** a signed zone with hosts, the NSEC or NSEC3 chain and fake
+ * signatures */
+static void
+gen_signed(FILE* out, FILE* qout, int count, int numq, int nsec3)
+{
+	struct owner* list = xalloc_array_zero((size_t)count+2,
+		sizeof(*list));
+	int i, num = count+2;
+	list[0].types = "SOA NS DNSKEY";
+	list[1].types = "A";
+	snprintf(list[1].label, sizeof(list[1].label), "ns1");
+	for(i=0; i<count; i++) {
+		snprintf(list[i+2].label, sizeof(list[i+2].label), "h%d", i);
+		list[i+2].types = "A AAAA";
+	}
+
+	zone_header(out);
+	fprintf(out, "@\tDNSKEY\t257 3 8 %s\n", FAKE_KEY);
+	print_rrsig(out, owner_name(&list[0]), "SOA", origin_labels);
+	print_rrsig(out, owner_name(&list[0]), "NS", origin_labels);
+	print_rrsig(out, owner_name(&list[0]), "DNSKEY", origin_labels);
+	print_rrsig(out, owner_name(&list[1]), "A", origin_labels+1);
+	for(i=0; i<count; i++) {
+		fprintf(out, "h%d\tA\t10.%d.%d.%d\n", i, (i>>16)&0xff,
+			(i>>8)&0xff, i&0xff);
+		fprintf(out, "h%d\tAAAA\t2001:db8::%x\n", i, i);
+		print_rrsig(out, owner_name(&list[i+2]), "A", origin_labels+1);
+		print_rrsig(out, owner_name(&list[i+2]), "AAAA",
+			origin_labels+1);
+	}
+
+	if(!nsec3) {
+		qsort(list, (size_t)num, sizeof(*list), owner_cmp_label);
+		for(i=0; i<num; i++) {
+			char next[512];
+			snprintf(next, sizeof(next), "%s",
+				owner_name(&list[(i+1)%num]));
+			fprintf(out, "%s\tNSEC\t%s %s RRSIG NSEC\n",
+				owner_name(&list[i]), next, list[i].types);
+			print_rrsig(out, owner_name(&list[i]), "NSEC",
+				origin_labels+(list[i].label[0]?1:0));
+		}
+	} else {
+#ifdef NSEC3
+		uint8_t wire[MAXDOMAINLEN+2];
+		unsigned char hash[SHA_DIGEST_LENGTH];
+		fprintf(out, "@\tNSEC3PARAM\t1 0 0 -\n");
+		print_rrsig(out, owner_name(&list[0]), "NSEC3PARAM",
+			origin_labels);
+		for(i=0; i<num; i++) {
+			int len = dname_parse_wire(wire, owner_name(&list[i]));
+			if(len == 0) {
+				fprintf(stderr, "cannot parse %s\n",
+					owner_name(&list[i]));
+				exit(1);
+			}
+			(void)iterated_hash(hash, NULL, 0, wire, len, 0);
+			if(b32_ntop(hash, sizeof(hash), list[i].hash,
+				sizeof(list[i].hash)) == -1) {
+				fprintf(stderr, "cannot base32 the hash\n");
+				exit(1);
+			}
+		}
+		qsort(list, (size_t)num, sizeof(*list), owner_cmp_hash);
+		for(i=0; i<num; i++) {
+			char owner[512];
+			snprintf(owner, sizeof(owner), "%s.%s.", list[i].hash,
+				origin);
+			fprintf(out, "%s\tNSEC3\t1 0 0 - %s %s%s RRSIG\n",
+				owner, list[(i+1)%num].hash, list[i].types,
+				(list[i].label[0]?"":" NSEC3PARAM"));
+			print_rrsig(out, owner, "NSEC3", origin_labels+1);
+		}
+#else
+		fprintf(stderr, "zonegen: nsec3 needs NSEC3 support, "
+			"it is disabled in this build\n");
+		exit(1);
+#endif
+	}
+	free(list);
+	/* the queries for the signed zone are the flat queries with DO */
+	flat_queries(qout, count, numq, " DO");
+}
+
+/** getopt global, in case header files fail to declare it. */
+extern int optind;
+/** getopt global, in case header files fail to declare it. */
+extern char* optarg;
+
+int
+main(int argc, char* argv[])
+{
+	int c, count = 10000, numq = 10000;
+	const char* p;
+	FILE* out, *qout;
+	while((c = getopt(argc, argv, "hn:q:")) != -1) {
+		switch(c) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'q':
+			numq = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if(argc != 4 || count < 1 || numq < 1) {
+		usage();
+		return 1;
+	}
+	origin = argv[1];
+	origin_labels = 1;
+	for(p = origin; *p; p++)
+		if(*p == '.')
+			origin_labels++;
+	if(!(out = fopen(argv[2], "w"))) {
+		fprintf(stderr, "cannot open %s: %s\n", argv[2],
+			strerror(errno));
+		return 1;
+	}
+	if(!(qout = fopen(argv[3], "w"))) {
+		fprintf(stderr, "cannot open %s: %s\n", argv[3],
+			strerror(errno));
+		return 1;
+	}
+
+	if(strcmp(argv[0], "flat") == 0)
+		gen_flat(out, qout, count, numq);
+	else if(strcmp(argv[0], "deep") == 0)
+		gen_deep(out, qout, count, numq);
+	else if(strcmp(argv[0], "wildcard") == 0)
+		gen_wildcard(out, qout, count, numq);
+	else if(strcmp(argv[0], "nsec") == 0)
+		gen_signed(out, qout, count, numq, 0);
+	else if(strcmp(argv[0], "nsec3") == 0)
+		gen_signed(out, qout, count, numq, 1);
+	else if(strcmp(argv[0], "tld") == 0)
+		gen_tld(out, qout, count, numq);
+	else {
+		fprintf(stderr, "unknown zone kind %s\n", argv[0]);
+		usage();
+		return 1;
+	}
+	fclose(out);
+	fclose(qout);
+	return 0;
+}
@@ -0,0 +1,505 @@
+/*
+ * cutest_bench.c -- microbenchmarks for the core data structures.
+ *
+ * Copyright (c) 2021, NLnet Labs.  See LICENSE for license.
+ *
+ * Run with cutest -b, and select benchmarks with -r regex.  It prints the
+ * ns per operation, and the cache misses per operation when the perf
+ * counters can be opened.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <regex.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "region-allocator.h"
+#include "util.h"
+#include "dname.h"
+#include "radtree.h"
+#include "rbtree.h"
+#include "namedb.h"
+#include "packet.h"
+#include "answer.h"
+#include "query.h"
+#include "udb.h"
+
+/* number of timed operations per benchmark */
+#define BENCH_OPS 1000000
+/* number of names, objects for the benchmarks */
+static const size_t bench_sizes[] = { 1000, 10000, 100000, 1000000 };
+#define BENCH_NUM_SIZES (sizeof(bench_sizes)/sizeof(bench_sizes[0]))
+
+/* selected benchmarks */
+static regex_t bench_preg;
+
+/* the cache miss counter, or -1 if not available */
+static int bench_perf_fd = -1;
+
+/* deterministic random numbers, the same data for every run */
+static uint32_t bench_rnd_state;
+
+static uint32_t
+bench_rnd(void)
+{
+	/* xorshift32 */
+	bench_rnd_state ^= bench_rnd_state << 13;
+	bench_rnd_state ^= bench_rnd_state >> 17;
+	bench_rnd_state ^= bench_rnd_state << 5;
+	return bench_rnd_state;
+}
+
+static void
+bench_perf_open(void)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CACHE_MISSES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	bench_perf_fd = (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+	if(bench_perf_fd == -1)
+		printf("no perf counters (%s), no cache misses reported\n",
+			strerror(errno));
+#endif
+}
+
+static void
+bench_start(struct timespec* t)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	if(bench_perf_fd != -1) {
+		(void)ioctl(bench_perf_fd, PERF_EVENT_IOC_RESET, 0);
+		(void)ioctl(bench_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+	get_time_monotonic(t);
+}
+
+/* stop the timer and print the result line */
+static void
+bench_stop(struct timespec* start, const char* name, size_t size, size_t ops)
+{
+	struct timespec end;
+	double ns;
+	uint64_t misses = 0;
+	int have_misses = 0;
+	get_time_monotonic(&end);
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	if(bench_perf_fd != -1) {
+		(void)ioctl(bench_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(bench_perf_fd, &misses, sizeof(misses)) ==
+			(ssize_t)sizeof(misses))
+			have_misses = 1;
+	}
+#endif
+	ns = ((double)(end.tv_sec - start->tv_sec))*1e9 +
+		(double)(end.tv_nsec - start->tv_nsec);
+	if(have_misses)
+		printf("%-28s %8u %10.1f ns/op %8.2f misses/op\n", name,
+			(unsigned)size, ns/(double)ops,
+			(double)misses/(double)ops);
+	else	printf("%-28s %8u %10.1f ns/op\n", name, (unsigned)size,
+			ns/(double)ops);
+	fflush(stdout);
+}
+
+static int
+bench_selected(const char* name)
+{
+	return regexec(&bench_preg, name, 0, NULL, 0) == 0;
+}
+
+/* a random hostname like label, lowercase letters, digits and hyphens */
+static int
+bench_label(uint8_t* p)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+	int len = 1 + (int)(bench_rnd()%12), i;
+	p[0] = (uint8_t)len;
+	for(i=0; i<len; i++)
+		p[1+i] = (uint8_t)chars[bench_rnd()%(i==0?36:37)];
+	return len+1;
+}
+
+/* a random domain name, one to three labels below a TLD */
+static const dname_type*
+bench_name(region_type* region)
+{
+	static const char* tlds[] = { "\003com", "\003net", "\003org",
+		"\002nl", "\002de", "\002co\002uk" };
+	uint8_t buf[MAXDOMAINLEN];
+	int depth = 1 + (int)(bench_rnd()%3), i, pos = 0;
+	const char* tld = tlds[bench_rnd()%6];
+	for(i=0; i<depth; i++)
+		pos += bench_label(buf+pos);
+	memcpy(buf+pos, tld, strlen(tld)+1);
+	pos += (int)strlen(tld)+1;
+	return dname_make(region, buf, 0);
+}
+
+/* the names to insert, and the names to look up, half of which are not
+ * in the set */
+static void
+bench_names(region_type* region, size_t n, const dname_type*** names,
+	const dname_type*** lookups)
+{
+	size_t i;
+	bench_rnd_state = 2463534242U;
+	*names = region_alloc_array(region, n, sizeof(**names));
+	*lookups = region_alloc_array(region, BENCH_OPS, sizeof(**lookups));
+	for(i=0; i<n; i++)
+		(*names)[i] = bench_name(region);
+	for(i=0; i<BENCH_OPS; i++) {
+		if(bench_rnd()%2)
+			(*lookups)[i] = (*names)[bench_rnd()%n];
+		else	(*lookups)[i] = bench_name(region);
+	}
+}
+
+static void
+bench_radtree(size_t n, const dname_type** names, const dname_type** lookups)
+{
+	region_type* region = region_create(xalloc, free);
+	struct radtree* rt = radix_tree_create(region);
+	struct radnode* res;
+	struct timespec start;
+	uint8_t** keys;
+	radstrlen_type* lens;
+	size_t i, found = 0;
+	if(!bench_selected("radname_find_less_equal") &&
+		!bench_selected("radix_search"))
+		goto done;
+	for(i=0; i<n; i++)
+		(void)radname_insert(rt, dname_name(names[i]),
+			names[i]->name_size, (void*)names[i]);
+
+	if(bench_selected("radname_find_less_equal")) {
+		bench_start(&start);
+		for(i=0; i<BENCH_OPS; i++)
+			found += radname_find_less_equal(rt,
+				dname_name(lookups[i]), lookups[i]->name_size,
+				&res);
+		bench_stop(&start, "radname_find_less_equal", n, BENCH_OPS);
+	}
+
+	if(bench_selected("radix_search")) {
+		/* the conversion to radix keys is not timed */
+		keys = xalloc_array_zero(BENCH_OPS, sizeof(*keys));
+		lens = xalloc_array_zero(BENCH_OPS, sizeof(*lens));
+		for(i=0; i<BENCH_OPS; i++) {
+			keys[i] = region_alloc(region, MAXDOMAINLEN);
+			lens[i] = MAXDOMAINLEN;
+			radname_d2r(keys[i], &lens[i], dname_name(lookups[i]),
+				lookups[i]->name_size);
+		}
+		bench_start(&start);
+		for(i=0; i<BENCH_OPS; i++)
+			found += (radix_search(rt, keys[i], lens[i]) != NULL);
+		bench_stop(&start, "radix_search", n, BENCH_OPS);
+		free(keys);
+		free(lens);
+	}
+	if(found == 0)
+		printf("radtree: nothing found\n");
+done:
+	radix_tree_delete(rt);
+	region_destroy(region);
+}
+
+/* rbtree node keyed by domain name */
+struct bench_rbnode {
+	rbnode_type node;
+	const dname_type* dname;
+};
+
+static int
+bench_rbcmp(const void* a, const void* b)
+{
+	return dname_compare((const dname_type*)a, (const dname_type*)b);
+}
+
+static void
+bench_rbtree(size_t n, const dname_type** names, const dname_type** lookups)
+{
+	region_type* region = region_create(xalloc, free);
+	rbtree_type* tree = rbtree_create(region, bench_rbcmp);
+	struct bench_rbnode* nodes = xalloc_array_zero(n, sizeof(*nodes));
+	rbnode_type* res;
+	struct timespec start;
+	size_t i, found = 0;
+	if(!bench_selected("rbtree_find_less_equal"))
+		goto done;
+	for(i=0; i<n; i++) {
+		nodes[i].dname = names[i];
+		nodes[i].node.key = names[i];
+		(void)rbtree_insert(tree, &nodes[i].node);
+	}
+	bench_start(&start);
+	for(i=0; i<BENCH_OPS; i++)
+		found += rbtree_find_less_equal(tree, lookups[i], &res);
+	bench_stop(&start, "rbtree_find_less_equal", n, BENCH_OPS);
+	if(found == 0)
+		printf("rbtree: nothing found\n");
+done:
+	free(nodes);
+	region_destroy(region);
+}
+
+static void
+bench_dname(size_t n, const dname_type** names, const dname_type** lookups)
+{
+	struct timespec start;
+	size_t i;
+	int sum = 0;
+	if(bench_selected("dname_compare")) {
+		bench_start(&start);
+		for(i=0; i<BENCH_OPS; i++)
+			sum += dname_compare(names[i%n], lookups[i]);
+		bench_stop(&start, "dname_compare", n, BENCH_OPS);
+	}
+	if(bench_selected("label_compare")) {
+		bench_start(&start);
+		for(i=0; i<BENCH_OPS; i++)
+			sum += label_compare(dname_name(names[i%n]),
+				dname_name(lookups[i]));
+		bench_stop(&start, "label_compare", n, BENCH_OPS);
+	}
+	if(sum == 0x7fffffff)
+		printf("dname: unlikely sum\n");
+}
+
+/* sizes like the allocations for domains, rrsets and rdata */
+static size_t
+bench_alloc_size(void)
+{
+	static const size_t sizes[] = { 8, 16, 24, 32, 48, 64, 96, 128, 256 };
+	return sizes[bench_rnd()%(sizeof(sizes)/sizeof(sizes[0]))];
+}
+
+static void
+bench_region(size_t n)
+{
+	/* with a recycle bin, as the database region */
+	region_type* region = region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	void** live = xalloc_array_zero(n, sizeof(*live));
+	size_t* livesz = xalloc_array_zero(n, sizeof(*livesz));
+	struct timespec start;
+	size_t i;
+	if(!bench_selected("region_alloc_recycle"))
+		goto done;
+	bench_rnd_state = 2463534242U;
+	for(i=0; i<n; i++) {
+		livesz[i] = bench_alloc_size();
+		live[i] = region_alloc(region, livesz[i]);
+	}
+	/* replace random live objects, like updates to the database */
+	bench_start(&start);
+	for(i=0; i<BENCH_OPS; i++) {
+		size_t j = bench_rnd()%n;
+		region_recycle(region, live[j], livesz[j]);
+		livesz[j] = bench_alloc_size();
+		live[j] = region_alloc(region, livesz[j]);
+	}
+	bench_stop(&start, "region_alloc_recycle", n, BENCH_OPS);
+done:
+	free(live);
+	free(livesz);
+	region_destroy(region);
+}
+
+#ifdef HAVE_MMAP
+/* no relptrs in the benchmark chunks */
+static void
+bench_udbwalk(void* base, void* warg, uint8_t t, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg)
+{
+	(void)base; (void)warg; (void)t; (void)d; (void)s; (void)cb;
+	(void)arg;
+}
+
+static void
+bench_udb(size_t n)
+{
+	char fname[1024];
+	udb_base* udb;
+	udb_ptr* live;
+	size_t* livesz;
+	struct timespec start;
+	size_t i;
+	if(!bench_selected("udb_alloc_space_free"))
+		return;
+	/* large sizes are slow to set up and use a lot of disk */
+	if(n > 100000)
+		return;
+	snprintf(fname, sizeof(fname), "/tmp/benchudb%u.udb",
+		(unsigned)getpid());
+	udb = udb_base_create_new(fname, bench_udbwalk, NULL);
+	if(!udb) {
+		printf("cannot create %s\n", fname);
+		return;
+	}
+	/* the chunks are referenced with udb_ptrs, because compaction
+	 * after udb_alloc_free moves them, like in the namedb.  A chunk is
+	 * replaced by one of the same size, like an updated rrset */
+	live = xalloc_array_zero(n, sizeof(*live));
+	livesz = xalloc_array_zero(n, sizeof(*livesz));
+	bench_rnd_state = 2463534242U;
+	for(i=0; i<n; i++) {
+		livesz[i] = bench_alloc_size();
+		udb_ptr_init(&live[i], udb);
+		(void)udb_ptr_alloc_space(&live[i], udb, udb_chunk_type_data,
+			livesz[i]);
+	}
+	bench_start(&start);
+	for(i=0; i<BENCH_OPS; i++) {
+		size_t j = bench_rnd()%n;
+		udb_ptr_free_space(&live[j], udb, livesz[j]);
+		(void)udb_ptr_alloc_space(&live[j], udb, udb_chunk_type_data,
+			livesz[j]);
+	}
+	bench_stop(&start, "udb_alloc_space_free", n, BENCH_OPS);
+	/* the file is deleted, unlink the ptrs without freeing the space */
+	for(i=0; i<n; i++)
+		udb_ptr_set(&live[i], udb, 0);
+	udb_base_close(udb);
+	udb_base_free(udb);
+	(void)unlink(fname);
+	free(live);
+	free(livesz);
+}
+#endif /* HAVE_MMAP */
+
+/* an rrset of count records of the type at the owner */
+static rrset_type*
+bench_rrset(region_type* region, domain_table_type* table,
+	domain_type* owner, uint16_t type, int count)
+{
+	rrset_type* rrset = region_alloc_zero(region, sizeof(*rrset));
+	int i;
+	rrset->rr_count = (uint16_t)count;
+	rrset->rrs = region_alloc_array_zero(region, count, sizeof(rr_type));
+	for(i=0; i<count; i++) {
+		rr_type* rr = &rrset->rrs[i];
+		rr_set_owner(rr, owner);
+		rr->type = type;
+		rr->klass = CLASS_IN;
+		rr->ttl = 3600;
+		rr->rdata_count = 1;
+		rr->rdatas = region_alloc_zero(region, sizeof(rdata_atom_type));
+		if(type == TYPE_A) {
+			uint16_t* d = region_alloc(region, sizeof(uint16_t)+4);
+			d[0] = 4;
+			memcpy(d+1, "\012\000\000", 3);
+			((uint8_t*)(d+1))[3] = (uint8_t)i;
+			rr->rdatas[0].data = d;
+		} else {
+			/* NS records with names below the owner, that
+			 * compress */
+			uint8_t buf[MAXDOMAINLEN];
+			const dname_type* ns;
+			buf[0] = 3;
+			memcpy(buf+1, "ns", 2);
+			buf[3] = (uint8_t)('a' + i%26);
+			memcpy(buf+4, dname_name(domain_dname(owner)),
+				domain_dname(owner)->name_size);
+			ns = dname_make(region, buf, 0);
+			rr->rdatas[0].domain = domain_table_insert(table, ns);
+		}
+	}
+	return rrset;
+}
+
+static void
+bench_packet(void)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_table_type* table = domain_table_create(region);
+	static const int counts[] = { 1, 8, 32 };
+	static const uint8_t ownername[] =
+		"\003www\007example\003com";
+	domain_type* owner = domain_table_insert(table, dname_make(region,
+		ownername, 0));
+	static domain_type* compressed_dnames[MAXRRSPP];
+	uint16_t* offsets;
+	query_type* q;
+	struct timespec start;
+	size_t i, c, t;
+	int done = 0;
+	char name[64];
+	rrset_type* rrsets[2][3];
+	for(t=0; t<2; t++)
+		for(c=0; c<3; c++)
+			rrsets[t][c] = bench_rrset(region, table, owner,
+				(t==0?TYPE_A:TYPE_NS), counts[c]);
+	offsets = xalloc_array_zero(domain_table_count(table) + 1 +
+		EXTRA_DOMAIN_NUMBERS, sizeof(uint16_t));
+	q = query_create(region, offsets, domain_table_count(table) + 1,
+		compressed_dnames);
+	for(t=0; t<2; t++) {
+		snprintf(name, sizeof(name), "packet_encode_rrset_%s",
+			(t==0?"A":"NS"));
+		if(!bench_selected(name))
+			continue;
+		for(c=0; c<3; c++) {
+			bench_start(&start);
+			for(i=0; i<BENCH_OPS; i++) {
+				query_reset(q, TCP_MAX_MESSAGE_LEN, 1);
+				buffer_set_position(q->packet, QHEADERSZ);
+				(void)packet_encode_rrset(q, owner,
+					rrsets[t][c], ANSWER_SECTION,
+					TCP_MAX_MESSAGE_LEN, &done);
+				query_clear_compression_tables(q);
+			}
+			bench_stop(&start, name, (size_t)counts[c],
+				BENCH_OPS);
+		}
+	}
+	free(offsets);
+	region_destroy(region);
+}
+
+int runbench(const char* regex);
+
+int
+runbench(const char* regex)
+{
+	size_t s;
+	if(regcomp(&bench_preg, regex, REG_EXTENDED | REG_NOSUB) != 0) {
+		fprintf(stderr, "invalid regular expression\n");
+		return 1;
+	}
+	bench_perf_open();
+	printf("%-28s %8s %10s\n", "benchmark", "size", "speed");
+	for(s=0; s<BENCH_NUM_SIZES; s++) {
+		region_type* region = region_create(xalloc, free);
+		const dname_type** names, **lookups;
+		size_t n = bench_sizes[s];
+		bench_names(region, n, &names, &lookups);
+		bench_radtree(n, names, lookups);
+		bench_rbtree(n, names, lookups);
+		bench_dname(n, names, lookups);
+		bench_region(n);
+#ifdef HAVE_MMAP
+		bench_udb(n);
+#endif
+		region_destroy(region);
+	}
+	bench_packet();
+	if(bench_perf_fd != -1)
+		close(bench_perf_fd);
+	regfree(&bench_preg);
+	return 0;
+}
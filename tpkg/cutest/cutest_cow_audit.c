@@ -0,0 +1,152 @@
+/*
+	test the audit of the writes to the zone data in the server
+	processes, database-cow-audit
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "tpkg/cutest/cutest.h"
+#include "nsd.h"
+#include "namedb.h"
+#include "cow-audit.h"
+#include "region-allocator.h"
+#include "util.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SIGACTION) && defined(SA_SIGINFO)
+
+static void cow_audit_write(CuTest *tc);
+static void cow_audit_other_fault(CuTest *tc);
+
+CuSuite* reg_cutest_cow_audit(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, cow_audit_write);
+	SUITE_ADD_TEST(suite, cow_audit_other_fault);
+	return suite;
+}
+
+/* number and size of the objects in the zone data, more than one arena */
+#define TEST_OBJECTS 20000
+#define TEST_OBJECT_SIZE 200
+
+/* the zone data of the test, in a slab region */
+static region_type*
+test_zone_data(struct nsd* nsd, struct namedb* db, char** objs)
+{
+	region_type* region = region_create_slab(xalloc, free,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 0);
+	size_t i;
+	for(i=0; i<TEST_OBJECTS; i++) {
+		objs[i] = (char*)region_alloc(region, TEST_OBJECT_SIZE);
+		memset(objs[i], (int)(i&0x7f), TEST_OBJECT_SIZE);
+	}
+	memset(nsd, 0, sizeof(*nsd));
+	memset(db, 0, sizeof(*db));
+	db->region = region;
+	nsd->db = db;
+	return region;
+}
+
+/* in the server process, the exit code is the error */
+static int
+test_server_write(struct nsd* nsd, char** objs)
+{
+	size_t i, page = getpagesize();
+	int sum = 0;
+	cow_audit_start(nsd);
+	/* reads are not counted */
+	for(i=0; i<TEST_OBJECTS; i++)
+		sum += objs[i][0];
+	if(sum == 0 || cow_audit_bytes() != 0)
+		return 2;
+	/* a write is counted once for its page, and it is done */
+	objs[0][0] = 'x';
+	if(cow_audit_bytes() != page || objs[0][0] != 'x')
+		return 3;
+	objs[0][1] = 'y';
+	if(cow_audit_bytes() != page || objs[0][1] != 'y')
+		return 4;
+	/* a write to the last object, on another page */
+	objs[TEST_OBJECTS-1][0] = 'z';
+	if(cow_audit_bytes() != 2*page || objs[TEST_OBJECTS-1][0] != 'z')
+		return 5;
+	cow_audit_stop(nsd);
+	/* after the stop, the writes are not counted */
+	objs[TEST_OBJECTS/2][0] = 'w';
+	if(cow_audit_bytes() != 2*page)
+		return 6;
+	return 0;
+}
+
+static void
+cow_audit_write(CuTest *tc)
+{
+	struct nsd nsd;
+	struct namedb db;
+	region_type* region;
+	char** objs = (char**)xalloc_array_zero(TEST_OBJECTS, sizeof(char*));
+	int status;
+	pid_t pid;
+
+	region = test_zone_data(&nsd, &db, objs);
+	pid = fork();
+	CuAssert(tc, "fork", pid != -1);
+	if(pid == 0)
+		_exit(test_server_write(&nsd, objs));
+	CuAssert(tc, "waitpid", waitpid(pid, &status, 0) == pid);
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		printf("cow audit server exit %d signal %d\n",
+			WIFEXITED(status)?WEXITSTATUS(status):-1,
+			WIFSIGNALED(status)?WTERMSIG(status):0);
+	CuAssert(tc, "server counts the writes", WIFEXITED(status) &&
+		WEXITSTATUS(status) == 0);
+	/* the pages of the server were copies */
+	CuAssert(tc, "zone data unchanged", objs[0][0] == 0);
+	free(objs);
+	region_destroy(region);
+}
+
+static void
+cow_audit_other_fault(CuTest *tc)
+{
+	struct nsd nsd;
+	struct namedb db;
+	region_type* region;
+	char** objs = (char**)xalloc_array_zero(TEST_OBJECTS, sizeof(char*));
+	int status;
+	pid_t pid;
+
+	region = test_zone_data(&nsd, &db, objs);
+	pid = fork();
+	CuAssert(tc, "fork", pid != -1);
+	if(pid == 0) {
+		volatile char* p = NULL;
+		struct rlimit rl;
+		/* no core file for the crash of the test */
+		rl.rlim_cur = rl.rlim_max = 0;
+		(void)setrlimit(RLIMIT_CORE, &rl);
+		/* the action from before the audit is the default one */
+		(void)signal(SIGSEGV, SIG_DFL);
+		cow_audit_start(&nsd);
+		/* a fault outside the zone data still ends the process */
+		*p = 0;
+		_exit(0);
+	}
+	CuAssert(tc, "waitpid", waitpid(pid, &status, 0) == pid);
+	CuAssert(tc, "server crashes", WIFSIGNALED(status) &&
+		WTERMSIG(status) == SIGSEGV);
+	free(objs);
+	region_destroy(region);
+}
+
+#endif /* HAVE_MMAP && HAVE_SIGACTION && SA_SIGINFO */
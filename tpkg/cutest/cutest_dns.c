@@ -13,14 +13,18 @@
 #include "tpkg/cutest/cutest.h"
 #include "region-allocator.h"
 #include "dns.h"
+#include "namedb.h"
+#include "rdata.h"
 
 static void dns_1(CuTest *tc);
+static void dns_2(CuTest *tc);
 
 CuSuite* reg_cutest_dns(void)
 {
         CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, dns_1);
+	SUITE_ADD_TEST(suite, dns_2);
 	return suite;
 }
 
@@ -39,3 +43,63 @@ static void dns_1(CuTest *tc)
 	d = rrtype_descriptor_by_type(TYPE_NSEC3);
 	CuAssert(tc, "dns rrtype descriptor: type nsec3", d->type == TYPE_NSEC3);
 }
+
+/* see if the atom is stored inline and has the data */
+static void check_atom(CuTest *tc, rdata_atom_type* atom, int is_inline,
+	const uint8_t* data, size_t len)
+{
+	uint8_t* d = rdata_atom_data(*atom);
+	CuAssert(tc, "rdata atom inline", rdata_atom_is_inline(*atom) ==
+		is_inline);
+	CuAssert(tc, "rdata atom size", rdata_atom_size(*atom) == len);
+	CuAssert(tc, "rdata atom data", memcmp(d, data, len) == 0);
+	if(is_inline)
+		CuAssert(tc, "rdata atom data in the atom",
+			d > (uint8_t*)atom && d+len <= (uint8_t*)(atom+1));
+}
+
+/* parse the rdata in wireformat into atoms */
+static ssize_t wire_to_atoms(region_type* region, uint16_t type,
+	const uint8_t* wire, size_t len, rdata_atom_type** rdatas)
+{
+	buffer_type packet;
+	buffer_create_from(&packet, (void*)wire, len);
+	return rdata_wireformat_to_rdata_atoms(region, NULL, type, len,
+		&packet, rdatas);
+}
+
+static void dns_2(CuTest *tc)
+{
+	/* Check the small rdata that is stored in the atom. */
+	region_type* region = region_create(xalloc, free);
+	rdata_atom_type* rdatas, atom;
+	const uint8_t a[] = {192, 0, 2, 1};
+	const uint8_t aaaa[] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 1};
+	const uint8_t mx[] = {0, 10, 2, 'm', 'x', 0};
+	const uint8_t big[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+
+	CuAssert(tc, "rdata a", wire_to_atoms(region, TYPE_A, a, sizeof(a),
+		&rdatas) == 1);
+	check_atom(tc, &rdatas[0], 1, a, sizeof(a));
+
+	CuAssert(tc, "rdata aaaa", wire_to_atoms(region, TYPE_AAAA, aaaa,
+		sizeof(aaaa), &rdatas) == 1);
+	check_atom(tc, &rdatas[0], 0, aaaa, sizeof(aaaa));
+
+	CuAssert(tc, "rdata mx", wire_to_atoms(region, TYPE_MX, mx,
+		sizeof(mx), &rdatas) == 2);
+	check_atom(tc, &rdatas[0], 1, mx, 2);
+
+	/* the largest that fits, and one more */
+	CuAssert(tc, "rdata inline max", rdata_atom_set_inline(&atom, big,
+		RDATA_INLINE_MAX));
+	check_atom(tc, &atom, 1, big, RDATA_INLINE_MAX);
+	CuAssert(tc, "rdata inline empty", rdata_atom_set_inline(&atom, big,
+		0));
+	check_atom(tc, &atom, 1, big, 0);
+	CuAssert(tc, "rdata inline too large", !rdata_atom_set_inline(&atom,
+		big, RDATA_INLINE_MAX+1));
+
+	region_destroy(region);
+}
@@ -0,0 +1,382 @@
+/*
+	test the dnstap collector, the rings of a previous worker and the
+	new worker after a reload, and the filter that selects the queries
+	that are logged
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "tpkg/cutest/cutest.h"
+#include "nsd.h"
+#include "options.h"
+#include "namedb.h"
+#include "query.h"
+#include "packet.h"
+#include "dname.h"
+#include "region-allocator.h"
+#include "util.h"
+
+#ifdef USE_DNSTAP
+#include "dnstap/dnstap_collector.h"
+
+static void dt_ring_handoff(CuTest *tc);
+static void dt_filter_match(CuTest *tc);
+static void dt_filter_sample(CuTest *tc);
+
+CuSuite* reg_cutest_dnstap(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, dt_ring_handoff);
+	SUITE_ADD_TEST(suite, dt_filter_match);
+	SUITE_ADD_TEST(suite, dt_filter_sample);
+	return suite;
+}
+
+/* number of messages that a worker writes */
+#define TEST_RING_MSGS 2000
+
+/* the nsd of a server process, with one worker */
+static struct nsd test_nsd;
+static struct nsd_child test_child;
+
+/* a query message from the worker, the id is the sequence number and
+ * the port is the tag of the worker */
+static void
+test_ring_query(query_type* q, uint16_t tag, uint16_t id)
+{
+	struct sockaddr_in* a = (struct sockaddr_in*)&q->addr;
+	memset(&q->addr, 0, sizeof(q->addr));
+	a->sin_family = AF_INET;
+	a->sin_port = htons(tag);
+	q->addrlen = sizeof(*a);
+	q->tcp = 0;
+	buffer_clear(q->packet);
+	buffer_write_u16(q->packet, id);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u32(q->packet, 0);
+	buffer_write_u32(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_flip(q->packet);
+	dt_collector_submit_auth_query(&test_nsd, q);
+}
+
+/* a worker process, that tells the test when it has claimed its ring,
+ * writes its messages and exits when the test closes the pipe */
+static pid_t
+test_ring_worker(query_type* q, uint16_t tag, int* done)
+{
+	int info[2], wait[2];
+	char c = 0;
+	pid_t pid;
+	if(pipe(info) == -1 || pipe(wait) == -1)
+		return -1;
+	pid = fork();
+	if(pid == 0) {
+		int i;
+		close(info[0]);
+		close(wait[1]);
+		dt_collector_worker_start(&test_nsd);
+		if(write(info[1], &c, 1) != 1)
+			_exit(1);
+		for(i=0; i<TEST_RING_MSGS; i++)
+			test_ring_query(q, tag, (uint16_t)i);
+		if(read(wait[0], &c, 1) == -1)
+			_exit(1);
+		_exit(0);
+	}
+	close(info[1]);
+	close(wait[0]);
+	if(pid != -1 && read(info[0], &c, 1) != 1)
+		pid = -1;
+	close(info[0]);
+	*done = wait[1];
+	return pid;
+}
+
+/* let the worker exit, returns true if it exited without error */
+static int
+test_ring_worker_exit(pid_t pid, int done)
+{
+	int status, w;
+	close(done);
+	while((w = waitpid(pid, &status, 0)) == -1 && errno == EINTR)
+		;
+	return (w == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* check the messages in the ring, the messages of the workers with the
+ * tags, in that order, each its messages in sequence */
+static int
+test_ring_check(struct dt_collector_ring* ring, uint16_t tag1,
+	uint16_t tag2)
+{
+	uint32_t off = 0, len, addrlen, n = 0;
+	while(off < ring->head) {
+		uint8_t* p = ring->data+off;
+		struct sockaddr_in a;
+		uint16_t tag, id;
+		len = read_uint32(p);
+		addrlen = read_uint32(p+4+1);
+		if(addrlen != sizeof(a))
+			return 0;
+		memcpy(&a, p+4+1+4, sizeof(a));
+		tag = ntohs(a.sin_port);
+		id = read_uint16(p+4+1+4+addrlen+1+4);
+		if(tag != (n<TEST_RING_MSGS?tag1:tag2) ||
+			id != n%TEST_RING_MSGS)
+			return 0;
+		off += (4+len+7)&~((uint32_t)7);
+		n++;
+	}
+	return (n == (tag2?2:1)*TEST_RING_MSGS && ring->queued == n &&
+		ring->dropped == 0);
+}
+
+static void
+dt_ring_handoff(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = nsd_options_create(region);
+	query_type* q = query_create(region, NULL, 0, NULL);
+	struct dt_collector* dt_col;
+	pid_t a, b, c, d;
+	int done_a, done_b, done_c, done_d;
+
+	memset(&test_nsd, 0, sizeof(test_nsd));
+	memset(&test_child, 0, sizeof(test_child));
+	test_nsd.options = opt;
+	test_nsd.child_count = 1;
+	test_nsd.children = &test_child;
+	test_nsd.this_child = &test_child;
+	opt->dnstap_log_auth_query_messages = 1;
+	dt_col = test_nsd.dt_collector = dt_collector_create(&test_nsd);
+	CuAssertTrue(tc, dt_col->ring_count == 2);
+
+	/* the worker, and the new worker after a reload while the
+	 * previous one serves tcp, they write at the same time */
+	a = test_ring_worker(q, 1, &done_a);
+	CuAssertTrue(tc, a != -1);
+	b = test_ring_worker(q, 2, &done_b);
+	CuAssertTrue(tc, b != -1);
+	/* after another reload, both rings are in use */
+	d = test_ring_worker(q, 4, &done_d);
+	CuAssertTrue(tc, d != -1);
+	CuAssertTrue(tc, test_ring_worker_exit(d, done_d));
+	CuAssertTrue(tc, test_ring_worker_exit(b, done_b));
+	CuAssertTrue(tc, test_ring_worker_exit(a, done_a));
+
+	/* the ring of the exited worker is free for the next worker */
+	c = test_ring_worker(q, 3, &done_c);
+	CuAssertTrue(tc, c != -1);
+	CuAssertTrue(tc, test_ring_worker_exit(c, done_c));
+
+	CuAssertTrue(tc, test_ring_check(&dt_col->rings[0], 1, 3));
+	CuAssertTrue(tc, test_ring_check(&dt_col->rings[1], 2, 0));
+
+	dt_collector_close(dt_col, &test_nsd);
+	dt_collector_destroy(dt_col, &test_nsd);
+	test_nsd.dt_collector = NULL;
+	region_destroy(region);
+}
+
+/* create the collector, and its ring, for the options */
+static void
+test_filter_start(struct nsd_options* opt)
+{
+	memset(&test_nsd, 0, sizeof(test_nsd));
+	memset(&test_child, 0, sizeof(test_child));
+	test_nsd.options = opt;
+	test_nsd.child_count = 1;
+	test_nsd.children = &test_child;
+	test_nsd.this_child = &test_child;
+	opt->dnstap_log_auth_query_messages = 1;
+	opt->dnstap_log_auth_response_messages = 1;
+	test_nsd.dt_collector = dt_collector_create(&test_nsd);
+	dt_collector_worker_start(&test_nsd);
+}
+
+static void
+test_filter_stop(void)
+{
+	dt_collector_close(test_nsd.dt_collector, &test_nsd);
+	dt_collector_destroy(test_nsd.dt_collector, &test_nsd);
+	test_nsd.dt_collector = NULL;
+}
+
+/* a zone, and a zone filter entry for it */
+static zone_type*
+test_filter_zone(region_type* region, struct namedb* db,
+	struct nsd_options* opt, const char* name, int filter)
+{
+	if(filter) {
+		struct dnstap_zone_option* z = region_alloc_zero(region,
+			sizeof(*z));
+		z->name = region_strdup(region, name);
+		z->next = opt->dnstap_filter_zones;
+		opt->dnstap_filter_zones = z;
+	}
+	return namedb_zone_create(db, dname_parse(region, name), NULL);
+}
+
+/* submit a query and its response, returns the number of messages that
+ * are put in the ring */
+static int
+test_filter_query(query_type* q, zone_type* zone, uint16_t qtype,
+	int rcode, int tcp, int tc, int discarded)
+{
+	struct dt_collector_ring* ring = &test_nsd.dt_collector->rings[0];
+	uint64_t queued = ring->queued;
+	struct sockaddr_in* a = (struct sockaddr_in*)&q->addr;
+	memset(&q->addr, 0, sizeof(q->addr));
+	a->sin_family = AF_INET;
+	a->sin_port = htons(53);
+	q->addrlen = sizeof(*a);
+	q->tcp = tcp;
+	q->qtype = qtype;
+	q->zone = NULL;
+	buffer_clear(q->packet);
+	buffer_write_u16(q->packet, 0x1234);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_flip(q->packet);
+	dt_collector_submit_auth_query(&test_nsd, q);
+
+	/* the processed query */
+	q->zone = zone;
+	QR_SET(q->packet);
+	RCODE_SET(q->packet, rcode);
+	if(tc)
+		TC_SET(q->packet);
+	dt_collector_submit_auth_response(&test_nsd, q, discarded);
+	return (int)(ring->queued - queued);
+}
+
+static void
+dt_filter_match(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = nsd_options_create(region);
+	struct namedb* db = namedb_open(NULL, NULL);
+	zone_type *com, *net, *sub;
+	query_type* q = query_create(region, NULL, 0, NULL);
+	uint64_t filter[DT_FILTER_NUM];
+	CuAssertTrue(tc, db != NULL);
+
+	/* log udp queries for A and AAAA in example.com, with NXDOMAIN */
+	com = test_filter_zone(region, db, opt, "example.com.", 1);
+	net = test_filter_zone(region, db, opt, "example.net.", 0);
+	sub = test_filter_zone(region, db, opt, "sub.example.com.", 0);
+	opt->dnstap_filter_qtypes = region_alloc_zero(region, 65536/8);
+	opt->dnstap_filter_qtypes[TYPE_A/8] |= (1<<(TYPE_A&7));
+	opt->dnstap_filter_qtypes[TYPE_AAAA/8] |= (1<<(TYPE_AAAA&7));
+	opt->dnstap_filter_rcodes = (1<<RCODE_NXDOMAIN);
+	opt->dnstap_filter_transport = 1;
+	test_filter_start(opt);
+	CuAssertTrue(tc, dt_collector_filter_used(test_nsd.dt_collector,
+		opt, DT_FILTER_ZONE));
+	CuAssertTrue(tc, dt_collector_filter_used(test_nsd.dt_collector,
+		opt, DT_FILTER_TRANSPORT));
+	CuAssertTrue(tc, !dt_collector_filter_used(test_nsd.dt_collector,
+		opt, DT_FILTER_SAMPLE));
+	CuAssertTrue(tc, !dt_collector_filter_used(test_nsd.dt_collector,
+		opt, DT_FILTER_TC));
+
+	/* the zones are marked before the servers are forked */
+	dt_collector_mark_zones(test_nsd.dt_collector, db);
+	CuAssertTrue(tc, com->dnstap_filter && !net->dnstap_filter &&
+		!sub->dnstap_filter);
+
+	/* the query and the response are logged */
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_A, RCODE_NXDOMAIN,
+		0, 0, 0) == 2);
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_AAAA,
+		RCODE_NXDOMAIN, 0, 0, 0) == 2);
+	/* the zone filter, the zone below it is a zone of its own */
+	CuAssertTrue(tc, test_filter_query(q, net, TYPE_A, RCODE_NXDOMAIN,
+		0, 0, 0) == 0);
+	CuAssertTrue(tc, test_filter_query(q, sub, TYPE_A, RCODE_NXDOMAIN,
+		0, 0, 0) == 0);
+	CuAssertTrue(tc, test_filter_query(q, NULL, TYPE_A, RCODE_NXDOMAIN,
+		0, 0, 0) == 0);
+	/* the qtype, rcode and transport filters */
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_MX, RCODE_NXDOMAIN,
+		0, 0, 0) == 0);
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_A, RCODE_OK,
+		0, 0, 0) == 0);
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_A, RCODE_NXDOMAIN,
+		1, 0, 0) == 0);
+	/* a dropped query has no rcode */
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_A, RCODE_NXDOMAIN,
+		0, 0, 1) == 0);
+
+	/* the number that passed each stage */
+	dt_collector_get_filter_stats(test_nsd.dt_collector, filter);
+	CuAssertTrue(tc, filter[DT_FILTER_TRANSPORT] == 8);
+	CuAssertTrue(tc, filter[DT_FILTER_ZONE] == 5);
+	CuAssertTrue(tc, filter[DT_FILTER_QTYPE] == 4);
+	CuAssertTrue(tc, filter[DT_FILTER_RCODE] == 2);
+	CuAssertTrue(tc, filter[DT_FILTER_SAMPLE] == 0);
+	dt_collector_clear_stats(test_nsd.dt_collector);
+	dt_collector_get_filter_stats(test_nsd.dt_collector, filter);
+	CuAssertTrue(tc, filter[DT_FILTER_TRANSPORT] == 0);
+
+	test_filter_stop();
+	namedb_close(db);
+	region_destroy(region);
+}
+
+static void
+dt_filter_sample(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = nsd_options_create(region);
+	struct namedb* db = namedb_open(NULL, NULL);
+	zone_type* com;
+	query_type* q = query_create(region, NULL, 0, NULL);
+	uint64_t filter[DT_FILTER_NUM];
+	int i, n = 0;
+	CuAssertTrue(tc, db != NULL);
+	com = test_filter_zone(region, db, opt, "example.com.", 0);
+
+	/* one in three queries, and of those the truncated responses */
+	opt->dnstap_sample_rate = 3;
+	opt->dnstap_filter_tc = 1;
+	test_filter_start(opt);
+	for(i=0; i<30; i++)
+		n += test_filter_query(q, com, TYPE_A, RCODE_OK, 0, (i%2), 0);
+	/* of the sampled queries, 2, 5, 8, .. the odd ones are truncated */
+	CuAssertTrue(tc, n == 2*5);
+	dt_collector_get_filter_stats(test_nsd.dt_collector, filter);
+	CuAssertTrue(tc, filter[DT_FILTER_SAMPLE] == 10);
+	CuAssertTrue(tc, filter[DT_FILTER_TC] == 5);
+	CuAssertTrue(tc, filter[DT_FILTER_ZONE] == 0);
+	test_filter_stop();
+
+	/* without the filters that need the response, the query is put
+	 * in the ring before it is processed */
+	opt->dnstap_sample_rate = 0;
+	opt->dnstap_filter_tc = 0;
+	test_filter_start(opt);
+	CuAssertTrue(tc, test_filter_query(q, com, TYPE_A, RCODE_OK, 1, 1,
+		1) == 1);
+	CuAssertTrue(tc, test_filter_query(q, NULL, TYPE_MX, RCODE_SERVFAIL,
+		0, 0, 0) == 2);
+	test_filter_stop();
+	namedb_close(db);
+	region_destroy(region);
+}
+
+#endif /* USE_DNSTAP */
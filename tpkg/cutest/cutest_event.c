@@ -6,6 +6,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #if defined(USE_MINI_EVENT)
@@ -376,6 +378,139 @@ event_kill_children(CuTest *tc)
 	if(verb) log_msg(LOG_INFO, "event_kill_children end\n");
 }
 
+#define NUM_TIMERS (200)
+
+struct timer {
+	struct event event;
+	int num;
+	int *fired;
+	int *count;
+};
+
+static void
+timer_callback(int fd, short event, void *arg)
+{
+	struct timer *t = (struct timer *)arg;
+	(void)fd;
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	t->fired[(*t->count)++] = t->num;
+}
+
+static void
+event_timer_order(CuTest *tc)
+{
+	struct event_base *base;
+	struct timer *timers;
+	struct timeval tv;
+	int fired[NUM_TIMERS], count = 0, i, prev = -1, deleted = 0;
+
+	if(verb) log_msg(LOG_INFO, "event_timer_order start\n");
+	base = nsd_child_event_base();
+	assert(base != NULL);
+	timers = calloc(NUM_TIMERS, sizeof(*timers));
+	assert(timers != NULL);
+	/* add the timers out of order, within 0.2 seconds */
+	for(i = 0; i < NUM_TIMERS; i++) {
+		timers[i].num = (i*37)%NUM_TIMERS;
+		timers[i].fired = fired;
+		timers[i].count = &count;
+		event_set(&timers[i].event, -1, EV_TIMEOUT, timer_callback,
+			&timers[i]);
+		event_base_set(base, &timers[i].event);
+		tv.tv_sec = 0;
+		tv.tv_usec = 1000*timers[i].num;
+		CuAssert(tc, "", event_add(&timers[i].event, &tv) == 0);
+	}
+	/* delete every third timer again */
+	for(i = 0; i < NUM_TIMERS; i += 3) {
+		CuAssert(tc, "", event_del(&timers[i].event) == 0);
+		deleted++;
+	}
+	while(count < NUM_TIMERS - deleted) {
+		CuAssert(tc, "", event_base_loop(base, EVLOOP_ONCE) != -1);
+	}
+	CuAssert(tc, "", count == NUM_TIMERS - deleted);
+	for(i = 0; i < count; i++) {
+		CuAssert(tc, "", fired[i] > prev);
+		CuAssert(tc, "", ((fired[i]*173)%NUM_TIMERS)%3 != 0);
+		prev = fired[i];
+	}
+	free(timers);
+	event_base_free(base);
+	if(verb) log_msg(LOG_INFO, "event_timer_order end\n");
+}
+
+#define NUM_SOCKETS (1500)
+
+static void
+socket_callback(int fd, short event, void *arg)
+{
+	int *count = (int *)arg;
+	char buf[4];
+	assert(event & EV_READ);
+	(void)event;
+	if(read(fd, buf, sizeof(buf)) > 0)
+		(*count)++;
+}
+
+static void
+event_many_fds(CuTest *tc)
+{
+	struct event_base *base;
+	struct event *events;
+	struct rlimit rlim;
+	int (*fds)[2];
+	const char *method;
+	int count = 0, i, n;
+
+	if(getrlimit(RLIMIT_NOFILE, &rlim) == -1 ||
+		rlim.rlim_cur < NUM_SOCKETS*2 + 64) {
+		if(verb) log_msg(LOG_INFO, "event_many_fds: no fds\n");
+		return;
+	}
+	base = nsd_child_event_base();
+	assert(base != NULL);
+#ifdef USE_MINI_EVENT
+	method = event_get_method();
+#else
+	method = event_base_get_method(base);
+#endif
+	if(strcmp(method, "select") == 0) {
+		/* select is limited to FD_SETSIZE */
+		event_base_free(base);
+		return;
+	}
+	if(verb) log_msg(LOG_INFO, "event_many_fds start\n");
+	events = calloc(NUM_SOCKETS, sizeof(*events));
+	fds = calloc(NUM_SOCKETS, sizeof(*fds));
+	assert(events != NULL && fds != NULL);
+	for(i = 0; i < NUM_SOCKETS; i++) {
+		CuAssert(tc, "", socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) == 0);
+		event_set(&events[i], fds[i][0], EV_READ|EV_PERSIST,
+			socket_callback, &count);
+		event_base_set(base, &events[i]);
+		CuAssert(tc, "", event_add(&events[i], NULL) == 0);
+	}
+	/* the sockets with the highest fds are written to */
+	for(i = NUM_SOCKETS-10, n = 0; i < NUM_SOCKETS; i++, n++) {
+		CuAssert(tc, "", write(fds[i][1], "x", 1) == 1);
+	}
+	while(count < n) {
+		CuAssert(tc, "", event_base_loop(base, EVLOOP_ONCE) != -1);
+	}
+	CuAssert(tc, "", count == n);
+	for(i = 0; i < NUM_SOCKETS; i++) {
+		event_del(&events[i]);
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	free(events);
+	free(fds);
+	event_base_free(base);
+	if(verb) log_msg(LOG_INFO, "event_many_fds end\n");
+}
+
 CuSuite *reg_cutest_event(void)
 {
 	CuSuite *suite = CuSuiteNew();
@@ -383,5 +518,7 @@ CuSuite *reg_cutest_event(void)
 	SUITE_ADD_TEST(suite, &event_wait_for_children);
 	SUITE_ADD_TEST(suite, &event_terminate_children);
 	SUITE_ADD_TEST(suite, &event_kill_children);
+	SUITE_ADD_TEST(suite, &event_timer_order);
+	SUITE_ADD_TEST(suite, &event_many_fds);
 	return suite;
 }
@@ -156,15 +156,15 @@ static void iterate_zone(CuTest *tc)
 	/* verify soa rr is returned first */
 	rr = zone_rr_iter_next(&iter);
 	CuAssert(tc, "", rr != NULL);
-	eq = dname_compare(dname, domain_dname(rr->owner));
+	eq = dname_compare(dname, domain_dname(rr_owner(rr)));
 	CuAssert(tc, "", eq == 0);
 	CuAssert(tc, "", rr->type == TYPE_SOA);
 
 	while((rr = zone_rr_iter_next(&iter)) != NULL) {
 		/* verify soa rr is not returned again */
 		CuAssert(tc, "", rr->type != TYPE_SOA);
-		if((eq = dname_compare(dname, domain_dname(rr->owner))) != 0) {
-			eq = !dname_is_subdomain(domain_dname(rr->owner),
+		if((eq = dname_compare(dname, domain_dname(rr_owner(rr)))) != 0) {
+			eq = !dname_is_subdomain(domain_dname(rr_owner(rr)),
 			                         dname);
 		}
 		CuAssert(tc, "", eq == 0);
@@ -29,6 +29,9 @@ static void namedb_2(CuTest *tc);
 static void namedb_3(CuTest *tc);
 static void namedb_4(CuTest *tc);
 #endif /* NSEC3 */
+static void namedb_read_threads(CuTest *tc);
+static void namedb_lazy_zones(CuTest *tc);
+static void namedb_lazy_gen_wrap(CuTest *tc);
 static int v = 0; /* verbosity */
 
 /** get a temporary file name */
@@ -44,6 +47,9 @@ CuSuite* reg_cutest_namedb(void)
 	SUITE_ADD_TEST(suite, namedb_3);
 	SUITE_ADD_TEST(suite, namedb_4);
 #endif /* NSEC3 */
+	SUITE_ADD_TEST(suite, namedb_read_threads);
+	SUITE_ADD_TEST(suite, namedb_lazy_zones);
+	SUITE_ADD_TEST(suite, namedb_lazy_gen_wrap);
 	return suite;
 }
 
@@ -157,7 +163,7 @@ check_walkzones(CuTest* tc, namedb_type* db)
 				CuAssertTrue(tc, zone->nsec3_param != NULL);
 				CuAssertTrue(tc, zone->nsec3_param->type ==
 					TYPE_NSEC3PARAM);
-				CuAssertTrue(tc, zone->nsec3_param->owner ==
+				CuAssertTrue(tc, rr_owner(zone->nsec3_param) ==
 					zone->apex);
 				if(zone->nsec3_last) {
 					CuAssertTrue(tc, domain_find_rrset(
@@ -238,7 +244,7 @@ check_rrsets(CuTest* tc, domain_type* domain)
 		for(i=0; i<rrset->rr_count; i++) {
 			CuAssertTrue(tc, rrset->rrs[i].type ==
 				rrset_rrtype(rrset));
-			CuAssertTrue(tc, rrset->rrs[i].owner == domain);
+			CuAssertTrue(tc, rr_owner(&rrset->rrs[i]) == domain);
 		}
 	}
 }
@@ -295,7 +301,7 @@ domain_in_nsec3_space(domain_type* domain, zone_type** zone)
 			*zone = rrset->zone;
 			return 1;
 		}
-		domain = domain->parent;
+		domain = domain_parent(domain);
 	}
 	return 0;
 }
@@ -463,16 +469,16 @@ check_numlist(CuTest* tc, domain_table_type* table)
 		/* check number */
 		CuAssertTrue(tc, d->number == num);
 		/* check list structure */
-		CuAssertTrue(tc, d->numlist_prev == prevd);
-		if(d->numlist_next) {
-			CuAssertTrue(tc, d == d->numlist_next->numlist_prev);
+		CuAssertTrue(tc, domain_numlist_prev(d) == prevd);
+		if(domain_numlist_next(d)) {
+			CuAssertTrue(tc, d == domain_numlist_prev(domain_numlist_next(d)));
 		} else {
 			CuAssertTrue(tc, d == table->numlist_last);
 		}
 
 		num++;
 		prevd = d;
-		d = d->numlist_next;
+		d = domain_numlist_next(d);
 	}
 	CuAssertTrue(tc, table->numlist_last->number == domain_table_count(table));
 }
@@ -490,17 +496,17 @@ check_walkdomains(CuTest* tc, namedb_type* db)
 			NULL));
 		/* check parent: exists, NULL for root and one label less */
 		if(domain_dname(d)->label_count == 1) {
-			CuAssertTrue(tc, d->parent == NULL);
+			CuAssertTrue(tc, domain_parent(d) == NULL);
 		} else {
-			CuAssertTrue(tc, d->parent != NULL);
-			CuAssertTrue(tc, domain_dname(d->parent)->label_count
+			CuAssertTrue(tc, domain_parent(d) != NULL);
+			CuAssertTrue(tc, domain_dname(domain_parent(d))->label_count
 				== domain_dname(d)->label_count-1);
 			CuAssertTrue(tc, dname_is_subdomain(domain_dname(d),
-				domain_dname(d->parent)));
+				domain_dname(domain_parent(d))));
 		}
 		/* check wildcard_child_closest_match */
 		CuAssertTrue(tc, find_wc_under(db, d) ==
-			d->wildcard_child_closest_match);
+			domain_wildcard_match(d));
 		/* check rrsets */
 		check_rrsets(tc, d);
 		/* check nsec3 */
@@ -618,7 +624,7 @@ add_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 	}
 	rdatalen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
 	buffer_create_from(&databuffer, rdata, rdatalen);
-	if(!add_RR(db, domain_dname(rr->owner), rr->type, rr->klass, rr->ttl,
+	if(!add_RR(db, domain_dname(rr_owner(rr)), rr->type, rr->klass, rr->ttl,
 		&databuffer, rdatalen, zone, udbz, &softfail)) {
 		printf("cannot add RR: %s\n", str);
 		exit(1);
@@ -643,7 +649,7 @@ del_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 	}
 	rdatalen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
 	buffer_create_from(&databuffer, rdata, rdatalen);
-	if(!delete_RR(db, domain_dname(rr->owner), rr->type, rr->klass,
+	if(!delete_RR(db, domain_dname(rr_owner(rr)), rr->type, rr->klass,
 		&databuffer, rdatalen, zone, temp, udbz, &softfail)) {
 		printf("cannot delete RR: %s\n", str);
 		exit(1);
@@ -1762,3 +1768,383 @@ static void namedb_4(CuTest *tc)
 	region_destroy(region);
 }
 #endif /* NSEC3 */
+
+/* the zones in the nsd.db for the read tests, z0.example. ..  */
+#define TEST_ZONES 12
+
+/* add a zone with a SOA, NS, and for the names A, MX and TXT records,
+ * the MX points to a name in the next zone */
+static void
+add_udb_zone(CuTest* tc, udb_base* udb, int num, int names)
+{
+	region_type* r = region_create(xalloc, free);
+	const dname_type *apex, *d, *mx;
+	uint8_t rdata[512], a[4];
+	char buf[300];
+	udb_ptr z;
+	size_t len;
+	int i;
+	snprintf(buf, sizeof(buf), "z%d.example.", num);
+	apex = dname_parse(r, buf);
+	CuAssertTrue(tc, udb_zone_create(udb, &z, dname_name(apex),
+		apex->name_size));
+	/* SOA, mname and rname are the apex, serial 1 */
+	memcpy(rdata, dname_name(apex), apex->name_size);
+	memcpy(rdata+apex->name_size, dname_name(apex), apex->name_size);
+	len = 2*apex->name_size;
+	memset(rdata+len, 0, 20);
+	rdata[len+3] = 1;
+	len += 20;
+	CuAssertTrue(tc, udb_zone_add_rr(udb, &z, dname_name(apex),
+		apex->name_size, TYPE_SOA, CLASS_IN, 3600, rdata, len));
+	snprintf(buf, sizeof(buf), "ns.z%d.example.", num);
+	d = dname_parse(r, buf);
+	CuAssertTrue(tc, udb_zone_add_rr(udb, &z, dname_name(apex),
+		apex->name_size, TYPE_NS, CLASS_IN, 3600,
+		(uint8_t*)dname_name(d), d->name_size));
+	for(i=0; i<names; i++) {
+		snprintf(buf, sizeof(buf), "h%d.z%d.example.", i, num);
+		d = dname_parse(r, buf);
+		a[0] = 10; a[1] = num; a[2] = i>>8; a[3] = i;
+		CuAssertTrue(tc, udb_zone_add_rr(udb, &z, dname_name(d),
+			d->name_size, TYPE_A, CLASS_IN, 3600, a, 4));
+		if(i%3 == 0) {
+			snprintf(buf, sizeof(buf), "h%d.z%d.example.", i,
+				(num+1)%TEST_ZONES);
+			mx = dname_parse(r, buf);
+			rdata[0] = 0;
+			rdata[1] = 10;
+			memcpy(rdata+2, dname_name(mx), mx->name_size);
+			CuAssertTrue(tc, udb_zone_add_rr(udb, &z,
+				dname_name(d), d->name_size, TYPE_MX,
+				CLASS_IN, 3600, rdata, 2+mx->name_size));
+		}
+		if(i%5 == 0) {
+			len = (size_t)snprintf((char*)rdata+1,
+				sizeof(rdata)-1, "text %d in zone %d", i, num);
+			rdata[0] = (uint8_t)len;
+			CuAssertTrue(tc, udb_zone_add_rr(udb, &z,
+				dname_name(d), d->name_size, TYPE_TXT,
+				CLASS_IN, 300, rdata, len+1));
+		}
+	}
+	udb_ptr_unlink(&z, udb);
+	region_destroy(r);
+}
+
+/* options with the zones of the read tests */
+static struct nsd_options*
+read_test_options(region_type* region)
+{
+	struct nsd_options* opt = nsd_options_create(region);
+	struct pattern_options* pat = pattern_options_create(region);
+	char buf[64];
+	int i;
+	pat->pname = "readtest";
+	nsd_options_insert_pattern(opt, pat);
+	for(i=0; i<TEST_ZONES; i++) {
+		struct zone_options* zo = zone_options_create(region);
+		snprintf(buf, sizeof(buf), "z%d.example.", i);
+		zo->name = region_strdup(region, buf);
+		zo->pattern = pat;
+		if(!nsd_options_insert_zone(opt, zo))
+			return NULL;
+	}
+	opt->zonefiles_check = 0;
+	return opt;
+}
+
+/* print the zones, domains and records of the namedb in text */
+static void
+dump_namedb(namedb_type* db, CuString* out)
+{
+	struct radnode* n;
+	domain_type* d;
+	rrset_type* rrset;
+	uint8_t rdata[MAX_RDLENGTH];
+	size_t i, j, len;
+	for(n=radix_first(db->zonetree); n; n=radix_next(n)) {
+		zone_type* zone = (zone_type*)n->elem;
+		CuStringAppendFormat(out, "zone %s secure %d changed %d "
+			"soa %d ns %d\n", domain_to_string(zone->apex),
+			(int)zone->is_secure, (int)zone->is_changed,
+			zone->soa_rrset != NULL, zone->ns_rrset != NULL);
+	}
+	for(d=db->domains->root; d; d=domain_next(d)) {
+		CuStringAppendFormat(out, "%s usage %d number %d "
+			"existing %d apex %d\n", domain_to_string(d),
+			(int)d->usage, (int)d->number,
+			(int)d->is_existing, (int)d->is_apex);
+		for(rrset=d->rrsets; rrset; rrset=rrset->next) {
+			CuStringAppendFormat(out, " %s %s\n",
+				domain_to_string(rrset->zone->apex),
+				rrtype_to_string(rrset_rrtype(rrset)));
+			for(i=0; i<rrset->rr_count; i++) {
+				len = rr_marshal_rdata(&rrset->rrs[i], rdata,
+					sizeof(rdata));
+				CuStringAppendFormat(out, "  %u %u ",
+					(unsigned)rrset->rrs[i].ttl,
+					(unsigned)len);
+				for(j=0; j<len; j++)
+					CuStringAppendFormat(out, "%2.2x",
+						(unsigned)rdata[j]);
+				CuStringAppend(out, "\n");
+			}
+		}
+	}
+}
+
+/* read the nsd.db with a number of threads and print it */
+static CuString*
+read_and_dump(CuTest* tc, char* dbfile, struct nsd_options* opt,
+	int threads)
+{
+	CuString* out = CuStringNew();
+	namedb_type* db;
+	opt->database_read_threads = threads;
+	db = namedb_open(dbfile, opt);
+	CuAssertTrue(tc, db != NULL);
+	dump_namedb(db, out);
+	namedb_close(db);
+	return out;
+}
+
+static void namedb_read_threads(CuTest *tc)
+{
+	/* the zones decoded with threads are the same in memory as the
+	 * zones read by the main thread */
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = read_test_options(region);
+	char* dbfile = udbtest_get_temp_file("readthreads.udb");
+	CuString *serial, *threaded;
+	namedb_type* db;
+	int i;
+	CuAssertTrue(tc, opt != NULL);
+	unlink(dbfile);
+	opt->database_read_threads = 1;
+	db = namedb_open(dbfile, opt);
+	CuAssertTrue(tc, db != NULL && db->udb != NULL);
+	for(i=0; i<TEST_ZONES; i++)
+		add_udb_zone(tc, db->udb, i, 200 + 50*i);
+	namedb_close(db);
+
+	serial = read_and_dump(tc, dbfile, opt, 1);
+	CuAssertTrue(tc, strstr(serial->buffer, "zone z11.example. ") != NULL);
+	CuAssertTrue(tc, strstr(serial->buffer, "h749.z11.example. ") != NULL);
+#ifdef HAVE_PTHREAD
+	threaded = read_and_dump(tc, dbfile, opt, 4);
+	CuAssertTrue(tc, serial->length == threaded->length);
+	CuAssertTrue(tc, strcmp(serial->buffer, threaded->buffer) == 0);
+	CuStringFree(threaded);
+	/* more threads than zones */
+	threaded = read_and_dump(tc, dbfile, opt, TEST_ZONES+4);
+	CuAssertTrue(tc, strcmp(serial->buffer, threaded->buffer) == 0);
+	CuStringFree(threaded);
+#else
+	(void)threaded;
+#endif
+	CuStringFree(serial);
+	unlink(dbfile);
+	free(dbfile);
+	region_destroy(region);
+}
+
+/* the number of rrsets of the zone */
+static int
+count_zone_rrsets(zone_type* zone)
+{
+	domain_type* d;
+	rrset_type* rrset;
+	int n = 0;
+	for(d=zone->apex; d && domain_is_subdomain(d, zone->apex);
+		d=domain_next(d)) {
+		for(rrset=d->rrsets; rrset; rrset=rrset->next)
+			if(rrset->zone == zone)
+				n++;
+	}
+	return n;
+}
+
+/* the zone z<num>.example. */
+static zone_type*
+find_test_zone(namedb_type* db, region_type* region, int num)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "z%d.example.", num);
+	return namedb_find_zone(db, dname_parse(region, buf));
+}
+
+/* an nsd.db with the zones of the read tests, and the rrsets per zone
+ * when it is read without lazy-zones */
+static char*
+lazy_test_db(CuTest* tc, struct nsd_options* opt, int names, int* rrsets)
+{
+	char* dbfile = udbtest_get_temp_file("lazyzones.udb");
+	region_type* region = region_create(xalloc, free);
+	namedb_type* db;
+	int i;
+	unlink(dbfile);
+	opt->lazy_zones = 0;
+	opt->database_read_threads = 1;
+	db = namedb_open(dbfile, opt);
+	CuAssertTrue(tc, db != NULL && db->udb != NULL);
+	for(i=0; i<TEST_ZONES; i++)
+		add_udb_zone(tc, db->udb, i, names);
+	namedb_close(db);
+	db = namedb_open(dbfile, opt);
+	CuAssertTrue(tc, db != NULL);
+	for(i=0; i<TEST_ZONES; i++)
+		rrsets[i] = count_zone_rrsets(find_test_zone(db, region, i));
+	namedb_close(db);
+	region_destroy(region);
+	return dbfile;
+}
+
+static void namedb_lazy_zones(CuTest *tc)
+{
+	/* the zones are read when used, and put away when they are not
+	 * used and over the memory limit */
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = read_test_options(region);
+	int rrsets[TEST_ZONES];
+	zone_type* z[TEST_ZONES];
+	char* dbfile;
+	namedb_type* db;
+	struct nsd nsd;
+	int i, cold = 0;
+	CuAssertTrue(tc, opt != NULL);
+	dbfile = lazy_test_db(tc, opt, 1000, rrsets);
+	opt->lazy_zones = 1;
+	opt->lazy_zones_memory = 1;
+	db = namedb_open(dbfile, opt);
+	CuAssertTrue(tc, db != NULL && db->lazy_used != NULL);
+	memset(&nsd, 0, sizeof(nsd));
+	nsd.db = db;
+	nsd.options = opt;
+
+	/* at the start only the SOA and NS are read */
+	for(i=0; i<TEST_ZONES; i++) {
+		z[i] = find_test_zone(db, region, i);
+		CuAssertTrue(tc, z[i] != NULL && z[i]->is_cold);
+		CuAssertTrue(tc, z[i]->lazy_id > 0 && z[i]->lazy_id <= TEST_ZONES);
+		CuAssertTrue(tc, z[i]->soa_rrset && z[i]->ns_rrset);
+		CuAssertTrue(tc, count_zone_rrsets(z[i]) == 2);
+	}
+	CuAssertTrue(tc, db->lazy_first == NULL && db->lazy_mem == 0);
+
+	/* warm, the zone is read whole, and used since the reload */
+	for(i=0; i<TEST_ZONES; i++) {
+		namedb_zone_warm(&nsd, z[i], NULL, NULL);
+		CuAssertTrue(tc, !z[i]->is_cold && z[i]->lazy_mem > 0);
+		CuAssertTrue(tc, count_zone_rrsets(z[i]) == rrsets[i]);
+		CuAssertTrue(tc, db->lazy_used[z[i]->lazy_id] ==
+			LAZY_ZONE_USED);
+		CuAssertTrue(tc, db->lazy_first == z[i]);
+	}
+	CuAssertTrue(tc, db->lazy_mem > 1024*1024);
+
+	/* the zones used since the previous reload are kept, over the
+	 * limit, and the marks are cleared */
+	namedb_lazy_zones_update(&nsd, opt);
+	for(i=0; i<TEST_ZONES; i++) {
+		CuAssertTrue(tc, !z[i]->is_cold);
+		CuAssertTrue(tc, db->lazy_used[z[i]->lazy_id] == 0);
+	}
+
+	/* z1 and z5 are used, the least recently used of the others are
+	 * put away, down to the limit */
+	lazy_zone_touch(db, z[1]);
+	lazy_zone_touch(db, z[5]);
+	namedb_lazy_zones_update(&nsd, opt);
+	CuAssertTrue(tc, !z[1]->is_cold && !z[5]->is_cold);
+	CuAssertTrue(tc, db->lazy_first == z[1] || db->lazy_first == z[5]);
+	CuAssertTrue(tc, db->lazy_mem <= 1024*1024);
+	for(i=0; i<TEST_ZONES; i++) {
+		if(z[i]->is_cold) {
+			cold++;
+			CuAssertTrue(tc, count_zone_rrsets(z[i]) == 2);
+			CuAssertTrue(tc, z[i]->soa_rrset && z[i]->ns_rrset);
+			CuAssertTrue(tc, db->lazy_used[z[i]->lazy_id] == 0);
+			CuAssertTrue(tc, z[i]->lazy_prev == NULL &&
+				z[i]->lazy_next == NULL && z[i]->lazy_mem == 0);
+		} else {
+			CuAssertTrue(tc, count_zone_rrsets(z[i]) == rrsets[i]);
+		}
+	}
+	CuAssertTrue(tc, cold > 0 && cold < TEST_ZONES);
+
+	/* an evicted zone is read again whole */
+	for(i=0; i<TEST_ZONES && !z[i]->is_cold; i++)
+		;
+	CuAssertTrue(tc, i < TEST_ZONES);
+	namedb_zone_warm(&nsd, z[i], NULL, NULL);
+	CuAssertTrue(tc, !z[i]->is_cold && db->lazy_first == z[i]);
+	CuAssertTrue(tc, count_zone_rrsets(z[i]) == rrsets[i]);
+
+	/* without a limit, nothing is put away */
+	opt->lazy_zones_memory = 0;
+	for(i=0; i<TEST_ZONES; i++)
+		namedb_zone_warm(&nsd, z[i], NULL, NULL);
+	namedb_lazy_zones_update(&nsd, opt);
+	namedb_lazy_zones_update(&nsd, opt);
+	for(i=0; i<TEST_ZONES; i++) {
+		CuAssertTrue(tc, !z[i]->is_cold);
+		CuAssertTrue(tc, count_zone_rrsets(z[i]) == rrsets[i]);
+	}
+
+	namedb_close(db);
+	unlink(dbfile);
+	free(dbfile);
+	region_destroy(region);
+}
+
+static void namedb_lazy_gen_wrap(CuTest *tc)
+{
+	/* the marks of the servers that asked for a cold zone are for
+	 * their reload, also when the reload number wraps around */
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = read_test_options(region);
+	int rrsets[TEST_ZONES];
+	zone_type *cold, *warm;
+	char* dbfile;
+	namedb_type* db;
+	struct nsd nsd;
+	int i;
+	CuAssertTrue(tc, opt != NULL);
+	dbfile = lazy_test_db(tc, opt, 100, rrsets);
+	opt->lazy_zones = 1;
+	opt->lazy_zones_memory = 1;
+	db = namedb_open(dbfile, opt);
+	CuAssertTrue(tc, db != NULL && db->lazy_used != NULL);
+	memset(&nsd, 0, sizeof(nsd));
+	nsd.db = db;
+	nsd.options = opt;
+	cold = find_test_zone(db, region, 3);
+	warm = find_test_zone(db, region, 4);
+	CuAssertTrue(tc, cold && cold->is_cold && warm && warm->is_cold);
+	namedb_zone_warm(&nsd, warm, NULL, NULL);
+	namedb_lazy_zones_update(&nsd, opt);
+
+	/* a server asks for the cold zone, xfrd does not read it, the
+	 * servers of the later reloads have to ask again */
+	db->lazy_used[cold->lazy_id] = LAZY_ZONE_ASKED(db->lazy_gen);
+	for(i=0; i<2*LAZY_ZONE_GENS+1; i++) {
+		namedb_lazy_zones_update(&nsd, opt);
+		CuAssertTrue(tc, db->lazy_used[cold->lazy_id] !=
+			LAZY_ZONE_ASKED(db->lazy_gen));
+		CuAssertTrue(tc, cold->is_cold);
+	}
+
+	/* a server from before the warm zone was read asked for it, that
+	 * is a use of the zone, it is kept and the mark is cleared */
+	namedb_zone_warm(&nsd, find_test_zone(db, region, 5), NULL, NULL);
+	db->lazy_used[warm->lazy_id] = LAZY_ZONE_ASKED(db->lazy_gen);
+	namedb_lazy_zones_update(&nsd, opt);
+	CuAssertTrue(tc, db->lazy_first == warm && !warm->is_cold);
+	CuAssertTrue(tc, db->lazy_used[warm->lazy_id] == 0);
+
+	namedb_close(db);
+	unlink(dbfile);
+	free(dbfile);
+	region_destroy(region);
+}
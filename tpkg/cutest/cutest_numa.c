@@ -0,0 +1,242 @@
+/*
+	test the NUMA replicas of the zone data, the contents that a server
+	maps over the zone data and its cpu affinity
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "tpkg/cutest/cutest.h"
+#include "nsd.h"
+#include "options.h"
+#include "namedb.h"
+#include "numa.h"
+#include "region-allocator.h"
+#include "util.h"
+
+#if defined(HAVE_CPUSET_T) && defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+
+static void numa_replica_small(CuTest *tc);
+static void numa_replica_thp(CuTest *tc);
+static void numa_replica_hugetlb(CuTest *tc);
+
+CuSuite* reg_cutest_numa(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, numa_replica_small);
+	SUITE_ADD_TEST(suite, numa_replica_thp);
+	SUITE_ADD_TEST(suite, numa_replica_hugetlb);
+	return suite;
+}
+
+/* number and size of the objects in the zone data */
+#define TEST_OBJECTS 20000
+#define TEST_OBJECT_SIZE 200
+
+/* write the file in the fake sysfs directory */
+static void
+test_sysfs_write(CuTest *tc, const char* dir, const char* name,
+	const char* content)
+{
+	char file[256];
+	FILE* out;
+	snprintf(file, sizeof(file), "%s/%s", dir, name);
+	out = fopen(file, "w");
+	CuAssert(tc, "open sysfs file", out != NULL);
+	fputs(content, out);
+	fclose(out);
+}
+
+/* a sysfs directory with two nodes, that both have the cpu that the test
+ * runs on, so that the nodes can be filled on any system */
+static void
+test_sysfs_create(CuTest *tc, char* dir, size_t len)
+{
+	char file[256], cpu[32];
+	int i;
+	snprintf(dir, len, "/tmp/nsd.cutest.numa.%d", (int)getpid());
+	CuAssert(tc, "mkdir sysfs", mkdir(dir, 0700) == 0);
+	test_sysfs_write(tc, dir, "online", "0-1\n");
+	snprintf(cpu, sizeof(cpu), "%d\n", sched_getcpu());
+	for(i=0; i<2; i++) {
+		snprintf(file, sizeof(file), "%s/node%d", dir, i);
+		CuAssert(tc, "mkdir node", mkdir(file, 0700) == 0);
+		snprintf(file, sizeof(file), "node%d/cpulist", i);
+		test_sysfs_write(tc, dir, file, cpu);
+	}
+}
+
+static void
+test_sysfs_delete(const char* dir)
+{
+	char file[256];
+	int i;
+	for(i=0; i<2; i++) {
+		snprintf(file, sizeof(file), "%s/node%d/cpulist", dir, i);
+		unlink(file);
+		snprintf(file, sizeof(file), "%s/node%d", dir, i);
+		rmdir(file);
+	}
+	snprintf(file, sizeof(file), "%s/online", dir);
+	unlink(file);
+	rmdir(dir);
+}
+
+/* the byte at position j of object i */
+static char
+test_byte(size_t i, size_t j)
+{
+	return (char)(i*7 + j);
+}
+
+/* is the address in a mapping of a replica, from /proc/self/maps */
+static int
+test_in_replica(void* p)
+{
+	char line[1024];
+	unsigned long start, end;
+	int found = 0;
+	FILE* in = fopen("/proc/self/maps", "r");
+	if(!in)
+		return 1; /* cannot check it */
+	while(fgets(line, sizeof(line), in)) {
+		if(sscanf(line, "%lx-%lx", &start, &end) == 2 &&
+			(unsigned long)p >= start && (unsigned long)p < end) {
+			found = (strstr(line, "nsd-numa-replica") != NULL);
+			break;
+		}
+	}
+	fclose(in);
+	return found;
+}
+
+/* in the server process, map the replica and check it, the exit code is
+ * the error */
+static int
+test_server(struct nsd* nsd, char** objs)
+{
+	cpuset_t* before = cpuset_create(), *after = cpuset_create();
+	size_t i, j;
+	int pinned;
+	if(get_cpu_affinity(before) != 0)
+		return 2;
+	numa_replicas_map(nsd);
+	/* without cpu-affinity the server is not pinned */
+	pinned = (get_cpu_affinity(after) != 0 ||
+		memcmp(before, after, sizeof(*before)) != 0);
+	cpuset_destroy(before);
+	cpuset_destroy(after);
+	if(pinned)
+		return 3;
+	for(i=0; i<TEST_OBJECTS; i++) {
+		if(i%100 == 0 && !test_in_replica(objs[i]))
+			return 4;
+		for(j=0; j<TEST_OBJECT_SIZE; j++)
+			if(objs[i][j] != test_byte(i, j))
+				return 5;
+	}
+	/* the replica is private, a write is not seen by the others */
+	objs[0][0] = 'x';
+	return 0;
+}
+
+static void
+numa_replica_test(CuTest *tc, int huge)
+{
+	char dir[128];
+	struct nsd nsd;
+	struct namedb db;
+	struct nsd_options opt;
+	struct nsd_child child;
+	region_type* region;
+	char** objs;
+	cpuset_t* before = cpuset_create(), *after = cpuset_create();
+	size_t i, j;
+	int status;
+	pid_t pid;
+
+	test_sysfs_create(tc, dir, sizeof(dir));
+	numa_sysfs_dir = dir;
+	region = region_create_slab(xalloc, free, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, (huge==2?REGION_SLAB_HUGETLB:
+		(huge?REGION_SLAB_HUGE:0)));
+	objs = (char**)xalloc_array_zero(TEST_OBJECTS, sizeof(char*));
+	for(i=0; i<TEST_OBJECTS; i++) {
+		objs[i] = (char*)region_alloc(region, TEST_OBJECT_SIZE);
+		for(j=0; j<TEST_OBJECT_SIZE; j++)
+			objs[i][j] = test_byte(i, j);
+	}
+	memset(&nsd, 0, sizeof(nsd));
+	memset(&db, 0, sizeof(db));
+	memset(&opt, 0, sizeof(opt));
+	memset(&child, 0, sizeof(child));
+	db.region = region;
+	opt.database_huge_pages = huge;
+	nsd.db = &db;
+	nsd.options = &opt;
+	nsd.this_child = &child;
+	child.child_num = 1;
+
+	CuAssert(tc, "get affinity", get_cpu_affinity(before) == 0);
+	nsd.numa = numa_replicas_create(&nsd);
+	CuAssert(tc, "replicas created", nsd.numa != NULL);
+	CuAssert(tc, "two nodes", nsd.numa->node_count == 2);
+	/* the process runs on its cpus again */
+	CuAssert(tc, "get affinity", get_cpu_affinity(after) == 0);
+	CuAssert(tc, "affinity restored",
+		memcmp(before, after, sizeof(*before)) == 0);
+	/* the replica is a copy of the zone data when it was made */
+	objs[1][0] = 'y';
+
+	pid = fork();
+	CuAssert(tc, "fork", pid != -1);
+	if(pid == 0)
+		_exit(test_server(&nsd, objs));
+	CuAssert(tc, "waitpid", waitpid(pid, &status, 0) == pid);
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		printf("numa replica server exit %d\n", WIFEXITED(status)?
+			WEXITSTATUS(status):-1);
+	CuAssert(tc, "server checks the replica", WIFEXITED(status) &&
+		WEXITSTATUS(status) == 0);
+	/* the write of the server is not seen */
+	CuAssert(tc, "zone data unchanged", objs[0][0] == test_byte(0, 0));
+	CuAssert(tc, "zone data own write", objs[1][0] == 'y');
+
+	numa_replicas_delete(nsd.numa);
+	cpuset_destroy(before);
+	cpuset_destroy(after);
+	free(objs);
+	region_destroy(region);
+	numa_sysfs_dir = NUMA_SYSFS_DIR;
+	test_sysfs_delete(dir);
+}
+
+static void
+numa_replica_small(CuTest *tc)
+{
+	numa_replica_test(tc, 0);
+}
+
+static void
+numa_replica_thp(CuTest *tc)
+{
+	numa_replica_test(tc, 1);
+}
+
+static void
+numa_replica_hugetlb(CuTest *tc)
+{
+	/* without a hugetlbfs pool, the copies are in other memfds */
+	numa_replica_test(tc, 2);
+}
+
+#endif /* HAVE_CPUSET_T && HAVE_MEMFD_CREATE && HAVE_MMAP */
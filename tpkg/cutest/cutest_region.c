@@ -25,11 +25,17 @@
 #endif /* PACKED_STRUCTS */
 
 static void region_1(CuTest *tc);
+static void region_2(CuTest *tc);
+static void region_3(CuTest *tc);
+static void region_4(CuTest *tc);
 
 CuSuite* reg_cutest_region(void)
 {
 	CuSuite* suite = CuSuiteNew();
 	SUITE_ADD_TEST(suite, region_1); /* test recycle */
+	SUITE_ADD_TEST(suite, region_2); /* test slabs */
+	SUITE_ADD_TEST(suite, region_3); /* test slabs with huge pages */
+	SUITE_ADD_TEST(suite, region_4); /* test slabs with hugetlbfs pages */
 	return suite;
 }
 
@@ -317,3 +323,117 @@ region_1(CuTest *tc)
 	region_destroy(region);
 	region_destroy(tree_region);
 }
+
+/* a block allocated in the slab region, filled with its own byte */
+struct slabblock {
+	unsigned char* block;
+	size_t size;
+};
+
+static void
+slab_check(CuTest *tc, struct slabblock* b)
+{
+	size_t i;
+	for(i=0; i<b->size; i++) {
+		if(b->block[i] != (unsigned char)(b->size & 0xff)) {
+			CuAssert(tc, "slab block data intact", 0);
+			return;
+		}
+	}
+}
+
+/* test the slab region, alloc and recycle random blocks, check that
+ * they do not overlap, and that empty slabs are given back */
+static void
+slab_test(CuTest *tc, int flags)
+{
+	region_type* region = region_create_slab(xalloc, free,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, flags);
+	size_t num = 20000, i, n = 0;
+	struct slabblock* blocks = xalloc_array_zero(num,
+		sizeof(struct slabblock));
+	size_t mapped, used, released, expect = 0, empty;
+
+	srand48(4097);
+	for(i=0; i<num*4; i++) {
+		if(n < num && (n == 0 || drand48() < 0.6)) {
+			size_t sz = GetRandom(1, DEFAULT_LARGE_OBJECT_SIZE*2);
+			blocks[n].block = region_alloc(region, sz);
+			blocks[n].size = sz;
+			CuAssert(tc, "slab alloc", blocks[n].block != NULL);
+			memset(blocks[n].block, (int)(sz & 0xff), sz);
+			expect += sz;
+			n++;
+		} else {
+			size_t k = GetRandom(0, n-1);
+			slab_check(tc, &blocks[k]);
+			region_recycle(region, blocks[k].block, blocks[k].size);
+			expect -= blocks[k].size;
+			blocks[k] = blocks[--n];
+		}
+	}
+	CuAssert(tc, "slab mem", region_get_mem(region) -
+		region_get_mem_unused(region) == expect);
+	for(i=0; i<n; i++)
+		slab_check(tc, &blocks[i]);
+
+#if defined(HAVE_MMAP)
+	region_get_slab_stats(region, &mapped, &used, &released);
+	CuAssert(tc, "slabs in use", mapped > 0 && used > 0);
+	CuAssert(tc, "slab used", used <= mapped);
+#endif
+	/* recycle everything, only one slab per size class is kept */
+	while(n > 0) {
+		region_recycle(region, blocks[n-1].block, blocks[n-1].size);
+		n--;
+	}
+	CuAssert(tc, "slab mem empty", region_get_mem(region) == 0);
+	CuAssert(tc, "slab objects empty", region_get_alloc_count(region) == 0);
+	region_get_slab_stats(region, &mapped, &used, &released);
+	CuAssert(tc, "slab used empty", used == 0);
+#if defined(HAVE_MMAP) && defined(HAVE_MADVISE)
+	if(flags == 0)
+		CuAssert(tc, "slabs released", released > mapped/2);
+	else	CuAssert(tc, "slabs kept", released == 0);
+#endif
+
+	/* the empty slabs are used again */
+	for(i=0; i<num; i++) {
+		size_t sz = GetRandom(0, DEFAULT_LARGE_OBJECT_SIZE-1);
+		blocks[i].block = region_alloc_zero(region, sz);
+		blocks[i].size = sz;
+		CuAssert(tc, "slab alloc again", blocks[i].block != NULL);
+	}
+	empty = released;
+	region_get_slab_stats(region, &mapped, &used, &released);
+#if defined(HAVE_MMAP) && defined(HAVE_MADVISE)
+	if(flags == 0)
+		CuAssert(tc, "slabs used again", released < empty);
+#endif
+	region_free_all(region);
+	CuAssert(tc, "slab free_all", region_get_mem(region) == 0);
+	blocks[0].block = region_alloc(region, 10);
+	CuAssert(tc, "slab alloc after free_all", blocks[0].block != NULL);
+	region_destroy(region);
+	free(blocks);
+}
+
+static void
+region_2(CuTest *tc)
+{
+	slab_test(tc, 0);
+}
+
+static void
+region_3(CuTest *tc)
+{
+	slab_test(tc, REGION_SLAB_HUGE | REGION_SLAB_PREFAULT);
+}
+
+static void
+region_4(CuTest *tc)
+{
+	/* without a hugetlbfs pool this falls back to transparent huge
+	 * pages */
+	slab_test(tc, REGION_SLAB_HUGETLB);
+}
@@ -32,6 +32,17 @@ CuSuite * reg_cutest_rrl(void);
 CuSuite * reg_cutest_popen3(void);
 CuSuite * reg_cutest_iter(void);
 CuSuite * reg_cutest_event(void);
+CuSuite * reg_cutest_xfrd(void);
+#ifdef USE_DNSTAP
+CuSuite * reg_cutest_dnstap(void);
+#endif
+#if defined(HAVE_CPUSET_T) && defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+CuSuite * reg_cutest_numa(void);
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SIGACTION) && defined(SA_SIGINFO)
+CuSuite * reg_cutest_cow_audit(void);
+#endif
+int runbench(const char* regex);
 
 /* dummy functions to link */
 struct nsd nsd;
@@ -85,6 +96,16 @@ int runalltests(const char *regex)
 	CuSuiteAddSuite(suite, reg_cutest_popen3());
 	CuSuiteAddSuite(suite, reg_cutest_iter());
 	CuSuiteAddSuite(suite, reg_cutest_event());
+	CuSuiteAddSuite(suite, reg_cutest_xfrd());
+#ifdef USE_DNSTAP
+	CuSuiteAddSuite(suite, reg_cutest_dnstap());
+#endif
+#if defined(HAVE_CPUSET_T) && defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+	CuSuiteAddSuite(suite, reg_cutest_numa());
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SIGACTION) && defined(SA_SIGINFO)
+	CuSuiteAddSuite(suite, reg_cutest_cow_audit());
+#endif
 
 	if(CuSuiteRunRegexDisplay(suite, regex, disp_callback) == -1) {
 		fprintf(stderr, "invalid regular expression");
@@ -128,14 +149,17 @@ int main(int argc, char* argv[])
 {
 	int c;
 	char* config = NULL, *qfile=NULL;
-	int verb=0;
+	int verb=0, bench=0;
 	unsigned seed;
 	char *regex = ".*";
 	log_init("cutest");
-	while((c = getopt(argc, argv, "c:hq:r:tv")) != -1) {
+	while((c = getopt(argc, argv, "bc:hq:r:tv")) != -1) {
 		switch(c) {
 		case 't':
 			return check_inet_ntop();
+		case 'b':
+			bench = 1;
+			break;
 		case 'c':
 			config = optarg;
 			break;
@@ -153,6 +177,7 @@ int main(int argc, char* argv[])
 			printf("usage: %s [opts]\n", argv[0]);
 			printf("no options: run unit test\n");
 			printf("-q file: run query answer test with file\n");
+			printf("-b run the microbenchmarks, select with -r.\n");
 			printf("-c config: specify nsd.conf file\n");
 			printf("-t test inet_ntop for string comparisons.\n");
 			printf("-v verbose, -vv, -vvv\n");
@@ -165,6 +190,8 @@ int main(int argc, char* argv[])
 	   argv += optind; move along argc, argv, for positional args */
 	if(qfile)
 		return runqtest(config, qfile, verb);
+	if(bench)
+		return runbench(regex);
 
 	/* init random */
 	seed = time(NULL) ^ getpid();
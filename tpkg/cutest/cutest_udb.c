@@ -15,6 +15,7 @@ static void udb_1(CuTest* tc);
 static void udb_2(CuTest* tc);
 static void udb_3(CuTest* tc);
 static void udb_4(CuTest* tc);
+static void udb_5(CuTest* tc);
 
 CuSuite* reg_cutest_udb(void)
 {
@@ -23,6 +24,7 @@ CuSuite* reg_cutest_udb(void)
 	SUITE_ADD_TEST(suite, udb_2);
 	SUITE_ADD_TEST(suite, udb_3);
 	SUITE_ADD_TEST(suite, udb_4);
+	SUITE_ADD_TEST(suite, udb_5);
 	return suite;
 }
 
@@ -361,6 +363,92 @@ static void test_A(void)
 
 /*** end test A for create and delete chunks ***/
 
+/** assert that the free list counts are the lengths of the free lists */
+static void
+assert_free_counts(udb_base* udb)
+{
+	uint64_t c[UDB_ALLOC_CHUNKS_MAX-UDB_ALLOC_CHUNK_MINEXP+1];
+	int i;
+	udb_alloc_free_counts(udb->alloc, c, sizeof(c)/sizeof(c[0]));
+	for(i=0; i<UDB_ALLOC_CHUNKS_MAX-UDB_ALLOC_CHUNK_MINEXP+1; i++) {
+		uint64_t n = 0;
+		udb_void f = udb->alloc->disk->free[i];
+		while(f) {
+			n++;
+			f = ((udb_free_chunk_d*)UDB_REL(udb->base, f))->next;
+		}
+		CuAssertTrue(tc, c[i] == n);
+	}
+}
+
+/** test B, compaction in steps */
+static void
+test_B(void)
+{
+	char* fname = udbtest_get_temp_file(".udb");
+	struct info_A inf[MAX_NUM_A];
+	size_t num_a = 0, i;
+	int steps = 0;
+	udb_base* udb = udb_base_create_new(fname, testAwalk, NULL);
+	CuAssertTrue(tc, udb != NULL);
+	udb_A = udb;
+
+	/* allocate, and free two out of three with compaction inhibited */
+	for(i=0; i<MAX_NUM_A; i++) {
+		inf[i].sz = size_for_A();
+		inf[i].fill = random()%255;
+		inf[i].a = udb_alloc_space(udb->alloc, inf[i].sz);
+		CuAssertTrue(tc, inf[i].a);
+		memset(UDB_REL(udb->base, inf[i].a), (int)inf[i].fill,
+			inf[i].sz);
+		udb_ptr_init(&inf[i].ptr, udb);
+		udb_ptr_set(&inf[i].ptr, udb, inf[i].a);
+	}
+	num_a = MAX_NUM_A;
+	assert_free_counts(udb);
+	udb_compact_inhibited(udb, 1);
+	for(i=0; i<num_a; ) {
+		if(random()%3 != 0) {
+			udb_void d = inf[i].ptr.data;
+			udb_ptr_set(&inf[i].ptr, udb, 0);
+			CuAssertTrue(tc, udb_alloc_free(udb->alloc, d,
+				inf[i].sz));
+			if(i != num_a-1) {
+				inf[i] = inf[num_a-1];
+				udb_ptr_init(&inf[i].ptr, udb);
+				udb_ptr_set(&inf[i].ptr, udb,
+					inf[num_a-1].ptr.data);
+				udb_ptr_set(&inf[num_a-1].ptr, udb, 0);
+			}
+			num_a--;
+		} else	i++;
+	}
+	udb_compact_inhibited(udb, 0);
+	CuAssertTrue(tc, udb_compact_pending(udb));
+
+	/* compact in small steps, the data stays the same */
+	while(udb_compact_pending(udb)) {
+		CuAssertTrue(tc, udb_compact_step(udb, 256));
+		steps++;
+		assert_udb_invariant(udb);
+		assert_info_A(udb, inf, num_a);
+		assert_free_structure(udb);
+		assert_relptr_structure(udb);
+		assert_free_counts(udb);
+	}
+	CuAssertTrue(tc, steps > 1);
+	/* a full compaction has nothing left to do */
+	CuAssertTrue(tc, udb->alloc->disk->stat_free < UDB_ALLOC_CHUNK_SIZE);
+
+	for(i=0; i<num_a; i++)
+		udb_ptr_unlink(&inf[i].ptr, udb);
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror("unlink");
+	free(fname);
+}
+
 /** test structure sizes for compiler padding */
 static void
 test_struct_sizes(void)
@@ -454,3 +542,9 @@ static void udb_4(CuTest* t)
 	tc = t;
 	test_A();
 }
+
+static void udb_5(CuTest* t)
+{
+	tc = t;
+	test_B();
+}
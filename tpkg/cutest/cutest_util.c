@@ -13,11 +13,22 @@
 #include "tpkg/cutest/cutest.h"
 #include "region-allocator.h"
 #include "util.h"
+#include "latency.h"
+#include "bench-query.h"
+#include "dns.h"
+#include "packet.h"
+#include "nsd.h"
+#include "ipc.h"
 
 static void util_1(CuTest *tc);
 static void util_2(CuTest *tc);
 static void util_3(CuTest *tc);
 static void util_4(CuTest *tc);
+static void util_latency(CuTest *tc);
+static void util_bench_query(CuTest *tc);
+#ifdef BIND8_STATS
+static void util_zonestat(CuTest *tc);
+#endif
 
 CuSuite* reg_cutest_util(void)
 {
@@ -27,6 +38,11 @@ CuSuite* reg_cutest_util(void)
 	SUITE_ADD_TEST(suite, util_2);
 	SUITE_ADD_TEST(suite, util_3);
 	SUITE_ADD_TEST(suite, util_4);
+	SUITE_ADD_TEST(suite, util_latency);
+	SUITE_ADD_TEST(suite, util_bench_query);
+#ifdef BIND8_STATS
+	SUITE_ADD_TEST(suite, util_zonestat);
+#endif
 	return suite;
 }
 
@@ -158,3 +174,93 @@ static void util_4(CuTest *tc)
 	/* strings differ only in case */
 	CuAssert(tc, "test results of pton ntop", strcasecmp(buf, teststr)==0);
 }
+
+static void util_latency(CuTest *tc)
+{
+	/* test the latency histogram buckets */
+	uint64_t hist[64], v;
+	int b;
+
+	CuAssert(tc, "small values", latency_bucket(3, 2, 64) == 3);
+	CuAssert(tc, "first split", latency_bucket(4, 2, 64) == 4);
+	CuAssert(tc, "last bucket", latency_bucket((uint64_t)1<<40, 2, 64)
+		== 63);
+	for(v=1; v<100000; v+=7) {
+		b = latency_bucket(v, 2, 64);
+		CuAssert(tc, "value in bucket", latency_bucket_start(b, 2) <= v
+			&& v < latency_bucket_end(b, 2));
+	}
+	for(b=0; b<62; b++)
+		CuAssert(tc, "end is next start", latency_bucket_end(b, 2) ==
+			latency_bucket_start(b+1, 2));
+
+	memset(hist, 0, sizeof(hist));
+	for(v=0; v<100; v++)
+		hist[latency_bucket(v < 90 ? 1 : 1000, 2, 64)]++;
+	CuAssert(tc, "p50", latency_percentile(hist, 64, 2, 100, 0.5) == 2);
+	CuAssert(tc, "p99", latency_percentile(hist, 64, 2, 100, 0.99) ==
+		latency_bucket_end(latency_bucket(1000, 2, 64), 2));
+}
+
+static void util_bench_query(CuTest *tc)
+{
+	/* test the query lines of the benchmark tools */
+	uint8_t buf[UDP_MAX_MESSAGE_LEN];
+	char line[100];
+	size_t len;
+
+	strlcpy(line, "www.example.com. A\n", sizeof(line));
+	CuAssert(tc, "parse", bench_query_from_line(line, 7, 0, buf, &len));
+	CuAssert(tc, "len", len == QHEADERSZ + 17 + 4);
+	CuAssert(tc, "id", buf[0] == 0 && buf[1] == 7);
+	CuAssert(tc, "qdcount", buf[5] == 1 && buf[11] == 0);
+	strlcpy(line, "example.com. CH TXT DO", sizeof(line));
+	CuAssert(tc, "parse DO", bench_query_from_line(line, 1, 0, buf, &len));
+	CuAssert(tc, "len DO", len == QHEADERSZ + 13 + 4 + 11);
+	CuAssert(tc, "class", buf[QHEADERSZ+13+3] == CLASS_CH);
+	CuAssert(tc, "DO bit", buf[len-4] == 0x80 && buf[11] == 1);
+	strlcpy(line, "example.com. A", sizeof(line));
+	CuAssert(tc, "parse edns", bench_query_from_line(line, 1, 1232, buf,
+		&len));
+	CuAssert(tc, "edns size", len == QHEADERSZ + 13 + 4 + 11 &&
+		buf[QHEADERSZ+13+4+3] == (1232>>8) && buf[len-4] == 0);
+	strlcpy(line, "example.com.", sizeof(line));
+	CuAssert(tc, "no type", !bench_query_from_line(line, 1, 0, buf, &len));
+	strlcpy(line, "example.com. NOSUCHTYPE", sizeof(line));
+	CuAssert(tc, "bad type", !bench_query_from_line(line, 1, 0, buf, &len));
+}
+
+#ifdef BIND8_STATS
+static void util_zonestat(CuTest *tc)
+{
+	/* the per zone record is compact, without the latency histograms,
+	 * and the cleared totals subtract slot by slot */
+	struct nsdzst z, c;
+	struct nsdst st;
+	int i;
+
+	CuAssert(tc, "zone stats without histograms", sizeof(struct nsdzst)
+		< sizeof(((struct nsdst*)0)->latency)/16);
+	memset(&z, 0, sizeof(z));
+	z.qtype[0] = 5; /* A */
+	z.qudp = 7;
+	for(i=0; i<3; i++)
+		zonestat_inc_overflow(&z, ZST_KEY(ZST_QTYPE, TYPE_SRV));
+	zonestat_inc_overflow(&z, ZST_KEY(ZST_RCODE, RCODE_FORMAT));
+	memcpy(&c, &z, sizeof(c));
+	z.qtype[0] += 2;
+	z.qudp += 1;
+	zonestat_inc_overflow(&z, ZST_KEY(ZST_QTYPE, TYPE_SRV));
+	zonestat_inc_overflow(&z, ZST_KEY(ZST_OPCODE, OPCODE_NOTIFY));
+	zonestat_subtract(&z, &c);
+
+	memset(&st, 0, sizeof(st));
+	zonestat_add(&st, &z);
+	CuAssert(tc, "A", st.qtype[TYPE_A] == 2);
+	CuAssert(tc, "udp", st.qudp == 1);
+	CuAssert(tc, "SRV", st.qtype[TYPE_SRV] == 1);
+	CuAssert(tc, "FORMERR", st.rcode[RCODE_FORMAT] == 0);
+	CuAssert(tc, "NOTIFY", st.opcode[OPCODE_NOTIFY] == 1);
+	CuAssert(tc, "overflowed", z.overflowed == 0);
+}
+#endif /* BIND8_STATS */
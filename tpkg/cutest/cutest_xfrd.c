@@ -0,0 +1,1145 @@
+/*
+	test xfrd, the udp set, timers, notify, reloads and tcp with
+	a local master or slave on the loopback
+*/
+
+#include "config.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tpkg/cutest/cutest.h"
+#include "nsd.h"
+#include "options.h"
+#include "xfrd.h"
+#include "xfrd-udp.h"
+#include "xfrd-tcp.h"
+#include "xfrd-notify.h"
+#include "xfrd-disk.h"
+#include "ipc.h"
+#include "packet.h"
+#include "dname.h"
+#include "region-allocator.h"
+#include "util.h"
+
+static void xfrd_udp_shared(CuTest *tc);
+static void xfrd_udp_paced(CuTest *tc);
+static void xfrd_timer_wheel(CuTest *tc);
+static void xfrd_timer_clock_back(CuTest *tc);
+static void xfrd_state_journal(CuTest *tc);
+static void xfrd_notify_paced(CuTest *tc);
+static void xfrd_reload_batch(CuTest *tc);
+static void xfrd_tcp_reuse(CuTest *tc);
+
+CuSuite* reg_cutest_xfrd(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, xfrd_udp_shared);
+	SUITE_ADD_TEST(suite, xfrd_udp_paced);
+	SUITE_ADD_TEST(suite, xfrd_timer_wheel);
+	SUITE_ADD_TEST(suite, xfrd_timer_clock_back);
+	SUITE_ADD_TEST(suite, xfrd_state_journal);
+	SUITE_ADD_TEST(suite, xfrd_notify_paced);
+	SUITE_ADD_TEST(suite, xfrd_reload_batch);
+	SUITE_ADD_TEST(suite, xfrd_tcp_reuse);
+	return suite;
+}
+
+/* the nsd that the xfrd of the tests belongs to */
+static struct nsd test_nsd;
+/* the other end of the ipc socket of xfrd */
+static int test_ipc_fd = -1;
+
+/* set up the xfrd global like xfrd_init, without zones and tasks */
+static void
+test_xfrd_setup(size_t udp_window, size_t udp_rate, size_t notify_rate)
+{
+	region_type* region = region_create(xalloc, free);
+	int sv[2];
+	memset(&test_nsd, 0, sizeof(test_nsd));
+	test_nsd.region = region;
+	test_nsd.options = nsd_options_create(region);
+	test_nsd.tcp_timeout = 120;
+
+	assert(xfrd == NULL);
+	xfrd = (xfrd_state_type*)region_alloc_zero(region, sizeof(*xfrd));
+	xfrd->region = region;
+	xfrd->nsd = &test_nsd;
+	xfrd->xfrd_start_time = time(NULL);
+	xfrd->event_base = nsd_child_event_base();
+	assert(xfrd->event_base);
+	xfrd->packet = buffer_create(region, QIOBUFSZ);
+	xfrd->udp_set = xfrd_udp_set_create(region, udp_window, udp_rate,
+		notify_rate);
+	xfrd->tcp_set = xfrd_tcp_set_create(region);
+	xfrd->tcp_set->tcp_timeout = test_nsd.tcp_timeout;
+	xfrd->tcp_set->tcp_idle_timeout =
+		test_nsd.options->xfrd_tcp_idle_timeout;
+	xfrd->zones = rbtree_create(region,
+		(int (*)(const void *, const void *)) dname_compare);
+	xfrd->notify_zones = rbtree_create(region,
+		(int (*)(const void *, const void *)) dname_compare);
+	xfrd->timer_wheel_time = xfrd_time();
+	/* no state file, the zone state is not written */
+	xfrd->state_fd = -1;
+	xfrd->state_buf = buffer_create(region, XFRD_JOURNAL_BUFSIZE);
+	xfrd->reload_wait = test_nsd.options->xfrd_reload_timeout;
+
+	/* the ipc is not read, reload commands are seen in the flags */
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+		perror("socketpair");
+		exit(1);
+	}
+	test_ipc_fd = sv[1];
+	event_set(&xfrd->ipc_handler, sv[0], EV_PERSIST|EV_READ,
+		xfrd_handle_ipc, xfrd);
+	(void)event_base_set(xfrd->event_base, &xfrd->ipc_handler);
+	xfrd->ipc_handler_flags = EV_PERSIST|EV_READ;
+}
+
+static void
+test_xfrd_teardown(void)
+{
+	xfrd_zone_type* zone;
+	struct notify_zone* nz;
+	int i;
+	RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones) {
+		if(zone->tcp_conn != -1)
+			xfrd_tcp_release(xfrd->tcp_set, zone);
+		if(zone->udp_query)
+			xfrd_udp_query_remove(xfrd->udp_set, zone);
+		xfrd_unset_timer(zone);
+	}
+	RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones) {
+		if(nz->notify_send_enable)
+			notify_disable(nz);
+	}
+	for(i=0; i<XFRD_MAX_TCP; i++) {
+		if(xfrd->tcp_set->tcp_state[i]->tcp_r->fd != -1)
+			xfrd_tcp_pipe_release(xfrd->tcp_set,
+				xfrd->tcp_set->tcp_state[i], i);
+	}
+	xfrd_udp_set_close(xfrd->udp_set);
+	if(xfrd->state_timer_added)
+		event_del(&xfrd->state_timer);
+	if(xfrd->state_fd != -1)
+		close(xfrd->state_fd);
+	if(xfrd->timer_wheel_added)
+		event_del(&xfrd->timer_wheel_event);
+	if(xfrd->reload_added)
+		event_del(&xfrd->reload_handler);
+	if(xfrd->ipc_handler_flags & EV_WRITE)
+		event_del(&xfrd->ipc_handler);
+	close(xfrd->ipc_handler.ev_fd);
+	close(test_ipc_fd);
+	event_base_free(xfrd->event_base);
+	region_destroy(xfrd->region);
+	xfrd = NULL;
+}
+
+/* an acl for the loopback with the port */
+static struct acl_options*
+test_acl(int port, int allow_udp)
+{
+	char spec[64];
+	struct acl_options* acl;
+	snprintf(spec, sizeof(spec), "127.0.0.1@%d", port);
+	acl = parse_acl_info(xfrd->region, spec, "NOKEY");
+	acl->allow_udp = allow_udp;
+	return acl;
+}
+
+/* zone options with their own pattern */
+static struct zone_options*
+test_zone_options(const char* name, struct acl_options* request_xfr,
+	struct acl_options* notify)
+{
+	struct zone_options* zopt = zone_options_create(xfrd->region);
+	zopt->pattern = pattern_options_create(xfrd->region);
+	zopt->pattern->pname = region_strdup(xfrd->region, name);
+	zopt->pattern->request_xfr = request_xfr;
+	zopt->pattern->notify = notify;
+	zopt->name = region_strdup(xfrd->region, name);
+	zopt->node.key = dname_parse(xfrd->region, name);
+	assert(zopt->node.key);
+	return zopt;
+}
+
+/* a SOA with the serial, and the root as names */
+static void
+test_soa(xfrd_soa_type* soa, uint32_t serial)
+{
+	memset(soa, 0, sizeof(*soa));
+	soa->type = htons(TYPE_SOA);
+	soa->klass = htons(CLASS_IN);
+	soa->ttl = htonl(3600);
+	soa->rdata_count = htons(7);
+	soa->prim_ns[0] = 1;
+	soa->email[0] = 1;
+	soa->serial = htonl(serial);
+	soa->refresh = htonl(3600);
+	soa->retry = htonl(900);
+	soa->expire = htonl(604800);
+	soa->minimum = htonl(900);
+}
+
+/* a secondary zone that has serial 1 on disk */
+static xfrd_zone_type*
+test_slave_zone(const char* name, struct acl_options* master)
+{
+	struct zone_options* zopt = test_zone_options(name, master, NULL);
+	xfrd_zone_type* zone;
+	xfrd_init_slave_zone(xfrd, zopt);
+	zone = (xfrd_zone_type*)rbtree_search(xfrd->zones, zopt->node.key);
+	assert(zone);
+	test_soa(&zone->soa_disk, 1);
+	zone->soa_disk_acquired = xfrd_time();
+	return zone;
+}
+
+/* start the activated zones, like the xfrd main loop */
+static void
+test_xfrd_activated(void)
+{
+	xfrd_zone_type* zone;
+	while((zone = xfrd->activated_first) != NULL) {
+		xfrd_deactivate_zone(zone);
+		xfrd_handle_zone(-1, 0, zone);
+	}
+}
+
+static void
+test_guard_cb(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
+	void* ATTR_UNUSED(arg))
+{
+}
+
+/* one round of the xfrd main loop, that waits at most msec for events.
+ * With keep_time, xfrd_time stays at the time the test set. */
+static void
+test_xfrd_round(int msec, int keep_time)
+{
+	struct event guard;
+	struct timeval tv;
+	test_xfrd_activated();
+	xfrd_udp_flush(xfrd->udp_set);
+	if(!keep_time)
+		xfrd->got_time = 0;
+	tv.tv_sec = msec/1000;
+	tv.tv_usec = (msec%1000)*1000;
+	memset(&guard, 0, sizeof(guard));
+	event_set(&guard, -1, EV_TIMEOUT, test_guard_cb, NULL);
+	(void)event_base_set(xfrd->event_base, &guard);
+	(void)event_add(&guard, &tv);
+	(void)event_base_loop(xfrd->event_base, EVLOOP_ONCE);
+	(void)event_del(&guard);
+}
+
+/* a nonblocking udp socket on the loopback, returns the fd */
+static int
+test_udp_listen(CuTest* tc, int* port)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	CuAssert(tc, "udp socket", fd != -1);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	CuAssert(tc, "udp bind", bind(fd, (struct sockaddr*)&addr,
+		sizeof(addr)) == 0);
+	CuAssert(tc, "udp getsockname", getsockname(fd,
+		(struct sockaddr*)&addr, &len) == 0);
+	CuAssert(tc, "udp nonblock", fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+	*port = (int)ntohs(addr.sin_port);
+	return fd;
+}
+
+/* a query received by the test master or slave */
+struct test_query {
+	uint8_t pkt[512];
+	size_t len;
+	struct sockaddr_in from;
+};
+
+/* read the packets waiting on the socket, returns the number read */
+static int
+test_udp_recv(int fd, struct test_query* q, int max)
+{
+	int num = 0;
+	while(num < max) {
+		socklen_t fromlen = sizeof(q[num].from);
+		ssize_t r = recvfrom(fd, q[num].pkt, sizeof(q[num].pkt), 0,
+			(struct sockaddr*)&q[num].from, &fromlen);
+		if(r <= 0)
+			break;
+		q[num].len = (size_t)r;
+		num++;
+	}
+	return num;
+}
+
+/* answer the IXFR query with the SOA it has, the serial is current */
+static void
+test_udp_reply_current(CuTest* tc, int fd, struct test_query* q)
+{
+	uint8_t reply[512];
+	buffer_type pkt;
+	memcpy(reply, q->pkt, q->len);
+	buffer_create_from(&pkt, reply, q->len);
+	CuAssert(tc, "ixfr query", QDCOUNT(&pkt) == 1 && NSCOUNT(&pkt) == 1
+		&& !QR(&pkt));
+	QR_SET(&pkt);
+	AA_SET(&pkt);
+	ANCOUNT_SET(&pkt, 1);
+	NSCOUNT_SET(&pkt, 0);
+	CuAssert(tc, "udp reply", sendto(fd, reply, q->len, 0,
+		(struct sockaddr*)&q->from, sizeof(q->from)) == (ssize_t)q->len);
+}
+
+/* see if the port is in the list, and add it if not */
+static void
+test_port_seen(int* ports, int* num, int port)
+{
+	int i;
+	for(i=0; i<*num; i++)
+		if(ports[i] == port)
+			return;
+	ports[(*num)++] = port;
+}
+
+#define TEST_UDP_ZONES 300
+#define TEST_UDP_WINDOW 100
+
+/* SOA and IXFR queries of many zones share a few sockets, the window
+ * holds back the rest, and replies are matched to the zones */
+static void
+xfrd_udp_shared(CuTest *tc)
+{
+	static struct test_query q[TEST_UDP_ZONES];
+	xfrd_zone_type* zones[TEST_UDP_ZONES];
+	struct acl_options* master;
+	int fd, port, i, num, rounds, received = 0, ports[TEST_UDP_ZONES],
+		num_ports = 0;
+	char name[64];
+
+	test_xfrd_setup(TEST_UDP_WINDOW, 0, 0);
+	fd = test_udp_listen(tc, &port);
+	master = test_acl(port, 1);
+	for(i=0; i<TEST_UDP_ZONES; i++) {
+		snprintf(name, sizeof(name), "z%d.example.", i);
+		zones[i] = test_slave_zone(name, master);
+	}
+	test_xfrd_activated();
+	CuAssert(tc, "window full", xfrd->udp_set->num_use ==
+		TEST_UDP_WINDOW);
+	CuAssert(tc, "zones wait", xfrd->udp_waiting_first != NULL);
+	xfrd_udp_flush(xfrd->udp_set);
+
+	/* the first queries share one socket */
+	num = test_udp_recv(fd, q, TEST_UDP_ZONES);
+	CuAssert(tc, "first queries sent", num == TEST_UDP_WINDOW);
+	for(i=0; i<num; i++)
+		test_port_seen(ports, &num_ports, ntohs(q[i].from.sin_port));
+	CuAssert(tc, "one socket", num_ports == 1);
+
+	/* replies that do not match a query are dropped: another ID, and
+	 * another qname */
+	q[0].pkt[1] ^= 0x01;
+	test_udp_reply_current(tc, fd, &q[0]);
+	q[0].pkt[1] ^= 0x01;
+	q[1].pkt[QHEADERSZ+1] ^= 0x01;
+	test_udp_reply_current(tc, fd, &q[1]);
+	q[1].pkt[QHEADERSZ+1] ^= 0x01;
+	test_xfrd_round(200, 0);
+	CuAssert(tc, "unmatched dropped", xfrd->udp_set->num_use ==
+		TEST_UDP_WINDOW);
+	for(i=0; i<TEST_UDP_ZONES; i++)
+		CuAssert(tc, "no zone answered", zones[i]->state !=
+			xfrd_zone_ok);
+
+	/* answer everything, the waiting zones get the slots */
+	for(rounds = 0; rounds < 100 && (received < TEST_UDP_ZONES ||
+		xfrd->udp_set->num_use > 0); rounds++) {
+		for(i=0; i<num; i++)
+			test_udp_reply_current(tc, fd, &q[i]);
+		received += num;
+		test_xfrd_round(100, 0);
+		num = test_udp_recv(fd, q, TEST_UDP_ZONES);
+		for(i=0; i<num; i++)
+			test_port_seen(ports, &num_ports,
+				ntohs(q[i].from.sin_port));
+		CuAssert(tc, "window", xfrd->udp_set->num_use <=
+			TEST_UDP_WINDOW);
+	}
+	CuAssert(tc, "all queried", received == TEST_UDP_ZONES);
+	for(i=0; i<TEST_UDP_ZONES; i++) {
+		CuAssert(tc, "zone ok", zones[i]->state == xfrd_zone_ok);
+		CuAssert(tc, "query done", zones[i]->udp_query == NULL);
+		CuAssert(tc, "not waiting", zones[i]->udp_waiting == 0);
+	}
+	CuAssert(tc, "set empty", xfrd->udp_set->num_use == 0);
+	/* the socket is replaced after XFRD_UDP_SOCK_ROTATE queries, and
+	 * closed when it has no queries left */
+	CuAssert(tc, "rotated", num_ports >= 2 && num_ports <= 4);
+	CuAssert(tc, "sockets closed", xfrd->udp_set->socks->count == 0);
+
+	close(fd);
+	test_xfrd_teardown();
+}
+
+#define TEST_PACED_ZONES 200
+#define TEST_OTHER_ZONES TEST_PACED_RATE
+#define TEST_PACED_RATE 10
+
+/* the number of zones that wait for the master */
+static int
+test_udp_waiting(struct acl_options* master)
+{
+	struct xfrd_udp_master* m = xfrd_udp_master_obtain(xfrd->udp_set,
+		master);
+	xfrd_zone_type* z;
+	int n = 0;
+	for(z = m->wait_first; z; z = z->udp_waiting_next)
+		n++;
+	return n;
+}
+
+/* the zones of a paced master wait in a list of their own, and do not
+ * hold up the zones of another master */
+static void
+xfrd_udp_paced(CuTest *tc)
+{
+	static struct test_query q[TEST_PACED_ZONES], qo[TEST_OTHER_ZONES];
+	xfrd_zone_type* order[TEST_PACED_ZONES], *z;
+	struct acl_options* paced, *other;
+	int fd[2], port[2], i, num, sec;
+	time_t t;
+	char name[64];
+
+	test_xfrd_setup(TEST_UDP_WINDOW, TEST_PACED_RATE, 0);
+	fd[0] = test_udp_listen(tc, &port[0]);
+	fd[1] = test_udp_listen(tc, &port[1]);
+	paced = test_acl(port[0], 1);
+	other = test_acl(port[1], 1);
+	/* the test keeps the time, the rate counts per second of it */
+	t = time(NULL);
+	xfrd->got_time = 1;
+	xfrd->current_time = t;
+	for(i=0; i<TEST_PACED_ZONES; i++) {
+		snprintf(name, sizeof(name), "p%d.example.", i);
+		(void)test_slave_zone(name, paced);
+	}
+	for(i=0; i<TEST_OTHER_ZONES; i++) {
+		snprintf(name, sizeof(name), "o%d.example.", i);
+		(void)test_slave_zone(name, other);
+	}
+	test_xfrd_activated();
+	xfrd_udp_flush(xfrd->udp_set);
+	CuAssert(tc, "rate", test_udp_recv(fd[0], q, TEST_PACED_ZONES) ==
+		TEST_PACED_RATE);
+	CuAssert(tc, "other master", test_udp_recv(fd[1], qo,
+		TEST_OTHER_ZONES) == TEST_OTHER_ZONES);
+	CuAssert(tc, "paced zones wait", test_udp_waiting(paced) ==
+		TEST_PACED_ZONES - TEST_PACED_RATE);
+	CuAssert(tc, "one master waits", xfrd->udp_waiting_first ==
+		xfrd->udp_waiting_last && xfrd->udp_waiting_first ==
+		xfrd_udp_master_obtain(xfrd->udp_set, paced));
+	num = 0;
+	for(z = xfrd_udp_master_obtain(xfrd->udp_set, paced)->wait_first; z;
+		z = z->udp_waiting_next)
+		order[num++] = z;
+
+	/* the replies start no paced zones in the same second */
+	for(i=0; i<TEST_OTHER_ZONES; i++)
+		test_udp_reply_current(tc, fd[1], &qo[i]);
+	for(i=0; i<TEST_PACED_RATE; i++)
+		test_udp_reply_current(tc, fd[0], &q[i]);
+	for(i=0; i<10 && xfrd->udp_set->num_use > 0; i++)
+		test_xfrd_round(100, 1);
+	CuAssert(tc, "replies done", xfrd->udp_set->num_use == 0);
+	CuAssert(tc, "still paced", test_udp_waiting(paced) ==
+		TEST_PACED_ZONES - TEST_PACED_RATE);
+
+	/* every second, the next zones of the paced master, in order */
+	for(sec=1; sec<TEST_PACED_ZONES/TEST_PACED_RATE; sec++) {
+		xfrd->current_time = ++t;
+		xfrd_udp_start_waiting();
+		xfrd_udp_flush(xfrd->udp_set);
+		num = test_udp_recv(fd[0], q, TEST_PACED_ZONES);
+		CuAssert(tc, "paced rate", num == TEST_PACED_RATE);
+		CuAssert(tc, "waiting", test_udp_waiting(paced) ==
+			TEST_PACED_ZONES - (sec+1)*TEST_PACED_RATE);
+		for(i=0; i<TEST_PACED_RATE; i++)
+			CuAssert(tc, "in order", order[(sec-1)*TEST_PACED_RATE+
+				i]->udp_query != NULL);
+		for(i=0; i<num; i++)
+			test_udp_reply_current(tc, fd[0], &q[i]);
+		for(i=0; i<10 && xfrd->udp_set->num_use > 0; i++)
+			test_xfrd_round(100, 1);
+		CuAssert(tc, "replied", xfrd->udp_set->num_use == 0);
+	}
+	CuAssert(tc, "no masters wait", xfrd->udp_waiting_first == NULL &&
+		xfrd->udp_waiting_last == NULL);
+
+	close(fd[0]);
+	close(fd[1]);
+	test_xfrd_teardown();
+}
+
+#define TEST_WHEEL_ZONES 600
+#define TEST_WHEEL_STEP 61
+
+/* the timeout of zone i, on all three levels of the wheel */
+static time_t
+test_wheel_timeout(int i)
+{
+	if(i%3 == 0)
+		return 1 + i%200;
+	if(i%3 == 1)
+		return 300 + (i*97)%60000;
+	/* after the randomization it is still on the top level */
+	return 73000 + (i*1013)%13400;
+}
+
+/* zone timers fire from the wheel in the step of time that they expire,
+ * also after they move down the levels of the wheel, are set again or
+ * are deleted */
+static void
+xfrd_timer_wheel(CuTest *tc)
+{
+	static xfrd_zone_type* zones[TEST_WHEEL_ZONES];
+	static time_t expire[TEST_WHEEL_ZONES];
+	struct acl_options* master;
+	time_t t0, t, end = 0;
+	int fd, port, i, fired = 0, deleted = 0, reset = 0;
+	size_t count;
+	char name[64];
+
+	test_xfrd_setup(TEST_WHEEL_ZONES, 0, 0);
+	fd = test_udp_listen(tc, &port);
+	master = test_acl(port, 1);
+	/* the test sets the xfrd time, it is in the past, so that the wheel
+	 * event fires at once */
+	t0 = time(NULL) - 1000000;
+	xfrd->got_time = 1;
+	xfrd->current_time = t0;
+	xfrd->timer_wheel_time = t0;
+	for(i=0; i<TEST_WHEEL_ZONES; i++) {
+		snprintf(name, sizeof(name), "w%d.example.", i);
+		zones[i] = test_slave_zone(name, master);
+		xfrd_deactivate_zone(zones[i]);
+		xfrd_set_timer(zones[i], test_wheel_timeout(i));
+		expire[i] = zones[i]->timer_expire;
+		CuAssert(tc, "expire", expire[i] > t0 && expire[i] <= t0 +
+			test_wheel_timeout(i));
+		if(expire[i] > end)
+			end = expire[i];
+	}
+	CuAssert(tc, "count", xfrd->timer_wheel_count == TEST_WHEEL_ZONES);
+	for(i=0; i<TEST_WHEEL_ZONES; i+=10) {
+		xfrd_unset_timer(zones[i]);
+		expire[i] = 0;
+		deleted++;
+	}
+	CuAssert(tc, "count after delete", xfrd->timer_wheel_count ==
+		(size_t)(TEST_WHEEL_ZONES - deleted));
+
+	for(t = t0; t <= end + TEST_WHEEL_STEP; t += TEST_WHEEL_STEP) {
+		xfrd->current_time = t;
+		/* half way, a couple of timers are set to a short time */
+		if(t - t0 >= 40000 && t - t0 < 40000 + TEST_WHEEL_STEP) {
+			for(i=1; i<TEST_WHEEL_ZONES; i+=7) {
+				if(!expire[i] || !zones[i]->timer_set)
+					continue;
+				xfrd_set_timer(zones[i], 5);
+				expire[i] = zones[i]->timer_expire;
+				reset++;
+			}
+		}
+		test_xfrd_round(0, 1);
+		/* a zone that fires sends a query to its master */
+		count = xfrd->timer_wheel_count;
+		for(i=0; i<TEST_WHEEL_ZONES; i++) {
+			if(!zones[i]->udp_query) {
+				CuAssert(tc, "not early", !expire[i] ||
+					expire[i] > t || !zones[i]->timer_set);
+				continue;
+			}
+			CuAssert(tc, "not deleted", expire[i] != 0);
+			CuAssert(tc, "on time", expire[i] <= t &&
+				expire[i] > t - TEST_WHEEL_STEP);
+			xfrd_udp_query_remove(xfrd->udp_set, zones[i]);
+			xfrd_unset_timer(zones[i]);
+			fired++;
+		}
+		CuAssert(tc, "count", xfrd->timer_wheel_count <= count);
+	}
+	CuAssert(tc, "all fired", fired == TEST_WHEEL_ZONES - deleted);
+	CuAssert(tc, "reset", reset > 0);
+	CuAssert(tc, "empty", xfrd->timer_wheel_count == 0);
+
+	close(fd);
+	test_xfrd_teardown();
+}
+
+#define TEST_BACK_ZONES 50
+#define TEST_BACK_STEP 7
+
+/* when the clock steps back, the zone timers keep the time that they had
+ * left, also on the higher levels of the wheel, and a timer that is set
+ * after the step is not held up to the old time */
+static void
+xfrd_timer_clock_back(CuTest *tc)
+{
+	static xfrd_zone_type* zones[TEST_BACK_ZONES];
+	static time_t left[TEST_BACK_ZONES];
+	struct acl_options* master;
+	time_t t0, t, back, end = 0;
+	int fd, port, i, fired = 0;
+	char name[64];
+
+	test_xfrd_setup(TEST_BACK_ZONES, 0, 0);
+	fd = test_udp_listen(tc, &port);
+	master = test_acl(port, 1);
+	/* in the past, so that the wheel event fires at once */
+	t0 = time(NULL) - 1000000;
+	xfrd->got_time = 1;
+	xfrd->current_time = t0;
+	xfrd->timer_wheel_time = t0;
+	for(i=0; i<TEST_BACK_ZONES; i++) {
+		snprintf(name, sizeof(name), "b%d.example.", i);
+		zones[i] = test_slave_zone(name, master);
+		xfrd_deactivate_zone(zones[i]);
+		xfrd_set_timer(zones[i], 200 + i*40);
+	}
+	/* the wheel runs for a while, then the clock is set back an hour */
+	t = t0 + 100;
+	xfrd->current_time = t;
+	test_xfrd_round(0, 1);
+	for(i=0; i<TEST_BACK_ZONES; i++) {
+		CuAssert(tc, "not yet fired", zones[i]->timer_set &&
+			!zones[i]->udp_query);
+		left[i] = zones[i]->timer_expire - t;
+	}
+	back = t - 3600;
+	xfrd->current_time = back;
+	/* a timer that is set now, expires from the new time */
+	xfrd_set_timer(zones[0], 5);
+	left[0] = zones[0]->timer_expire - back;
+	CuAssert(tc, "set after the step", left[0] > 0 && left[0] <= 5);
+	for(i=0; i<TEST_BACK_ZONES; i++) {
+		CuAssert(tc, "time left", zones[i]->timer_expire - back ==
+			left[i]);
+		if(left[i] > end)
+			end = left[i];
+	}
+
+	for(t = back; t <= back + end + TEST_BACK_STEP; t += TEST_BACK_STEP) {
+		xfrd->current_time = t;
+		test_xfrd_round(0, 1);
+		for(i=0; i<TEST_BACK_ZONES; i++) {
+			if(!zones[i]->udp_query) {
+				CuAssert(tc, "not early", back + left[i] > t ||
+					!zones[i]->timer_set);
+				continue;
+			}
+			CuAssert(tc, "on time", back + left[i] <= t &&
+				back + left[i] > t - TEST_BACK_STEP);
+			xfrd_udp_query_remove(xfrd->udp_set, zones[i]);
+			xfrd_unset_timer(zones[i]);
+			fired++;
+		}
+	}
+	CuAssert(tc, "all fired", fired == TEST_BACK_ZONES);
+	CuAssert(tc, "empty", xfrd->timer_wheel_count == 0);
+
+	close(fd);
+	test_xfrd_teardown();
+}
+
+#define TEST_JOURNAL_ZONES 3
+
+/* the xfrd of the test with the zones of the journal, that reads their
+ * state from the file */
+static void
+test_journal_start(const char* statefile, xfrd_zone_type** zones)
+{
+	struct acl_options* master;
+	char name[64];
+	int i;
+	test_xfrd_setup(TEST_JOURNAL_ZONES, 0, 0);
+	test_nsd.options->xfrdfile = region_strdup(xfrd->region, statefile);
+	master = test_acl(53, 1);
+	for(i=0; i<TEST_JOURNAL_ZONES; i++) {
+		snprintf(name, sizeof(name), "j%d.example.", i);
+		zones[i] = test_slave_zone(name, master);
+	}
+	xfrd_read_state(xfrd);
+}
+
+/* the zone state changes to the serial, and it is put in the journal */
+static void
+test_journal_set(xfrd_zone_type* zone, uint32_t serial)
+{
+	zone->soa_disk.serial = htonl(serial);
+	zone->round_num = (int)serial;
+	xfrd_state_dirty(zone);
+}
+
+/* fire the state timer, like the event loop, that appends the changes */
+static void
+test_journal_flush(void)
+{
+	assert(xfrd->state_timer_added);
+	event_del(&xfrd->state_timer);
+	xfrd_handle_state_timer(-1, EV_TIMEOUT, xfrd);
+}
+
+static int
+test_journal_serial(xfrd_zone_type* zone)
+{
+	return (int)ntohl(zone->soa_disk.serial);
+}
+
+static off_t
+test_file_size(CuTest* tc, const char* file)
+{
+	struct stat st;
+	CuAssert(tc, "stat", stat(file, &st) == 0);
+	return st.st_size;
+}
+
+static void
+xfrd_state_journal(CuTest *tc)
+{
+	char dir[] = "/tmp/cutest_xfrd.XXXXXX";
+	char statefile[64];
+	xfrd_zone_type* z[TEST_JOURNAL_ZONES];
+	off_t full;
+	int fd;
+
+	CuAssert(tc, "mkdtemp", mkdtemp(dir) != NULL);
+	snprintf(statefile, sizeof(statefile), "%s/xfrd.state", dir);
+
+	/* without a file, a checkpoint is written to append to */
+	test_journal_start(statefile, z);
+	CuAssert(tc, "journal open", xfrd->state_fd != -1);
+	CuAssert(tc, "checkpoint", test_file_size(tc, statefile) ==
+		xfrd->state_size);
+	test_journal_set(z[0], 10);
+	test_journal_set(z[1], 11);
+	test_journal_set(z[2], 12);
+	test_journal_flush();
+	CuAssert(tc, "flushed", xfrd->state_dirty_first == NULL);
+	CuAssert(tc, "appended", test_file_size(tc, statefile) ==
+		xfrd->state_size);
+	test_journal_set(z[2], 20);
+	xfrd_write_state(xfrd);
+	test_xfrd_teardown();
+
+	/* the last record of every zone is read back */
+	test_journal_start(statefile, z);
+	CuAssert(tc, "read 0", test_journal_serial(z[0]) == 10);
+	CuAssert(tc, "read 1", test_journal_serial(z[1]) == 11);
+	CuAssert(tc, "read 2", test_journal_serial(z[2]) == 20);
+	CuAssert(tc, "round_num", z[2]->round_num == 20);
+	test_xfrd_teardown();
+
+	/* a partly written record at the end is ignored and cut off, and
+	 * the record before it is used */
+	full = test_file_size(tc, statefile);
+	CuAssert(tc, "truncate", truncate(statefile, full-5) == 0);
+	test_journal_start(statefile, z);
+	CuAssert(tc, "partial 0", test_journal_serial(z[0]) == 10);
+	CuAssert(tc, "partial 1", test_journal_serial(z[1]) == 11);
+	CuAssert(tc, "partial 2", test_journal_serial(z[2]) == 12);
+	CuAssert(tc, "cut off", test_file_size(tc, statefile) < full-5 &&
+		test_file_size(tc, statefile) == xfrd->state_size);
+	/* records appended after it are read */
+	test_journal_set(z[2], 30);
+	xfrd_write_state(xfrd);
+	test_xfrd_teardown();
+	test_journal_start(statefile, z);
+	CuAssert(tc, "append after cut", test_journal_serial(z[2]) == 30);
+
+	/* when the append fails, the zones stay dirty and the state is
+	 * written in a new checkpoint */
+	test_journal_set(z[1], 40);
+	close(xfrd->state_fd);
+	fd = open(statefile, O_RDONLY);
+	CuAssert(tc, "open", fd != -1);
+	xfrd->state_fd = fd;
+	test_journal_flush();
+	CuAssert(tc, "checkpoint after fail", xfrd->state_fd != fd &&
+		xfrd->state_fd != -1);
+	CuAssert(tc, "written", xfrd->state_dirty_first == NULL);
+	xfrd_write_state(xfrd);
+	test_xfrd_teardown();
+	test_journal_start(statefile, z);
+	CuAssert(tc, "fail 0", test_journal_serial(z[0]) == 10);
+	CuAssert(tc, "fail 1", test_journal_serial(z[1]) == 40);
+	CuAssert(tc, "fail 2", test_journal_serial(z[2]) == 30);
+	test_xfrd_teardown();
+
+	unlink(statefile);
+	rmdir(dir);
+}
+
+#define TEST_NOTIFY_ZONES 6
+#define TEST_NOTIFY_WINDOW 4
+#define TEST_NOTIFY_RATE 2
+
+/* acknowledge the NOTIFY, returns the serial in it */
+static uint32_t
+test_notify_ack(CuTest* tc, int fd, struct test_query* q)
+{
+	uint8_t reply[512];
+	buffer_type pkt;
+	memcpy(reply, q->pkt, q->len);
+	buffer_create_from(&pkt, reply, q->len);
+	CuAssert(tc, "notify", OPCODE(&pkt) == OPCODE_NOTIFY && !QR(&pkt) &&
+		QDCOUNT(&pkt) == 1 && ANCOUNT(&pkt) == 1);
+	QR_SET(&pkt);
+	CuAssert(tc, "notify ack", sendto(fd, reply, q->len, 0,
+		(struct sockaddr*)&q->from, sizeof(q->from)) == (ssize_t)q->len);
+	/* the serial is after the rdata names of the SOA, that are the
+	 * root, then follow refresh, retry, expire and minimum */
+	return read_uint32(q->pkt + q->len - 20);
+}
+
+static void
+xfrd_notify_paced(CuTest *tc)
+{
+	struct notify_zone* zones[TEST_NOTIFY_ZONES];
+	struct acl_options* notify;
+	struct test_query q[TEST_NOTIFY_ZONES];
+	xfrd_soa_type soa;
+	int fd[2], port[2], got[2] = {0, 0}, persec[2] = {0, 0};
+	int i, j, n, rounds, seconds = 0;
+	time_t t;
+	char name[64];
+
+	test_xfrd_setup(100, 0, TEST_NOTIFY_RATE);
+	test_nsd.options->xfrd_notify_window = TEST_NOTIFY_WINDOW;
+	fd[0] = test_udp_listen(tc, &port[0]);
+	fd[1] = test_udp_listen(tc, &port[1]);
+	notify = test_acl(port[0], 1);
+	notify->next = test_acl(port[1], 1);
+	/* the test keeps the time, the rate counts per second of it */
+	t = time(NULL);
+	xfrd->got_time = 1;
+	xfrd->current_time = t;
+	test_soa(&soa, 5);
+	for(i=0; i<TEST_NOTIFY_ZONES; i++) {
+		struct zone_options* zopt;
+		snprintf(name, sizeof(name), "n%d.example.", i);
+		zopt = test_zone_options(name, NULL, notify);
+		init_notify_send(xfrd->notify_zones, xfrd->region, zopt);
+		zones[i] = (struct notify_zone*)rbtree_search(
+			xfrd->notify_zones, zopt->node.key);
+		xfrd_send_notify(xfrd->notify_zones, zones[i]->apex, &soa);
+	}
+	/* the zones over the window wait for room */
+	CuAssert(tc, "window", xfrd->notify_udp_num == TEST_NOTIFY_WINDOW);
+	CuAssert(tc, "waiting", xfrd->notify_waiting_num ==
+		TEST_NOTIFY_ZONES - TEST_NOTIFY_WINDOW);
+
+	for(rounds=0; rounds<200 && (got[0] < TEST_NOTIFY_ZONES ||
+		got[1] < TEST_NOTIFY_ZONES || xfrd->notify_udp_num > 0);
+		rounds++) {
+		test_xfrd_round(100, 1);
+		for(j=0; j<2; j++) {
+			n = test_udp_recv(fd[j], q, TEST_NOTIFY_ZONES);
+			for(i=0; i<n; i++)
+				CuAssert(tc, "serial", test_notify_ack(tc,
+					fd[j], &q[i]) == 5);
+			got[j] += n;
+			persec[j] += n;
+			/* the rate holds for every secondary */
+			CuAssert(tc, "rate", persec[j] <= TEST_NOTIFY_RATE);
+		}
+		if(rounds%10 == 9) {
+			/* the next second, the paced NOTIFY can go */
+			xfrd->current_time = ++t;
+			persec[0] = persec[1] = 0;
+			seconds++;
+		}
+	}
+	CuAssert(tc, "all sent", got[0] == TEST_NOTIFY_ZONES &&
+		got[1] == TEST_NOTIFY_ZONES);
+	/* it had to wait for the rate, but not for retries */
+	CuAssert(tc, "paced", seconds >= TEST_NOTIFY_ZONES/TEST_NOTIFY_RATE-1);
+	CuAssert(tc, "done", xfrd->notify_udp_num == 0 &&
+		xfrd->notify_waiting_num == 0);
+	for(i=0; i<TEST_NOTIFY_ZONES; i++)
+		CuAssert(tc, "zone done", !zones[i]->notify_send_enable);
+	CuAssert(tc, "sent", xfrd->notify_sent == 2*TEST_NOTIFY_ZONES);
+	CuAssert(tc, "acked", xfrd->notify_acked == 2*TEST_NOTIFY_ZONES);
+	CuAssert(tc, "failed", xfrd->notify_failed == 0);
+	CuAssert(tc, "no queries", xfrd->udp_set->num_use == 0);
+
+	close(fd[0]);
+	close(fd[1]);
+	test_xfrd_teardown();
+}
+
+/* the reload command goes to the server, like xfrd_send_reload_req, that
+ * the test cannot run without the task files */
+static void
+test_reload_send(void)
+{
+	xfrd_reload_sent();
+	xfrd->need_to_send_reload = 0;
+}
+
+/* the reload is done after it took the seconds */
+static void
+test_reload_done(int secs)
+{
+	xfrd->reload_sent_time.tv_sec -= secs;
+	xfrd->reload_running_since.tv_sec -= secs;
+	xfrd_reload_done();
+}
+
+static void
+xfrd_reload_batch(CuTest *tc)
+{
+	time_t t;
+	int i;
+
+	test_xfrd_setup(100, 0, 0);
+	test_nsd.options->xfrd_reload_timeout = 1;
+	test_nsd.options->xfrd_reload_max_staleness = 30;
+	t = time(NULL);
+	xfrd->got_time = 1;
+	xfrd->current_time = t;
+
+	/* without a reload before it, the first update reloads at once */
+	xfrd_set_reload_timeout();
+	CuAssert(tc, "reload now", xfrd->need_to_send_reload);
+	CuAssert(tc, "pending", xfrd->reload_pending == 1);
+	test_reload_send();
+	CuAssert(tc, "wait", xfrd->reload_wait == 1 &&
+		xfrd->reload_timeout.tv_sec == t+1);
+	CuAssert(tc, "running", xfrd->reload_running == 1 &&
+		xfrd->reload_pending == 0);
+	test_reload_done(3);
+	CuAssert(tc, "reload time", xfrd->reload_num == 1 &&
+		xfrd->reload_time_avg >= 3000000 &&
+		xfrd->reload_time_avg < 4000000);
+	CuAssert(tc, "staleness", xfrd->reload_updates == 1 &&
+		xfrd->reload_staleness_last >= 3000000);
+
+	/* the updates in the wait period are batched, the timer reloads */
+	for(i=0; i<100; i++)
+		xfrd_set_reload_timeout();
+	CuAssert(tc, "batched", !xfrd->need_to_send_reload &&
+		xfrd->reload_pending == 100 && xfrd->reload_added);
+	for(i=0; i<30 && !xfrd->need_to_send_reload; i++)
+		test_xfrd_round(100, 1);
+	CuAssert(tc, "timer reload", xfrd->need_to_send_reload &&
+		!xfrd->reload_added);
+
+	/* the wait adapts to twice the reload time */
+	test_reload_send();
+	CuAssert(tc, "adapted", xfrd->reload_wait >= 3*XFRD_RELOAD_DUTY &&
+		xfrd->reload_wait <= 3*XFRD_RELOAD_DUTY+1 &&
+		xfrd->reload_timeout.tv_sec == t+xfrd->reload_wait);
+	CuAssert(tc, "running batch", xfrd->reload_running == 100);
+	test_reload_done(3);
+	CuAssert(tc, "batch updates", xfrd->reload_updates == 101);
+
+	/* but not longer than the max staleness */
+	test_nsd.options->xfrd_reload_max_staleness = 4;
+	test_reload_send();
+	CuAssert(tc, "max staleness", xfrd->reload_wait == 4);
+
+	/* a full batch reloads without the wait */
+	for(i=0; i<XFRD_RELOAD_BATCH_MAX-1; i++)
+		xfrd_set_reload_timeout();
+	CuAssert(tc, "batch wait", !xfrd->need_to_send_reload);
+	xfrd_set_reload_timeout();
+	CuAssert(tc, "batch full", xfrd->need_to_send_reload &&
+		xfrd->reload_pending == XFRD_RELOAD_BATCH_MAX);
+	test_reload_send();
+	test_reload_done(3);
+
+	/* a max staleness of 0 turns off the adaptive wait */
+	test_nsd.options->xfrd_reload_max_staleness = 0;
+	test_reload_send();
+	CuAssert(tc, "not adapted", xfrd->reload_wait == 1);
+
+	/* after the wait period an update reloads at once */
+	xfrd->current_time = t+2;
+	xfrd_set_reload_timeout();
+	CuAssert(tc, "after wait", xfrd->need_to_send_reload);
+
+	test_xfrd_teardown();
+}
+
+#define TEST_TCP_ZONES (2+XFRD_TCP_PIPELINE_DEPTH+1)
+#define TEST_TCP_CONNS 4
+
+/* a tcp connection to the test master */
+struct test_tcp_conn {
+	int fd;
+	uint8_t buf[4096];
+	size_t len;
+	/* the number of queries read from it */
+	int queries;
+	/* the connection was closed by xfrd */
+	int closed;
+};
+
+/* a nonblocking tcp socket that listens on the loopback */
+static int
+test_tcp_listen(CuTest* tc, int* port)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	CuAssert(tc, "tcp socket", fd != -1);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	CuAssert(tc, "tcp bind", bind(fd, (struct sockaddr*)&addr,
+		sizeof(addr)) == 0);
+	CuAssert(tc, "tcp listen", listen(fd, 16) == 0);
+	CuAssert(tc, "tcp getsockname", getsockname(fd,
+		(struct sockaddr*)&addr, &len) == 0);
+	CuAssert(tc, "tcp nonblock", fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+	*port = (int)ntohs(addr.sin_port);
+	return fd;
+}
+
+/* accept the new connections and count the queries on them */
+static void
+test_tcp_serve(CuTest* tc, int lfd, struct test_tcp_conn* conns, int* num)
+{
+	int fd, i;
+	while((fd = accept(lfd, NULL, NULL)) != -1) {
+		CuAssert(tc, "tcp conns", *num < TEST_TCP_CONNS);
+		CuAssert(tc, "tcp nonblock", fcntl(fd, F_SETFL, O_NONBLOCK)
+			== 0);
+		memset(&conns[*num], 0, sizeof(conns[*num]));
+		conns[(*num)++].fd = fd;
+	}
+	for(i=0; i<*num; i++) {
+		struct test_tcp_conn* c = &conns[i];
+		ssize_t r;
+		if(c->closed)
+			continue;
+		while((r = recv(c->fd, c->buf+c->len, sizeof(c->buf)-c->len,
+			0)) > 0)
+			c->len += (size_t)r;
+		if(r == 0)
+			c->closed = 1;
+		/* the queries are preceded by their length */
+		while(c->len >= 2 && c->len >= 2+(size_t)read_uint16(c->buf)) {
+			size_t msglen = 2+(size_t)read_uint16(c->buf);
+			buffer_type pkt;
+			buffer_create_from(&pkt, c->buf+2, msglen-2);
+			CuAssert(tc, "xfr query", !QR(&pkt) &&
+				QDCOUNT(&pkt) == 1);
+			memmove(c->buf, c->buf+msglen, c->len-msglen);
+			c->len -= msglen;
+			c->queries++;
+		}
+	}
+}
+
+/* run xfrd until the master has read the number of queries */
+static void
+test_tcp_run(CuTest* tc, int lfd, struct test_tcp_conn* conns, int* num,
+	int queries)
+{
+	int rounds, i, total = 0;
+	for(rounds=0; rounds<100 && total < queries; rounds++) {
+		test_xfrd_round(50, 0);
+		test_tcp_serve(tc, lfd, conns, num);
+		total = 0;
+		for(i=0; i<*num; i++)
+			total += conns[i].queries;
+	}
+	CuAssert(tc, "queries", total == queries);
+}
+
+static void
+xfrd_tcp_reuse(CuTest *tc)
+{
+	xfrd_zone_type* zones[TEST_TCP_ZONES];
+	struct test_tcp_conn conns[TEST_TCP_CONNS];
+	struct acl_options* master;
+	struct xfrd_tcp_set* set;
+	int lfd, port, num = 0, i, rounds;
+	char name[64];
+
+	test_xfrd_setup(100, 0, 0);
+	set = xfrd->tcp_set;
+	set->tcp_idle_timeout = 1;
+	lfd = test_tcp_listen(tc, &port);
+	master = test_acl(port, 0);
+	for(i=0; i<TEST_TCP_ZONES; i++) {
+		snprintf(name, sizeof(name), "t%d.example.", i);
+		zones[i] = test_slave_zone(name, master);
+		xfrd_deactivate_zone(zones[i]);
+	}
+
+	/* the first transfer opens a connection */
+	xfrd_tcp_obtain(set, zones[0]);
+	test_tcp_run(tc, lfd, conns, &num, 1);
+	CuAssert(tc, "connect", num == 1 && set->num_connect == 1 &&
+		set->tcp_count == 1);
+	/* when it is done, the connection stays open */
+	xfrd_tcp_release(set, zones[0]);
+	CuAssert(tc, "idle", xfrd_tcp_num_idle(set) == 1 &&
+		set->tcp_count == 1);
+
+	/* the next transfer to the master goes on the same connection */
+	xfrd_tcp_obtain(set, zones[1]);
+	CuAssert(tc, "not idle", xfrd_tcp_num_idle(set) == 0);
+	test_tcp_run(tc, lfd, conns, &num, 2);
+	CuAssert(tc, "reuse", num == 1 && conns[0].queries == 2 &&
+		set->num_connect == 1 && set->num_query == 2 &&
+		set->num_reuse == 1);
+	xfrd_tcp_release(set, zones[1]);
+
+	/* transfers are pipelined on it up to the depth, then another
+	 * connection is opened */
+	for(i=2; i<TEST_TCP_ZONES; i++)
+		xfrd_tcp_obtain(set, zones[i]);
+	CuAssert(tc, "depth", set->tcp_count == 2 && set->num_connect == 2);
+	CuAssert(tc, "pipelined", zones[2+XFRD_TCP_PIPELINE_DEPTH-1]->tcp_conn
+		== zones[2]->tcp_conn && zones[TEST_TCP_ZONES-1]->tcp_conn !=
+		zones[2]->tcp_conn);
+	test_tcp_run(tc, lfd, conns, &num, TEST_TCP_ZONES);
+	CuAssert(tc, "second conn", num == 2 &&
+		conns[0].queries == 2+XFRD_TCP_PIPELINE_DEPTH &&
+		conns[1].queries == 1);
+	for(i=2; i<TEST_TCP_ZONES; i++)
+		xfrd_tcp_release(set, zones[i]);
+	CuAssert(tc, "both idle", xfrd_tcp_num_idle(set) == 2);
+
+	/* the idle timeout closes them */
+	for(rounds=0; rounds<40 && set->tcp_count > 0; rounds++)
+		test_xfrd_round(100, 0);
+	CuAssert(tc, "idle closed", set->tcp_count == 0 &&
+		xfrd_tcp_num_idle(set) == 0);
+	test_tcp_serve(tc, lfd, conns, &num);
+	CuAssert(tc, "master sees close", conns[0].closed && conns[1].closed);
+
+	for(i=0; i<num; i++)
+		close(conns[i].fd);
+	close(lfd);
+	test_xfrd_teardown();
+}
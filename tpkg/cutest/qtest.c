@@ -306,7 +306,7 @@ buffer_spool_rr(buffer_type* output, rr_type* rr, int qsection)
 {
 	rrtype_descriptor_type *d = rrtype_descriptor_by_type(rr->type);
 	int result;
-	const dname_type *owner = domain_dname(rr->owner);
+	const dname_type *owner = domain_dname(rr_owner(rr));
 	buffer_printf(output, "%s", dname_to_string(owner, NULL));
 	if(qsection)
 		buffer_printf(output, "\t%s\t%s",
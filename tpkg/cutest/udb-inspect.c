@@ -498,7 +498,7 @@ print_udb_rr(uint8_t* name, udb_ptr* urr)
 	domain_table_type* owners;
 
 	owners = domain_table_create(region);
-	rr.owner = domain_table_insert(owners, dname_make(region, name, 0));
+	rr_set_owner(&rr, domain_table_insert(owners, dname_make(region, name, 0)));
 
 	/* to RR */
 	rr.type = RR(urr)->type;
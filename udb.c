@@ -419,6 +419,7 @@ grow_ram_hash(udb_base* udb, udb_ptr** newhash)
 			p->prev=NULL;
 			p->next=newhash[chunk_hash_ptr(p->data)&udb->ram_mask];
 			if(p->next) p->next->prev = p;
+			newhash[chunk_hash_ptr(p->data)&udb->ram_mask] = p;
 			/* go to next element of oldhash */
 			p = np;
 		}
@@ -1010,6 +1011,8 @@ udb_alloc_unlink_fl(void* base, udb_alloc* alloc, udb_void chunk, int exp)
 	else	alloc->disk->free[exp-UDB_ALLOC_CHUNK_MINEXP] = fp->next;
 	if(fp->next)
 		UDB_FREE_CHUNK(fp->next)->prev = fp->prev;
+	if(alloc->fl_counted)
+		alloc->fl_count[exp-UDB_ALLOC_CHUNK_MINEXP]--;
 }
 
 /** pop first element off freelist, list may not be empty */
@@ -1026,6 +1029,8 @@ udb_alloc_pop_fl(void* base, udb_alloc* alloc, int exp)
 	if(fp->next) {
 		UDB_FREE_CHUNK(fp->next)->prev = 0;
 	}
+	if(alloc->fl_counted)
+		alloc->fl_count[exp-UDB_ALLOC_CHUNK_MINEXP]--;
 	return f;
 }
 
@@ -1044,6 +1049,8 @@ udb_alloc_push_fl(void* base, udb_alloc* alloc, udb_void f, int exp)
 		UDB_FREE_CHUNK(fp->next)->prev = f;
 	chunk_set_last(base, f, exp, (uint8_t)exp);
 	alloc->disk->free[exp-UDB_ALLOC_CHUNK_MINEXP] = f;
+	if(alloc->fl_counted)
+		alloc->fl_count[exp-UDB_ALLOC_CHUNK_MINEXP]++;
 }
 
 /** push new element onto freelist - do not initialize the elt */
@@ -1060,6 +1067,8 @@ udb_alloc_push_fl_noinit(void* base, udb_alloc* alloc, udb_void f, int exp)
 	if(fp->next)
 		UDB_FREE_CHUNK(fp->next)->prev = f;
 	alloc->disk->free[exp-UDB_ALLOC_CHUNK_MINEXP] = f;
+	if(alloc->fl_counted)
+		alloc->fl_count[exp-UDB_ALLOC_CHUNK_MINEXP]++;
 }
 
 /** add free chunks at end until specified alignment occurs */
@@ -1293,6 +1302,7 @@ udb_void udb_alloc_space(udb_alloc* alloc, size_t sz)
 	void* base = alloc->udb->base;
 	/* calculate actual allocation size */
 	int e2, exp = udb_alloc_exp_needed(sz);
+	alloc->compact_resume = 0;
 	if(exp == UDB_EXP_XL)
 		return udb_alloc_xl_space(base, alloc, sz);
 	/* see if there is a free chunk of that size exactly */
@@ -1553,9 +1563,20 @@ coagulate_and_push(void* base, udb_alloc* alloc, udb_void last, int exp,
 	return last;
 }
 
-/** attempt to compact the data and move free space to the end */
-int
-udb_alloc_compact(void* base, udb_alloc* alloc)
+/** see if the incremental compaction can continue where it paused */
+static int
+compact_can_resume(udb_alloc* alloc)
+{
+	return alloc->compact_resume &&
+		alloc->compact_nextgrow == alloc->disk->nextgrow &&
+		alloc->compact_stat_free == alloc->disk->stat_free &&
+		alloc->compact_stat_alloc == alloc->disk->stat_alloc;
+}
+
+/** compact the data, if maxmove is nonzero stop after that many bytes
+ * are moved and set the resume point */
+static int
+udb_alloc_compact_part(void* base, udb_alloc* alloc, uint64_t maxmove)
 {
 	udb_void last;
 	int exp, e2;
@@ -1563,10 +1584,25 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 	uint64_t at = alloc->disk->nextgrow;
 	udb_void xl_start = 0;
 	uint64_t xl_sz = 0;
-	if(alloc->udb->inhibit_compact)
-		return 1;
-	alloc->udb->useful_compact = 0;
+	uint64_t moved = 0;
+	if(maxmove && compact_can_resume(alloc)) {
+		at = alloc->compact_at;
+		xl_start = alloc->compact_xl_start;
+		xl_sz = alloc->compact_xl_sz;
+	}
+	alloc->compact_resume = 0;
 	while(at > alloc->udb->glob_data->hsize) {
+		if(maxmove && moved >= maxmove) {
+			/* pause here, continue in the next step */
+			alloc->compact_resume = 1;
+			alloc->compact_at = at;
+			alloc->compact_xl_start = xl_start;
+			alloc->compact_xl_sz = xl_sz;
+			alloc->compact_nextgrow = alloc->disk->nextgrow;
+			alloc->compact_stat_free = alloc->disk->stat_free;
+			alloc->compact_stat_alloc = alloc->disk->stat_alloc;
+			return 1;
+		}
 		/* grab last entry */
 		exp = (int)*((uint8_t*)UDB_REL(base, at-1));
 		if(exp == UDB_EXP_XL) {
@@ -1623,6 +1659,7 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 			 * move it to its new position, adjust rel_ptrs */
 			alloc->udb->glob_data->dirty_alloc = udb_dirty_compact;
 			move_chunk(base, alloc, last, exp, esz, e2);
+			moved += esz;
 			if(xl_start) {
 				last = coagulate_and_push(base, alloc,
 					last, exp, esz);
@@ -1683,6 +1720,16 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 	return 1;
 }
 
+/** attempt to compact the data and move free space to the end */
+int
+udb_alloc_compact(void* base, udb_alloc* alloc)
+{
+	if(alloc->udb->inhibit_compact)
+		return 1;
+	alloc->udb->useful_compact = 0;
+	return udb_alloc_compact_part(base, alloc, 0);
+}
+
 int
 udb_compact(udb_base* udb)
 {
@@ -1692,6 +1739,45 @@ udb_compact(udb_base* udb)
 	return udb_alloc_compact(udb->base, udb->alloc);
 }
 
+int
+udb_compact_step(udb_base* udb, uint64_t maxmove)
+{
+	if(!udb) return 1;
+	if(!udb->useful_compact && !udb->alloc->compact_resume) return 1;
+	udb->useful_compact = 0;
+	return udb_alloc_compact_part(udb->base, udb->alloc, maxmove);
+}
+
+int
+udb_compact_pending(udb_base* udb)
+{
+	if(!udb) return 0;
+	return udb->useful_compact || udb->alloc->compact_resume;
+}
+
+void
+udb_alloc_free_counts(udb_alloc* alloc, uint64_t* counts, size_t num)
+{
+	void* base = alloc->udb->base;
+	size_t i;
+	if(!alloc->fl_counted) {
+		for(i=0; i<UDB_ALLOC_CHUNKS_MAX-UDB_ALLOC_CHUNK_MINEXP+1; i++) {
+			udb_void f = alloc->disk->free[i];
+			alloc->fl_count[i] = 0;
+			while(f) {
+				alloc->fl_count[i]++;
+				f = UDB_FREE_CHUNK(f)->next;
+			}
+		}
+		alloc->fl_counted = 1;
+	}
+	for(i=0; i<num; i++) {
+		if(i < UDB_ALLOC_CHUNKS_MAX-UDB_ALLOC_CHUNK_MINEXP+1)
+			counts[i] = alloc->fl_count[i];
+		else	counts[i] = 0;
+	}
+}
+
 void udb_compact_inhibited(udb_base* udb, int inhibit)
 {
 	if(!udb) return;
@@ -1755,6 +1841,7 @@ int udb_alloc_free(udb_alloc* alloc, udb_void r, size_t sz)
 	int coagulated = 0;
 	if(!r)
 		return 1; /* free(NULL) does nothing */
+	alloc->compact_resume = 0;
 
 	/* lookup size of chunk */
 	base = alloc->udb->base;
@@ -1847,6 +1934,7 @@ udb_void udb_alloc_realloc(udb_alloc* alloc, udb_void r, size_t osz, size_t sz)
 	/* emulate some posix realloc stuff */
 	if(r == 0)
 		return udb_alloc_space(alloc, sz);
+	alloc->compact_resume = 0;
 	if(sz == 0) {
 		if(!udb_alloc_free(alloc, r, osz))
 			log_msg(LOG_ERR, "udb_alloc_realloc: free failed");
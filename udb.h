@@ -330,6 +330,19 @@ struct udb_alloc {
 	udb_base* udb;
 	/** real pointer to space allocation info on disk; fixedsize struct */
 	udb_alloc_d* disk;
+	/** if the free list lengths are counted in fl_count */
+	int fl_counted;
+	/** number of free chunks per exp, in RAM, [0] is MINEXP */
+	uint64_t fl_count[UDB_ALLOC_CHUNKS_MAX-UDB_ALLOC_CHUNK_MINEXP+1];
+	/** if an incremental compaction can continue at compact_at, it
+	 * is reset by allocs and frees, and when the disk stats differ */
+	int compact_resume;
+	udb_void compact_at;
+	/** the list of XL chunks that the compaction passed */
+	udb_void compact_xl_start;
+	uint64_t compact_xl_sz;
+	/** the disk nextgrow and stats when the compaction paused */
+	uint64_t compact_nextgrow, compact_stat_free, compact_stat_alloc;
 };
 
 /** 
@@ -564,6 +577,40 @@ int udb_alloc_grow(udb_alloc* alloc, size_t sz, size_t num);
  */
 int udb_compact(udb_base* udb);
 
+/** max bytes moved by one step of incremental compaction */
+#define UDB_COMPACT_STEP_SIZE (1024*1024)
+
+/**
+ * compact a part of the data, like udb_compact, but stop after maxmove
+ * bytes of chunks are moved.  The next call continues where it stopped,
+ * if the udb has not changed in the mean time.  It is done when
+ * udb_compact_pending returns false.  Runs also if compaction is
+ * inhibited.  The XL chunks are moved all at once, at the end.
+ * @param udb: the udb base.
+ * @param maxmove: max bytes to move in this step.
+ * @return 0 on failure (to remap the (possibly) changed udb base).
+ */
+int udb_compact_step(udb_base* udb, uint64_t maxmove);
+
+/**
+ * see if compaction of the udb is useful, because of deletions, or if
+ * an incremental compaction has not finished.
+ * @param udb: the udb base, or NULL.
+ * @return true if udb_compact_step has work to do.
+ */
+int udb_compact_pending(udb_base* udb);
+
+/**
+ * get the number of free chunks per size, the first is for chunks of
+ * 2**UDB_ALLOC_CHUNK_MINEXP bytes, up to chunks of 2**UDB_ALLOC_CHUNKS_MAX.
+ * The free lists are walked the first time, after that the counts are
+ * kept up to date.
+ * @param alloc: the udb space allocator.
+ * @param counts: array to fill.
+ * @param num: length of the array.
+ */
+void udb_alloc_free_counts(udb_alloc* alloc, uint64_t* counts, size_t num);
+
 /** 
  * set the udb to inhibit or uninhibit compaction.  Does not perform
  * the compaction itself if enabled, for that call udb_compact.
@@ -448,6 +448,26 @@ void get_time(struct timespec* t)
 	t->tv_nsec = 0;
 }
 
+void get_time_monotonic(struct timespec* t)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	if(clock_gettime(CLOCK_MONOTONIC, t)>=0) {
+		return; /* success */
+	}
+#endif
+	get_time(t);
+}
+
+uint64_t
+timespec_elapsed_usec(const struct timespec* start, const struct timespec* end)
+{
+	if(end->tv_sec < start->tv_sec || (end->tv_sec == start->tv_sec &&
+		end->tv_nsec < start->tv_nsec))
+		return 0;
+	return ((uint64_t)(end->tv_sec - start->tv_sec))*1000000 +
+		(uint64_t)(end->tv_nsec/1000) - (uint64_t)(start->tv_nsec/1000);
+}
+
 int
 timespec_compare(const struct timespec *left,
 		 const struct timespec *right)
@@ -1029,7 +1049,7 @@ print_rr(FILE *out,
         rrtype_descriptor_type *descriptor
                 = rrtype_descriptor_by_type(record->type);
         int result;
-        const dname_type *owner = domain_dname(record->owner);
+        const dname_type *owner = domain_dname(rr_owner(record));
 	buffer_clear(output);
         if (state) {
 		if (!state->previous_owner
@@ -1217,6 +1237,11 @@ int set_cpu_affinity(cpuset_t *ATTR_UNUSED(set))
 	log_err("sched_setaffinity: not available on this system");
 	return -1;
 }
+int get_cpu_affinity(cpuset_t *ATTR_UNUSED(set))
+{
+	log_err("sched_getaffinity: not available on this system");
+	return -1;
+}
 #elif defined(HAVE_SCHED_SETAFFINITY)
 /* Linux */
 int set_cpu_affinity(cpuset_t *set)
@@ -1224,6 +1249,11 @@ int set_cpu_affinity(cpuset_t *set)
 	assert(set != NULL);
 	return sched_setaffinity(getpid(), sizeof(*set), set);
 }
+int get_cpu_affinity(cpuset_t *set)
+{
+	assert(set != NULL);
+	return sched_getaffinity(getpid(), sizeof(*set), set);
+}
 #else
 /* FreeBSD */
 int set_cpu_affinity(cpuset_t *set)
@@ -1232,5 +1262,11 @@ int set_cpu_affinity(cpuset_t *set)
 	return cpuset_setaffinity(
 		CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(*set), set);
 }
+int get_cpu_affinity(cpuset_t *set)
+{
+	assert(set != NULL);
+	return cpuset_getaffinity(
+		CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(*set), set);
+}
 #endif
 #endif /* HAVE_CPUSET_T */
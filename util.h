@@ -310,6 +310,12 @@ timeval_to_timespec(struct timespec *left,
 
 /* get the time */
 void get_time(struct timespec* t);
+/* get the time from a clock that does not jump, for measuring durations,
+ * falls back to get_time if there is no monotonic clock */
+void get_time_monotonic(struct timespec* t);
+/* microseconds elapsed between start and end, 0 if end is before start */
+uint64_t timespec_elapsed_usec(const struct timespec* start,
+	const struct timespec* end);
 
 /*
  * Converts a string representation of a period of time into
@@ -438,6 +444,7 @@ void error(const char *format, ...) ATTR_FORMAT(printf, 1, 2) ATTR_NORETURN;
 #if HAVE_CPUSET_T
 int number_of_cpus(void);
 int set_cpu_affinity(cpuset_t *set);
+int get_cpu_affinity(cpuset_t *set);
 #endif
 
 #endif /* _UTIL_H_ */
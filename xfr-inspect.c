@@ -172,7 +172,7 @@ print_records(region_type* region, buffer_type* pkt, int num, int qsection)
 			return;
 		}
 		if(qsection) {
-			printf("%s", dname_to_string(domain_dname(rr->owner),
+			printf("%s", dname_to_string(domain_dname(rr_owner(rr)),
 				NULL));
 			printf("\t%s", rrclass_to_string(rr->klass));
 			if(rr->type == TYPE_IXFR)
@@ -12,14 +12,18 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include "xfrd-disk.h"
 #include "xfrd.h"
 #include "buffer.h"
 #include "nsd.h"
 #include "options.h"
+#include "lookup3.h"
+#include "util.h"
 
 /* quick tokenizer, reads words separated by whitespace.
    No quoted strings. Comments are skipped (#... eol). */
@@ -139,37 +143,144 @@ xfrd_read_state_soa(FILE* in, const char* id_acquired,
 	return 1;
 }
 
-void
-xfrd_read_state(struct xfrd_state* xfrd)
+/* the state of a zone, as read from the state file or journal */
+struct xfrd_state_zone {
+	/* time the state was written */
+	time_t filetime;
+	uint32_t state, masnum, nextmas, round_num, timeout, backoff;
+	xfrd_soa_type soa_nsd, soa_disk, soa_notified;
+	time_t soa_nsd_acquired, soa_disk_acquired, soa_notified_acquired;
+};
+
+/* set the zone state from what was read from disk */
+static void
+xfrd_read_state_zone(xfrd_zone_type* zone, struct xfrd_state_zone* r,
+	const char* statefile)
+{
+	time_t soa_refresh;
+	uint32_t timeout = r->timeout;
+	xfrd_soa_type incoming_soa;
+	time_t incoming_acquired;
+
+	if(r->soa_nsd_acquired>xfrd_time()+15 ||
+		r->soa_disk_acquired>xfrd_time()+15 ||
+		r->soa_notified_acquired>xfrd_time()+15 ||
+		r->filetime>xfrd_time()+15)
+	{
+		log_msg(LOG_ERR, "xfrd: statefile %s contains"
+			" times in the future for zone %s. Ignoring.",
+			statefile, zone->apex_str);
+		return;
+	}
+	zone->state = r->state;
+	zone->master_num = r->masnum;
+	zone->next_master = r->nextmas;
+	zone->round_num = r->round_num;
+	zone->timeout = timeout;
+	zone->fresh_xfr_timeout = r->backoff*XFRD_TRANSFER_TIMEOUT_START;
+
+	/* read the zone OK, now set the master properly */
+	zone->master = acl_find_num(zone->zone_options->pattern->
+		request_xfr, zone->master_num);
+	if(!zone->master) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: masters changed for zone %s",
+			zone->apex_str));
+		zone->master = zone->zone_options->pattern->request_xfr;
+		zone->master_num = 0;
+		zone->round_num = 0;
+	}
+
+	/*
+	 * There is no timeout,
+	 * or there is a notification,
+	 * or there is a soa && current time is past refresh point
+	 */
+	soa_refresh = ntohl(r->soa_disk.refresh);
+	if (soa_refresh > (time_t)zone->zone_options->pattern->max_refresh_time)
+		soa_refresh = zone->zone_options->pattern->max_refresh_time;
+	else if (soa_refresh < (time_t)zone->zone_options->pattern->min_refresh_time)
+		soa_refresh = zone->zone_options->pattern->min_refresh_time;
+	if(timeout == 0 || r->soa_notified_acquired != 0 ||
+		(r->soa_disk_acquired != 0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> (uint32_t)soa_refresh))
+	{
+		zone->state = xfrd_zone_refreshing;
+		xfrd_set_refresh_now(zone);
+	}
+	if(timeout != 0 && (uint32_t)r->filetime + timeout <
+		(uint32_t)xfrd_time()) {
+		/* timeout is in the past, refresh the zone */
+		timeout = 0;
+		if(zone->state == xfrd_zone_ok)
+			zone->state = xfrd_zone_refreshing;
+		xfrd_set_refresh_now(zone);
+	}
+
+	/* There is a soa && current time is past expiry point */
+	if(r->soa_disk_acquired!=0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> ntohl(r->soa_disk.expire))
+	{
+		zone->state = xfrd_zone_expired;
+		xfrd_set_refresh_now(zone);
+	} 
+
+	/* there is a zone read and it matches what we had before */
+	if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
+		&& zone->soa_nsd.serial == r->soa_nsd.serial) {
+		xfrd_deactivate_zone(zone);
+		zone->state = r->state;
+		xfrd_set_timer(zone,
+			within_refresh_bounds(zone, timeout));
+	}	
+	if((zone->soa_nsd_acquired == 0 && r->soa_nsd_acquired == 0 &&
+		r->soa_disk_acquired == 0) ||
+		(zone->state != xfrd_zone_ok && timeout != 0)) {
+		/* but don't check now, because that would mean a
+		 * storm of attempts on some master servers */
+		xfrd_deactivate_zone(zone);
+		zone->state = r->state;
+		xfrd_set_timer(zone,
+			within_retry_bounds(zone, timeout));
+	}
+
+	/* handle as an incoming SOA. */
+	incoming_soa = zone->soa_nsd;
+	incoming_acquired = zone->soa_nsd_acquired;
+	zone->soa_nsd = r->soa_nsd;
+	zone->soa_disk = r->soa_disk;
+	zone->soa_notified = r->soa_notified;
+	zone->soa_nsd_acquired = r->soa_nsd_acquired;
+	/* we had better use what we got from starting NSD, not
+	 * what we store in this file, because the actual zone
+	 * contents trumps the contents of this cache */
+	/* zone->soa_disk_acquired = r->soa_disk_acquired; */
+	zone->soa_notified_acquired = r->soa_notified_acquired;
+	if (zone->state == xfrd_zone_expired)
+	{
+		xfrd_send_expire_notification(zone);
+	}
+	if(incoming_acquired != 0)
+		xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+}
+
+/* read the text state file, as many zones as possible */
+static void
+xfrd_read_state_text(struct xfrd_state* xfrd, FILE* in, const char* statefile)
 {
-	const char* statefile = xfrd->nsd->options->xfrdfile;
-	FILE *in;
 	uint32_t filetime = 0;
 	uint32_t numzones, i;
 	region_type *tempregion;
-	time_t soa_refresh;
 
 	tempregion = region_create(xalloc, free);
 	if(!tempregion)
 		return;
 
-	in = fopen(statefile, "r");
-	if(!in) {
-		if(errno != ENOENT) {
-			log_msg(LOG_ERR, "xfrd: Could not open file %s for reading: %s",
-				statefile, strerror(errno));
-		} else {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: no file %s. refreshing all zones.",
-				statefile));
-		}
-		region_destroy(tempregion);
-		return;
-	}
 	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
 		/* older file version; reset everything */
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: file %s is old version. refreshing all zones.",
 			statefile));
-		fclose(in);
 		region_destroy(tempregion);
 		return;
 	}
@@ -181,7 +292,6 @@ xfrd_read_state(struct xfrd_state* xfrd)
 	{
 		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 			statefile, (int)filetime, (long long)xfrd_time());
-		fclose(in);
 		region_destroy(tempregion);
 		return;
 	}
@@ -190,49 +300,41 @@ xfrd_read_state(struct xfrd_state* xfrd)
 		char *p;
 		xfrd_zone_type* zone;
 		const dname_type* dname;
-		uint32_t state, masnum, nextmas, round_num, timeout, backoff;
-		xfrd_soa_type soa_nsd_read, soa_disk_read, soa_notified_read;
-		time_t soa_nsd_acquired_read,
-			soa_disk_acquired_read, soa_notified_acquired_read;
-		xfrd_soa_type incoming_soa;
-		time_t incoming_acquired;
+		struct xfrd_state_zone r;
 
 		if(nsd.signal_hint_shutdown) {
-			fclose(in);
 			region_destroy(tempregion);
 			return;
 		}
 
-		memset(&soa_nsd_read, 0, sizeof(soa_nsd_read));
-		memset(&soa_disk_read, 0, sizeof(soa_disk_read));
-		memset(&soa_notified_read, 0, sizeof(soa_notified_read));
+		memset(&r, 0, sizeof(r));
+		r.filetime = filetime;
 
 		if(!xfrd_read_check_str(in, "zone:") ||
 		   !xfrd_read_check_str(in, "name:")  ||
 		   !(p=xfrd_read_token(in)) ||
 		   !(dname = dname_parse(tempregion, p)) ||
 		   !xfrd_read_check_str(in, "state:") ||
-		   !xfrd_read_i32(in, &state) || (state>2) ||
+		   !xfrd_read_i32(in, &r.state) || (r.state>2) ||
 		   !xfrd_read_check_str(in, "master:") ||
-		   !xfrd_read_i32(in, &masnum) ||
+		   !xfrd_read_i32(in, &r.masnum) ||
 		   !xfrd_read_check_str(in, "next_master:") ||
-		   !xfrd_read_i32(in, &nextmas) ||
+		   !xfrd_read_i32(in, &r.nextmas) ||
 		   !xfrd_read_check_str(in, "round_num:") ||
-		   !xfrd_read_i32(in, &round_num) ||
+		   !xfrd_read_i32(in, &r.round_num) ||
 		   !xfrd_read_check_str(in, "next_timeout:") ||
-		   !xfrd_read_i32(in, &timeout) ||
+		   !xfrd_read_i32(in, &r.timeout) ||
 		   !xfrd_read_check_str(in, "backoff:") ||
-		   !xfrd_read_i32(in, &backoff) ||
+		   !xfrd_read_i32(in, &r.backoff) ||
 		   !xfrd_read_state_soa(in, "soa_nsd_acquired:", "soa_nsd:",
-			&soa_nsd_read, &soa_nsd_acquired_read) ||
+			&r.soa_nsd, &r.soa_nsd_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_disk_acquired:", "soa_disk:",
-			&soa_disk_read, &soa_disk_acquired_read) ||
+			&r.soa_disk, &r.soa_disk_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_notify_acquired:", "soa_notify:",
-			&soa_notified_read, &soa_notified_acquired_read))
+			&r.soa_notified, &r.soa_notified_acquired))
 		{
 			log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 				statefile, (int)filetime, (long long)xfrd_time());
-			fclose(in);
 			region_destroy(tempregion);
 			return;
 		}
@@ -242,156 +344,290 @@ xfrd_read_state(struct xfrd_state* xfrd)
 			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: state file has info for not configured zone %s", p));
 			continue;
 		}
-
-		if(soa_nsd_acquired_read>xfrd_time()+15 ||
-			soa_disk_acquired_read>xfrd_time()+15 ||
-			soa_notified_acquired_read>xfrd_time()+15)
-		{
-			log_msg(LOG_ERR, "xfrd: statefile %s contains"
-				" times in the future for zone %s. Ignoring.",
-				statefile, zone->apex_str);
-			continue;
-		}
-		zone->state = state;
-		zone->master_num = masnum;
-		zone->next_master = nextmas;
-		zone->round_num = round_num;
-		zone->timeout.tv_sec = timeout;
-		zone->timeout.tv_usec = 0;
-		zone->fresh_xfr_timeout = backoff*XFRD_TRANSFER_TIMEOUT_START;
-
-		/* read the zone OK, now set the master properly */
-		zone->master = acl_find_num(zone->zone_options->pattern->
-			request_xfr, zone->master_num);
-		if(!zone->master) {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: masters changed for zone %s",
-				zone->apex_str));
-			zone->master = zone->zone_options->pattern->request_xfr;
-			zone->master_num = 0;
-			zone->round_num = 0;
-		}
-
-		/*
-		 * There is no timeout,
-		 * or there is a notification,
-		 * or there is a soa && current time is past refresh point
-		 */
-		soa_refresh = ntohl(soa_disk_read.refresh);
-		if (soa_refresh > (time_t)zone->zone_options->pattern->max_refresh_time)
-			soa_refresh = zone->zone_options->pattern->max_refresh_time;
-		else if (soa_refresh < (time_t)zone->zone_options->pattern->min_refresh_time)
-			soa_refresh = zone->zone_options->pattern->min_refresh_time;
-		if(timeout == 0 || soa_notified_acquired_read != 0 ||
-			(soa_disk_acquired_read != 0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> (uint32_t)soa_refresh))
-		{
-			zone->state = xfrd_zone_refreshing;
-			xfrd_set_refresh_now(zone);
-		}
-		if(timeout != 0 && filetime + timeout < (uint32_t)xfrd_time()) {
-			/* timeout is in the past, refresh the zone */
-			timeout = 0;
-			if(zone->state == xfrd_zone_ok)
-				zone->state = xfrd_zone_refreshing;
-			xfrd_set_refresh_now(zone);
-		}
-
-		/* There is a soa && current time is past expiry point */
-		if(soa_disk_acquired_read!=0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> ntohl(soa_disk_read.expire))
-		{
-			zone->state = xfrd_zone_expired;
-			xfrd_set_refresh_now(zone);
-		} 
-
-		/* there is a zone read and it matches what we had before */
-		if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
-			&& zone->soa_nsd.serial == soa_nsd_read.serial) {
-			xfrd_deactivate_zone(zone);
-			zone->state = state;
-			xfrd_set_timer(zone,
-				within_refresh_bounds(zone, timeout));
-		}	
-		if((zone->soa_nsd_acquired == 0 && soa_nsd_acquired_read == 0 &&
-			soa_disk_acquired_read == 0) ||
-			(zone->state != xfrd_zone_ok && timeout != 0)) {
-			/* but don't check now, because that would mean a
-			 * storm of attempts on some master servers */
-			xfrd_deactivate_zone(zone);
-			zone->state = state;
-			xfrd_set_timer(zone,
-				within_retry_bounds(zone, timeout));
-		}
-
-		/* handle as an incoming SOA. */
-		incoming_soa = zone->soa_nsd;
-		incoming_acquired = zone->soa_nsd_acquired;
-		zone->soa_nsd = soa_nsd_read;
-		zone->soa_disk = soa_disk_read;
-		zone->soa_notified = soa_notified_read;
-		zone->soa_nsd_acquired = soa_nsd_acquired_read;
-		/* we had better use what we got from starting NSD, not
-		 * what we store in this file, because the actual zone
-		 * contents trumps the contents of this cache */
-		/* zone->soa_disk_acquired = soa_disk_acquired_read; */
-		zone->soa_notified_acquired = soa_notified_acquired_read;
-		if (zone->state == xfrd_zone_expired)
-		{
-			xfrd_send_expire_notification(zone);
-		}
-		if(incoming_acquired != 0)
-			xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+		xfrd_read_state_zone(zone, &r, statefile);
 	}
 
 	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
 		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 			statefile, (int)filetime, (long long)xfrd_time());
 		region_destroy(tempregion);
-		fclose(in);
 		return;
 	}
 
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %d zones from state file", (int)numzones));
-	fclose(in);
 	region_destroy(tempregion);
 }
 
+/*
+ * The binary state journal starts with XFRD_JOURNAL_MAGIC, followed by
+ * records with the state of one zone.  A record has a 4 byte length and a
+ * 4 byte checksum of the data, and then the data: the zone apex, the time,
+ * the state numbers and the three SOAs.  A later record for a zone
+ * replaces the earlier ones.  On a checkpoint the journal is rewritten
+ * with one record per zone.
+ */
+
+/* check that the wire format name is a sequence of labels that ends at
+ * the end, with the root label */
+static int
+xfrd_journal_dname_ok(const uint8_t* wire, size_t len)
+{
+	size_t i = 0;
+	if(len == 0 || len > MAXDOMAINLEN)
+		return 0;
+	while(i < len) {
+		if(wire[i] == 0)
+			return i+1 == len;
+		if((wire[i]&0xc0))
+			return 0;
+		i += wire[i]+1;
+	}
+	return 0;
+}
+
+/* read a dname with its length byte into the soa format, 1 octet length
+ * and the wireformat */
+static int
+xfrd_journal_read_soa_dname(buffer_type* buf, uint8_t* d)
+{
+	uint8_t len;
+	if(!buffer_available(buf, 1))
+		return 0;
+	len = buffer_read_u8(buf);
+	if(!buffer_available(buf, len) ||
+		!xfrd_journal_dname_ok(buffer_current(buf), len))
+		return 0;
+	d[0] = len;
+	buffer_read(buf, d+1, len);
+	return 1;
+}
+
+static int
+xfrd_journal_read_soa(buffer_type* buf, xfrd_soa_type* soa, time_t* soatime)
+{
+	if(!buffer_available(buf, 4))
+		return 0;
+	*soatime = (time_t)buffer_read_u32(buf);
+	if(*soatime == 0)
+		return 1;
+	/* the values are kept in network order, as in the soa struct */
+	if(!buffer_available(buf, 10))
+		return 0;
+	buffer_read(buf, &soa->type, 2);
+	buffer_read(buf, &soa->klass, 2);
+	buffer_read(buf, &soa->ttl, 4);
+	buffer_read(buf, &soa->rdata_count, 2);
+	if(!xfrd_journal_read_soa_dname(buf, soa->prim_ns) ||
+		!xfrd_journal_read_soa_dname(buf, soa->email) ||
+		!buffer_available(buf, 20))
+		return 0;
+	buffer_read(buf, &soa->serial, 4);
+	buffer_read(buf, &soa->refresh, 4);
+	buffer_read(buf, &soa->retry, 4);
+	buffer_read(buf, &soa->expire, 4);
+	buffer_read(buf, &soa->minimum, 4);
+	return 1;
+}
+
+/* parse the record after the apex */
+static int
+xfrd_journal_read_rec(buffer_type* buf, struct xfrd_state_zone* r)
+{
+	memset(r, 0, sizeof(*r));
+	if(!buffer_available(buf, 25))
+		return 0;
+	r->filetime = (time_t)buffer_read_u32(buf);
+	r->state = buffer_read_u8(buf);
+	r->masnum = buffer_read_u32(buf);
+	r->nextmas = buffer_read_u32(buf);
+	r->round_num = buffer_read_u32(buf);
+	r->timeout = buffer_read_u32(buf);
+	r->backoff = buffer_read_u32(buf);
+	if(r->state > 2)
+		return 0;
+	return xfrd_journal_read_soa(buf, &r->soa_nsd, &r->soa_nsd_acquired) &&
+		xfrd_journal_read_soa(buf, &r->soa_disk, &r->soa_disk_acquired) &&
+		xfrd_journal_read_soa(buf, &r->soa_notified,
+			&r->soa_notified_acquired);
+}
+
+/* the last record in the journal for a zone */
+struct xfrd_journal_last {
+	rbnode_type node;
+	xfrd_zone_type* zone;
+	uint8_t* data;
+	size_t len;
+};
+
+static int
+xfrd_journal_last_cmp(const void* a, const void* b)
+{
+	if(a < b)
+		return -1;
+	if(a > b)
+		return 1;
+	return 0;
+}
+
+/* read the binary journal, returns the length of the valid part of the
+ * file, or 0 if it has to be rewritten */
+static off_t
+xfrd_read_journal(struct xfrd_state* xfrd, int fd, const char* statefile)
+{
+	struct stat st;
+	uint8_t* base;
+	size_t pos = sizeof(XFRD_JOURNAL_MAGIC)-1, size, num = 0;
+	region_type *tempregion, *dnameregion;
+	rbtree_type* last;
+	struct xfrd_journal_last* l;
+
+	if(fstat(fd, &st) == -1) {
+		log_msg(LOG_ERR, "xfrd: could not stat %s: %s", statefile,
+			strerror(errno));
+		return 0;
+	}
+	size = (size_t)st.st_size;
+	if(size < pos)
+		return 0;
+	base = (uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(base == MAP_FAILED) {
+		log_msg(LOG_ERR, "xfrd: could not mmap %s: %s", statefile,
+			strerror(errno));
+		return 0;
+	}
+	tempregion = region_create(xalloc, free);
+	dnameregion = region_create(xalloc, free);
+	last = rbtree_create(tempregion, xfrd_journal_last_cmp);
+
+	/* find the last record for every zone */
+	while(pos + 8 <= size) {
+		uint32_t len = read_uint32(base+pos);
+		uint32_t sum = read_uint32(base+pos+4);
+		uint8_t* data = base+pos+8;
+		xfrd_zone_type* zone;
+		const dname_type* dname;
+		if(len > size - pos - 8 || len < 1 ||
+			hashlittle(data, len, 0) != sum ||
+			data[0] >= len ||
+			!xfrd_journal_dname_ok(data+1, data[0])) {
+			/* a partly written record at the end */
+			log_msg(LOG_WARNING, "xfrd: state journal %s is damaged"
+				" after %u bytes, the rest is ignored",
+				statefile, (unsigned)pos);
+			break;
+		}
+		pos += 8 + len;
+		num++;
+		region_free_all(dnameregion);
+		dname = dname_make(dnameregion, data+1, 0);
+		if(!dname || !(zone = (xfrd_zone_type*)rbtree_search(
+			xfrd->zones, dname)))
+			continue;
+		l = (struct xfrd_journal_last*)rbtree_search(last, zone);
+		if(!l) {
+			l = (struct xfrd_journal_last*)region_alloc(tempregion,
+				sizeof(*l));
+			l->node.key = zone;
+			l->zone = zone;
+			rbtree_insert(last, &l->node);
+		}
+		l->data = data + 1 + data[0];
+		l->len = len - 1 - data[0];
+	}
+
+	RBTREE_FOR(l, struct xfrd_journal_last*, last) {
+		struct xfrd_state_zone r;
+		buffer_type buf;
+		if(nsd.signal_hint_shutdown)
+			break;
+		buffer_create_from(&buf, l->data, l->len);
+		if(!xfrd_journal_read_rec(&buf, &r)) {
+			log_msg(LOG_ERR, "xfrd: state journal %s has a bad "
+				"record for zone %s", statefile,
+				l->zone->apex_str);
+			continue;
+		}
+		xfrd_read_state_zone(l->zone, &r, statefile);
+	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %u records for %u zones "
+		"from state journal %s", (unsigned)num,
+		(unsigned)last->count, statefile));
+
+	region_destroy(dnameregion);
+	region_destroy(tempregion);
+	munmap(base, size);
+	return (off_t)pos;
+}
+
+static void xfrd_state_open(struct xfrd_state* xfrd, off_t valid);
+
+void
+xfrd_read_state(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	char magic[sizeof(XFRD_JOURNAL_MAGIC)-1];
+	FILE *in;
+	off_t valid = 0;
+
+	in = fopen(statefile, "r");
+	if(!in) {
+		if(errno != ENOENT) {
+			log_msg(LOG_ERR, "xfrd: Could not open file %s for reading: %s",
+				statefile, strerror(errno));
+		} else {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: no file %s. refreshing all zones.",
+				statefile));
+		}
+	} else {
+		if(fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+			memcmp(magic, XFRD_JOURNAL_MAGIC, sizeof(magic)) == 0) {
+			valid = xfrd_read_journal(xfrd, fileno(in), statefile);
+		} else {
+			/* the text format, of older versions or edited */
+			rewind(in);
+			xfrd_read_state_text(xfrd, in, statefile);
+		}
+		fclose(in);
+	}
+	if(nsd.signal_hint_shutdown)
+		return;
+	xfrd_state_open(xfrd, valid);
+}
+
 /* prints neato days hours and minutes. */
 static void
-neato_timeout(FILE* out, const char* str, time_t secs)
+neato_timeout(buffer_type* out, const char* str, time_t secs)
 {
-	fprintf(out, "%s", str);
+	buffer_printf(out, "%s", str);
 	if(secs <= 0) {
-		fprintf(out, " %llds", (long long)secs);
+		buffer_printf(out, " %llds", (long long)secs);
 		return;
 	}
 	if(secs >= 3600*24) {
-		fprintf(out, " %lldd", (long long)(secs/(3600*24)));
+		buffer_printf(out, " %lldd", (long long)(secs/(3600*24)));
 		secs = secs % (3600*24);
 	}
 	if(secs >= 3600) {
-		fprintf(out, " %lldh", (long long)(secs/3600));
+		buffer_printf(out, " %lldh", (long long)(secs/3600));
 		secs = secs%3600;
 	}
 	if(secs >= 60) {
-		fprintf(out, " %lldm", (long long)(secs/60));
+		buffer_printf(out, " %lldm", (long long)(secs/60));
 		secs = secs%60;
 	}
 	if(secs > 0) {
-		fprintf(out, " %llds", (long long)secs);
+		buffer_printf(out, " %llds", (long long)secs);
 	}
 }
 
-static void xfrd_write_dname(FILE* out, uint8_t* dname)
+static void xfrd_write_dname(buffer_type* out, uint8_t* dname)
 {
 	uint8_t* d= dname+1;
 	uint8_t len = *d++;
 	uint8_t i;
 
 	if(dname[0]<=1) {
-		fprintf(out, ".");
+		buffer_printf(out, ".");
 		return;
 	}
 
@@ -402,119 +638,466 @@ static void xfrd_write_dname(FILE* out, uint8_t* dname)
 		{
 			uint8_t ch = *d++;
 			if (isalnum((unsigned char)ch) || ch == '-' || ch == '_') {
-				fprintf(out, "%c", ch);
+				buffer_printf(out, "%c", ch);
 			} else if (ch == '.' || ch == '\\') {
-				fprintf(out, "\\%c", ch);
+				buffer_printf(out, "\\%c", ch);
 			} else {
-				fprintf(out, "\\%03u", (unsigned int)ch);
+				buffer_printf(out, "\\%03u", (unsigned int)ch);
 			}
 		}
-		fprintf(out, ".");
+		buffer_printf(out, ".");
 		len = *d++;
 	}
 }
 
 static void
-xfrd_write_state_soa(FILE* out, const char* id,
+xfrd_write_state_soa(buffer_type* out, const char* id,
 	xfrd_soa_type* soa, time_t soatime, const dname_type* ATTR_UNUSED(apex))
 {
-	fprintf(out, "\t%s_acquired: %d", id, (int)soatime);
+	buffer_printf(out, "\t%s_acquired: %d", id, (int)soatime);
 	if(!soatime) {
-		fprintf(out, "\n");
+		buffer_printf(out, "\n");
 		return;
 	}
 	neato_timeout(out, "\t# was", xfrd_time()-soatime);
-	fprintf(out, " ago\n");
+	buffer_printf(out, " ago\n");
 
-	fprintf(out, "\t%s: %u %u %u %u", id,
+	buffer_printf(out, "\t%s: %u %u %u %u", id,
 		(unsigned)ntohs(soa->type), (unsigned)ntohs(soa->klass),
 		(unsigned)ntohl(soa->ttl), (unsigned)ntohs(soa->rdata_count));
-	fprintf(out, " ");
+	buffer_printf(out, " ");
 	xfrd_write_dname(out, soa->prim_ns);
-	fprintf(out, " ");
+	buffer_printf(out, " ");
 	xfrd_write_dname(out, soa->email);
-	fprintf(out, " %u", (unsigned)ntohl(soa->serial));
-	fprintf(out, " %u", (unsigned)ntohl(soa->refresh));
-	fprintf(out, " %u", (unsigned)ntohl(soa->retry));
-	fprintf(out, " %u", (unsigned)ntohl(soa->expire));
-	fprintf(out, " %u\n", (unsigned)ntohl(soa->minimum));
-	fprintf(out, "\t#");
+	buffer_printf(out, " %u", (unsigned)ntohl(soa->serial));
+	buffer_printf(out, " %u", (unsigned)ntohl(soa->refresh));
+	buffer_printf(out, " %u", (unsigned)ntohl(soa->retry));
+	buffer_printf(out, " %u", (unsigned)ntohl(soa->expire));
+	buffer_printf(out, " %u\n", (unsigned)ntohl(soa->minimum));
+	buffer_printf(out, "\t#");
 	neato_timeout(out, " refresh =", ntohl(soa->refresh));
 	neato_timeout(out, " retry =", ntohl(soa->retry));
 	neato_timeout(out, " expire =", ntohl(soa->expire));
 	neato_timeout(out, " minimum =", ntohl(soa->minimum));
-	fprintf(out, "\n");
+	buffer_printf(out, "\n");
 }
 
-void
-xfrd_write_state(struct xfrd_state* xfrd)
+int
+xfrd_print_state_text(struct xfrd_state* xfrd, buffer_type* out,
+	int (*flush)(void*, buffer_type*), void* arg)
 {
 	rbnode_type* p;
-	const char* statefile = xfrd->nsd->options->xfrdfile;
-	FILE *out;
 	time_t now = xfrd_time();
 
-	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: write file %s", statefile));
-	out = fopen(statefile, "w");
-	if(!out) {
-		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
-				statefile, strerror(errno));
-		return;
-	}
-
-	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
-	fprintf(out, "# This file is written on exit by nsd xfr daemon.\n");
-	fprintf(out, "# This file contains slave zone information:\n");
-	fprintf(out, "# 	* timeouts (when was zone data acquired)\n");
-	fprintf(out, "# 	* state (OK, refreshing, expired)\n");
-	fprintf(out, "# 	* which master transfer to attempt next\n");
-	fprintf(out, "# The file is read on start (but not on reload) by nsd xfr daemon.\n");
-	fprintf(out, "# You can edit; but do not change statement order\n");
-	fprintf(out, "# and no fancy stuff (like quoted \"strings\").\n");
-	fprintf(out, "#\n");
-	fprintf(out, "# If you remove a zone entry, it will be refreshed.\n");
-	fprintf(out, "# This can be useful for an expired zone; it revives\n");
-	fprintf(out, "# the zone temporarily, from refresh-expiry time.\n");
-	fprintf(out, "# If you delete the file all slave zones are updated.\n");
-	fprintf(out, "#\n");
-	fprintf(out, "# Note: if you edit this file while nsd is running,\n");
-	fprintf(out, "#       it will be overwritten on exit by nsd.\n");
-	fprintf(out, "\n");
-	fprintf(out, "filetime: %lld\t# %s\n", (long long)now, ctime(&now));
-	fprintf(out, "# The number of zone entries in this file\n");
-	fprintf(out, "numzones: %d\n", (int)xfrd->zones->count);
-	fprintf(out, "\n");
+	buffer_clear(out);
+	buffer_printf(out, "%s\n", XFRD_FILE_MAGIC);
+	buffer_printf(out, "# This file is exported from the state journal of nsd xfr daemon.\n");
+	buffer_printf(out, "# This file contains slave zone information:\n");
+	buffer_printf(out, "# 	* timeouts (when was zone data acquired)\n");
+	buffer_printf(out, "# 	* state (OK, refreshing, expired)\n");
+	buffer_printf(out, "# 	* which master transfer to attempt next\n");
+	buffer_printf(out, "# Put in place of the xfrdfile, it is read on start (but not on\n");
+	buffer_printf(out, "# reload) by nsd xfr daemon.\n");
+	buffer_printf(out, "# You can edit; but do not change statement order\n");
+	buffer_printf(out, "# and no fancy stuff (like quoted \"strings\").\n");
+	buffer_printf(out, "#\n");
+	buffer_printf(out, "# If you remove a zone entry, it will be refreshed.\n");
+	buffer_printf(out, "# This can be useful for an expired zone; it revives\n");
+	buffer_printf(out, "# the zone temporarily, from refresh-expiry time.\n");
+	buffer_printf(out, "# If you delete the file all slave zones are updated.\n");
+	buffer_printf(out, "#\n");
+	buffer_printf(out, "# Note: if you put this file in place while nsd is running,\n");
+	buffer_printf(out, "#       it will be overwritten by the journal of nsd.\n");
+	buffer_printf(out, "\n");
+	buffer_printf(out, "filetime: %lld\t# %s\n", (long long)now, ctime(&now));
+	buffer_printf(out, "# The number of zone entries in this file\n");
+	buffer_printf(out, "numzones: %d\n", (int)xfrd->zones->count);
+	buffer_printf(out, "\n");
 	for(p = rbtree_first(xfrd->zones); p && p!=RBTREE_NULL; p=rbtree_next(p))
 	{
 		xfrd_zone_type* zone = (xfrd_zone_type*)p;
-		fprintf(out, "zone: \tname: %s\n", zone->apex_str);
-		fprintf(out, "\tstate: %d", (int)zone->state);
-		fprintf(out, " # %s", zone->state==xfrd_zone_ok?"OK":(
+		buffer_printf(out, "zone: \tname: %s\n", zone->apex_str);
+		buffer_printf(out, "\tstate: %d", (int)zone->state);
+		buffer_printf(out, " # %s", zone->state==xfrd_zone_ok?"OK":(
 			zone->state==xfrd_zone_refreshing?"refreshing":"expired"));
-		fprintf(out, "\n");
-		fprintf(out, "\tmaster: %d\n", zone->master_num);
-		fprintf(out, "\tnext_master: %d\n", zone->next_master);
-		fprintf(out, "\tround_num: %d\n", zone->round_num);
-		fprintf(out, "\tnext_timeout: %d",
-			(zone->zone_handler_flags&EV_TIMEOUT)?(int)zone->timeout.tv_sec:0);
-		if((zone->zone_handler_flags&EV_TIMEOUT)) {
-			neato_timeout(out, "\t# =", zone->timeout.tv_sec);
+		buffer_printf(out, "\n");
+		buffer_printf(out, "\tmaster: %d\n", zone->master_num);
+		buffer_printf(out, "\tnext_master: %d\n", zone->next_master);
+		buffer_printf(out, "\tround_num: %d\n", zone->round_num);
+		buffer_printf(out, "\tnext_timeout: %d",
+			zone->timer_set?(int)zone->timeout:0);
+		if(zone->timer_set) {
+			neato_timeout(out, "\t# =", zone->timeout);
 		}
-		fprintf(out, "\n");
-		fprintf(out, "\tbackoff: %d\n", zone->fresh_xfr_timeout/XFRD_TRANSFER_TIMEOUT_START);
+		buffer_printf(out, "\n");
+		buffer_printf(out, "\tbackoff: %d\n", zone->fresh_xfr_timeout/XFRD_TRANSFER_TIMEOUT_START);
 		xfrd_write_state_soa(out, "soa_nsd", &zone->soa_nsd,
 			zone->soa_nsd_acquired, zone->apex);
 		xfrd_write_state_soa(out, "soa_disk", &zone->soa_disk,
 			zone->soa_disk_acquired, zone->apex);
 		xfrd_write_state_soa(out, "soa_notify", &zone->soa_notified,
 			zone->soa_notified_acquired, zone->apex);
-		fprintf(out, "\n");
+		buffer_printf(out, "\n");
+		/* pass on the text per zone, it is not kept for all zones */
+		if(!(*flush)(arg, out))
+			return 0;
+		buffer_clear(out);
 	}
 
-	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
-	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: written %d zones to state file",
-		(int)xfrd->zones->count));
-	fclose(out);
+	buffer_printf(out, "%s\n", XFRD_FILE_MAGIC);
+	return (*flush)(arg, out);
+}
+
+
+/* write the dname with its length byte, from the soa format */
+static void
+xfrd_journal_write_soa_dname(buffer_type* buf, uint8_t* d)
+{
+	buffer_write_u8(buf, d[0]);
+	buffer_write(buf, d+1, d[0]);
+}
+
+static void
+xfrd_journal_write_soa(buffer_type* buf, xfrd_soa_type* soa, time_t soatime)
+{
+	buffer_write_u32(buf, (uint32_t)soatime);
+	if(!soatime)
+		return;
+	/* the values are kept in network order, as in the soa struct */
+	buffer_write(buf, &soa->type, 2);
+	buffer_write(buf, &soa->klass, 2);
+	buffer_write(buf, &soa->ttl, 4);
+	buffer_write(buf, &soa->rdata_count, 2);
+	xfrd_journal_write_soa_dname(buf, soa->prim_ns);
+	xfrd_journal_write_soa_dname(buf, soa->email);
+	buffer_write(buf, &soa->serial, 4);
+	buffer_write(buf, &soa->refresh, 4);
+	buffer_write(buf, &soa->retry, 4);
+	buffer_write(buf, &soa->expire, 4);
+	buffer_write(buf, &soa->minimum, 4);
+}
+
+/* append the record for the zone to the buffer */
+static void
+xfrd_journal_write_zone(buffer_type* buf, xfrd_zone_type* zone)
+{
+	size_t start = buffer_position(buf), len;
+	assert(buffer_remaining(buf) >= XFRD_JOURNAL_REC_MAX);
+	buffer_skip(buf, 8);
+	buffer_write_u8(buf, (uint8_t)zone->apex->name_size);
+	buffer_write(buf, dname_name(zone->apex), zone->apex->name_size);
+	buffer_write_u32(buf, (uint32_t)xfrd_time());
+	buffer_write_u8(buf, (uint8_t)zone->state);
+	buffer_write_u32(buf, (uint32_t)zone->master_num);
+	buffer_write_u32(buf, (uint32_t)zone->next_master);
+	buffer_write_u32(buf, (uint32_t)zone->round_num);
+	buffer_write_u32(buf, zone->timer_set?(uint32_t)zone->timeout:0);
+	buffer_write_u32(buf, (uint32_t)(zone->fresh_xfr_timeout/
+		XFRD_TRANSFER_TIMEOUT_START));
+	xfrd_journal_write_soa(buf, &zone->soa_nsd, zone->soa_nsd_acquired);
+	xfrd_journal_write_soa(buf, &zone->soa_disk, zone->soa_disk_acquired);
+	xfrd_journal_write_soa(buf, &zone->soa_notified,
+		zone->soa_notified_acquired);
+	len = buffer_position(buf) - start - 8;
+	buffer_write_u32_at(buf, start, (uint32_t)len);
+	buffer_write_u32_at(buf, start+4, hashlittle(
+		buffer_at(buf, start+8), len, 0));
+}
+
+/* write all of the data to the file, returns 0 on failure */
+static int
+xfrd_journal_write_all(int fd, uint8_t* data, size_t len)
+{
+	while(len > 0) {
+		ssize_t r = write(fd, data, len);
+		if(r == -1) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			return 0;
+		}
+		data += r;
+		len -= (size_t)r;
+	}
+	return 1;
+}
+
+/* write the buffer to the file and clear it */
+static int
+xfrd_journal_write_buf(struct xfrd_state* xfrd, int fd, off_t* size)
+{
+	buffer_type* buf = xfrd->state_buf;
+	size_t len = buffer_position(buf);
+	if(!xfrd_journal_write_all(fd, buffer_begin(buf), len)) {
+		log_msg(LOG_ERR, "xfrd: could not write %s: %s",
+			xfrd->nsd->options->xfrdfile, strerror(errno));
+		buffer_clear(buf);
+		return 0;
+	}
+	buffer_clear(buf);
+	*size += (off_t)len;
+	return 1;
+}
+
+/* take the zone off the list of changed zones */
+static void
+xfrd_state_dirty_remove(struct xfrd_state* xfrd, xfrd_zone_type* zone)
+{
+	if(zone->state_dirty_prev)
+		zone->state_dirty_prev->state_dirty_next =
+			zone->state_dirty_next;
+	else	xfrd->state_dirty_first = zone->state_dirty_next;
+	if(zone->state_dirty_next)
+		zone->state_dirty_next->state_dirty_prev =
+			zone->state_dirty_prev;
+	zone->state_dirty_next = NULL;
+	zone->state_dirty_prev = NULL;
+	zone->state_dirty = 0;
+}
+
+/* fsync the directory of the file, so that a rename in it is on disk */
+static void
+xfrd_state_sync_dir(const char* statefile)
+{
+	char dir[1200];
+	char* slash;
+	int fd;
+
+	strlcpy(dir, statefile, sizeof(dir));
+	slash = strrchr(dir, '/');
+	if(slash == dir)
+		dir[1] = 0;
+	else if(slash)
+		*slash = 0;
+	else	strlcpy(dir, ".", sizeof(dir));
+	fd = open(dir, O_RDONLY);
+	if(fd == -1 || fsync(fd) == -1)
+		log_msg(LOG_ERR, "xfrd: could not fsync directory %s: %s",
+			dir, strerror(errno));
+	if(fd != -1)
+		close(fd);
+}
+
+/* rewrite the journal with one record for every zone, and start to
+ * append to that, the old journal is replaced when it is written */
+static int
+xfrd_state_checkpoint(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	char tmpfile[1200];
+	xfrd_zone_type* zone;
+	off_t size = 0;
+	int fd;
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", statefile);
+	fd = open(tmpfile, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "xfrd: could not open %s: %s", tmpfile,
+			strerror(errno));
+		return 0;
+	}
+	buffer_clear(xfrd->state_buf);
+	buffer_write(xfrd->state_buf, XFRD_JOURNAL_MAGIC,
+		sizeof(XFRD_JOURNAL_MAGIC)-1);
+	RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones) {
+		if(buffer_remaining(xfrd->state_buf) < XFRD_JOURNAL_REC_MAX &&
+			!xfrd_journal_write_buf(xfrd, fd, &size))
+			goto fail;
+		xfrd_journal_write_zone(xfrd->state_buf, zone);
+	}
+	if(!xfrd_journal_write_buf(xfrd, fd, &size))
+		goto fail;
+	if(fsync(fd) == -1) {
+		log_msg(LOG_ERR, "xfrd: could not fsync %s: %s", tmpfile,
+			strerror(errno));
+		goto fail;
+	}
+	if(rename(tmpfile, statefile) == -1) {
+		log_msg(LOG_ERR, "xfrd: could not rename %s to %s: %s",
+			tmpfile, statefile, strerror(errno));
+		goto fail;
+	}
+	xfrd_state_sync_dir(statefile);
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: wrote checkpoint of %d zones, "
+		"%lld bytes, to %s", (int)xfrd->zones->count, (long long)size,
+		statefile));
+	while(xfrd->state_dirty_first)
+		xfrd_state_dirty_remove(xfrd, xfrd->state_dirty_first);
+	if(xfrd->state_fd != -1)
+		close(xfrd->state_fd);
+	xfrd->state_fd = fd;
+	xfrd->state_size = size;
+	xfrd->state_base_size = size;
+	xfrd->state_need_sync = 0;
+	xfrd->state_last_sync = xfrd_time();
+	return 1;
+fail:
+	close(fd);
+	unlink(tmpfile);
+	return 0;
+}
+
+/* append the buffer to the journal.  When the write fails the part that
+ * was written is truncated away, a later append would be after it and
+ * the reader stops at it.  The zones are still on the dirty list, and
+ * are written by a checkpoint, or the next flush if that fails too. */
+static int
+xfrd_state_append(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	if(xfrd_journal_write_buf(xfrd, xfrd->state_fd, &xfrd->state_size))
+		return 1;
+	if(ftruncate(xfrd->state_fd, xfrd->state_size) == -1)
+		log_msg(LOG_ERR, "xfrd: could not truncate %s: %s",
+			statefile, strerror(errno));
+	if(lseek(xfrd->state_fd, xfrd->state_size, SEEK_SET) == (off_t)-1)
+		log_msg(LOG_ERR, "xfrd: could not seek in %s: %s",
+			statefile, strerror(errno));
+	(void)xfrd_state_checkpoint(xfrd);
+	return 0;
+}
+
+/* append the changed zones to the journal, and fsync it if it is time.
+ * If the journal has grown large, it is compacted. */
+static void
+xfrd_state_flush(struct xfrd_state* xfrd, int sync)
+{
+	xfrd_zone_type* zone;
+	if(xfrd->state_fd == -1)
+		return;
+	buffer_clear(xfrd->state_buf);
+	/* the zones leave the dirty list when their records are written */
+	for(zone = xfrd->state_dirty_first; zone;
+		zone = zone->state_dirty_next) {
+		if(buffer_remaining(xfrd->state_buf) < XFRD_JOURNAL_REC_MAX) {
+			if(!xfrd_state_append(xfrd))
+				return;
+			while(xfrd->state_dirty_first != zone)
+				xfrd_state_dirty_remove(xfrd,
+					xfrd->state_dirty_first);
+			xfrd->state_need_sync = 1;
+		}
+		xfrd_journal_write_zone(xfrd->state_buf, zone);
+	}
+	if(buffer_position(xfrd->state_buf) != 0) {
+		if(!xfrd_state_append(xfrd))
+			return;
+		while(xfrd->state_dirty_first)
+			xfrd_state_dirty_remove(xfrd, xfrd->state_dirty_first);
+		xfrd->state_need_sync = 1;
+	}
+	if(xfrd->state_size > XFRD_JOURNAL_COMPACT_MIN &&
+		xfrd->state_size > XFRD_JOURNAL_COMPACT_FACTOR *
+		xfrd->state_base_size) {
+		if(xfrd_state_checkpoint(xfrd))
+			return;
+	}
+	/* batch the fsyncs, the appends in between share one */
+	if(xfrd->state_need_sync && (sync || xfrd_time() >=
+		xfrd->state_last_sync + XFRD_JOURNAL_SYNC)) {
+		if(fsync(xfrd->state_fd) == -1)
+			log_msg(LOG_ERR, "xfrd: could not fsync %s: %s",
+				xfrd->nsd->options->xfrdfile, strerror(errno));
+		xfrd->state_need_sync = 0;
+		xfrd->state_last_sync = xfrd_time();
+	}
+}
+
+static void
+xfrd_state_timer_set(struct xfrd_state* xfrd, time_t secs)
+{
+	struct timeval tv;
+	if(xfrd->state_timer_added)
+		return;
+	tv.tv_sec = secs;
+	tv.tv_usec = 0;
+	memset(&xfrd->state_timer, 0, sizeof(xfrd->state_timer));
+	event_set(&xfrd->state_timer, -1, EV_TIMEOUT, xfrd_handle_state_timer,
+		xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->state_timer) != 0)
+		log_msg(LOG_ERR, "xfrd state timer: event_base_set failed");
+	if(event_add(&xfrd->state_timer, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd state timer: event_add failed");
+	xfrd->state_timer_added = 1;
+}
+
+void
+xfrd_handle_state_timer(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct xfrd_state* xfrd = (struct xfrd_state*)arg;
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	xfrd->state_timer_added = 0;
+	xfrd_state_flush(xfrd, 0);
+	if(xfrd->state_dirty_first)
+		xfrd_state_timer_set(xfrd, XFRD_JOURNAL_FLUSH);
+	else if(xfrd->state_need_sync)
+		xfrd_state_timer_set(xfrd, xfrd->state_last_sync +
+			XFRD_JOURNAL_SYNC - xfrd_time());
+}
+
+/* start to append to the journal after it is read, or write a new one */
+static void
+xfrd_state_open(struct xfrd_state* xfrd, off_t valid)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	/* changes made while reading are already on disk, or not yet known */
+	while(xfrd->state_dirty_first)
+		xfrd_state_dirty_remove(xfrd, xfrd->state_dirty_first);
+	if(valid != 0) {
+		int fd = open(statefile, O_WRONLY);
+		if(fd != -1 && ftruncate(fd, valid) == 0 &&
+			lseek(fd, valid, SEEK_SET) != (off_t)-1) {
+			xfrd->state_fd = fd;
+			xfrd->state_size = valid;
+			/* an estimate, the size without older records is
+			 * found at the next checkpoint */
+			xfrd->state_base_size = valid;
+			xfrd->state_last_sync = xfrd_time();
+			return;
+		}
+		log_msg(LOG_ERR, "xfrd: could not open %s for append: %s",
+			statefile, strerror(errno));
+		if(fd != -1)
+			close(fd);
+	}
+	/* convert from the text format, or start a new journal */
+	(void)xfrd_state_checkpoint(xfrd);
+}
+
+void
+xfrd_state_dirty(xfrd_zone_type* zone)
+{
+	if(zone->state_dirty || xfrd->state_fd == -1)
+		return;
+	zone->state_dirty = 1;
+	zone->state_dirty_prev = NULL;
+	zone->state_dirty_next = xfrd->state_dirty_first;
+	if(zone->state_dirty_next)
+		zone->state_dirty_next->state_dirty_prev = zone;
+	xfrd->state_dirty_first = zone;
+	xfrd_state_timer_set(xfrd, XFRD_JOURNAL_FLUSH);
+}
+
+void
+xfrd_state_remove(xfrd_zone_type* zone)
+{
+	if(zone->state_dirty)
+		xfrd_state_dirty_remove(xfrd, zone);
+}
+
+void
+xfrd_write_state(struct xfrd_state* xfrd)
+{
+	if(xfrd->state_timer_added) {
+		event_del(&xfrd->state_timer);
+		xfrd->state_timer_added = 0;
+	}
+	/* if it was not opened, the state was not read completely */
+	if(xfrd->state_fd == -1)
+		return;
+	xfrd_state_flush(xfrd, 1);
+	close(xfrd->state_fd);
+	xfrd->state_fd = -1;
 }
 
 /* return tempdirname */
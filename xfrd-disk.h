@@ -11,15 +11,44 @@
 #define XFRD_DISK_H
 
 struct xfrd_state;
+struct buffer;
+struct xfrd_zone;
 struct nsd;
 
 /* magic string to identify xfrd state file */
 #define XFRD_FILE_MAGIC "NSDXFRD2"
+/* magic string to identify the binary xfrd state journal */
+#define XFRD_JOURNAL_MAGIC "NSDXFRJ1"
+/* max size of a journal record, and the size of the write buffer */
+#define XFRD_JOURNAL_REC_MAX 2048
+#define XFRD_JOURNAL_BUFSIZE 65536
+/* seconds before changed zones are appended to the journal */
+#define XFRD_JOURNAL_FLUSH 1
+/* seconds between fsyncs of the journal, appends in between share one */
+#define XFRD_JOURNAL_SYNC 10
+/* the journal is compacted when it has grown to this factor times the
+ * size of the last checkpoint, and is larger than the minimum size */
+#define XFRD_JOURNAL_COMPACT_FACTOR 4
+#define XFRD_JOURNAL_COMPACT_MIN (1024*1024)
 
-/* read from state file as many zones as possible (until error/eof).*/
+/* read from state file as many zones as possible (until error/eof).
+ * Reads the binary journal, or the text format. Afterwards changes are
+ * appended to the journal. */
 void xfrd_read_state(struct xfrd_state* xfrd);
-/* write xfrd zone state if possible */
+/* write the changed zones to the journal, and close it */
 void xfrd_write_state(struct xfrd_state* xfrd);
+/* print xfrd zone state in the text format into the buffer.  The flush
+ * function is called with the text after every zone, and at the end; it
+ * returns 0 to stop, and then this returns 0 */
+int xfrd_print_state_text(struct xfrd_state* xfrd, struct buffer* out,
+	int (*flush)(void*, struct buffer*), void* arg);
+
+/* the zone state has changed, append it to the journal soon */
+void xfrd_state_dirty(struct xfrd_zone* zone);
+/* the zone is deleted, do not append it */
+void xfrd_state_remove(struct xfrd_zone* zone);
+/* handle the timer that appends changes to the journal */
+void xfrd_handle_state_timer(int fd, short event, void* arg);
 
 /* create temp directory */
 void xfrd_make_tempdir(struct nsd* nsd);
@@ -15,9 +15,12 @@
 #include "xfrd-notify.h"
 #include "xfrd.h"
 #include "xfrd-tcp.h"
+#include "xfrd-udp.h"
+#include "nsd.h"
 #include "packet.h"
 
 #define XFRD_NOTIFY_RETRY_TIMOUT 3 /* seconds between retries sending NOTIFY */
+#define XFRD_NOTIFY_PACE_TIMOUT 1 /* seconds to wait for the rate to allow */
 
 /* start sending notifies */
 static void notify_enable(struct notify_zone* zone,
@@ -25,31 +28,29 @@ static void notify_enable(struct notify_zone* zone,
 /* setup the notify active state */
 static void setup_notify_active(struct notify_zone* zone);
 
-/* handle zone notify send */
+/* handle zone notify timer */
 static void xfrd_handle_notify_send(int fd, short event, void* arg);
 
 static int xfrd_notify_send_udp(struct notify_zone* zone, int index);
 
+/* remove the outstanding query of the packet slot from the udp set */
 static void
-notify_send_disable(struct notify_zone* zone)
+notify_pkt_query_remove(struct notify_zone* zone, int index)
 {
-	zone->notify_send_enable = 0;
-	event_del(&zone->notify_send_handler);
-	if(zone->notify_send_handler.ev_fd != -1) {
-		close(zone->notify_send_handler.ev_fd);
-		zone->notify_send_handler.ev_fd = -1;
+	if(zone->pkts[index].query) {
+		xfrd_udp_notify_remove(xfrd->udp_set, zone->pkts[index].query);
+		zone->pkts[index].query = NULL;
 	}
 }
 
 static void
-notify_send6_disable(struct notify_zone* zone)
+notify_send_disable(struct notify_zone* zone)
 {
-	zone->notify_send6_enable = 0;
-	event_del(&zone->notify_send6_handler);
-	if(zone->notify_send6_handler.ev_fd != -1) {
-		close(zone->notify_send6_handler.ev_fd);
-		zone->notify_send6_handler.ev_fd = -1;
-	}
+	int i;
+	zone->notify_send_enable = 0;
+	event_del(&zone->notify_send_handler);
+	for(i=0; i<NOTIFY_CONCURRENT_MAX; i++)
+		notify_pkt_query_remove(zone, i);
 }
 
 void
@@ -57,14 +58,11 @@ notify_disable(struct notify_zone* zone)
 {
 	zone->notify_current = 0;
 	/* if added, then remove */
-	if(zone->notify_send_enable) {
-		notify_send_disable(zone);
-	}
-	if(zone->notify_send6_enable) {
-		notify_send6_disable(zone);
-	}
+	if(!zone->notify_send_enable)
+		return;
+	notify_send_disable(zone);
 
-	if(xfrd->notify_udp_num == XFRD_MAX_UDP_NOTIFY) {
+	if(xfrd->notify_udp_num >= xfrd->nsd->options->xfrd_notify_window) {
 		/* find next waiting and needy zone */
 		while(xfrd->notify_waiting_first) {
 			/* snip off */
@@ -76,11 +74,12 @@ notify_disable(struct notify_zone* zone)
 				wz->waiting_next->waiting_prev = NULL;
 			if(xfrd->notify_waiting_last == wz)
 				xfrd->notify_waiting_last = NULL;
+			xfrd->notify_waiting_num--;
 			/* see if this zone needs notify sending */
 			if(wz->notify_current) {
 				DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 					"xfrd: zone %s: notify off waiting list.",
-					zone->apex_str)	);
+					wz->apex_str)	);
 				setup_notify_active(wz);
 				return;
 			}
@@ -107,11 +106,9 @@ init_notify_send(rbtree_type* tree, region_type* region,
 	memset(not->current_soa, 0, sizeof(struct xfrd_soa));
 
 	not->notify_send_handler.ev_fd = -1;
-	not->notify_send6_handler.ev_fd = -1;
 	not->is_waiting = 0;
 
 	not->notify_send_enable = 0;
-	not->notify_send6_enable = 0;
 	tsig_create_record_custom(&not->notify_tsig, NULL, 0, 0, 4);
 	not->notify_current = 0;
 	rbtree_insert(tree, (rbnode_type*)not);
@@ -135,10 +132,11 @@ xfrd_del_notify(xfrd_state_type* xfrd, const dname_type* dname)
 			not->waiting_next->waiting_prev = not->waiting_prev;
 		else	xfrd->notify_waiting_last = not->waiting_prev;
 		not->is_waiting = 0;
+		xfrd->notify_waiting_num--;
 	}
 
 	/* event */
-	if(not->notify_send_enable || not->notify_send6_enable) {
+	if(not->notify_send_enable) {
 		notify_disable(not);
 	}
 
@@ -181,49 +179,10 @@ reply_pkt_is_ack(struct notify_zone* zone, buffer_type* packet, int index)
 	return 1;
 }
 
-/* compare sockaddr and acl_option addr and port numbers */
-static int
-cmp_addr_equal(struct sockaddr* a, socklen_t a_len, struct acl_options* dest)
-{
-	if(dest) {
-		unsigned int destport = ((dest->port == 0)?
-			(unsigned)atoi(TCP_PORT):dest->port);
-#ifdef INET6
-		struct sockaddr_storage* a1 = (struct sockaddr_storage*)a;
-		if(a1->ss_family == AF_INET6 && dest->is_ipv6) {
-			struct sockaddr_in6* a2 = (struct sockaddr_in6*)a;
-			if(a_len < sizeof(struct sockaddr_in6))
-				return 0; /* too small */
-			if(ntohs(a2->sin6_port) != destport)
-				return 0; /* different port number */
-			if(memcmp(&a2->sin6_addr, &dest->addr.addr6,
-				sizeof(struct in6_addr)) != 0)
-				return 0; /* different address */
-			return 1;
-		}
-		if(a1->ss_family == AF_INET6 || dest->is_ipv6)
-			return 0; /* different address family */
-		else {
-#endif /* INET6 */
-			struct sockaddr_in* a3 = (struct sockaddr_in*)a;
-			if(a_len < sizeof(struct sockaddr_in))
-				return 0; /* too small */
-			if(ntohs(a3->sin_port) != destport)
-				return 0; /* different port number */
-			if(memcmp(&a3->sin_addr, &dest->addr.addr,
-				sizeof(struct in_addr)) != 0)
-				return 0; /* different address */
-			return 1;
-#ifdef INET6
-		}
-#endif
-	}
-	return 0;
-}
-
 static void
 notify_pkt_done(struct notify_zone* zone, int index)
 {
+	notify_pkt_query_remove(zone, index);
 	zone->pkts[index].dest = NULL;
 	zone->pkts[index].notify_retry = 0;
 	zone->pkts[index].send_time = 0;
@@ -239,6 +198,7 @@ notify_pkt_retry(struct notify_zone* zone, int index)
 		log_msg(LOG_ERR, "xfrd: zone %s: max notify send count reached, %s unreachable",
 			zone->apex_str,
 			zone->pkts[index].dest->ip_address_spec);
+		xfrd->notify_failed++;
 		notify_pkt_done(zone, index);
 		return;
 	}
@@ -247,28 +207,22 @@ notify_pkt_retry(struct notify_zone* zone, int index)
 	}
 }
 
+/* account the time from the first send to the ack */
 static void
-xfrd_handle_notify_reply(struct notify_zone* zone, buffer_type* packet, 
-	struct sockaddr* src, socklen_t srclen)
+notify_pkt_latency(struct notify_zone* zone, int index)
 {
-	int i;
-	for(i=0; i<NOTIFY_CONCURRENT_MAX; i++) {
-		/* is this entry in use */
-		if(!zone->pkts[i].dest)
-			continue;
-		/* based on destination */
-		if(!cmp_addr_equal(src, srclen, zone->pkts[i].dest))
-			continue;
-		if(reply_pkt_is_ack(zone, packet, i)) {
-			/* is done */
-			notify_pkt_done(zone, i);
-			return;
-		} else {
-			/* retry */
-			notify_pkt_retry(zone, i);
-			return;
-		}
-	}
+	struct timeval now;
+	uint64_t usec;
+	if(gettimeofday(&now, NULL) != 0)
+		return;
+	if(now.tv_sec < zone->pkts[index].start.tv_sec)
+		return;
+	usec = (uint64_t)(now.tv_sec - zone->pkts[index].start.tv_sec)*1000000
+		+ now.tv_usec - zone->pkts[index].start.tv_usec;
+	xfrd->notify_acked++;
+	xfrd->notify_latency_sum += usec;
+	if(usec > xfrd->notify_latency_max)
+		xfrd->notify_latency_max = usec;
 }
 
 static int
@@ -276,6 +230,13 @@ xfrd_notify_send_udp(struct notify_zone* zone, int index)
 {
 	buffer_type* packet = xfrd_get_temp_buffer();
 	if(!zone->pkts[index].dest) return 0;
+	notify_pkt_query_remove(zone, index);
+	if(!xfrd_udp_notify_allowed(xfrd->udp_set, zone->pkts[index].dest)) {
+		/* the rate to this secondary is used up, the timer sends
+		 * it later, this is not counted as a retry */
+		zone->pkts[index].send_time = time(NULL);
+		return 1;
+	}
 	/* send NOTIFY to secondary. */
 	xfrd_setup_packet(packet, TYPE_SOA, CLASS_IN, zone->apex,
 		qid_generate());
@@ -292,45 +253,17 @@ xfrd_notify_send_udp(struct notify_zone* zone, int index)
 	}
 	buffer_flip(packet);
 
-	if((zone->pkts[index].dest->is_ipv6
-		&& zone->notify_send6_handler.ev_fd == -1) ||
-		(!zone->pkts[index].dest->is_ipv6
-		&& zone->notify_send_handler.ev_fd == -1)) {
-		/* open fd */
-		int fd = xfrd_send_udp(zone->pkts[index].dest, packet,
-			zone->options->pattern->outgoing_interface);
-		if(fd == -1) {
-			log_msg(LOG_ERR, "xfrd: zone %s: could not send notify #%d to %s",
-				zone->apex_str, zone->pkts[index].notify_retry,
-				zone->pkts[index].dest->ip_address_spec);
-			return 0;
-		}
-		if(zone->pkts[index].dest->is_ipv6)
-			zone->notify_send6_handler.ev_fd = fd;
-		else	zone->notify_send_handler.ev_fd = fd;
-	} else {
-		/* send on existing fd */
-#ifdef INET6
-        	struct sockaddr_storage to;
-#else
-        	struct sockaddr_in to;
-#endif /* INET6 */
-		int fd;
-		socklen_t to_len = xfrd_acl_sockaddr_to(
-			zone->pkts[index].dest, &to);
-		if(zone->pkts[index].dest->is_ipv6)
-			fd = zone->notify_send6_handler.ev_fd;
-		else	fd = zone->notify_send_handler.ev_fd;
-		if(sendto(fd,
-			buffer_current(packet), buffer_remaining(packet), 0,
-			(struct sockaddr*)&to, to_len) == -1) {
-			log_msg(LOG_ERR, "xfrd notify: sendto %s failed %s",
-				zone->pkts[index].dest->ip_address_spec,
-				strerror(errno));
-			return 0;
-		}
+	/* the packet is sent with the others on xfrd_udp_flush */
+	zone->pkts[index].query = xfrd_udp_notify_add(xfrd->udp_set, zone,
+		index, zone->pkts[index].dest, packet);
+	if(!zone->pkts[index].query) {
+		log_msg(LOG_ERR, "xfrd: zone %s: could not send notify #%d to %s",
+			zone->apex_str, zone->pkts[index].notify_retry,
+			zone->pkts[index].dest->ip_address_spec);
+		return 0;
 	}
 	zone->pkts[index].send_time = time(NULL);
+	xfrd->notify_sent++;
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: sent notify #%d to %s",
 		zone->apex_str, zone->pkts[index].notify_retry,
 		zone->pkts[index].dest->ip_address_spec));
@@ -345,7 +278,12 @@ notify_timeout_check(struct notify_zone* zone)
 	for(i=0; i<NOTIFY_CONCURRENT_MAX; i++) {
 		if(!zone->pkts[i].dest)
 			continue;
-		if(now >= zone->pkts[i].send_time + XFRD_NOTIFY_RETRY_TIMOUT) {
+		if(!zone->pkts[i].query) {
+			/* paced, see if it can be sent now */
+			if(!xfrd_notify_send_udp(zone, i))
+				notify_pkt_retry(zone, i);
+		} else if(now >= zone->pkts[i].send_time +
+			XFRD_NOTIFY_RETRY_TIMOUT) {
 			notify_pkt_retry(zone, i);
 		}
 	}
@@ -365,6 +303,10 @@ notify_start_pkts(struct notify_zone* zone)
 			zone->pkts[i].notify_retry = 0;
 			zone->pkts[i].notify_query_id = 0;
 			zone->pkts[i].send_time = 0;
+			zone->pkts[i].query = NULL;
+			if(gettimeofday(&zone->pkts[i].start, NULL) != 0)
+				memset(&zone->pkts[i].start, 0,
+					sizeof(zone->pkts[i].start));
 			zone->notify_pkt_count++;
 			if(!xfrd_notify_send_udp(zone, i)) {
 				notify_pkt_retry(zone, i);
@@ -373,102 +315,111 @@ notify_start_pkts(struct notify_zone* zone)
 	}
 }
 
+/* see if the zone is done, returns true and stops the notify if so */
+static int
+notify_check_done(struct notify_zone* zone)
+{
+	if(!zone->notify_current && !zone->notify_pkt_count) {
+		/* we are done */
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+			"xfrd: zone %s: no more notify-send acls. stop notify.",
+			zone->apex_str));
+		notify_disable(zone);
+		return 1;
+	}
+	return 0;
+}
+
 static void
 notify_setup_event(struct notify_zone* zone)
 {
-	if(zone->notify_send_handler.ev_fd != -1) {
-		int fd = zone->notify_send_handler.ev_fd;
-		if(zone->notify_send_enable) {
-			event_del(&zone->notify_send_handler);
-		}
-		zone->notify_timeout.tv_sec = XFRD_NOTIFY_RETRY_TIMOUT;
-		memset(&zone->notify_send_handler, 0,
-			sizeof(zone->notify_send_handler));
-		event_set(&zone->notify_send_handler, fd, EV_READ | EV_TIMEOUT,
-			xfrd_handle_notify_send, zone);
-		if(event_base_set(xfrd->event_base, &zone->notify_send_handler) != 0)
-			log_msg(LOG_ERR, "notify_send: event_base_set failed");
-		if(event_add(&zone->notify_send_handler, &zone->notify_timeout) != 0)
-			log_msg(LOG_ERR, "notify_send: event_add failed");
-		zone->notify_send_enable = 1;
-	}
-	if(zone->notify_send6_handler.ev_fd != -1) {
-		int fd = zone->notify_send6_handler.ev_fd;
-		if(zone->notify_send6_enable) {
-			event_del(&zone->notify_send6_handler);
+	int i;
+	zone->notify_timeout.tv_sec = XFRD_NOTIFY_RETRY_TIMOUT;
+	zone->notify_timeout.tv_usec = 0;
+	for(i=0; i<NOTIFY_CONCURRENT_MAX; i++) {
+		if(zone->pkts[i].dest && !zone->pkts[i].query) {
+			/* a paced packet waits for the next second */
+			zone->notify_timeout.tv_sec = XFRD_NOTIFY_PACE_TIMOUT;
+			break;
 		}
-		zone->notify_timeout.tv_sec = XFRD_NOTIFY_RETRY_TIMOUT;
-		memset(&zone->notify_send6_handler, 0,
-			sizeof(zone->notify_send6_handler));
-		event_set(&zone->notify_send6_handler, fd, EV_READ | EV_TIMEOUT,
-			xfrd_handle_notify_send, zone);
-		if(event_base_set(xfrd->event_base, &zone->notify_send6_handler) != 0)
-			log_msg(LOG_ERR, "notify_send: event_base_set failed");
-		if(event_add(&zone->notify_send6_handler, &zone->notify_timeout) != 0)
-			log_msg(LOG_ERR, "notify_send: event_add failed");
-		zone->notify_send6_enable = 1;
 	}
+	event_del(&zone->notify_send_handler);
+	memset(&zone->notify_send_handler, 0,
+		sizeof(zone->notify_send_handler));
+	event_set(&zone->notify_send_handler, -1, EV_TIMEOUT,
+		xfrd_handle_notify_send, zone);
+	if(event_base_set(xfrd->event_base, &zone->notify_send_handler) != 0)
+		log_msg(LOG_ERR, "notify_send: event_base_set failed");
+	if(evtimer_add(&zone->notify_send_handler, &zone->notify_timeout) != 0)
+		log_msg(LOG_ERR, "notify_send: evtimer_add failed");
 }
 
 static void
-xfrd_handle_notify_send(int fd, short event, void* arg)
+xfrd_handle_notify_send(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
+	void* arg)
 {
 	struct notify_zone* zone = (struct notify_zone*)arg;
-	buffer_type* packet = xfrd_get_temp_buffer();
 	if(zone->is_waiting) {
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 			"xfrd: notify waiting, skipped, %s", zone->apex_str));
 		return;
 	}
-	if((event & EV_READ)) {
-		struct sockaddr_storage src;
-		socklen_t srclen = (socklen_t)sizeof(src);
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
-			"xfrd: zone %s: read notify ACK", zone->apex_str));
-		assert(fd != -1);
-		if(xfrd_udp_read_packet(packet, fd, (struct sockaddr*)&src,
-			&srclen)) {
-			/* find entry, send retry or make entry NULL */
-			xfrd_handle_notify_reply(zone, packet,
-				(struct sockaddr*)&src, srclen);
-		}
-	}
-	if((event & EV_TIMEOUT)) {
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: notify timeout",
-			zone->apex_str));
-		/* timeout, try again */
-	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: notify timeout",
+		zone->apex_str));
 
-	/* see which pkts have timeouted, retry or NULL them */
+	/* see which pkts have timeouted, retry or NULL them, and send the
+	 * paced pkts */
 	notify_timeout_check(zone);
 
 	/* start new packets if we have empty space */
 	notify_start_pkts(zone);
 
 	/* see if we are done */
-	if(!zone->notify_current && !zone->notify_pkt_count) {
-		/* we are done */
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
-			"xfrd: zone %s: no more notify-send acls. stop notify.",
-			zone->apex_str));
-		notify_disable(zone);
+	if(notify_check_done(zone))
 		return;
-	}
 
 	notify_setup_event(zone);
 }
 
+void
+xfrd_notify_udp_read(struct notify_zone* zone, int index,
+	buffer_type* packet)
+{
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+		"xfrd: zone %s: read notify ACK", zone->apex_str));
+	if(reply_pkt_is_ack(zone, packet, index)) {
+		/* is done */
+		notify_pkt_latency(zone, index);
+		notify_pkt_done(zone, index);
+	} else {
+		/* retry */
+		notify_pkt_retry(zone, index);
+	}
+	/* start new packets on the free slots, the timer stays set
+	 * for the timeouts of the others */
+	notify_start_pkts(zone);
+	(void)notify_check_done(zone);
+}
+
+void
+xfrd_notify_udp_failed(struct notify_zone* zone, int index)
+{
+	/* called while the udp set sends, only this slot is changed, the
+	 * timer sees if the zone is done */
+	notify_pkt_retry(zone, index);
+}
+
 static void
 setup_notify_active(struct notify_zone* zone)
 {
+	if(zone->notify_send_enable)
+		notify_send_disable(zone);
 	zone->notify_pkt_count = 0;
 	memset(zone->pkts, 0, sizeof(zone->pkts));
 	zone->notify_current = zone->options->pattern->notify;
 	zone->notify_timeout.tv_sec = 0;
 	zone->notify_timeout.tv_usec = 0;
 
-	if(zone->notify_send_enable)
-		notify_send_disable(zone);
 	memset(&zone->notify_send_handler, 0,
 		sizeof(zone->notify_send_handler));
 	event_set(&zone->notify_send_handler, -1, EV_TIMEOUT,
@@ -494,7 +445,7 @@ notify_enable(struct notify_zone* zone, struct xfrd_soa* new_soa)
 	if(zone->is_waiting)
 		return;
 
-	if(xfrd->notify_udp_num < XFRD_MAX_UDP_NOTIFY) {
+	if(xfrd->notify_udp_num < xfrd->nsd->options->xfrd_notify_window) {
 		setup_notify_active(zone);
 		xfrd->notify_udp_num++;
 		return;
@@ -510,6 +461,7 @@ notify_enable(struct notify_zone* zone, struct xfrd_soa* new_soa)
 		xfrd->notify_waiting_first = zone;
 	}
 	xfrd->notify_waiting_last = zone;
+	xfrd->notify_waiting_num++;
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: notify on waiting list.",
 		zone->apex_str));
 }
@@ -518,8 +470,7 @@ void
 xfrd_notify_start(struct notify_zone* zone, struct xfrd_state* xfrd)
 {
 	xfrd_zone_type* xz;
-	if(zone->is_waiting || zone->notify_send_enable ||
-		zone->notify_send6_enable)
+	if(zone->is_waiting || zone->notify_send_enable)
 		return;
 	xz = (xfrd_zone_type*)rbtree_search(xfrd->zones, zone->apex);
 	if(xz && xz->soa_nsd_acquired)
@@ -534,7 +485,7 @@ xfrd_send_notify(rbtree_type* tree, const dname_type* apex, struct xfrd_soa* new
 	struct notify_zone* zone = (struct notify_zone*)
 		rbtree_search(tree, apex);
 	assert(zone);
-	if(zone->notify_send_enable || zone->notify_send6_enable)
+	if(zone->notify_send_enable)
 		notify_disable(zone);
 
 	notify_enable(zone, new_soa);
@@ -553,7 +504,7 @@ notify_handle_master_zone_soainfo(rbtree_type* tree,
 	if( (new_soa == NULL && zone->current_soa->serial == 0) ||
 		(new_soa && new_soa->serial == zone->current_soa->serial))
 		return;
-	if(zone->notify_send_enable || zone->notify_send6_enable)
+	if(zone->notify_send_enable)
 		notify_disable(zone);
 	notify_enable(zone, new_soa);
 }
@@ -564,7 +515,7 @@ close_notify_fds(rbtree_type* tree)
 	struct notify_zone* zone;
 	RBTREE_FOR(zone, struct notify_zone*, tree)
 	{
-		if(zone->notify_send_enable || zone->notify_send6_enable)
+		if(zone->notify_send_enable)
 			notify_send_disable(zone);
 	}
 }
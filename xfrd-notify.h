@@ -32,6 +32,8 @@ struct zone;
 struct xfrd_soa;
 struct acl_options;
 struct xfrd_state;
+struct xfrd_udp_query;
+struct buffer;
 
 /** number of concurrent notify packets in flight */
 #define NOTIFY_CONCURRENT_MAX 16 
@@ -42,6 +44,10 @@ struct notify_pkt {
 	uint8_t notify_retry; /* how manieth retry in sending to current */
 	uint16_t notify_query_id;
 	time_t send_time;
+	/* outstanding query in the udp set, NULL if the send is paced */
+	struct xfrd_udp_query* query;
+	/* when the first NOTIFY was sent, for the ack latency */
+	struct timeval start;
 };
 
 /**
@@ -57,21 +63,19 @@ struct notify_zone {
 	struct zone_options* options;
 	struct xfrd_soa *current_soa; /* current SOA in NSD */
 
-	/* notify sending handler */
+	/* notify sending is active, the timer for timeouts and pacing */
 	/* Not saved on disk (i.e. kill of daemon stops notifies) */
 	int notify_send_enable;
 	struct event notify_send_handler;
-	int notify_send6_enable;
-	struct event notify_send6_handler;
 	struct timeval notify_timeout;
 	struct acl_options* notify_current; /* current slave to notify */
 	uint8_t notify_restart; /* restart notify after repattern */
 	struct notify_pkt pkts[NOTIFY_CONCURRENT_MAX];
 	int notify_pkt_count; /* number of entries nonNULL in pkts */
 
-	/* is this notify waiting for a socket? */
+	/* is this notify waiting for room in the notify window? */
 	uint8_t is_waiting;
-	/* the double linked waiting list for the udp sockets */
+	/* the double linked waiting list for the notify window */
 	struct notify_zone* waiting_next;
 	struct notify_zone* waiting_prev;
 } ATTR_PACKED;
@@ -93,7 +97,13 @@ void xfrd_notify_start(struct notify_zone* zone, struct xfrd_state* xfrd);
 void notify_handle_master_zone_soainfo(rbtree_type* tree,
 	const dname_type* apex, struct xfrd_soa* new_soa);
 
-/* close fds in use for notification sending */
+/* handle the reply to the NOTIFY of the packet slot, from the udp set */
+void xfrd_notify_udp_read(struct notify_zone* zone, int index,
+	struct buffer* packet);
+/* the NOTIFY of the packet slot could not be sent by the udp set */
+void xfrd_notify_udp_failed(struct notify_zone* zone, int index);
+
+/* stop the timers and queries in use for notification sending */
 void close_notify_fds(rbtree_type* tree);
 /* stop send of notify */
 void notify_disable(struct notify_zone* zone);
@@ -223,12 +223,13 @@ pipeline_find(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 	struct xfrd_tcp_pipeline* key = (struct xfrd_tcp_pipeline*)buf;
 	key->node.key = key;
 	key->ip_len = xfrd_acl_sockaddr_to(zone->master, &key->ip);
-	key->num_unused = ID_PIPE_NUM;
+	/* larger than any pipe, an idle pipe can be fully unused */
+	key->num_unused = ID_PIPE_NUM+1;
 	/* lookup existing tcp transfer to the master with highest unused */
 	if(rbtree_find_less_equal(set->pipetree, key, &sme)) {
-		/* exact match, strange, fully unused tcp cannot be open */
+		/* exact match, strange, the key is not in the tree */
 		assert(0);
-	} 
+	}
 	if(!sme)
 		return NULL;
 	r = (struct xfrd_tcp_pipeline*)sme->key;
@@ -296,11 +297,63 @@ tcp_pipe_id_remove(struct xfrd_tcp_pipeline* tp, xfrd_zone_type* zone)
 	(void)rbtree_insert(xfrd->tcp_set->pipetree, &tp->node);
 }
 
+/* see if the pipe has no active transfers, only skipped leftovers */
+static int
+tcp_pipe_is_idle(struct xfrd_tcp_pipeline* tp)
+{
+	return tp->num_skip >= ID_PIPE_NUM - tp->num_unused;
+}
+
+/* the index of the pipe in the tcp_state array */
+static int
+tcp_pipe_conn(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp)
+{
+	int i;
+	for(i=0; i<XFRD_MAX_TCP; i++) {
+		if(set->tcp_state[i] == tp)
+			return i;
+	}
+	return -1;
+}
+
+/* find an open connection without active transfers */
+static struct xfrd_tcp_pipeline*
+tcp_pipe_find_idle(struct xfrd_tcp_set* set)
+{
+	int i;
+	for(i=0; i<XFRD_MAX_TCP; i++) {
+		if(set->tcp_state[i]->tcp_r->fd != -1 &&
+			tcp_pipe_is_idle(set->tcp_state[i]))
+			return set->tcp_state[i];
+	}
+	return NULL;
+}
+
+int
+xfrd_tcp_num_idle(struct xfrd_tcp_set* set)
+{
+	int i, num = 0;
+	for(i=0; i<XFRD_MAX_TCP; i++) {
+		if(set->tcp_state[i]->tcp_r->fd != -1 &&
+			tcp_pipe_is_idle(set->tcp_state[i]))
+			num++;
+	}
+	return num;
+}
+
 /* stop the tcp pipe (and all its zones need to retry) */
 static void
 xfrd_tcp_pipe_stop(struct xfrd_tcp_pipeline* tp)
 {
 	int i, conn = -1;
+	if(tcp_pipe_is_idle(tp)) {
+		/* idle timeout, or the master closed the idle connection,
+		 * there are no zones to retry */
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: idle tcp pipe closed"));
+		xfrd_tcp_pipe_release(xfrd->tcp_set, tp,
+			tcp_pipe_conn(xfrd->tcp_set, tp));
+		return;
+	}
 	assert(tp->num_unused < ID_PIPE_NUM); /* at least one 'in-use' */
 	assert(ID_PIPE_NUM - tp->num_unused > tp->num_skip); /* at least one 'nonskip' */
 	/* need to retry for all the zones connected to it */
@@ -326,7 +379,9 @@ tcp_pipe_reset_timeout(struct xfrd_tcp_pipeline* tp)
 {
 	int fd = tp->handler.ev_fd;
 	struct timeval tv;
-	tv.tv_sec = xfrd->tcp_set->tcp_timeout;
+	/* an idle connection waits for the next transfer */
+	tv.tv_sec = tcp_pipe_is_idle(tp)?xfrd->tcp_set->tcp_idle_timeout:
+		xfrd->tcp_set->tcp_timeout;
 	tv.tv_usec = 0;
 	if(tp->handler_added)
 		event_del(&tp->handler);
@@ -382,6 +437,10 @@ pipeline_setup_new_zone(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 	(void)rbtree_delete(set->pipetree, &tp->node);
 	tp->num_unused--;
 	(void)rbtree_insert(set->pipetree, &tp->node);
+	set->num_query++;
+	if(tp->num_query > 0)
+		set->num_reuse++;
+	tp->num_query++;
 
 	/* add to sendlist, at end */
 	zone->tcp_send_next = NULL;
@@ -407,6 +466,20 @@ xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 	assert(zone->tcp_conn == -1);
 	assert(zone->tcp_waiting == 0);
 
+	/* check for a pipeline to the same master with unused ID, a new
+	 * connection is opened when it has many active transfers */
+	if((tp = pipeline_find(set, zone)) != NULL &&
+		(set->tcp_count >= XFRD_MAX_TCP || ID_PIPE_NUM - tp->num_unused
+		- tp->num_skip < XFRD_TCP_PIPELINE_DEPTH)) {
+		if(zone->udp_query)
+			xfrd_udp_release(zone);
+		zone->tcp_conn = tcp_pipe_conn(set, tp);
+		xfrd_deactivate_zone(zone);
+		xfrd_unset_timer(zone);
+		pipeline_setup_new_zone(set, tp, zone);
+		return;
+	}
+
 	if(set->tcp_count < XFRD_MAX_TCP) {
 		int i;
 		assert(!set->tcp_waiting_first);
@@ -427,7 +500,7 @@ xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 		zone->tcp_waiting = 0;
 
 		/* stop udp use (if any) */
-		if(zone->zone_handler.ev_fd != -1)
+		if(zone->udp_query)
 			xfrd_udp_release(zone);
 
 		if(!xfrd_tcp_open(set, tp, zone)) {
@@ -454,20 +527,6 @@ xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 		pipeline_setup_new_zone(set, tp, zone);
 		return;
 	}
-	/* check for a pipeline to the same master with unused ID */
-	if((tp = pipeline_find(set, zone))!= NULL) {
-		int i;
-		if(zone->zone_handler.ev_fd != -1)
-			xfrd_udp_release(zone);
-		for(i=0; i<XFRD_MAX_TCP; i++) {
-			if(set->tcp_state[i] == tp)
-				zone->tcp_conn = i;
-		}
-		xfrd_deactivate_zone(zone);
-		xfrd_unset_timer(zone);
-		pipeline_setup_new_zone(set, tp, zone);
-		return;
-	}
 
 	/* wait, at end of line */
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfrd: max number of tcp "
@@ -484,6 +543,14 @@ xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 	}
 	xfrd_deactivate_zone(zone);
 	xfrd_unset_timer(zone);
+
+	/* close an idle connection to another master, the waiting zone
+	 * gets its slot */
+	if((tp = tcp_pipe_find_idle(set)) != NULL) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: close idle tcp pipe "
+			"for a waiting zone"));
+		xfrd_tcp_pipe_release(set, tp, tcp_pipe_conn(set, tp));
+	}
 }
 
 int
@@ -511,6 +578,7 @@ xfrd_tcp_open(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 	tp->tcp_w->total_bytes = 0;
 	tp->tcp_w->msglen = 0;
 	tp->connection_established = 0;
+	tp->num_query = 0;
 
 	if(zone->master->is_ipv6) {
 #ifdef INET6
@@ -572,6 +640,7 @@ xfrd_tcp_open(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 	}
 	tp->tcp_r->fd = fd;
 	tp->tcp_w->fd = fd;
+	set->num_connect++;
 
 	/* set the tcp pipe event */
 	if(tp->handler_added)
@@ -967,7 +1036,7 @@ xfrd_tcp_release(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 			assert(zone->tcp_conn == -1);
 			zone->tcp_conn = conn;
 			tcp_zone_waiting_list_popfirst(set, zone);
-			if(zone->zone_handler.ev_fd != -1)
+			if(zone->udp_query)
 				xfrd_udp_release(zone);
 			xfrd_unset_timer(zone);
 			pipeline_setup_new_zone(set, tp, zone);
@@ -976,9 +1045,19 @@ xfrd_tcp_release(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 		/* waiting zone did not go to same server */
 	}
 
-	/* if all unused, or only skipped leftover, close the pipeline */
-	if(tp->num_unused >= ID_PIPE_NUM || tp->num_skip >= ID_PIPE_NUM - tp->num_unused)
+	/* if all unused, or only skipped leftover, the pipeline is idle */
+	if(tcp_pipe_is_idle(tp)) {
+		/* keep it open for the next transfer to this master, unless
+		 * a zone waits for the slot */
+		if(set->tcp_idle_timeout > 0 && !set->tcp_waiting_first &&
+			tp->connection_established) {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: tcp pipe to %s "
+				"idle", zone->master->ip_address_spec));
+			tcp_pipe_reset_timeout(tp);
+			return;
+		}
 		xfrd_tcp_pipe_release(set, tp, conn);
+	}
 }
 
 void
@@ -1014,7 +1093,7 @@ xfrd_tcp_pipe_release(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 		tcp_zone_waiting_list_popfirst(set, zone);
 
 		/* stop udp (if any) */
-		if(zone->zone_handler.ev_fd != -1)
+		if(zone->udp_query)
 			xfrd_udp_release(zone);
 		if(!xfrd_tcp_open(set, tp, zone)) {
 			zone->tcp_conn = -1;
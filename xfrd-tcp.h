@@ -33,10 +33,18 @@ struct xfrd_tcp_set {
 	int tcp_count;
 	/* TCP timeout. */
 	int tcp_timeout;
+	/* seconds an idle connection stays open for reuse, 0 closes it */
+	int tcp_idle_timeout;
 	/* rbtree with pipelines sorted by master */
 	rbtree_type* pipetree;
 	/* double linked list of zones waiting for a TCP connection */
 	struct xfrd_zone *tcp_waiting_first, *tcp_waiting_last;
+	/* number of connections opened, the tcp handshakes */
+	uint64_t num_connect;
+	/* number of transfers started, and of those, the number started
+	 * on a connection that was used before */
+	uint64_t num_query;
+	uint64_t num_reuse;
 };
 
 /*
@@ -68,6 +76,9 @@ struct xfrd_tcp {
 #define TCP_NULL_SKIP ((struct xfrd_zone*)-1)
 /* the number of ID values (16 bits) for a pipeline */
 #define ID_PIPE_NUM 65536
+/* number of active transfers on a connection, before the next transfer to
+ * that master opens another connection (if the max is not reached) */
+#define XFRD_TCP_PIPELINE_DEPTH 16
 
 /**
  * Structure to keep track of a pipelined set of queries on
@@ -88,7 +99,7 @@ struct xfrd_tcp_pipeline {
 	socklen_t ip_len;
 	/* number of unused IDs.  used IDs are waiting to send their query,
 	 * or have been sent but not not all answer packets have been received.
-	 * Sorted by num_unused, so a lookup smaller-equal for 65536 finds the
+	 * Sorted by num_unused, so a lookup smaller-equal for 65537 finds the
 	 * connection to that master that has the most free IDs. */
 	int num_unused;
 	/* number of skip-set IDs (these are 'in-use') */
@@ -105,6 +116,8 @@ struct xfrd_tcp_pipeline {
 	struct xfrd_tcp* tcp_w;
 	/* once a byte has been written, handshake complete */
 	int connection_established;
+	/* number of transfers started on this connection */
+	uint64_t num_query;
 
 	/* list of queries that want to send, first to get write event,
 	 * if NULL, no write event interest */
@@ -133,6 +146,8 @@ struct xfrd_tcp* xfrd_tcp_create(struct region* region, size_t bufsize);
 void xfrd_tcp_obtain(struct xfrd_tcp_set* set, struct xfrd_zone* zone);
 /* release tcp connection for a zone (starts waiting) */
 void xfrd_tcp_release(struct xfrd_tcp_set* set, struct xfrd_zone* zone);
+/* number of open connections that have no active transfers */
+int xfrd_tcp_num_idle(struct xfrd_tcp_set* set);
 /* release tcp pipe entirely (does not stop the zones inside it) */
 void xfrd_tcp_pipe_release(struct xfrd_tcp_set* set,
 	struct xfrd_tcp_pipeline* tp, int conn);
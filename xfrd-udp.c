@@ -0,0 +1,781 @@
+/*
+ * xfrd-udp.c - XFR (transfer) Daemon UDP system source file. Manages the
+ * shared udp sockets for SOA and IXFR queries to masters, and NOTIFY to
+ * slaves.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "nsd.h"
+#include "xfrd-udp.h"
+#include "xfrd-tcp.h"
+#include "xfrd-notify.h"
+#include "buffer.h"
+#include "packet.h"
+#include "dname.h"
+#include "options.h"
+#include "xfrd.h"
+#include "util.h"
+
+#ifndef HAVE_MMSGHDR
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int  msg_len;
+};
+#endif
+
+/*
+ * A shared udp socket. It is bound to the outgoing interface and carries
+ * the queries of all zones for masters and slaves of that address family.
+ */
+struct xfrd_udp_sock {
+	/* rbtree node, key is this structure */
+	rbnode_type node;
+	/* address family of the socket */
+	int family;
+	/* the outgoing interface list it is bound with, "" for none */
+	char* ifc;
+	int fd;
+	struct event event;
+	int event_flags;
+	int event_added;
+	/* if in the socks tree, it takes new queries */
+	int in_tree;
+	/* number of outstanding queries on the socket */
+	size_t num_use;
+	/* number of queries sent on the socket */
+	size_t num_sent;
+	/* queries waiting to be sent */
+	struct xfrd_udp_query *send_first, *send_last;
+	/* in the flush list of the set */
+	int in_flush;
+	struct xfrd_udp_sock* flush_next;
+};
+
+static void xfrd_udp_handle_sock(int fd, short event, void* arg);
+static void xfrd_udp_handle_pace(int fd, short event, void* arg);
+
+/* Implement recvmmsg and sendmmsg if the platform does not, like in
+ * server.c. The sockets are nonblocking. */
+#if defined(HAVE_RECVMMSG)
+#define nsd_recvmmsg recvmmsg
+#else /* !HAVE_RECVMMSG */
+
+static int
+nsd_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+             int flags, struct timespec *timeout)
+{
+	unsigned int vpos = 0;
+	ssize_t rcvd;
+
+	/* timeout is ignored, ensure caller does not expect it to work */
+	assert(timeout == NULL); (void)timeout;
+
+	while(vpos < vlen) {
+		rcvd = recvfrom(sockfd,
+		                msgvec[vpos].msg_hdr.msg_iov->iov_base,
+		                msgvec[vpos].msg_hdr.msg_iov->iov_len,
+		                flags,
+		                msgvec[vpos].msg_hdr.msg_name,
+		               &msgvec[vpos].msg_hdr.msg_namelen);
+		if(rcvd < 0) {
+			break;
+		} else {
+			assert((unsigned long long)rcvd <= (unsigned long long)UINT_MAX);
+			msgvec[vpos].msg_len = (unsigned int)rcvd;
+			vpos++;
+		}
+	}
+
+	if(vpos) {
+		/* error will be picked up next time */
+		return (int)vpos;
+	} else if(errno == 0) {
+		return 0;
+	} else if(errno == EAGAIN) {
+		return 0;
+	}
+
+	return -1;
+}
+#endif /* HAVE_RECVMMSG */
+
+#ifdef HAVE_SENDMMSG
+#define nsd_sendmmsg(...) sendmmsg(__VA_ARGS__)
+#else /* !HAVE_SENDMMSG */
+
+static int
+nsd_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	unsigned int vpos = 0;
+	ssize_t snd;
+
+	while(vpos < vlen) {
+		assert(msgvec[vpos].msg_hdr.msg_iovlen == 1);
+		snd = sendto(sockfd,
+		             msgvec[vpos].msg_hdr.msg_iov->iov_base,
+		             msgvec[vpos].msg_hdr.msg_iov->iov_len,
+		             flags,
+		             msgvec[vpos].msg_hdr.msg_name,
+		             msgvec[vpos].msg_hdr.msg_namelen);
+		if(snd < 0) {
+			break;
+		} else {
+			msgvec[vpos].msg_len = (unsigned int)snd;
+			vpos++;
+		}
+	}
+
+	if(vpos) {
+		return (int)vpos;
+	} else if(errno == 0) {
+		return 0;
+	}
+
+	return -1;
+}
+#endif /* HAVE_SENDMMSG */
+
+/* compare the family, port and address of two socket addresses */
+static int
+xfrd_udp_addr_cmp(const struct sockaddr* a, socklen_t alen,
+	const struct sockaddr* b, socklen_t blen)
+{
+	if(a->sa_family != b->sa_family)
+		return a->sa_family < b->sa_family ? -1 : 1;
+#ifdef INET6
+	if(a->sa_family == AF_INET6) {
+		const struct sockaddr_in6* a6 = (const struct sockaddr_in6*)a;
+		const struct sockaddr_in6* b6 = (const struct sockaddr_in6*)b;
+		if(alen < sizeof(*a6) || blen < sizeof(*b6))
+			return (int)alen - (int)blen;
+		if(a6->sin6_port != b6->sin6_port)
+			return a6->sin6_port < b6->sin6_port ? -1 : 1;
+		return memcmp(&a6->sin6_addr, &b6->sin6_addr,
+			sizeof(a6->sin6_addr));
+	}
+#endif /* INET6 */
+	if(a->sa_family == AF_INET) {
+		const struct sockaddr_in* a4 = (const struct sockaddr_in*)a;
+		const struct sockaddr_in* b4 = (const struct sockaddr_in*)b;
+		if(alen < sizeof(*a4) || blen < sizeof(*b4))
+			return (int)alen - (int)blen;
+		if(a4->sin_port != b4->sin_port)
+			return a4->sin_port < b4->sin_port ? -1 : 1;
+		return memcmp(&a4->sin_addr, &b4->sin_addr,
+			sizeof(a4->sin_addr));
+	}
+	if(alen != blen)
+		return (int)alen - (int)blen;
+	return memcmp(a, b, alen);
+}
+
+/* sort sockets on address family and outgoing interface */
+static int
+xfrd_udp_sock_cmp(const void* a, const void* b)
+{
+	const struct xfrd_udp_sock* x = (const struct xfrd_udp_sock*)a;
+	const struct xfrd_udp_sock* y = (const struct xfrd_udp_sock*)b;
+	if(x->family != y->family)
+		return x->family < y->family ? -1 : 1;
+	return strcmp(x->ifc, y->ifc);
+}
+
+/* sort queries on ID, master and qname */
+static int
+xfrd_udp_query_cmp(const void* a, const void* b)
+{
+	const struct xfrd_udp_query* x = (const struct xfrd_udp_query*)a;
+	const struct xfrd_udp_query* y = (const struct xfrd_udp_query*)b;
+	int r;
+	if(x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	if((r = xfrd_udp_addr_cmp((const struct sockaddr*)&x->to, x->to_len,
+		(const struct sockaddr*)&y->to, y->to_len)) != 0)
+		return r;
+	return dname_compare(x->qname, y->qname);
+}
+
+/* sort master counters on address */
+static int
+xfrd_udp_master_cmp(const void* a, const void* b)
+{
+	const struct xfrd_udp_master* x = (const struct xfrd_udp_master*)a;
+	const struct xfrd_udp_master* y = (const struct xfrd_udp_master*)b;
+	return xfrd_udp_addr_cmp((const struct sockaddr*)&x->to, x->to_len,
+		(const struct sockaddr*)&y->to, y->to_len);
+}
+
+struct xfrd_udp_set*
+xfrd_udp_set_create(struct region* region, size_t window, size_t rate,
+	size_t notify_rate)
+{
+	int i;
+	struct xfrd_udp_set* set = region_alloc_zero(region, sizeof(*set));
+	set->region = region;
+	set->socks = rbtree_create(region, &xfrd_udp_sock_cmp);
+	set->queries = rbtree_create(region, &xfrd_udp_query_cmp);
+	set->masters = rbtree_create(region, &xfrd_udp_master_cmp);
+	set->window = window;
+	set->rate = rate;
+	set->notify_rate = notify_rate;
+	set->recv_msgs = region_alloc_array_zero(region, XFRD_UDP_RECV_BATCH,
+		sizeof(*set->recv_msgs));
+	set->recv_iovecs = region_alloc_array_zero(region,
+		XFRD_UDP_RECV_BATCH, sizeof(*set->recv_iovecs));
+	set->recv_addrs = region_alloc_array_zero(region, XFRD_UDP_RECV_BATCH,
+		sizeof(*set->recv_addrs));
+	for(i=0; i<XFRD_UDP_RECV_BATCH; i++) {
+		set->recv_iovecs[i].iov_base = region_alloc(region, QIOBUFSZ);
+		set->recv_iovecs[i].iov_len = QIOBUFSZ;
+		set->recv_msgs[i].msg_hdr.msg_iov = &set->recv_iovecs[i];
+		set->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+		set->recv_msgs[i].msg_hdr.msg_name = &set->recv_addrs[i];
+	}
+	set->temp_region = region_create(xalloc, free);
+	return set;
+}
+
+/* create a new socket for the family and outgoing interface */
+static struct xfrd_udp_sock*
+xfrd_udp_sock_create(struct xfrd_udp_set* set, struct acl_options* master,
+	struct acl_options* ifc, const char* ifcstr)
+{
+	struct xfrd_udp_sock* sock;
+	int fd, family;
+	if(master->is_ipv6) {
+#ifdef INET6
+		family = PF_INET6;
+#else
+		return NULL;
+#endif /* INET6 */
+	} else {
+		family = PF_INET;
+	}
+	fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "xfrd: cannot create udp socket to %s: %s",
+			master->ip_address_spec, strerror(errno));
+		return NULL;
+	}
+	if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "xfrd: fcntl udp socket: %s",
+			strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	/* bind it */
+	if(!xfrd_bind_local_interface(fd, ifc, master, 0)) {
+		log_msg(LOG_ERR, "xfrd: cannot bind outgoing interface '%s' to "
+				 "udp socket: No matching ip addresses found",
+			ifc->ip_address_spec);
+		close(fd);
+		return NULL;
+	}
+	sock = region_alloc_zero(set->region, sizeof(*sock));
+	sock->node.key = sock;
+	sock->family = family;
+	sock->ifc = region_strdup(set->region, ifcstr);
+	sock->fd = fd;
+	sock->event_flags = EV_PERSIST|EV_READ;
+	event_set(&sock->event, fd, sock->event_flags, xfrd_udp_handle_sock,
+		sock);
+	if(event_base_set(xfrd->event_base, &sock->event) != 0)
+		log_msg(LOG_ERR, "xfrd udp: event_base_set failed");
+	if(event_add(&sock->event, NULL) != 0)
+		log_msg(LOG_ERR, "xfrd udp: event_add failed");
+	sock->event_added = 1;
+	sock->in_tree = 1;
+	(void)rbtree_insert(set->socks, &sock->node);
+	return sock;
+}
+
+/* close the socket and free it */
+static void
+xfrd_udp_sock_delete(struct xfrd_udp_set* set, struct xfrd_udp_sock* sock)
+{
+	assert(sock->num_use == 0 && sock->send_first == NULL);
+	if(sock->in_flush) {
+		struct xfrd_udp_sock** p = &set->flush_first;
+		while(*p != sock)
+			p = &(*p)->flush_next;
+		*p = sock->flush_next;
+		sock->in_flush = 0;
+	}
+	if(sock->in_tree)
+		(void)rbtree_delete(set->socks, sock);
+	if(sock->event_added)
+		event_del(&sock->event);
+	close(sock->fd);
+	region_recycle(set->region, sock->ifc, strlen(sock->ifc)+1);
+	region_recycle(set->region, sock, sizeof(*sock));
+}
+
+void
+xfrd_udp_set_close(struct xfrd_udp_set* set)
+{
+	struct xfrd_udp_sock* sock;
+	RBTREE_FOR(sock, struct xfrd_udp_sock*, set->socks) {
+		if(sock->event_added) {
+			event_del(&sock->event);
+			sock->event_added = 0;
+		}
+		close(sock->fd);
+	}
+	if(set->pace_added) {
+		event_del(&set->pace_timer);
+		set->pace_added = 0;
+	}
+}
+
+/* set the events the socket waits for */
+static void
+xfrd_udp_sock_set_event(struct xfrd_udp_sock* sock, int flags)
+{
+	if(sock->event_flags == flags)
+		return;
+	if(sock->event_added)
+		event_del(&sock->event);
+	memset(&sock->event, 0, sizeof(sock->event));
+	event_set(&sock->event, sock->fd, flags, xfrd_udp_handle_sock, sock);
+	if(event_base_set(xfrd->event_base, &sock->event) != 0)
+		log_msg(LOG_ERR, "xfrd udp: event_base_set failed");
+	if(event_add(&sock->event, NULL) != 0)
+		log_msg(LOG_ERR, "xfrd udp: event_add failed");
+	sock->event_flags = flags;
+	sock->event_added = 1;
+}
+
+/* find the socket for the master and outgoing interface, or open it */
+static struct xfrd_udp_sock*
+xfrd_udp_sock_obtain(struct xfrd_udp_set* set, struct acl_options* master,
+	struct acl_options* ifc)
+{
+	struct xfrd_udp_sock key, *sock;
+	struct acl_options* p;
+	/* the socket is bound to the first usable address in the
+	 * outgoing-interface list, the list identifies the socket */
+	memset(&key, 0, sizeof(key));
+#ifdef INET6
+	key.family = master->is_ipv6?PF_INET6:PF_INET;
+#else
+	key.family = PF_INET;
+#endif
+	key.ifc = "";
+	for(p = ifc; p; p = p->next) {
+		if(p->is_ipv6 == master->is_ipv6) {
+			key.ifc = (char*)p->ip_address_spec;
+			break;
+		}
+	}
+	key.node.key = &key;
+	sock = (struct xfrd_udp_sock*)rbtree_search(set->socks, &key);
+	if(sock)
+		return sock;
+	return xfrd_udp_sock_create(set, master, ifc, key.ifc);
+}
+
+struct xfrd_udp_master*
+xfrd_udp_master_obtain(struct xfrd_udp_set* set, struct acl_options* master)
+{
+	struct xfrd_udp_master key, *m;
+	key.node.key = &key;
+	key.to_len = xfrd_acl_sockaddr_to(master, &key.to);
+	m = (struct xfrd_udp_master*)rbtree_search(set->masters, &key);
+	if(m)
+		return m;
+	m = region_alloc_zero(set->region, sizeof(*m));
+	m->node.key = m;
+	memcpy(&m->to, &key.to, key.to_len);
+	m->to_len = key.to_len;
+	(void)rbtree_insert(set->masters, &m->node);
+	return m;
+}
+
+/* see if the number of queries to the address this second is below rate */
+static int
+xfrd_udp_rate_allowed(struct xfrd_udp_set* set, struct acl_options* dest,
+	size_t rate)
+{
+	struct xfrd_udp_master* m;
+	if(rate == 0)
+		return 1;
+	m = xfrd_udp_master_obtain(set, dest);
+	if(m->sec != xfrd_time()) {
+		m->sec = xfrd_time();
+		m->count = 0;
+	}
+	return m->count < rate;
+}
+
+int
+xfrd_udp_notify_allowed(struct xfrd_udp_set* set, struct acl_options* dest)
+{
+	return xfrd_udp_rate_allowed(set, dest, set->notify_rate);
+}
+
+int
+xfrd_udp_master_allowed(struct xfrd_udp_set* set, struct acl_options* master)
+{
+	if(xfrd_udp_rate_allowed(set, master, set->rate))
+		return 1;
+	/* try again in the next second */
+	if(!set->pace_added) {
+		struct timeval tv;
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		memset(&set->pace_timer, 0, sizeof(set->pace_timer));
+		event_set(&set->pace_timer, -1, EV_TIMEOUT,
+			xfrd_udp_handle_pace, set);
+		if(event_base_set(xfrd->event_base, &set->pace_timer) != 0)
+			log_msg(LOG_ERR, "xfrd udp pace: event_base_set failed");
+		if(event_add(&set->pace_timer, &tv) != 0)
+			log_msg(LOG_ERR, "xfrd udp pace: event_add failed");
+		set->pace_added = 1;
+	}
+	return 0;
+}
+
+/* add a query to the send list of a socket, returns NULL on failure */
+static struct xfrd_udp_query*
+xfrd_udp_add(struct xfrd_udp_set* set, struct acl_options* dest,
+	struct acl_options* ifc, const struct dname* qname,
+	struct buffer* packet)
+{
+	struct xfrd_udp_sock* sock;
+	struct xfrd_udp_query* q;
+	sock = xfrd_udp_sock_obtain(set, dest, ifc);
+	if(!sock)
+		return NULL;
+	q = region_alloc_zero(set->region, sizeof(*q));
+	q->node.key = q;
+	q->sock = sock;
+	q->id = ID(packet);
+	q->qname = qname;
+	q->to_len = xfrd_acl_sockaddr_to(dest, &q->to);
+	q->pkt_len = buffer_remaining(packet);
+	q->pkt = region_alloc_init(set->region, buffer_current(packet),
+		q->pkt_len);
+	if(!rbtree_insert(set->queries, &q->node)) {
+		log_msg(LOG_ERR, "xfrd: duplicate udp query ID to %s",
+			dest->ip_address_spec);
+		region_recycle(set->region, q->pkt, q->pkt_len);
+		region_recycle(set->region, q, sizeof(*q));
+		if(sock->num_use == 0)
+			xfrd_udp_sock_delete(set, sock);
+		return NULL;
+	}
+	sock->num_use++;
+
+	/* append to the send list of the socket */
+	if(sock->send_last)
+		sock->send_last->send_next = q;
+	else	sock->send_first = q;
+	sock->send_last = q;
+	if(!sock->in_flush) {
+		sock->flush_next = set->flush_first;
+		set->flush_first = sock;
+		sock->in_flush = 1;
+	}
+	/* new queries use a new socket, with a different source port,
+	 * after this number of queries */
+	if(++sock->num_sent >= XFRD_UDP_SOCK_ROTATE && sock->in_tree) {
+		(void)rbtree_delete(set->socks, sock);
+		sock->in_tree = 0;
+	}
+	return q;
+}
+
+/* remove a query from the set */
+static void
+xfrd_udp_delete(struct xfrd_udp_set* set, struct xfrd_udp_query* q)
+{
+	struct xfrd_udp_sock* sock = q->sock;
+	if(q->pkt) {
+		/* not sent yet, take it off the send list */
+		struct xfrd_udp_query* prev = NULL, *p;
+		for(p = sock->send_first; p && p != q; p = p->send_next)
+			prev = p;
+		assert(p == q);
+		if(prev)
+			prev->send_next = q->send_next;
+		else	sock->send_first = q->send_next;
+		if(sock->send_last == q)
+			sock->send_last = prev;
+		region_recycle(set->region, q->pkt, q->pkt_len);
+	}
+	(void)rbtree_delete(set->queries, q);
+	region_recycle(set->region, q, sizeof(*q));
+	assert(sock->num_use > 0);
+	sock->num_use--;
+	/* close idle sockets, the next query gets a new source port */
+	if(sock->num_use == 0)
+		xfrd_udp_sock_delete(set, sock);
+}
+
+int
+xfrd_udp_query_add(struct xfrd_udp_set* set, struct xfrd_zone* zone,
+	struct buffer* packet)
+{
+	struct xfrd_udp_query* q;
+	assert(zone->udp_query == NULL);
+	q = xfrd_udp_add(set, zone->master,
+		zone->zone_options->pattern->outgoing_interface, zone->apex,
+		packet);
+	if(!q)
+		return 0;
+	q->zone = zone;
+	zone->udp_query = q;
+	set->num_use++;
+	if(set->rate != 0)
+		xfrd_udp_master_obtain(set, zone->master)->count++;
+	return 1;
+}
+
+void
+xfrd_udp_query_remove(struct xfrd_udp_set* set, struct xfrd_zone* zone)
+{
+	struct xfrd_udp_query* q = zone->udp_query;
+	if(!q)
+		return;
+	zone->udp_query = NULL;
+	assert(set->num_use > 0);
+	set->num_use--;
+	xfrd_udp_delete(set, q);
+}
+
+struct xfrd_udp_query*
+xfrd_udp_notify_add(struct xfrd_udp_set* set, struct notify_zone* zone,
+	int index, struct acl_options* dest, struct buffer* packet)
+{
+	struct xfrd_udp_query* q = xfrd_udp_add(set, dest,
+		zone->options->pattern->outgoing_interface, zone->apex,
+		packet);
+	if(!q)
+		return NULL;
+	q->notify = zone;
+	q->notify_index = index;
+	set->num_notify++;
+	if(set->notify_rate != 0)
+		xfrd_udp_master_obtain(set, dest)->count++;
+	return q;
+}
+
+void
+xfrd_udp_notify_remove(struct xfrd_udp_set* set, struct xfrd_udp_query* q)
+{
+	assert(q->notify && set->num_notify > 0);
+	set->num_notify--;
+	xfrd_udp_delete(set, q);
+}
+
+/* a query could not be sent, the zone or notify continues with a retry.
+ * The query and perhaps the socket are deleted. */
+static void
+xfrd_udp_send_failed(struct xfrd_udp_query* q)
+{
+	if(q->notify) {
+		log_msg(LOG_ERR, "xfrd notify: sendto %s failed %s",
+			q->notify->pkts[q->notify_index].dest->ip_address_spec,
+			strerror(errno));
+		xfrd_notify_udp_failed(q->notify, q->notify_index);
+	} else {
+		log_msg(LOG_ERR, "xfrd: sendto %s failed %s",
+			q->zone->master->ip_address_spec, strerror(errno));
+		xfrd_udp_release(q->zone);
+	}
+}
+
+/* send the queries waiting on the socket, if the socket blocks it is set
+ * to wait until it is writable */
+static void
+xfrd_udp_sock_flush(struct xfrd_udp_set* set, struct xfrd_udp_sock* sock)
+{
+	struct mmsghdr msgs[XFRD_UDP_SEND_BATCH];
+	struct iovec iovecs[XFRD_UDP_SEND_BATCH];
+	struct xfrd_udp_query* q;
+	int i, num, sent;
+
+	while(sock->send_first) {
+		memset(msgs, 0, sizeof(msgs));
+		num = 0;
+		for(q = sock->send_first; q && num < XFRD_UDP_SEND_BATCH;
+			q = q->send_next) {
+			iovecs[num].iov_base = q->pkt;
+			iovecs[num].iov_len = q->pkt_len;
+			msgs[num].msg_hdr.msg_iov = &iovecs[num];
+			msgs[num].msg_hdr.msg_iovlen = 1;
+			msgs[num].msg_hdr.msg_name = &q->to;
+			msgs[num].msg_hdr.msg_namelen = q->to_len;
+			num++;
+		}
+		sent = nsd_sendmmsg(sock->fd, msgs, num, 0);
+		if(sent == -1) {
+			if(errno == EAGAIN
+#ifdef EWOULDBLOCK
+				|| errno == EWOULDBLOCK
+#endif
+				) {
+				/* continue when the socket is writable */
+				xfrd_udp_sock_set_event(sock,
+					EV_PERSIST|EV_READ|EV_WRITE);
+				return;
+			}
+			/* the first query fails, the zone times out and
+			 * continues with the next master, a notify retries */
+			if(sock->num_use == 1) {
+				/* the socket is deleted by the release */
+				xfrd_udp_send_failed(sock->send_first);
+				return;
+			}
+			xfrd_udp_send_failed(sock->send_first);
+			continue;
+		}
+		for(i=0; i<sent; i++) {
+			q = sock->send_first;
+			sock->send_first = q->send_next;
+			if(!sock->send_first)
+				sock->send_last = NULL;
+			q->send_next = NULL;
+			region_recycle(set->region, q->pkt, q->pkt_len);
+			q->pkt = NULL;
+			if(q->notify) {
+				DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: "
+					"sent notify to %s", q->notify->apex_str,
+					q->notify->pkts[q->notify_index].dest->
+					ip_address_spec));
+				continue;
+			}
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+				"xfrd sent udp request for ixfr=%u for zone "
+				"%s to %s", (unsigned)ntohl(
+				q->zone->soa_disk.serial), q->zone->apex_str,
+				q->zone->master->ip_address_spec));
+		}
+	}
+	xfrd_udp_sock_set_event(sock, EV_PERSIST|EV_READ);
+}
+
+void
+xfrd_udp_flush(struct xfrd_udp_set* set)
+{
+	struct xfrd_udp_sock* sock;
+	/* the release of failed queries can start other zones, those are
+	 * added to the flush list as well */
+	while((sock = set->flush_first) != NULL) {
+		set->flush_first = sock->flush_next;
+		sock->flush_next = NULL;
+		sock->in_flush = 0;
+		xfrd_udp_sock_flush(set, sock);
+	}
+}
+
+/* find the query for a received packet and give it to the zone */
+static void
+xfrd_udp_handle_reply(struct xfrd_udp_set* set, struct mmsghdr* msg)
+{
+	struct xfrd_udp_query key, *q;
+	buffer_type* packet = xfrd->packet;
+
+	buffer_clear(packet);
+	buffer_write(packet, msg->msg_hdr.msg_iov->iov_base, msg->msg_len);
+	buffer_flip(packet);
+	if(buffer_limit(packet) < QHEADERSZ || QDCOUNT(packet) != 1) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: udp reply without "
+			"question, dropped"));
+		return;
+	}
+	memset(&key, 0, sizeof(key));
+	key.node.key = &key;
+	key.id = ID(packet);
+	key.to_len = msg->msg_hdr.msg_namelen;
+	if(key.to_len > sizeof(key.to))
+		return;
+	memcpy(&key.to, msg->msg_hdr.msg_name, key.to_len);
+	buffer_skip(packet, QHEADERSZ);
+	key.qname = dname_make_from_packet(set->temp_region, packet, 1, 1);
+	if(!key.qname) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: udp reply with bad "
+			"qname, dropped"));
+		region_free_all(set->temp_region);
+		return;
+	}
+	q = (struct xfrd_udp_query*)rbtree_search(set->queries, &key);
+	region_free_all(set->temp_region);
+	if(!q || q->pkt) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: udp reply does not "
+			"match an outstanding query, dropped"));
+		return;
+	}
+	buffer_set_position(packet, 0);
+	if(q->notify)
+		xfrd_notify_udp_read(q->notify, q->notify_index, packet);
+	else	xfrd_udp_read(q->zone, packet);
+}
+
+/* read the replies on the socket */
+static void
+xfrd_udp_sock_read(struct xfrd_udp_set* set, int fd)
+{
+	int i, received;
+	for(i=0; i<XFRD_UDP_RECV_BATCH; i++) {
+		set->recv_iovecs[i].iov_len = QIOBUFSZ;
+		set->recv_msgs[i].msg_hdr.msg_namelen =
+			sizeof(set->recv_addrs[i]);
+		set->recv_msgs[i].msg_hdr.msg_flags = 0;
+	}
+	received = nsd_recvmmsg(fd, set->recv_msgs, XFRD_UDP_RECV_BATCH, 0,
+		NULL);
+	if(received == -1) {
+		if(errno != EAGAIN && errno != EINTR
+#ifdef EWOULDBLOCK
+			&& errno != EWOULDBLOCK
+#endif
+			)
+			log_msg(LOG_ERR, "xfrd: recvmmsg failed: %s",
+				strerror(errno));
+		return;
+	}
+	/* the socket can be closed by the handling of a reply, the
+	 * received packets are in the buffers of the set */
+	for(i=0; i<received; i++)
+		xfrd_udp_handle_reply(set, &set->recv_msgs[i]);
+}
+
+static void
+xfrd_udp_handle_sock(int fd, short event, void* arg)
+{
+	struct xfrd_udp_sock* sock = (struct xfrd_udp_sock*)arg;
+	struct xfrd_udp_set* set = xfrd->udp_set;
+	if((event & EV_WRITE) && !sock->in_flush) {
+		/* writable again, the sends continue in xfrd_udp_flush,
+		 * before xfrd waits for events again */
+		sock->flush_next = set->flush_first;
+		set->flush_first = sock;
+		sock->in_flush = 1;
+	}
+	if((event & EV_READ))
+		xfrd_udp_sock_read(set, fd);
+}
+
+static void
+xfrd_udp_handle_pace(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct xfrd_udp_set* set = (struct xfrd_udp_set*)arg;
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	set->pace_added = 0;
+	xfrd_udp_start_waiting();
+}
@@ -0,0 +1,171 @@
+/*
+ * xfrd-udp.h - XFR (transfer) Daemon UDP system header file. Manages the
+ * shared udp sockets for SOA and IXFR queries to masters, and NOTIFY to
+ * slaves.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef XFRD_UDP_H
+#define XFRD_UDP_H
+
+#include "xfrd.h"
+
+struct buffer;
+struct region;
+struct acl_options;
+struct xfrd_zone;
+struct xfrd_udp_sock;
+struct notify_zone;
+
+/* max number of packets per sendmmsg call */
+#define XFRD_UDP_SEND_BATCH 64
+/* max number of packets per recvmmsg call */
+#define XFRD_UDP_RECV_BATCH 16
+/* number of queries sent on a socket before it is replaced by a new one,
+ * so that the source port changes regularly */
+#define XFRD_UDP_SOCK_ROTATE 256
+
+/*
+ * Per master or slave send counter, for pacing, and the zones that wait
+ * to query the master.
+ */
+struct xfrd_udp_master {
+	/* rbtree node, key is this structure */
+	rbnode_type node;
+#ifdef INET6
+	struct sockaddr_storage to;
+#else
+	struct sockaddr_in to;
+#endif /* INET6 */
+	socklen_t to_len;
+	/* the second that is counted, and the queries sent in it */
+	time_t sec;
+	size_t count;
+	/* zones that wait for a slot in the window or for the pacing,
+	 * double linked list */
+	struct xfrd_zone *wait_first, *wait_last;
+	/* in the list of masters with waiting zones, double linked list */
+	int in_wait;
+	struct xfrd_udp_master *wait_next, *wait_prev;
+};
+
+/*
+ * A set of shared xfrd udp sockets, one per address family and outgoing
+ * interface. Outstanding queries are found by (ID, master, qname).
+ */
+struct xfrd_udp_set {
+	struct region* region;
+	/* rbtree with open sockets, by family and interface, that take
+	 * new queries. Contains struct xfrd_udp_sock* */
+	rbtree_type* socks;
+	/* rbtree with outstanding queries, contains struct xfrd_udp_query* */
+	rbtree_type* queries;
+	/* rbtree with per master send counters, for pacing */
+	rbtree_type* masters;
+	/* number of outstanding SOA and IXFR queries */
+	size_t num_use;
+	/* max number of outstanding SOA and IXFR queries */
+	size_t window;
+	/* number of outstanding NOTIFY queries */
+	size_t num_notify;
+	/* max number of queries per second per master, 0 is no limit */
+	size_t rate;
+	/* max number of NOTIFY per second per slave, 0 is no limit */
+	size_t notify_rate;
+	/* sockets with queries waiting to be sent */
+	struct xfrd_udp_sock* flush_first;
+	/* timer to start waiting zones that are paced */
+	struct event pace_timer;
+	int pace_added;
+	/* receive buffers and headers for recvmmsg */
+	struct mmsghdr* recv_msgs;
+	struct iovec* recv_iovecs;
+#ifdef INET6
+	struct sockaddr_storage* recv_addrs;
+#else
+	struct sockaddr_in* recv_addrs;
+#endif /* INET6 */
+	/* scratch region for the qname of received packets */
+	struct region* temp_region;
+};
+
+/*
+ * An outstanding SOA or IXFR query of a zone over udp, or a NOTIFY.
+ */
+struct xfrd_udp_query {
+	/* rbtree node, key is this structure */
+	rbnode_type node;
+	/* the zone of the SOA or IXFR query, or NULL for a NOTIFY */
+	struct xfrd_zone* zone;
+	/* the zone and packet slot of the NOTIFY */
+	struct notify_zone* notify;
+	int notify_index;
+	/* the socket it is sent on */
+	struct xfrd_udp_sock* sock;
+	/* query ID */
+	uint16_t id;
+	/* the query name, the zone apex */
+	const struct dname* qname;
+	/* the master or slave address and port it is sent to */
+#ifdef INET6
+	struct sockaddr_storage to;
+#else
+	struct sockaddr_in to;
+#endif /* INET6 */
+	socklen_t to_len;
+	/* the packet, while waiting to be sent, NULL once sent */
+	uint8_t* pkt;
+	size_t pkt_len;
+	/* next in the send list of the socket */
+	struct xfrd_udp_query* send_next;
+};
+
+/* create the set of udp sockets */
+struct xfrd_udp_set* xfrd_udp_set_create(struct region* region,
+	size_t window, size_t rate, size_t notify_rate);
+/* close the sockets of the set */
+void xfrd_udp_set_close(struct xfrd_udp_set* set);
+
+/*
+ * Add the query in the packet (flipped) for the zone, to be sent to
+ * zone->master on the next xfrd_udp_flush. Sets zone->udp_query.
+ * Returns 0 on failure, if no socket can be opened.
+ */
+int xfrd_udp_query_add(struct xfrd_udp_set* set, struct xfrd_zone* zone,
+	struct buffer* packet);
+/* remove the outstanding query of the zone, sets zone->udp_query NULL */
+void xfrd_udp_query_remove(struct xfrd_udp_set* set, struct xfrd_zone* zone);
+
+/*
+ * Add the NOTIFY in the packet (flipped) for the packet slot of the zone,
+ * to be sent to the slave on the next xfrd_udp_flush. The reply is given
+ * to xfrd_notify_udp_read. Returns NULL on failure.
+ */
+struct xfrd_udp_query* xfrd_udp_notify_add(struct xfrd_udp_set* set,
+	struct notify_zone* zone, int index, struct acl_options* dest,
+	struct buffer* packet);
+/* remove an outstanding NOTIFY */
+void xfrd_udp_notify_remove(struct xfrd_udp_set* set,
+	struct xfrd_udp_query* q);
+
+/* send the added queries, in batches per socket */
+void xfrd_udp_flush(struct xfrd_udp_set* set);
+
+/* get the pacing counter and waiting list of a master */
+struct xfrd_udp_master* xfrd_udp_master_obtain(struct xfrd_udp_set* set,
+	struct acl_options* master);
+/*
+ * See if a query can be sent to the master this second, with the pacing
+ * rate. If not, the pace timer is set to start the waiting zones later.
+ */
+int xfrd_udp_master_allowed(struct xfrd_udp_set* set,
+	struct acl_options* master);
+/* see if a NOTIFY can be sent to the slave this second, with the rate */
+int xfrd_udp_notify_allowed(struct xfrd_udp_set* set,
+	struct acl_options* dest);
+
+#endif /* XFRD_UDP_H */
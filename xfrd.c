@@ -17,6 +17,7 @@
 #include <sys/wait.h>
 #include "xfrd.h"
 #include "xfrd-tcp.h"
+#include "xfrd-udp.h"
 #include "xfrd-disk.h"
 #include "xfrd-notify.h"
 #include "options.h"
@@ -74,21 +75,23 @@ static void xfrd_set_zone_state(xfrd_zone_type* zone,
 static void xfrd_set_timer_retry(xfrd_zone_type* zone);
 /* set timer for refresh timeout (depends on zone_state) */
 static void xfrd_set_timer_refresh(xfrd_zone_type* zone);
+/* handle the timer wheel event, runs the zone timers that expired */
+static void xfrd_handle_timer_wheel(int fd, short event, void* arg);
+/* spread the refresh of the activated zones at startup */
+static void xfrd_spread_activated(void);
 
-/* set reload timeout */
-static void xfrd_set_reload_timeout(void);
 /* handle reload timeout */
 static void xfrd_handle_reload(int fd, short event, void* arg);
 /* handle child timeout */
 static void xfrd_handle_child_timer(int fd, short event, void* arg);
 
-/* send ixfr request, returns fd of connection to read on */
+/* send ixfr request, returns 0 on failure */
 static int xfrd_send_ixfr_request_udp(xfrd_zone_type* zone);
 /* obtain udp socket slot */
 static void xfrd_udp_obtain(xfrd_zone_type* zone);
-
-/* read data via udp */
-static void xfrd_udp_read(xfrd_zone_type* zone);
+/* remove zone from the udp waiting list */
+static void xfrd_udp_waiting_add(xfrd_zone_type* zone);
+static void xfrd_udp_waiting_remove(xfrd_zone_type* zone);
 
 /* find master by notify number */
 static int find_same_master_notify(xfrd_zone_type* zone, int acl_num_nfy);
@@ -145,15 +148,31 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	}
 	xfrd->nsd = nsd;
 	xfrd->packet = buffer_create(xfrd->region, QIOBUFSZ);
+	xfrd->udp_set = xfrd_udp_set_create(xfrd->region,
+		(size_t)nsd->options->xfrd_udp_window,
+		(size_t)nsd->options->xfrd_udp_master_rate,
+		(size_t)nsd->options->xfrd_notify_rate);
 	xfrd->udp_waiting_first = NULL;
 	xfrd->udp_waiting_last = NULL;
-	xfrd->udp_use_num = 0;
 	xfrd->got_time = 0;
 	xfrd->xfrfilenumber = 0;
 #ifdef USE_ZONE_STATS
 	xfrd->zonestat_safe = nsd->zonestatdesired;
 #endif
 	xfrd->activated_first = NULL;
+	memset(xfrd->timer_wheel, 0, sizeof(xfrd->timer_wheel));
+	xfrd->timer_wheel_time = xfrd_time();
+	xfrd->timer_wheel_count = 0;
+	xfrd->timer_wheel_added = 0;
+	xfrd->timer_wheel_at = 0;
+	xfrd->state_fd = -1;
+	xfrd->state_size = 0;
+	xfrd->state_base_size = 0;
+	xfrd->state_buf = buffer_create(xfrd->region, XFRD_JOURNAL_BUFSIZE);
+	xfrd->state_dirty_first = NULL;
+	xfrd->state_timer_added = 0;
+	xfrd->state_need_sync = 0;
+	xfrd->state_last_sync = 0;
 	xfrd->ipc_pass = buffer_create(xfrd->region, QIOBUFSZ);
 	xfrd->last_task = region_alloc(xfrd->region, sizeof(*xfrd->last_task));
 	udb_ptr_init(xfrd->last_task, xfrd->nsd->task[xfrd->nsd->mytask]);
@@ -165,6 +184,22 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->reload_cmd_last_sent = xfrd->xfrd_start_time;
 	xfrd->can_send_reload = !reload_active;
 	xfrd->reload_pid = nsd_pid;
+	xfrd->reload_pending = 0;
+	xfrd->reload_running = 0;
+	memset(&xfrd->reload_sent_time, 0, sizeof(xfrd->reload_sent_time));
+	xfrd->reload_wait = nsd->options->xfrd_reload_timeout;
+	xfrd->reload_time_avg = 0;
+	xfrd->reload_num = 0;
+	xfrd->reload_updates = 0;
+	xfrd->reload_time_last = 0;
+	xfrd->reload_staleness_last = 0;
+	xfrd->reload_staleness_max = 0;
+	xfrd->reload_last_tasks = 0;
+	xfrd->reload_last_xfrs = 0;
+	xfrd->reload_last_process = 0;
+	xfrd->reload_last_sync = 0;
+	xfrd->reload_last_children = 0;
+	xfrd->reload_last_quit = 0;
 	xfrd->child_timer_added = 0;
 
 	xfrd->ipc_send_blocked = 0;
@@ -191,6 +226,12 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->notify_waiting_first = NULL;
 	xfrd->notify_waiting_last = NULL;
 	xfrd->notify_udp_num = 0;
+	xfrd->notify_waiting_num = 0;
+	xfrd->notify_sent = 0;
+	xfrd->notify_acked = 0;
+	xfrd->notify_failed = 0;
+	xfrd->notify_latency_sum = 0;
+	xfrd->notify_latency_max = 0;
 
 #ifdef HAVE_SSL
 	daemon_remote_attach(xfrd->nsd->rc, xfrd);
@@ -198,6 +239,7 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 
 	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region);
 	xfrd->tcp_set->tcp_timeout = nsd->tcp_timeout;
+	xfrd->tcp_set->tcp_idle_timeout = nsd->options->xfrd_tcp_idle_timeout;
 #if !defined(HAVE_ARC4RANDOM) && !defined(HAVE_GETRANDOM)
 	srandom((unsigned long) getpid() * (unsigned long) time(NULL));
 #endif
@@ -207,6 +249,7 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd_receive_soa(socket, shortsoa);
 	if(nsd->options->xfrdfile != NULL && nsd->options->xfrdfile[0]!=0)
 		xfrd_read_state(xfrd);
+	xfrd_spread_activated();
 	
 	/* did we get killed before startup was successful? */
 	if(nsd->signal_hint_shutdown) {
@@ -248,7 +291,7 @@ xfrd_process_activated(void)
 		zone->is_activated = 0;
 		/* run it : no events, specifically not the TIMEOUT event,
 		 * so that running zone transfers are not interrupted */
-		xfrd_handle_zone(zone->zone_handler.ev_fd, 0, zone);
+		xfrd_handle_zone(-1, 0, zone);
 	}
 }
 
@@ -314,6 +357,8 @@ xfrd_main(void)
 	{
 		/* process activated zones before blocking in select again */
 		xfrd_process_activated();
+		/* send the udp queries made by this round of events */
+		xfrd_udp_flush(xfrd->udp_set);
 		/* dispatch may block for a longer period, so current is gone */
 		xfrd->got_time = 0;
 		if(event_base_loop(xfrd->event_base, EVLOOP_ONCE) == -1) {
@@ -357,18 +402,12 @@ xfrd_shutdown()
 	daemon_remote_close(xfrd->nsd->rc); /* close sockets of rc */
 #endif
 	/* close sockets */
-	RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones)
-	{
-		if(zone->event_added) {
-			event_del(&zone->zone_handler);
-			if(zone->zone_handler.ev_fd != -1) {
-				close(zone->zone_handler.ev_fd);
-				zone->zone_handler.ev_fd = -1;
-			}
-			zone->event_added = 0;
-		}
+	if(xfrd->timer_wheel_added) {
+		event_del(&xfrd->timer_wheel_event);
+		xfrd->timer_wheel_added = 0;
 	}
 	close_notify_fds(xfrd->notify_zones);
+	xfrd_udp_set_close(xfrd->udp_set);
 
 	/* wait for server parent (if necessary) */
 	if(xfrd->reload_pid != -1) {
@@ -490,12 +529,16 @@ xfrd_init_slave_zone(xfrd_state_type* xfrd, struct zone_options* zone_opt)
 	xzone->soa_notified.prim_ns[0]=1;
 	xzone->soa_notified.email[0]=1;
 
-	xzone->zone_handler.ev_fd = -1;
-	xzone->zone_handler_flags = 0;
-	xzone->event_added = 0;
+	xzone->timeout = 0;
+	xzone->timer_expire = 0;
+	xzone->timer_set = 0;
+	xzone->timer_slot = 0;
+	xzone->timer_next = NULL;
+	xzone->timer_prev = NULL;
 
 	xzone->tcp_conn = -1;
 	xzone->tcp_waiting = 0;
+	xzone->udp_query = NULL;
 	xzone->udp_waiting = 0;
 	xzone->is_activated = 0;
 
@@ -717,25 +760,16 @@ xfrd_del_slave_zone(xfrd_state_type* xfrd, const dname_type* dname)
 		else xfrd->tcp_set->tcp_waiting_last = z->tcp_waiting_prev;
 		z->tcp_waiting = 0;
 	}
-	if(z->udp_waiting) {
-		/* delete from udp waiting list */
-		if(z->udp_waiting_prev)
-			z->udp_waiting_prev->udp_waiting_next =
-				z->udp_waiting_next;
-		else	xfrd->udp_waiting_first = z->udp_waiting_next;
-		if(z->udp_waiting_next)
-			z->udp_waiting_next->udp_waiting_prev =
-				z->udp_waiting_prev;
-		else	xfrd->udp_waiting_last = z->udp_waiting_prev;
-		z->udp_waiting = 0;
-	}
+	if(z->udp_waiting)
+		xfrd_udp_waiting_remove(z);
 	xfrd_deactivate_zone(z);
 	if(z->tcp_conn != -1) {
 		xfrd_tcp_release(xfrd->tcp_set, z);
-	} else if(z->zone_handler.ev_fd != -1 && z->event_added) {
+	} else if(z->udp_query) {
 		xfrd_udp_release(z);
-	} else if(z->event_added)
-		event_del(&z->zone_handler);
+	}
+	xfrd_unset_timer(z);
+	xfrd_state_remove(z);
 	if(z->msg_seq_nr)
 		xfrd_unlink_xfrfile(xfrd->nsd, z->xfrfilenumber);
 
@@ -845,17 +879,9 @@ xfrd_handle_zone(int ATTR_UNUSED(fd), short event, void* arg)
 		event = EV_TIMEOUT;
 	}
 
-	if((event & EV_READ)) {
-		/* busy in udp transaction */
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s event udp read", zone->apex_str));
-		xfrd_udp_read(zone);
-		return;
-	}
-
 	/* timeout */
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s timeout", zone->apex_str));
-	if(zone->zone_handler.ev_fd != -1 && zone->event_added &&
-		(event & EV_TIMEOUT)) {
+	if(zone->udp_query && (event & EV_TIMEOUT)) {
 		assert(zone->tcp_conn == -1);
 		xfrd_udp_release(zone);
 	}
@@ -892,7 +918,7 @@ xfrd_handle_zone(int ATTR_UNUSED(fd), short event, void* arg)
 	}
 
 	/* only make a new request if no request is running (UDPorTCP) */
-	if(zone->zone_handler.ev_fd == -1 && zone->tcp_conn == -1) {
+	if(!zone->udp_query && zone->tcp_conn == -1) {
 		/* make a new request */
 		xfrd_make_request(zone);
 	}
@@ -1014,38 +1040,16 @@ xfrd_udp_obtain(xfrd_zone_type* zone)
 		/* no tcp and udp at the same time */
 		xfrd_tcp_release(xfrd->tcp_set, zone);
 	}
-	if(xfrd->udp_use_num < XFRD_MAX_UDP) {
-		int fd;
-		xfrd->udp_use_num++;
-		fd = xfrd_send_ixfr_request_udp(zone);
-		if(fd == -1)
-			xfrd->udp_use_num--;
-		else {
-			if(zone->event_added)
-				event_del(&zone->zone_handler);
-			memset(&zone->zone_handler, 0,
-				sizeof(zone->zone_handler));
-			event_set(&zone->zone_handler, fd,
-				EV_PERSIST|EV_READ|EV_TIMEOUT,
-				xfrd_handle_zone, zone);
-			if(event_base_set(xfrd->event_base, &zone->zone_handler) != 0)
-				log_msg(LOG_ERR, "xfrd udp: event_base_set failed");
-			if(event_add(&zone->zone_handler, &zone->timeout) != 0)
-				log_msg(LOG_ERR, "xfrd udp: event_add failed");
-			zone->zone_handler_flags=EV_PERSIST|EV_READ|EV_TIMEOUT;
-			zone->event_added = 1;
-		}
+	if(xfrd->udp_set->num_use < xfrd->udp_set->window &&
+		xfrd_udp_master_allowed(xfrd->udp_set, zone->master)) {
+		/* on failure the timer is set, and the next master is
+		 * tried when it expires */
+		(void)xfrd_send_ixfr_request_udp(zone);
 		return;
 	}
-	/* queue the zone as last */
-	zone->udp_waiting = 1;
-	zone->udp_waiting_next = NULL;
-	zone->udp_waiting_prev = xfrd->udp_waiting_last;
-	if(!xfrd->udp_waiting_first)
-		xfrd->udp_waiting_first = zone;
-	if(xfrd->udp_waiting_last)
-		xfrd->udp_waiting_last->udp_waiting_next = zone;
-	xfrd->udp_waiting_last = zone;
+	/* queue the zone as last for its master, it waits for a slot in
+	 * the window or for the pacing of its master */
+	xfrd_udp_waiting_add(zone);
 	xfrd_unset_timer(zone);
 }
 
@@ -1103,6 +1107,7 @@ xfrd_set_zone_state(xfrd_zone_type* zone, enum xfrd_zone_state s)
 	if(s != zone->state) {
 		enum xfrd_zone_state old = zone->state;
 		zone->state = s;
+		xfrd_state_dirty(zone);
 		if((s == xfrd_zone_expired || old == xfrd_zone_expired)
 			&& s!=old) {
 			xfrd_send_expire_notification(zone);
@@ -1115,6 +1120,7 @@ xfrd_set_refresh_now(xfrd_zone_type* zone)
 {
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd zone %s is activated, state %d",
 		zone->apex_str, zone->state));
+	xfrd_state_dirty(zone);
 	if(!zone->is_activated) {
 		/* push onto list */
 		zone->activated_prev = 0;
@@ -1126,21 +1132,224 @@ xfrd_set_refresh_now(xfrd_zone_type* zone)
 	}
 }
 
+/* the slot in the timer wheel for the expiry time */
+static int
+xfrd_timer_wheel_slot(time_t expire)
+{
+	time_t delta = expire - xfrd->timer_wheel_time;
+	int level = 0;
+	while(level < XFRD_WHEEL_LEVELS-1 &&
+		delta >= ((time_t)1<<(XFRD_WHEEL_BITS*(level+1))))
+		level++;
+	return level*XFRD_WHEEL_SIZE + (int)((expire>>(XFRD_WHEEL_BITS*level))
+		& (XFRD_WHEEL_SIZE-1));
+}
+
+/* put the zone in its slot of the timer wheel */
+static void
+xfrd_timer_wheel_link(xfrd_zone_type* zone, int slot)
+{
+	zone->timer_slot = (uint16_t)slot;
+	zone->timer_prev = NULL;
+	zone->timer_next = xfrd->timer_wheel[slot];
+	if(zone->timer_next)
+		zone->timer_next->timer_prev = zone;
+	xfrd->timer_wheel[slot] = zone;
+}
+
+static void
+xfrd_timer_wheel_unlink(xfrd_zone_type* zone)
+{
+	if(zone->timer_prev)
+		zone->timer_prev->timer_next = zone->timer_next;
+	else	xfrd->timer_wheel[zone->timer_slot] = zone->timer_next;
+	if(zone->timer_next)
+		zone->timer_next->timer_prev = zone->timer_prev;
+	zone->timer_next = NULL;
+	zone->timer_prev = NULL;
+}
+
+/* move the timers in the slot to the slots for their expiry time */
+static void
+xfrd_timer_wheel_move(int slot, int to_slot)
+{
+	xfrd_zone_type* zone = xfrd->timer_wheel[slot], *next;
+	xfrd->timer_wheel[slot] = NULL;
+	while(zone) {
+		next = zone->timer_next;
+		xfrd_timer_wheel_link(zone, to_slot == -1?
+			xfrd_timer_wheel_slot(zone->timer_expire):to_slot);
+		zone = next;
+	}
+}
+
+/* the next second that the wheel has to run, a nonempty slot in the
+ * lowest level, or the start of the next period of the higher levels */
+static time_t
+xfrd_timer_wheel_next(void)
+{
+	time_t t = xfrd->timer_wheel_time;
+	int i;
+	for(i = 0; i < XFRD_WHEEL_SIZE; i++, t++) {
+		if(xfrd->timer_wheel[t & (XFRD_WHEEL_SIZE-1)] ||
+			(t & (XFRD_WHEEL_SIZE-1)) == 0)
+			return t;
+	}
+	return t;
+}
+
+/* set the wheel event to run the wheel at the second */
+static void
+xfrd_timer_wheel_schedule(time_t at)
+{
+	struct timeval tv, now;
+	if(xfrd->timer_wheel_added) {
+		if(xfrd->timer_wheel_at <= at)
+			return;
+		event_del(&xfrd->timer_wheel_event);
+		xfrd->timer_wheel_added = 0;
+	}
+	/* fire at the start of the second, not a fraction late */
+	if(gettimeofday(&now, NULL) != 0) {
+		now.tv_sec = xfrd_time();
+		now.tv_usec = 0;
+	}
+	if(at <= now.tv_sec) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+	} else if(now.tv_usec == 0) {
+		tv.tv_sec = at - now.tv_sec;
+		tv.tv_usec = 0;
+	} else {
+		tv.tv_sec = at - now.tv_sec - 1;
+		tv.tv_usec = 1000000 - now.tv_usec;
+	}
+	memset(&xfrd->timer_wheel_event, 0, sizeof(xfrd->timer_wheel_event));
+	event_set(&xfrd->timer_wheel_event, -1, EV_TIMEOUT,
+		xfrd_handle_timer_wheel, xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->timer_wheel_event) != 0)
+		log_msg(LOG_ERR, "xfrd timer: event_base_set failed");
+	if(event_add(&xfrd->timer_wheel_event, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd timer: event_add failed");
+	xfrd->timer_wheel_added = 1;
+	xfrd->timer_wheel_at = at;
+}
+
+/* the clock has stepped back, move the wheel and its timers back with it,
+ * so that the timers keep the time that they had left to run */
+static void
+xfrd_timer_wheel_rebase(time_t now)
+{
+	xfrd_zone_type* list = NULL, *zone;
+	time_t back = xfrd->timer_wheel_time - (now+1);
+	int i;
+	log_msg(LOG_WARNING, "xfrd: the clock stepped back %lld seconds, "
+		"the zone timers move back with it", (long long)back);
+	for(i = 0; i < XFRD_WHEEL_LEVELS*XFRD_WHEEL_SIZE; i++) {
+		while((zone = xfrd->timer_wheel[i]) != NULL) {
+			xfrd_timer_wheel_unlink(zone);
+			zone->timer_next = list;
+			list = zone;
+		}
+	}
+	xfrd->timer_wheel_time = now+1;
+	while((zone = list) != NULL) {
+		list = zone->timer_next;
+		zone->timer_expire -= back;
+		xfrd_timer_wheel_link(zone, xfrd_timer_wheel_slot(
+			zone->timer_expire));
+	}
+	/* the wheel event is for a second of the old time */
+	if(xfrd->timer_wheel_added) {
+		event_del(&xfrd->timer_wheel_event);
+		xfrd->timer_wheel_added = 0;
+	}
+	if(xfrd->timer_wheel_count != 0)
+		xfrd_timer_wheel_schedule(xfrd_timer_wheel_next());
+}
+
+/* run the zone timers that expire up to and including now */
+static void
+xfrd_timer_wheel_run(time_t now)
+{
+	xfrd_zone_type* zone;
+	int level;
+	/* the wheel has run up to the previous second, unless the clock
+	 * was set back */
+	if(now+1 < xfrd->timer_wheel_time)
+		xfrd_timer_wheel_rebase(now);
+	while(xfrd->timer_wheel_time <= now) {
+		time_t t = xfrd->timer_wheel_time;
+		if(xfrd->timer_wheel_count == 0) {
+			/* nothing to run, skip ahead */
+			xfrd->timer_wheel_time = now+1;
+			break;
+		}
+		/* at the start of a period of a level, its slot moves down */
+		for(level = XFRD_WHEEL_LEVELS-1; level > 0; level--) {
+			if((t & (((time_t)1<<(XFRD_WHEEL_BITS*level))-1)) == 0)
+				xfrd_timer_wheel_move(level*XFRD_WHEEL_SIZE +
+					(int)((t>>(XFRD_WHEEL_BITS*level)) &
+					(XFRD_WHEEL_SIZE-1)), -1);
+		}
+		/* timers that are set while these run go into later slots */
+		xfrd_timer_wheel_move((int)(t & (XFRD_WHEEL_SIZE-1)),
+			XFRD_WHEEL_DUE);
+		xfrd->timer_wheel_time = t+1;
+		while((zone = xfrd->timer_wheel[XFRD_WHEEL_DUE]) != NULL) {
+			xfrd_unset_timer(zone);
+			xfrd_handle_zone(-1, EV_TIMEOUT, zone);
+		}
+	}
+}
+
+static void
+xfrd_handle_timer_wheel(int ATTR_UNUSED(fd), short event,
+	void* ATTR_UNUSED(arg))
+{
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	xfrd->timer_wheel_added = 0;
+	xfrd_timer_wheel_run(xfrd_time());
+	if(xfrd->timer_wheel_count != 0)
+		xfrd_timer_wheel_schedule(xfrd_timer_wheel_next());
+}
+
 void
 xfrd_unset_timer(xfrd_zone_type* zone)
 {
-	assert(zone->zone_handler.ev_fd == -1);
-	if(zone->event_added)
-		event_del(&zone->zone_handler);
-	zone->zone_handler_flags = 0;
-	zone->event_added = 0;
+	if(!zone->timer_set)
+		return;
+	xfrd_timer_wheel_unlink(zone);
+	zone->timer_set = 0;
+	xfrd->timer_wheel_count--;
+}
+
+/* set the zone timer to expire at the absolute time */
+static void
+xfrd_set_timer_at(xfrd_zone_type* zone, time_t expire)
+{
+	xfrd_unset_timer(zone);
+	/* the expiry time is from the current time, that can be before the
+	 * wheel if the clock was set back */
+	if(xfrd_time()+1 < xfrd->timer_wheel_time)
+		xfrd_timer_wheel_rebase(xfrd_time());
+	if(expire < xfrd->timer_wheel_time)
+		expire = xfrd->timer_wheel_time;
+	if(expire - xfrd->timer_wheel_time >= ((time_t)1<<(XFRD_WHEEL_BITS*
+		XFRD_WHEEL_LEVELS)))
+		expire = xfrd->timer_wheel_time + ((time_t)1<<(XFRD_WHEEL_BITS*
+			XFRD_WHEEL_LEVELS)) - 1;
+	zone->timer_expire = expire;
+	xfrd_timer_wheel_link(zone, xfrd_timer_wheel_slot(expire));
+	zone->timer_set = 1;
+	xfrd->timer_wheel_count++;
+	xfrd_timer_wheel_schedule(expire);
 }
 
 void
 xfrd_set_timer(xfrd_zone_type* zone, time_t t)
 {
-	int fd = zone->zone_handler.ev_fd;
-	int fl = ((fd == -1)?EV_TIMEOUT:zone->zone_handler_flags);
 	if(t > XFRD_TRANSFER_TIMEOUT_MAX)
 		t = XFRD_TRANSFER_TIMEOUT_MAX;
 	/* randomize the time, within 90%-100% of original */
@@ -1151,20 +1360,33 @@ xfrd_set_timer(xfrd_zone_type* zone, time_t t)
 		t = base + random_generate(t-base);
 	}
 
-	/* keep existing flags and fd, but re-add with timeout */
-	if(zone->event_added)
-		event_del(&zone->zone_handler);
-	else	fd = -1;
-	zone->timeout.tv_sec = t;
-	zone->timeout.tv_usec = 0;
-	memset(&zone->zone_handler, 0, sizeof(zone->zone_handler));
-	event_set(&zone->zone_handler, fd, fl, xfrd_handle_zone, zone);
-	if(event_base_set(xfrd->event_base, &zone->zone_handler) != 0)
-		log_msg(LOG_ERR, "xfrd timer: event_base_set failed");
-	if(event_add(&zone->zone_handler, &zone->timeout) != 0)
-		log_msg(LOG_ERR, "xfrd timer: event_add failed");
-	zone->zone_handler_flags = fl;
-	zone->event_added = 1;
+	zone->timeout = t;
+	xfrd_set_timer_at(zone, xfrd_time() + t);
+	xfrd_state_dirty(zone);
+}
+
+/* at startup, the activated zones are spread out over a couple of seconds,
+ * so that a restart with many zones does not refresh them all at once */
+static void
+xfrd_spread_activated(void)
+{
+	xfrd_zone_type* zone;
+	size_t num = 0;
+	time_t spread;
+	for(zone = xfrd->activated_first; zone; zone = zone->activated_next)
+		num++;
+	spread = (time_t)(num / XFRD_STARTUP_RATE);
+	if(spread > XFRD_STARTUP_SPREAD_MAX)
+		spread = XFRD_STARTUP_SPREAD_MAX;
+	if(spread < 2)
+		return;
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: spread refresh of %u zones "
+		"over %d seconds", (unsigned)num, (int)spread));
+	while((zone = xfrd->activated_first) != NULL) {
+		xfrd_deactivate_zone(zone);
+		zone->timeout = 0;
+		xfrd_set_timer_at(zone, xfrd_time() + random_generate(spread));
+	}
 }
 
 void
@@ -1259,80 +1481,102 @@ xfrd_send_expire_notification(xfrd_zone_type* zone)
 	xfrd_set_reload_timeout();
 }
 
-int
-xfrd_udp_read_packet(buffer_type* packet, int fd, struct sockaddr* src,
-	socklen_t* srclen)
+void
+xfrd_udp_release(xfrd_zone_type* zone)
 {
-	ssize_t received;
+	assert(zone->udp_waiting == 0);
+	xfrd_udp_query_remove(xfrd->udp_set, zone);
+	/* see if there are waiting zones */
+	if(xfrd->udp_waiting_first)
+		xfrd_udp_start_waiting();
+}
 
-	/* read the data */
-	buffer_clear(packet);
-	received = recvfrom(fd, buffer_begin(packet), buffer_remaining(packet),
-		0, src, srclen);
-	if(received == -1) {
-		log_msg(LOG_ERR, "xfrd: recvfrom failed: %s",
-			strerror(errno));
-		return 0;
+static void
+xfrd_udp_waiting_add(xfrd_zone_type* zone)
+{
+	struct xfrd_udp_master* m = xfrd_udp_master_obtain(xfrd->udp_set,
+		zone->master);
+	assert(zone->udp_waiting == 0);
+	zone->udp_waiting = 1;
+	zone->udp_waiting_master = m;
+	zone->udp_waiting_next = NULL;
+	zone->udp_waiting_prev = m->wait_last;
+	if(!m->wait_first)
+		m->wait_first = zone;
+	if(m->wait_last)
+		m->wait_last->udp_waiting_next = zone;
+	m->wait_last = zone;
+	if(!m->in_wait) {
+		m->in_wait = 1;
+		m->wait_next = NULL;
+		m->wait_prev = xfrd->udp_waiting_last;
+		if(!xfrd->udp_waiting_first)
+			xfrd->udp_waiting_first = m;
+		if(xfrd->udp_waiting_last)
+			xfrd->udp_waiting_last->wait_next = m;
+		xfrd->udp_waiting_last = m;
+	}
+}
+
+static void
+xfrd_udp_waiting_remove(xfrd_zone_type* zone)
+{
+	struct xfrd_udp_master* m = zone->udp_waiting_master;
+	assert(zone->udp_waiting);
+	if(zone->udp_waiting_prev)
+		zone->udp_waiting_prev->udp_waiting_next =
+			zone->udp_waiting_next;
+	else	m->wait_first = zone->udp_waiting_next;
+	if(zone->udp_waiting_next)
+		zone->udp_waiting_next->udp_waiting_prev =
+			zone->udp_waiting_prev;
+	else	m->wait_last = zone->udp_waiting_prev;
+	zone->udp_waiting_next = NULL;
+	zone->udp_waiting_prev = NULL;
+	zone->udp_waiting_master = NULL;
+	zone->udp_waiting = 0;
+	if(!m->wait_first) {
+		/* the master has no waiting zones left */
+		if(m->wait_prev)
+			m->wait_prev->wait_next = m->wait_next;
+		else	xfrd->udp_waiting_first = m->wait_next;
+		if(m->wait_next)
+			m->wait_next->wait_prev = m->wait_prev;
+		else	xfrd->udp_waiting_last = m->wait_prev;
+		m->wait_next = NULL;
+		m->wait_prev = NULL;
+		m->in_wait = 0;
 	}
-	buffer_set_limit(packet, received);
-	return 1;
 }
 
 void
-xfrd_udp_release(xfrd_zone_type* zone)
+xfrd_udp_start_waiting(void)
 {
-	assert(zone->udp_waiting == 0);
-	if(zone->event_added)
-		event_del(&zone->zone_handler);
-	if(zone->zone_handler.ev_fd != -1) {
-		close(zone->zone_handler.ev_fd);
-	}
-	zone->zone_handler.ev_fd = -1;
-	zone->zone_handler_flags = 0;
-	zone->event_added = 0;
-	/* see if there are waiting zones */
-	if(xfrd->udp_use_num == XFRD_MAX_UDP)
-	{
-		while(xfrd->udp_waiting_first) {
-			/* snip off waiting list */
-			xfrd_zone_type* wz = xfrd->udp_waiting_first;
-			assert(wz->udp_waiting);
-			wz->udp_waiting = 0;
-			xfrd->udp_waiting_first = wz->udp_waiting_next;
-			if(wz->udp_waiting_next)
-				wz->udp_waiting_next->udp_waiting_prev = NULL;
-			if(xfrd->udp_waiting_last == wz)
-				xfrd->udp_waiting_last = NULL;
+	struct xfrd_udp_master* m = xfrd->udp_waiting_first, *next;
+	xfrd_zone_type* wz;
+	while(m && xfrd->udp_set->num_use < xfrd->udp_set->window) {
+		next = m->wait_next;
+		while((wz = m->wait_first) != NULL &&
+			xfrd->udp_set->num_use < xfrd->udp_set->window) {
+			/* the zones of a paced master stay in the waiting
+			 * list, and are skipped together */
+			if(wz->tcp_conn == -1 && wz->master &&
+				!xfrd_udp_master_allowed(xfrd->udp_set,
+				wz->master))
+				break;
+			xfrd_udp_waiting_remove(wz);
 			/* see if this zone needs udp connection */
 			if(wz->tcp_conn == -1) {
-				int fd = xfrd_send_ixfr_request_udp(wz);
-				if(fd != -1) {
-					if(wz->event_added)
-						event_del(&wz->zone_handler);
-					memset(&wz->zone_handler, 0,
-						sizeof(wz->zone_handler));
-					event_set(&wz->zone_handler, fd,
-						EV_READ|EV_TIMEOUT|EV_PERSIST,
-						xfrd_handle_zone, wz);
-					if(event_base_set(xfrd->event_base,
-						&wz->zone_handler) != 0)
-						log_msg(LOG_ERR, "cannot set event_base for ixfr");
-					if(event_add(&wz->zone_handler, &wz->timeout) != 0)
-						log_msg(LOG_ERR, "cannot add event for ixfr");
-					wz->zone_handler_flags = EV_READ|EV_TIMEOUT|EV_PERSIST;
-					wz->event_added = 1;
-					return;
-				} else {
+				if(!wz->master ||
+					!xfrd_send_ixfr_request_udp(wz)) {
 					/* make this zone do something with
 					 * this failure to act */
 					xfrd_set_refresh_now(wz);
 				}
 			}
 		}
+		m = next;
 	}
-	/* no waiting zones */
-	if(xfrd->udp_use_num > 0)
-		xfrd->udp_use_num--;
 }
 
 /** disable ixfr for master */
@@ -1348,24 +1592,11 @@ xfrd_disable_ixfr(xfrd_zone_type* zone)
 	zone->master->ixfr_disabled = time(NULL);
 }
 
-static void
-xfrd_udp_read(xfrd_zone_type* zone)
+void
+xfrd_udp_read(xfrd_zone_type* zone, buffer_type* packet)
 {
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s read udp data", zone->apex_str));
-	if(!xfrd_udp_read_packet(xfrd->packet, zone->zone_handler.ev_fd,
-		NULL, NULL)) {
-		zone->master->bad_xfr_count++;
-		if (zone->master->bad_xfr_count > 2) {
-			xfrd_disable_ixfr(zone);
-			zone->master->bad_xfr_count = 0;
-		}
-		/* drop packet */
-		xfrd_udp_release(zone);
-		/* query next server */
-		xfrd_make_request(zone);
-		return;
-	}
-	switch(xfrd_handle_received_xfr_packet(zone, xfrd->packet)) {
+	switch(xfrd_handle_received_xfr_packet(zone, packet)) {
 		case xfrd_packet_tcp:
 			xfrd_set_timer(zone, xfrd->tcp_set->tcp_timeout);
 			xfrd_udp_release(zone);
@@ -1412,61 +1643,6 @@ xfrd_udp_read(xfrd_zone_type* zone)
 	}
 }
 
-int
-xfrd_send_udp(struct acl_options* acl, buffer_type* packet,
-	struct acl_options* ifc)
-{
-#ifdef INET6
-	struct sockaddr_storage to;
-#else
-	struct sockaddr_in to;
-#endif /* INET6 */
-	int fd, family;
-
-	/* this will set the remote port to acl->port or TCP_PORT */
-	socklen_t to_len = xfrd_acl_sockaddr_to(acl, &to);
-
-	/* get the address family of the remote host */
-	if(acl->is_ipv6) {
-#ifdef INET6
-		family = PF_INET6;
-#else
-		return -1;
-#endif /* INET6 */
-	} else {
-		family = PF_INET;
-	}
-
-	fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
-	if(fd == -1) {
-		log_msg(LOG_ERR, "xfrd: cannot create udp socket to %s: %s",
-			acl->ip_address_spec, strerror(errno));
-		return -1;
-	}
-
-	/* bind it */
-	if (!xfrd_bind_local_interface(fd, ifc, acl, 0)) {
-		log_msg(LOG_ERR, "xfrd: cannot bind outgoing interface '%s' to "
-				 "udp socket: No matching ip addresses found",
-			ifc->ip_address_spec);
-		close(fd);
-		return -1;
-	}
-
-	/* send it (udp) */
-	if(sendto(fd,
-		buffer_current(packet),
-		buffer_remaining(packet), 0,
-		(struct sockaddr*)&to, to_len) == -1)
-	{
-		log_msg(LOG_ERR, "xfrd: sendto %s failed %s",
-			acl->ip_address_spec, strerror(errno));
-		close(fd);
-		return -1;
-	}
-	return fd;
-}
-
 int
 xfrd_bind_local_interface(int sockd, struct acl_options* ifc,
 	struct acl_options* acl, int tcp)
@@ -1572,16 +1748,13 @@ xfrd_tsig_sign_request(buffer_type* packet, tsig_record_type* tsig,
 static int
 xfrd_send_ixfr_request_udp(xfrd_zone_type* zone)
 {
-	int fd;
-
 	/* make sure we have a master to query the ixfr request to */
 	assert(zone->master);
 
 	if(zone->tcp_conn != -1) {
-		/* tcp is using the zone_handler.fd */
 		log_msg(LOG_ERR, "xfrd: %s tried to send udp whilst tcp engaged",
 			zone->apex_str);
-		return -1;
+		return 0;
 	}
 	xfrd_setup_packet(xfrd->packet, TYPE_IXFR, CLASS_IN, zone->apex,
 		qid_generate());
@@ -1602,15 +1775,8 @@ xfrd_send_ixfr_request_udp(xfrd_zone_type* zone)
 	buffer_flip(xfrd->packet);
 	xfrd_set_timer(zone, XFRD_UDP_TIMEOUT);
 
-	if((fd = xfrd_send_udp(zone->master, xfrd->packet,
-		zone->zone_options->pattern->outgoing_interface)) == -1)
-		return -1;
-
-	DEBUG(DEBUG_XFRD,1, (LOG_INFO,
-		"xfrd sent udp request for ixfr=%u for zone %s to %s",
-		(unsigned)ntohl(zone->soa_disk.serial),
-		zone->apex_str, zone->master->ip_address_spec));
-	return fd;
+	/* sent with the other queries in xfrd_udp_flush */
+	return xfrd_udp_query_add(xfrd->udp_set, zone, xfrd->packet);
 }
 
 static int xfrd_parse_soa_info(buffer_type* packet, xfrd_soa_type* soa)
@@ -2196,19 +2362,21 @@ xfrd_handle_received_xfr_packet(xfrd_zone_type* zone, buffer_type* packet)
 	}
 }
 
-static void
-xfrd_set_reload_timeout()
+void
+xfrd_set_reload_timeout(void)
 {
 	if(xfrd->nsd->options->xfrd_reload_timeout == -1)
 		return; /* automatic reload disabled. */
+	/* the update is batched with the others that wait for a reload */
+	if(xfrd->reload_pending++ == 0)
+		get_time_monotonic(&xfrd->reload_pending_since);
 	if(xfrd->reload_timeout.tv_sec == 0 ||
-		xfrd_time() >= (time_t)xfrd->reload_timeout.tv_sec ) {
-		/* no reload wait period (or it passed), do it right away */
+		xfrd_time() >= (time_t)xfrd->reload_timeout.tv_sec ||
+		xfrd->reload_pending >= XFRD_RELOAD_BATCH_MAX) {
+		/* no reload wait period (or it passed), or the batch is
+		 * full, do it right away, the wait period starts when the
+		 * reload is sent */
 		xfrd_set_reload_now(xfrd);
-		/* start reload wait period */
-		xfrd->reload_timeout.tv_sec = xfrd_time() +
-			xfrd->nsd->options->xfrd_reload_timeout;
-		xfrd->reload_timeout.tv_usec = 0;
 		return;
 	}
 	/* cannot reload now, set that after the timeout a reload has to happen */
@@ -2216,8 +2384,8 @@ xfrd_set_reload_timeout()
 		struct timeval tv;
 		tv.tv_sec = xfrd->reload_timeout.tv_sec - xfrd_time();
 		tv.tv_usec = 0;
-		if(tv.tv_sec > xfrd->nsd->options->xfrd_reload_timeout)
-			tv.tv_sec = xfrd->nsd->options->xfrd_reload_timeout;
+		if(tv.tv_sec > xfrd->reload_wait)
+			tv.tv_sec = xfrd->reload_wait;
 		memset(&xfrd->reload_handler, 0, sizeof(xfrd->reload_handler));
 		event_set(&xfrd->reload_handler, -1, EV_TIMEOUT,
 			xfrd_handle_reload, xfrd);
@@ -2235,18 +2403,74 @@ xfrd_handle_reload(int ATTR_UNUSED(fd), short event, void* ATTR_UNUSED(arg))
 	/* reload timeout */
 	assert(event & EV_TIMEOUT);
 	(void)event;
-	/* timeout wait period after this request is sent */
+	/* the wait period starts again when this request is sent */
 	xfrd->reload_added = 0;
-	xfrd->reload_timeout.tv_sec = xfrd_time() +
-		xfrd->nsd->options->xfrd_reload_timeout;
 	xfrd_set_reload_now(xfrd);
 }
 
+void
+xfrd_reload_sent(void)
+{
+	time_t wait = xfrd->nsd->options->xfrd_reload_timeout;
+	time_t adapt = (time_t)((xfrd->reload_time_avg*XFRD_RELOAD_DUTY +
+		999999)/1000000);
+	/* wait longer when reloads take long, so that the updates are
+	 * batched and xfrd does not keep the server busy reloading, but
+	 * updates do not wait longer than the max staleness */
+	if(adapt > xfrd->nsd->options->xfrd_reload_max_staleness)
+		adapt = xfrd->nsd->options->xfrd_reload_max_staleness;
+	if(adapt > wait)
+		wait = adapt;
+	if(wait < 0)
+		wait = 0;
+	xfrd->reload_wait = wait;
+	xfrd->reload_timeout.tv_sec = xfrd_time() + wait;
+	xfrd->reload_timeout.tv_usec = 0;
+	/* the pending updates are in this reload */
+	if(xfrd->reload_added) {
+		event_del(&xfrd->reload_handler);
+		xfrd->reload_added = 0;
+	}
+	xfrd->reload_running = xfrd->reload_pending;
+	xfrd->reload_running_since = xfrd->reload_pending_since;
+	xfrd->reload_pending = 0;
+	get_time_monotonic(&xfrd->reload_sent_time);
+}
+
+void
+xfrd_reload_done(void)
+{
+	struct timespec now;
+	uint64_t usec;
+	if(xfrd->reload_sent_time.tv_sec == 0 &&
+		xfrd->reload_sent_time.tv_nsec == 0)
+		return; /* not a reload that xfrd asked for */
+	get_time_monotonic(&now);
+	usec = timespec_elapsed_usec(&xfrd->reload_sent_time, &now);
+	memset(&xfrd->reload_sent_time, 0, sizeof(xfrd->reload_sent_time));
+	xfrd->reload_num++;
+	xfrd->reload_time_last = usec;
+	/* moving average over about the last 8 reloads */
+	if(xfrd->reload_time_avg == 0)
+		xfrd->reload_time_avg = usec;
+	else	xfrd->reload_time_avg = xfrd->reload_time_avg -
+			xfrd->reload_time_avg/8 + usec/8;
+	if(xfrd->reload_running) {
+		/* the time the oldest update in the reload waited */
+		usec = timespec_elapsed_usec(&xfrd->reload_running_since, &now);
+		xfrd->reload_updates += xfrd->reload_running;
+		xfrd->reload_staleness_last = usec;
+		if(usec > xfrd->reload_staleness_max)
+			xfrd->reload_staleness_max = usec;
+		xfrd->reload_running = 0;
+	}
+}
+
 void
 xfrd_handle_notify_and_start_xfr(xfrd_zone_type* zone, xfrd_soa_type* soa)
 {
 	if(xfrd_handle_incoming_notify(zone, soa)) {
-		if(zone->zone_handler.ev_fd == -1 && zone->tcp_conn == -1 &&
+		if(!zone->udp_query && zone->tcp_conn == -1 &&
 			!zone->tcp_waiting && !zone->udp_waiting) {
 			xfrd_set_refresh_now(zone);
 		}
@@ -2278,6 +2502,22 @@ xfrd_handle_passed_packet(buffer_type* packet,
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: got passed packet for %s, acl "
 		   "%d", dname_to_string(dname,0), acl_num));
 
+	if(OPCODE(packet) == OPCODE_QUERY) {
+		/* lazy-zones, a server asks to read a cold zone, that is
+		 * done by the reload */
+		if(zone_options_find(xfrd->nsd->options, dname)) {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read lazy zone %s",
+				dname_to_string(dname,0)));
+			task_new_check_zonefiles(xfrd->nsd->task[
+				xfrd->nsd->mytask], xfrd->last_task, dname);
+			if(xfrd->nsd->options->xfrd_reload_timeout == -1)
+				xfrd_set_reload_now(xfrd);
+			else	xfrd_set_reload_timeout();
+		}
+		region_destroy(tempregion);
+		return;
+	}
+
 	/* find the zone */
 	zone = (xfrd_zone_type*)rbtree_search(xfrd->zones, dname);
 	if(!zone) {
@@ -2470,15 +2710,28 @@ xfrd_process_stat_info_task(xfrd_state_type* xfrd, struct task_list_d* task)
 }
 #endif /* BIND8_STATS */
 
+/** process reload info task, the phase timings of the reload */
+static void
+xfrd_process_reload_info_task(xfrd_state_type* xfrd, struct task_list_d* task)
+{
+	struct reload_info* info = (struct reload_info*)task->zname;
+	xfrd->reload_last_tasks = info->tasks;
+	xfrd->reload_last_xfrs = info->xfrs;
+	xfrd->reload_last_process = info->process_usec;
+	xfrd->reload_last_sync = info->sync_usec;
+	xfrd->reload_last_children = info->children_usec;
+	xfrd->reload_last_quit = info->quit_usec;
+}
+
 #ifdef USE_ZONE_STATS
 /** process zonestat inc task */
 static void
 xfrd_process_zonestat_inc_task(xfrd_state_type* xfrd, struct task_list_d* task)
 {
 	xfrd->zonestat_safe = (unsigned)task->oldserial;
-	zonestat_remap(xfrd->nsd, 0, xfrd->zonestat_safe*sizeof(struct nsdst));
+	zonestat_remap(xfrd->nsd, 0, xfrd->zonestat_safe*sizeof(struct nsdzst));
 	xfrd->nsd->zonestatsize[0] = xfrd->zonestat_safe;
-	zonestat_remap(xfrd->nsd, 1, xfrd->zonestat_safe*sizeof(struct nsdst));
+	zonestat_remap(xfrd->nsd, 1, xfrd->zonestat_safe*sizeof(struct nsdzst));
 	xfrd->nsd->zonestatsize[1] = xfrd->zonestat_safe;
 }
 #endif /* USE_ZONE_STATS */
@@ -2486,13 +2739,13 @@ xfrd_process_zonestat_inc_task(xfrd_state_type* xfrd, struct task_list_d* task)
 static void
 xfrd_handle_taskresult(xfrd_state_type* xfrd, struct task_list_d* task)
 {
-#ifndef BIND8_STATS
-	(void)xfrd;
-#endif
 	switch(task->task_type) {
 	case task_soa_info:
 		xfrd_process_soa_info_task(task);
 		break;
+	case task_reload_info:
+		xfrd_process_reload_info_task(xfrd, task);
+		break;
 #ifdef BIND8_STATS
 	case task_stat_info:
 		xfrd_process_stat_info_task(xfrd, task);
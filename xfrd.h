@@ -34,9 +34,18 @@ struct xfrd_tcp;
 struct xfrd_tcp_set;
 struct notify_zone;
 struct udb_ptr;
+struct xfrd_udp_set;
+struct xfrd_udp_query;
 typedef struct xfrd_state xfrd_state_type;
 typedef struct xfrd_zone xfrd_zone_type;
 typedef struct xfrd_soa xfrd_soa_type;
+
+/* timer wheel, levels of 256 slots, holds timers up to 2^24 seconds */
+#define XFRD_WHEEL_BITS 8
+#define XFRD_WHEEL_SIZE (1<<XFRD_WHEEL_BITS)
+#define XFRD_WHEEL_LEVELS 3
+/* slot of the timers that are run now */
+#define XFRD_WHEEL_DUE (XFRD_WHEEL_LEVELS*XFRD_WHEEL_SIZE)
 /*
  * The global state for the xfrd daemon process.
  * The time_t times are epochs in secs since 1970, absolute times.
@@ -51,13 +60,44 @@ struct xfrd_state {
 	struct xfrd_tcp_set* tcp_set;
 	/* packet buffer for udp packets */
 	struct buffer* packet;
-	/* udp waiting list, double linked list */
-	struct xfrd_zone *udp_waiting_first, *udp_waiting_last;
-	/* number of udp sockets (for sending queries) in use */
-	size_t udp_use_num;
+	/* shared udp sockets and outstanding udp queries */
+	struct xfrd_udp_set* udp_set;
+	/* masters with zones that wait for udp, double linked list, each
+	 * master has its waiting zones, so that the zones of a paced
+	 * master are skipped in one step */
+	struct xfrd_udp_master *udp_waiting_first, *udp_waiting_last;
 	/* activated waiting list, double linked list */
 	struct xfrd_zone *activated_first;
 
+	/* the binary state journal, fd or -1, its size, and its size after
+	 * the last checkpoint */
+	int state_fd;
+	off_t state_size;
+	off_t state_base_size;
+	/* buffer to write journal records */
+	struct buffer* state_buf;
+	/* zones with changed state, to append to the journal */
+	struct xfrd_zone* state_dirty_first;
+	/* timer to append the changes and fsync */
+	struct event state_timer;
+	int state_timer_added;
+	/* appended since the last fsync, and the time of that fsync */
+	int state_need_sync;
+	time_t state_last_sync;
+
+	/* timer wheel with the zone timers, by expiry second. Levels of
+	 * XFRD_WHEEL_SIZE slots, level n has slots of SIZE^n seconds, and
+	 * one extra slot holds the timers that are run now. */
+	struct xfrd_zone* timer_wheel[XFRD_WHEEL_LEVELS*XFRD_WHEEL_SIZE+1];
+	/* the next second that the wheel runs, the earlier are done */
+	time_t timer_wheel_time;
+	/* number of zone timers in the wheel */
+	size_t timer_wheel_count;
+	/* the one event that runs the wheel, and the second it is set for */
+	struct event timer_wheel_event;
+	int timer_wheel_added;
+	time_t timer_wheel_at;
+
 	/* current time is cached */
 	uint8_t got_time;
 	time_t current_time;
@@ -69,8 +109,9 @@ struct xfrd_state {
 	unsigned zonestat_safe;
 	/* size currently of the clear array */
 	size_t zonestat_clear_num;
-	/* array of malloced entries with cumulative cleared stat values */
-	struct nsdst** zonestat_clear;
+	/* array of malloced entries with cumulative cleared stat values,
+	 * every entry holds the compact values of both zonestat arrays */
+	struct nsdzst** zonestat_clear;
 
 	/* timer for NSD reload */
 	struct timeval reload_timeout;
@@ -80,6 +121,22 @@ struct xfrd_state {
 	time_t reload_cmd_last_sent;
 	uint8_t can_send_reload;
 	pid_t reload_pid;
+	/* zone updates that wait for a reload, and since when */
+	size_t reload_pending;
+	struct timespec reload_pending_since;
+	/* the updates in the reload that runs, and since when they wait */
+	size_t reload_running;
+	struct timespec reload_running_since;
+	struct timespec reload_sent_time;
+	/* wait period after a reload is sent, in seconds, adapted to the
+	 * average time a reload takes, in usec */
+	time_t reload_wait;
+	uint64_t reload_time_avg;
+	/* reload statistics, and the phases of the last reload in usec */
+	uint64_t reload_num, reload_updates, reload_time_last;
+	uint64_t reload_staleness_last, reload_staleness_max;
+	uint64_t reload_last_tasks, reload_last_xfrs, reload_last_process,
+		reload_last_sync, reload_last_children, reload_last_quit;
 	/* timeout for lost sigchild and reaping children */
 	struct event child_timer;
 	int child_timer_added;
@@ -110,10 +167,16 @@ struct xfrd_state {
 
 	/* tree of zones, by apex name, contains notify_zone*. All zones. */
 	rbtree_type *notify_zones;
-	/* number of notify_zone active using UDP socket */
+	/* number of notify_zone active sending NOTIFY */
 	int notify_udp_num;
-	/* first and last notify_zone* entries waiting for a UDP socket */
+	/* first and last notify_zone* entries waiting for the notify window */
 	struct notify_zone *notify_waiting_first, *notify_waiting_last;
+	/* number of notify_zone entries on the waiting list */
+	size_t notify_waiting_num;
+	/* NOTIFY statistics: packets sent, acknowledged and given up, and
+	 * the time from the first send to the ack in usec */
+	uint64_t notify_sent, notify_acked, notify_failed;
+	uint64_t notify_latency_sum, notify_latency_max;
 };
 
 /*
@@ -178,11 +241,20 @@ struct xfrd_zone {
 	struct zone_options* zone_options;
 	int fresh_xfr_timeout;
 
-	/* handler for timeouts */
-	struct timeval timeout;
-	struct event zone_handler;
-	int zone_handler_flags;
-	int event_added;
+	/* timeout period that was last set, in seconds */
+	time_t timeout;
+	/* the timer: absolute expiry time, and if it is in the timer wheel */
+	time_t timer_expire;
+	uint8_t timer_set;
+	/* slot in the timer wheel, and the list of zones in that slot */
+	uint16_t timer_slot;
+	xfrd_zone_type* timer_next;
+	xfrd_zone_type* timer_prev;
+
+	/* zone state has changed, and the list of changed zones */
+	uint8_t state_dirty;
+	xfrd_zone_type* state_dirty_next;
+	xfrd_zone_type* state_dirty_prev;
 
 	/* tcp connection zone is using, or -1 */
 	int tcp_conn;
@@ -196,11 +268,14 @@ struct xfrd_zone {
 	/* next zone in tcp send queue */
 	xfrd_zone_type* tcp_send_next;
 	xfrd_zone_type* tcp_send_prev;
+	/* outstanding udp query of the zone, or NULL */
+	struct xfrd_udp_query* udp_query;
 	/* zone is waiting for a udp connection (tcp is preferred) */
 	uint8_t udp_waiting;
-	/* next zone in waiting list for UDP */
+	/* next zone in waiting list for UDP, of the master */
 	xfrd_zone_type* udp_waiting_next;
 	xfrd_zone_type* udp_waiting_prev;
+	struct xfrd_udp_master* udp_waiting_master;
 	/* zone has been activated to run now (after the other events
 	 * but before blocking in select again) */
 	uint8_t is_activated;
@@ -242,11 +317,13 @@ enum xfrd_packet_result {
 */
 #define XFRD_MAX_TCP 128 /* max number of TCP AXFR/IXFR concurrent connections.*/
 			/* Each entry has 64Kb buffer preallocated.*/
-#define XFRD_MAX_UDP 128 /* max number of UDP sockets at a time for IXFR */
-#define XFRD_MAX_UDP_NOTIFY 128 /* max concurrent UDP sockets for NOTIFY */
 
 #define XFRD_TRANSFER_TIMEOUT_START 10 /* empty zone timeout is between x and 2*x seconds */
 #define XFRD_TRANSFER_TIMEOUT_MAX 86400 /* empty zone timeout max expbackoff */
+#define XFRD_STARTUP_RATE 1000 /* zones per second that refresh at startup */
+#define XFRD_STARTUP_SPREAD_MAX 300 /* seconds, max startup refresh spread */
+#define XFRD_RELOAD_DUTY 2 /* reload wait period is this times the reload time */
+#define XFRD_RELOAD_BATCH_MAX 10000 /* pending zone updates that reload now */
 #define XFRD_LOWERBOUND_REFRESH 1 /* seconds, smallest refresh timeout */
 #define XFRD_LOWERBOUND_RETRY 1 /* seconds, smallest retry timeout */
 
@@ -371,22 +448,19 @@ void xfrd_deactivate_zone(xfrd_zone_type* z);
 void xfrd_make_request(xfrd_zone_type* zone);
 
 /*
- * send packet via udp (returns UDP fd source socket) to acl addr.
- * returns -1 on failure.
+ * Release the udp query that a zone has outstanding
  */
-int xfrd_send_udp(struct acl_options* acl, buffer_type* packet,
-	struct acl_options* ifc);
+void xfrd_udp_release(xfrd_zone_type* zone);
 
 /*
- * read from udp port packet into buffer, returns 0 on failure
+ * Handle the reply to the udp query of the zone, in packet
  */
-int xfrd_udp_read_packet(buffer_type* packet, int fd, struct sockaddr* src,
-	socklen_t* srclen);
+void xfrd_udp_read(xfrd_zone_type* zone, buffer_type* packet);
 
 /*
- * Release udp socket that a zone is using
+ * Start zones waiting for udp, while the window and pacing allow it
  */
-void xfrd_udp_release(xfrd_zone_type* zone);
+void xfrd_udp_start_waiting(void);
 
 /*
  * Get a static buffer for temporary use (to build a packet).
@@ -429,6 +503,20 @@ void xfrd_check_failed_updates(void);
  */
 void xfrd_prepare_zones_for_reload(void);
 
+/*
+ * A zone update waits for a reload, it is batched with the other pending
+ * updates until the wait period after the last reload has passed.
+ */
+void xfrd_set_reload_timeout(void);
+/*
+ * The reload command is sent, the pending zone updates go with it.
+ * Starts the wait period for the next reload, adapted to the time that
+ * reloads take.
+ */
+void xfrd_reload_sent(void);
+/* the reload is done, account the time it took */
+void xfrd_reload_done(void);
+
 /* Bind a local interface to a socket descriptor, return 1 on success */
 int xfrd_bind_local_interface(int sockd, struct acl_options* ifc,
 	struct acl_options* acl, int tcp);
@@ -1150,8 +1150,12 @@ zadd_rdata_wireformat(uint16_t *data)
 	if (parser->current_rr.rdata_count >= MAXRDATALEN) {
 		zc_error_prev_line("too many rdata elements");
 	} else {
-		parser->current_rr.rdatas[parser->current_rr.rdata_count].data
-			= data;
+		rdata_atom_type* rd =
+			&parser->current_rr.rdatas[parser->current_rr.rdata_count];
+		if(data && rdata_atom_set_inline(rd, data+1, data[0]))
+			region_recycle(parser->region, data,
+				sizeof(uint16_t) + data[0]);
+		else	rd->data = data;
 		++parser->current_rr.rdata_count;
 	}
 }
@@ -1202,6 +1206,9 @@ zadd_rdata_txt_clean_wireformat()
 	rdata_atom_type *rd = &parser->current_rr.rdatas[parser->current_rr.rdata_count-1];
 	if(!rd || !rd->data)
 		return; /* previous syntax failure */
+	/* rd->data of u16+65535 freed when rr_region is freed */
+	if(rdata_atom_set_inline(rd, rd->data+1, rd->data[0]))
+		return;
 	if ((tmp_data = (uint16_t *) region_alloc(parser->region, 
 		((size_t)rd->data[0]) + ((size_t)2))) != NULL) {
 		memcpy(tmp_data, rd->data, rd->data[0] + 2);
@@ -1258,6 +1265,14 @@ parse_unknown_rdata(uint16_t type, uint16_t *wireformat)
 	for (i = 0; i < rdata_count; ++i) {
 		if (rdata_atom_is_domain(type, i)) {
 			zadd_rdata_domain(rdatas[i].domain);
+		} else if (rdata_atom_is_inline(rdatas[i])) {
+			if (parser->current_rr.rdata_count >= MAXRDATALEN) {
+				zc_error_prev_line("too many rdata elements");
+			} else {
+				parser->current_rr.rdatas[
+					parser->current_rr.rdata_count++] =
+					rdatas[i];
+			}
 		} else {
 			zadd_rdata_wireformat(rdatas[i].data);
 		}
@@ -1412,36 +1427,36 @@ process_rr(void)
 	/* we have the zone already */
 	assert(zone);
 	if (rr->type == TYPE_SOA) {
-		if (rr->owner != zone->apex) {
+		if (rr_owner(rr) != zone->apex) {
 			char s[MAXDOMAINLEN*5];
 			snprintf(s, sizeof(s), "%s", domain_to_string(zone->apex));
 			zc_error_prev_line(
-				"SOA record with invalid domain name, '%s' is not '%s'", domain_to_string(rr->owner), s);
+				"SOA record with invalid domain name, '%s' is not '%s'", domain_to_string(rr_owner(rr)), s);
 			return 0;
 		}
-		if(has_soa(rr->owner)) {
+		if(has_soa(rr_owner(rr))) {
 			if(zone_is_slave(zone->opts))
 				zc_warning_prev_line("this SOA record was already encountered");
 			else
 				zc_error_prev_line("this SOA record was already encountered");
 			return 0;
 		}
-		rr->owner->is_apex = 1;
+		rr_owner(rr)->is_apex = 1;
 	}
 
-	if (!domain_is_subdomain(rr->owner, zone->apex))
+	if (!domain_is_subdomain(rr_owner(rr), zone->apex))
 	{
 		char s[MAXDOMAINLEN*5];
 		snprintf(s, sizeof(s), "%s", domain_to_string(zone->apex));
 		if(zone_is_slave(zone->opts))
-			zc_warning_prev_line("out of zone data: %s is outside the zone for fqdn %s", domain_to_string(rr->owner), s);
+			zc_warning_prev_line("out of zone data: %s is outside the zone for fqdn %s", domain_to_string(rr_owner(rr)), s);
 		else
-			zc_error_prev_line("out of zone data: %s is outside the zone for fqdn %s", domain_to_string(rr->owner), s);
+			zc_error_prev_line("out of zone data: %s is outside the zone for fqdn %s", domain_to_string(rr_owner(rr)), s);
 		return 0;
 	}
 
 	/* Do we have this type of rrset already? */
-	rrset = domain_find_rrset(rr->owner, zone, rr->type);
+	rrset = domain_find_rrset(rr_owner(rr), zone, rr->type);
 	if (!rrset) {
 		rrset = (rrset_type *) region_alloc(parser->region,
 						    sizeof(rrset_type));
@@ -1452,13 +1467,13 @@ process_rr(void)
 		rrset->rrs[0] = *rr;
 
 		/* Add it */
-		domain_add_rrset(rr->owner, rrset);
+		domain_add_rrset(rr_owner(rr), rrset);
 	} else {
 		rr_type* o;
 		if (rr->type != TYPE_RRSIG && rrset->rrs[0].ttl != rr->ttl) {
 			zc_warning_prev_line(
 				"%s TTL %u does not match the TTL %u of the %s RRset",
-				domain_to_string(rr->owner), (unsigned)rr->ttl,
+				domain_to_string(rr_owner(rr)), (unsigned)rr->ttl,
 				(unsigned)rrset->rrs[0].ttl,
 				rrtype_to_string(rr->type));
 		}
@@ -1475,7 +1490,8 @@ process_rr(void)
 			/* add rdatas to recycle bin. */
 			size_t i;
 			for (i = 0; i < rr->rdata_count; i++) {
-				if(!rdata_atom_is_domain(rr->type, i))
+				if(!rdata_atom_is_domain(rr->type, i) &&
+					!rdata_atom_is_inline(rr->rdatas[i]))
 					region_recycle(parser->region, rr->rdatas[i].data,
 						rdata_atom_size(rr->rdatas[i])
 						+ sizeof(uint16_t));
@@ -1512,15 +1528,15 @@ process_rr(void)
 		else
 			zc_error_prev_line("multiple CNAMEs at the same name");
 	}
-	if((rr->type == TYPE_DNAME && domain_find_rrset(rr->owner, zone, TYPE_CNAME))
-	 ||(rr->type == TYPE_CNAME && domain_find_rrset(rr->owner, zone, TYPE_DNAME))) {
+	if((rr->type == TYPE_DNAME && domain_find_rrset(rr_owner(rr), zone, TYPE_CNAME))
+	 ||(rr->type == TYPE_CNAME && domain_find_rrset(rr_owner(rr), zone, TYPE_DNAME))) {
 		if(zone_is_slave(zone->opts))
 			zc_warning_prev_line("DNAME and CNAME at the same name");
 		else
 			zc_error_prev_line("DNAME and CNAME at the same name");
 	}
-	if(domain_find_rrset(rr->owner, zone, TYPE_CNAME) &&
-		domain_find_non_cname_rrset(rr->owner, zone)) {
+	if(domain_find_rrset(rr_owner(rr), zone, TYPE_CNAME) &&
+		domain_find_non_cname_rrset(rr_owner(rr), zone)) {
 		if(zone_is_slave(zone->opts))
 			zc_warning_prev_line("CNAME and other data at the same name");
 		else
@@ -1528,8 +1544,8 @@ process_rr(void)
 	}
 
 	/* Check we have SOA */
-	if(rr->owner == zone->apex)
-		apex_rrset_checks(parser->db, rrset, rr->owner);
+	if(rr_owner(rr) == zone->apex)
+		apex_rrset_checks(parser->db, rrset, rr_owner(rr));
 
 	if(parser->line % ZONEC_PCT_COUNT == 0 && time(NULL) > startzonec + ZONEC_PCT_TIME) {
 		struct stat buf;
@@ -1573,7 +1589,7 @@ check_dname(zone_type* zone)
 	{
 		if(domain->is_existing) {
 			/* there may not be DNAMEs above it */
-			domain_type* parent = domain->parent;
+			domain_type* parent = domain_parent(domain);
 #ifdef NSEC3
 			if(domain_has_only_NSEC3(domain, NULL))
 				continue;
@@ -1587,7 +1603,7 @@ check_dname(zone_type* zone)
 						domain_to_string(parent));
 					return;
 				}
-				parent = parent->parent;
+				parent = domain_parent(parent);
 			}
 		}
 	}
@@ -1643,10 +1659,10 @@ zonec_read(const char* name, const char* zonefile, zone_type* zone)
 		parser->current_zone->soa_rrset->rr_count == 0) {
 		zc_error("zone configured as '%s' has no SOA record.", name);
 	} else if(dname_compare(domain_dname(
-		parser->current_zone->soa_rrset->rrs[0].owner), dname) != 0) {
+		rr_owner(&parser->current_zone->soa_rrset->rrs[0])), dname) != 0) {
 		zc_error("zone configured as '%s', but SOA has owner '%s'.",
 			name, domain_to_string(
-			parser->current_zone->soa_rrset->rrs[0].owner));
+			rr_owner(&parser->current_zone->soa_rrset->rrs[0])));
 	}
 	region_free_all(parser->rr_region);
 
@@ -1761,7 +1777,7 @@ void check_sshfp(void)
 	if(!parser->current_rr.rdatas[0].data ||
 		!parser->current_rr.rdatas[1].data ||
 		!parser->current_rr.rdatas[2].data ||
-		!parser->current_rr.owner)
+		!rr_owner(&parser->current_rr))
 		return; /* cannot check, NULLs (due to earlier errors) */
 	if(rdata_atom_size(parser->current_rr.rdatas[1]) != 1)
 		return; /* wrong size of the hash type rdata element */
@@ -1770,12 +1786,12 @@ void check_sshfp(void)
 	if(hash == 1 && size != 20) {
 		zc_warning_prev_line("SSHFP %s of type SHA1 has hash of "
 			"wrong length, %d bytes, should be 20",
-			domain_to_string(parser->current_rr.owner),
+			domain_to_string(rr_owner(&parser->current_rr)),
 			(int)size);
 	} else if(hash == 2 && size != 32) {
 		zc_warning_prev_line("SSHFP %s of type SHA256 has hash of "
 			"wrong length, %d bytes, should be 32",
-			domain_to_string(parser->current_rr.owner),
+			domain_to_string(rr_owner(&parser->current_rr)),
 			(int)size);
 	}
 }
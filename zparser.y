@@ -173,7 +173,7 @@ origin_directive:	DOLLAR_ORIGIN sp abs_dname trail
 
 rr:	owner classttl type_and_rdata
     {
-	    parser->current_rr.owner = $1;
+	    rr_set_owner(&parser->current_rr, $1);
 	    parser->current_rr.type = $3;
     }
     ;